@@ -0,0 +1,239 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#import <ObjFW/ObjFW.h>
+
+#import "ObjMatrix.h"
+#import "MTXEvent+Private.h"
+
+@interface RequestBenchmark: OFObject <OFApplicationDelegate>
+@end
+
+OF_APPLICATION_DELEGATE(RequestBenchmark)
+
+static bool counting = false;
+static unsigned long long numAllocations = 0, allocatedBytes = 0;
+
+#ifdef __GLIBC__
+/*
+ * glibc allows replacing malloc in the executable, which lets the benchmark
+ * count every allocation made by ObjFW and ObjMatrix without any tooling.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+void *
+malloc(size_t size)
+{
+	if (counting) {
+		numAllocations++;
+		allocatedBytes += size;
+	}
+
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t count, size_t size)
+{
+	if (counting) {
+		numAllocations++;
+		allocatedBytes += count * size;
+	}
+
+	return __libc_calloc(count, size);
+}
+
+void *
+realloc(void *pointer, size_t size)
+{
+	if (counting) {
+		numAllocations++;
+		allocatedBytes += size;
+	}
+
+	return __libc_realloc(pointer, size);
+}
+#endif
+
+static OFTimeInterval
+now(void)
+{
+	return OFDate.date.timeIntervalSince1970;
+}
+
+static size_t
+sizeOption(OFString *string, size_t defaultValue)
+{
+	if (string == nil)
+		return defaultValue;
+
+	return (size_t)string.unsignedLongLongValue;
+}
+
+static OFData *
+syncResponse(size_t numRooms, size_t numEvents)
+{
+	OFMutableString *JSON = [OFMutableString
+	    stringWithString: @"{\"next_batch\":\"batch0\",\"rooms\":"
+			      @"{\"join\":{"];
+
+	for (size_t i = 0; i < numRooms; i++) {
+		void *pool = objc_autoreleasePoolPush();
+
+		if (i > 0)
+			[JSON appendString: @","];
+
+		[JSON appendFormat: @"\"!room%zu:localhost\":{\"timeline\":"
+				    @"{\"limited\":false,\"events\":[", i];
+
+		for (size_t j = 0; j < numEvents; j++) {
+			if (j > 0)
+				[JSON appendString: @","];
+
+			[JSON appendFormat:
+			    @"{\"type\":\"m.room.message\","
+			    @"\"event_id\":\"$e%zu_%zu:localhost\","
+			    @"\"sender\":\"@user%zu:localhost\","
+			    @"\"origin_server_ts\":1700000000000,"
+			    @"\"content\":{\"msgtype\":\"m.text\","
+			    @"\"body\":\"Message %zu in room %zu\"}}",
+			    i, j, j, j, i];
+		}
+
+		[JSON appendString: @"]}}"];
+
+		objc_autoreleasePoolPop(pool);
+	}
+
+	[JSON appendString: @"}}}"];
+
+	return [OFData dataWithItems: JSON.UTF8String
+			       count: JSON.UTF8StringLength];
+}
+
+@implementation RequestBenchmark
+- (void)applicationDidFinishLaunching: (OFNotification *)notification
+{
+	OFString *rooms = nil, *events = nil, *iterations = nil;
+	const OFOptionsParserOption options[] = {
+		{ 'r', @"rooms", 1, NULL, &rooms },
+		{ 'e', @"events", 1, NULL, &events },
+		{ 'i', @"iterations", 1, NULL, &iterations },
+		{ '\0', nil, 0, NULL, NULL }
+	};
+	OFOptionsParser *parser = [OFOptionsParser parserWithOptions: options];
+
+	if ([parser nextOption] != '\0') {
+		[OFStdErr writeFormat:
+		    @"Usage: %@ [--rooms=N] [--events=N] [--iterations=N]\n",
+		    OFApplication.programName];
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	size_t numIterations = sizeOption(iterations, 20);
+	OFData *response = syncResponse(sizeOption(rooms, 100),
+	    sizeOption(events, 20));
+	id body = MTXParseJSON(response.items, response.count);
+
+	[OFStdOut writeFormat: @"Response: %zu bytes\n", response.count];
+	[OFStdOut writeString: @"operation                   ops/s      mean"
+			       @"    allocs/op     bytes/op\n"];
+
+	/* What MTXRequest did before: make a string, then parse that. */
+	[self measureOperation: @"parse via OFString"
+		 numIterations: numIterations
+			 block: ^ {
+		OFString *string = [OFString
+		    stringWithUTF8String: response.items
+				  length: response.count];
+
+		[string objectByParsingJSON];
+	}];
+	[self measureOperation: @"parse from bytes"
+		 numIterations: numIterations
+			 block: ^ {
+		MTXParseJSON(response.items, response.count);
+	}];
+	[self measureOperation: @"parse lazy events"
+		 numIterations: numIterations
+			 block: ^ {
+		MTXParseJSONWithLazyEvents(response.items, response.count);
+	}];
+	[self measureOperation: @"serialize via OFString"
+		 numIterations: numIterations
+			 block: ^ {
+		OFString *JSON = [body JSONRepresentation];
+
+		[OFData dataWithItems: JSON.UTF8String
+				count: JSON.UTF8StringLength];
+	}];
+	[self measureOperation: @"serialize to bytes"
+		 numIterations: numIterations
+			 block: ^ {
+		MTXJSONData(body);
+	}];
+
+#ifndef __GLIBC__
+	[OFStdOut writeString:
+	    @"Allocations are only counted with glibc.\n"];
+#endif
+
+	[OFApplication terminate];
+}
+
+- (void)measureOperation: (OFString *)operation
+	   numIterations: (size_t)numIterations
+		   block: (void (^)(void))block
+{
+	unsigned long long allocations = 0, bytes = 0;
+	OFTimeInterval duration = 0;
+
+	for (size_t i = 0; i < numIterations; i++) {
+		void *pool = objc_autoreleasePoolPush();
+		OFTimeInterval started;
+
+		numAllocations = allocatedBytes = 0;
+		started = now();
+		counting = true;
+
+		block();
+
+		counting = false;
+		duration += now() - started;
+		allocations += numAllocations;
+		bytes += allocatedBytes;
+
+		objc_autoreleasePoolPop(pool);
+	}
+
+	if (numIterations == 0)
+		return;
+
+	[OFStdOut writeFormat: @"%-22s %10.0f %6.3f ms %12llu %12llu\n",
+			       operation.UTF8String,
+			       (duration > 0 ? numIterations / duration : 0),
+			       duration / numIterations * 1000,
+			       allocations / numIterations,
+			       bytes / numIterations];
+}
+@end
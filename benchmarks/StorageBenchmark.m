@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/resource.h>
+
+#import <ObjFW/ObjFW.h>
+
+#import "ObjMatrix.h"
+
+@interface StorageBenchmark: OFObject <OFApplicationDelegate>
+@end
+
+OF_APPLICATION_DELEGATE(StorageBenchmark)
+
+static OFString *const storagePath = @"storagebench.db";
+static OFString *const userID = @"@bench:localhost";
+static OFString *const deviceID = @"DEVICE";
+static OFString *const batchedUserID = @"@batched:localhost";
+static OFString *const batchedDeviceID = @"BATCHED";
+
+static OFTimeInterval
+now(void)
+{
+	return OFDate.date.timeIntervalSince1970;
+}
+
+static unsigned long long
+peakRSS(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+#ifdef OF_APPLE
+	return usage.ru_maxrss;
+#else
+	return usage.ru_maxrss * 1024ull;
+#endif
+}
+
+static size_t
+sizeOption(OFString *string, size_t defaultValue)
+{
+	if (string == nil)
+		return defaultValue;
+
+	return (size_t)string.unsignedLongLongValue;
+}
+
+static unsigned long long
+sizeOnDisk(void)
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	unsigned long long size = 0;
+
+	/* SQLite keeps uncheckpointed pages in separate files. */
+	for (OFString *suffix in @[ @"", @"-wal", @"-shm", @"-journal" ]) {
+		OFString *path = [storagePath stringByAppendingString: suffix];
+
+		if ([fileManager fileExistsAtPath: path])
+			size += [fileManager attributesOfItemAtPath: path]
+			    .fileSize;
+	}
+
+	return size;
+}
+
+@implementation StorageBenchmark
+{
+	OFMutableDictionary<OFString *, MTXLatencyHistogram *> *_histograms;
+	OFMutableArray<OFString *> *_operations;
+}
+
+- (void)applicationDidFinishLaunching: (OFNotification *)notification
+{
+	OFString *storageName = nil, *rooms = nil, *deltas = nil;
+	OFString *reads = nil;
+	const OFOptionsParserOption options[] = {
+		{ 'S', @"storage", 1, NULL, &storageName },
+		{ 'r', @"rooms", 1, NULL, &rooms },
+		{ 'd', @"deltas", 1, NULL, &deltas },
+		{ 'R', @"reads", 1, NULL, &reads },
+		{ '\0', nil, 0, NULL, NULL }
+	};
+	OFOptionsParser *parser = [OFOptionsParser parserWithOptions: options];
+
+	if ([parser nextOption] != '\0') {
+		[OFStdErr writeFormat:
+		    @"Usage: %@ [--storage=sqlite|caching|log] [--rooms=N] "
+		    @"[--deltas=N] [--reads=N]\n",
+		    OFApplication.programName];
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	_histograms = [[OFMutableDictionary alloc] init];
+	_operations = [[OFMutableArray alloc] init];
+
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	for (OFString *suffix in @[ @"", @"-wal", @"-shm", @"-journal" ]) {
+		OFString *path = [storagePath stringByAppendingString: suffix];
+
+		if ([fileManager fileExistsAtPath: path])
+			[fileManager removeItemAtPath: path];
+	}
+
+	unsigned long long baselineRSS = peakRSS();
+	id <MTXStorage> storage = [self storageWithName: storageName];
+
+	[self runInitialSyncWithStorage: storage
+			  numberOfRooms: sizeOption(rooms, 1000)];
+	[self runBatchedInitialSyncWithStorage: storage
+				 numberOfRooms: sizeOption(rooms, 1000)];
+	[self runDeltasWithStorage: storage
+		    numberOfDeltas: sizeOption(deltas, 1000)];
+	[self runRoomListingWithStorage: storage
+			  numberOfReads: sizeOption(reads, 1000)];
+
+	[self report];
+	[OFStdOut writeFormat: @"On disk:   %llu KiB\n", sizeOnDisk() / 1024];
+	[OFStdOut writeFormat: @"In memory: %llu KiB\n",
+			       (peakRSS() - baselineRSS) / 1024];
+
+	[OFApplication terminate];
+}
+
+- (id <MTXStorage>)storageWithName: (OFString *)name
+{
+	if ([name isEqual: @"log"])
+		return [MTXLogStorage storageWithIRI:
+		    [OFIRI fileIRIWithPath: storagePath]];
+
+	MTXSQLite3Storage *SQLite3Storage = [MTXSQLite3Storage
+	    storageWithIRI: [OFIRI fileIRIWithPath: storagePath]];
+
+	if (name == nil || [name isEqual: @"sqlite"])
+		return SQLite3Storage;
+
+	if ([name isEqual: @"caching"])
+		return [MTXCachingStorage storageWithStorage: SQLite3Storage];
+
+	[OFStdErr writeFormat: @"Unknown storage: %@\n", name];
+	[OFApplication terminateWithStatus: 1];
+}
+
+- (void)measureOperation: (OFString *)operation
+		   block: (void (^)(void))block
+{
+	MTXLatencyHistogram *histogram = _histograms[operation];
+
+	if (histogram == nil) {
+		histogram = [MTXLatencyHistogram histogram];
+		_histograms[operation] = histogram;
+		[_operations addObject: operation];
+	}
+
+	OFTimeInterval started = now();
+	block();
+	[histogram addDuration: now() - started];
+}
+
+/*
+ * All rooms of an account arrive in a single transaction and are joined one
+ * row at a time.
+ */
+- (void)runInitialSyncWithStorage: (id <MTXStorage>)storage
+		    numberOfRooms: (size_t)numRooms
+{
+	[self measureOperation: @"initial sync" block: ^ {
+		[storage transactionWithBlock: ^ {
+			for (size_t i = 0; i < numRooms; i++) {
+				void *pool = objc_autoreleasePoolPush();
+				OFString *roomID = [OFString stringWithFormat:
+				    @"!room%zu:localhost", i];
+
+				[self measureOperation: @"addJoinedRoom"
+						 block: ^ {
+					[storage addJoinedRoom: roomID
+						       forUser: userID];
+				}];
+
+				objc_autoreleasePoolPop(pool);
+			}
+
+			[self measureOperation: @"setNextBatch" block: ^ {
+				[storage setNextBatch: @"batch0"
+					  forDeviceID: deviceID];
+			}];
+
+			return true;
+		}];
+	}];
+}
+
+/*
+ * The same initial sync for another user, with the rooms joined in one batch
+ * as MTXClient does, followed by leaving all of them again in one batch.
+ */
+- (void)runBatchedInitialSyncWithStorage: (id <MTXStorage>)storage
+			   numberOfRooms: (size_t)numRooms
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableArray<OFString *> *roomIDs = [OFMutableArray array];
+
+	for (size_t i = 0; i < numRooms; i++)
+		[roomIDs addObject: [OFString stringWithFormat:
+		    @"!batched%zu:localhost", i]];
+
+	[self measureOperation: @"batched initial sync" block: ^ {
+		[storage transactionWithBlock: ^ {
+			[self measureOperation: @"addJoinedRooms" block: ^ {
+				[storage addJoinedRooms: roomIDs
+						forUser: batchedUserID];
+			}];
+
+			[self measureOperation: @"setNextBatch" block: ^ {
+				[storage setNextBatch: @"batch0"
+					  forDeviceID: batchedDeviceID];
+			}];
+
+			return true;
+		}];
+	}];
+
+	[self measureOperation: @"batched leave" block: ^ {
+		[storage transactionWithBlock: ^ {
+			[self measureOperation: @"removeJoinedRooms" block: ^ {
+				[storage removeJoinedRooms: roomIDs
+						   forUser: batchedUserID];
+			}];
+
+			return true;
+		}];
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+/*
+ * Every delta is its own small transaction that advances the batch and
+ * joins a room, with every fourth delta also leaving an earlier room.
+ */
+- (void)runDeltasWithStorage: (id <MTXStorage>)storage
+	      numberOfDeltas: (size_t)numDeltas
+{
+	for (size_t i = 0; i < numDeltas; i++) {
+		void *pool = objc_autoreleasePoolPush();
+		OFString *nextBatch =
+		    [OFString stringWithFormat: @"batch%zu", i + 1];
+		OFString *roomID =
+		    [OFString stringWithFormat: @"!delta%zu:localhost", i];
+		OFString *leftRoomID = (i % 4 == 3
+		    ? [OFString stringWithFormat: @"!delta%zu:localhost", i / 2]
+		    : nil);
+
+		[self measureOperation: @"delta" block: ^ {
+			[storage transactionWithBlock: ^ {
+				[self measureOperation: @"setNextBatch"
+						 block: ^ {
+					[storage setNextBatch: nextBatch
+						  forDeviceID: deviceID];
+				}];
+				[self measureOperation: @"addJoinedRoom"
+						 block: ^ {
+					[storage addJoinedRoom: roomID
+						       forUser: userID];
+				}];
+
+				if (leftRoomID != nil)
+					[self measureOperation:
+					    @"removeJoinedRoom" block: ^ {
+						[storage
+						    removeJoinedRoom: leftRoomID
+							     forUser: userID];
+					}];
+
+				return true;
+			}];
+		}];
+
+		objc_autoreleasePoolPop(pool);
+	}
+}
+
+- (void)runRoomListingWithStorage: (id <MTXStorage>)storage
+		    numberOfReads: (size_t)numReads
+{
+	for (size_t i = 0; i < numReads; i++) {
+		void *pool = objc_autoreleasePoolPush();
+
+		[self measureOperation: @"joinedRoomsForUser" block: ^ {
+			[storage joinedRoomsForUser: userID];
+		}];
+		[self measureOperation: @"nextBatchForDeviceID" block: ^ {
+			[storage nextBatchForDeviceID: deviceID];
+		}];
+
+		objc_autoreleasePoolPop(pool);
+	}
+}
+
+- (void)report
+{
+	[OFStdOut writeString: @"operation                   ops/s      mean"
+			       @"       p50       p99       max\n"];
+
+	for (OFString *operation in _operations) {
+		MTXLatencyHistogram *histogram = _histograms[operation];
+		double opsPerSecond = (histogram.sum > 0
+		    ? histogram.count / histogram.sum : 0);
+
+		[OFStdOut writeFormat:
+		    @"%-20s %12.0f %6.3f ms %6.3f ms %6.3f ms %6.3f ms\n",
+		    operation.UTF8String, opsPerSecond,
+		    histogram.mean * 1000,
+		    [histogram durationAtPercentile: 50] * 1000,
+		    [histogram durationAtPercentile: 99] * 1000,
+		    histogram.maximum * 1000];
+	}
+}
+@end
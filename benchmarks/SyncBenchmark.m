@@ -0,0 +1,437 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <sys/resource.h>
+
+#import <ObjFW/ObjFW.h>
+
+#import "ObjMatrix.h"
+
+@interface SyncBenchmark: OFObject <OFApplicationDelegate, OFHTTPServerDelegate>
+@end
+
+OF_APPLICATION_DELEGATE(SyncBenchmark)
+
+/* Every account has a storage of its own in this directory. */
+static OFString *const storageDirectory = @"syncbench";
+static OFString *const syncPath = @"/_matrix/client/r0/sync";
+
+static const char *const phaseNames[] = {
+	"request", "transfer", "parse", "process", "commit"
+};
+
+static OFTimeInterval
+now(void)
+{
+	return OFDate.date.timeIntervalSince1970;
+}
+
+static OFTimeInterval
+CPUTime(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0 +
+	    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+}
+
+static unsigned long long
+peakRSS(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+#ifdef OF_APPLE
+	return usage.ru_maxrss;
+#else
+	return usage.ru_maxrss * 1024ull;
+#endif
+}
+
+static size_t
+sizeOption(OFString *string, size_t defaultValue)
+{
+	if (string == nil)
+		return defaultValue;
+
+	return (size_t)string.unsignedLongLongValue;
+}
+
+static OFDictionary *
+makeEvent(OFString *eventID, OFString *type, OFString *stateKey,
+    OFDictionary *content)
+{
+	OFMutableDictionary *event = [OFMutableDictionary dictionary];
+
+	event[@"event_id"] = eventID;
+	event[@"type"] = type;
+	event[@"sender"] = @"@bench:localhost";
+	event[@"origin_server_ts"] = @1700000000000ull;
+	event[@"content"] = content;
+
+	if (stateKey != nil)
+		event[@"state_key"] = stateKey;
+
+	return event;
+}
+
+static OFString *
+makeSyncPayload(size_t iteration, size_t numRooms, size_t numEvents,
+    size_t stateSize)
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableDictionary *join = [OFMutableDictionary dictionary];
+
+	for (size_t i = 0; i < numRooms; i++) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFString *roomID =
+		    [OFString stringWithFormat: @"!room%zu:localhost", i];
+		OFMutableArray *state = [OFMutableArray array];
+		OFMutableArray *timeline = [OFMutableArray array];
+
+		/* The whole state is only sent in the initial sync. */
+		if (iteration == 0) {
+			[state addObject: makeEvent(
+			    [OFString stringWithFormat: @"$create%zu", i],
+			    @"m.room.create", @"",
+			    @{ @"creator": @"@bench:localhost" })];
+			[state addObject: makeEvent(
+			    [OFString stringWithFormat: @"$name%zu", i],
+			    @"m.room.name", @"",
+			    @{ @"name": [OFString stringWithFormat:
+			    @"Room %zu", i] })];
+			[state addObject: makeEvent(
+			    [OFString stringWithFormat: @"$power%zu", i],
+			    @"m.room.power_levels", @"",
+			    @{ @"users": @{ @"@bench:localhost": @100 } })];
+
+			for (size_t j = 0; j < stateSize; j++) {
+				OFString *userID = [OFString stringWithFormat:
+				    @"@user%zu:localhost", j];
+
+				[state addObject: makeEvent(
+				    [OFString stringWithFormat:
+				    @"$member%zu_%zu", i, j],
+				    @"m.room.member", userID, @{
+					@"membership": @"join",
+					@"displayname": [OFString
+					    stringWithFormat: @"User %zu", j]
+				    })];
+			}
+		}
+
+		for (size_t j = 0; j < numEvents; j++)
+			[timeline addObject: makeEvent(
+			    [OFString stringWithFormat: @"$event%zu_%zu_%zu",
+			    iteration, i, j],
+			    @"m.room.message", nil, @{
+				@"msgtype": @"m.text",
+				@"body": [OFString stringWithFormat:
+				    @"Message %zu in iteration %zu", j,
+				    iteration]
+			    })];
+
+		join[roomID] = @{
+			@"state": @{ @"events": state },
+			@"timeline": @{
+				@"events": timeline,
+				@"limited": [OFNumber numberWithBool: false],
+				@"prev_batch": [OFString stringWithFormat:
+				    @"prev%zu", iteration]
+			}
+		};
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	OFString *payload = [@{
+		@"next_batch": [OFString stringWithFormat: @"batch%zu",
+		    iteration + 1],
+		@"rooms": @{ @"join": join }
+	} JSONRepresentation];
+
+	[payload retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [payload autorelease];
+}
+
+@implementation SyncBenchmark
+{
+	size_t _numRooms, _numEvents, _stateSize, _numIterations, _numAccounts;
+	bool _logStorage;
+	OFArray<OFString *> *_payloads;
+	OFThread *_serverThread;
+	OFHTTPServer *_server;
+	OFMutableArray<OFHTTPResponse *> *_heldResponses;
+	MTXClientManager *_manager;
+	OFMutableArray<MTXClient *> *_clients;
+	OFTimer *_timer;
+	OFTimeInterval _started, _startedCPUTime;
+	unsigned long long _baselineRSS;
+}
+
+- (void)applicationDidFinishLaunching: (OFNotification *)notification
+{
+	OFString *rooms = nil, *events = nil, *state = nil;
+	OFString *iterations = nil, *accounts = nil, *storage = nil;
+	const OFOptionsParserOption options[] = {
+		{ 'r', @"rooms", 1, NULL, &rooms },
+		{ 'e', @"events", 1, NULL, &events },
+		{ 's', @"state", 1, NULL, &state },
+		{ 'i', @"iterations", 1, NULL, &iterations },
+		{ 'a', @"accounts", 1, NULL, &accounts },
+		{ 'S', @"storage", 1, NULL, &storage },
+		{ '\0', nil, 0, NULL, NULL }
+	};
+	OFOptionsParser *parser = [OFOptionsParser parserWithOptions: options];
+
+	if ([parser nextOption] != '\0') {
+		[OFStdErr writeFormat:
+		    @"Usage: %@ [--rooms=N] [--events=N] [--state=N] "
+		    @"[--iterations=N] [--accounts=N] [--storage=sqlite|log]\n",
+		    OFApplication.programName];
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	_numRooms = sizeOption(rooms, 100);
+	_numEvents = sizeOption(events, 10);
+	_stateSize = sizeOption(state, 10);
+	_numIterations = sizeOption(iterations, 5);
+	_numAccounts = sizeOption(accounts, 1);
+	_logStorage = [storage isEqual: @"log"];
+
+	if (_numIterations == 0 || _numAccounts == 0) {
+		[OFStdErr writeString: @"Need at least one iteration and one "
+				       @"account!\n"];
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	[self generatePayloads];
+	[self startServerThread];
+	[self startClients];
+}
+
+- (void)generatePayloads
+{
+	OFMutableArray *payloads = [OFMutableArray array];
+	OFTimeInterval started = now();
+	unsigned long long bytes = 0;
+
+	for (size_t i = 0; i < _numIterations; i++) {
+		OFString *payload = makeSyncPayload(i, _numRooms, _numEvents,
+		    _stateSize);
+
+		bytes += payload.UTF8StringLength;
+		[payloads addObject: payload];
+	}
+
+	_payloads = [payloads copy];
+
+	[OFStdOut writeFormat:
+	    @"Generated %zu payloads with %zu rooms, %zu events per room and "
+	    @"%zu state events per room (%llu KiB) in %.3f s\n",
+	    _numIterations, _numRooms, _numEvents, _stateSize, bytes / 1024,
+	    now() - started];
+}
+
+/*
+ * The server runs on its own thread, as OFHTTPServer writes responses
+ * synchronously, which would otherwise block the client from reading them.
+ */
+- (void)startServerThread
+{
+	_serverThread = [[OFThread alloc] init];
+	_serverThread.name = @"Stub homeserver";
+	[_serverThread start];
+
+	[self performSelector: @selector(startServer)
+		     onThread: _serverThread
+		waitUntilDone: true];
+}
+
+- (void)startServer
+{
+	_heldResponses = [[OFMutableArray alloc] init];
+
+	_server = [[OFHTTPServer alloc] init];
+	_server.host = @"127.0.0.1";
+	_server.port = 0;
+	_server.delegate = self;
+	[_server start];
+}
+
+- (void)startClients
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+
+	if ([fileManager fileExistsAtPath: storageDirectory])
+		[fileManager removeItemAtPath: storageDirectory];
+
+	[fileManager createDirectoryAtPath: storageDirectory];
+
+	OFIRI *homeserver = [OFIRI IRIWithString: [OFString stringWithFormat:
+	    @"http://127.0.0.1:%" PRIu16 "/", _server.port]];
+	bool logStorage = _logStorage;
+	__block size_t numStorages = 0;
+
+	_manager = [[MTXClientManager alloc] initWithStorageBlock:
+	    ^ id <MTXStorage> (OFString *userID) {
+		OFString *path = [storageDirectory
+		    stringByAppendingPathComponent: [OFString stringWithFormat:
+		    @"%zu.%@", numStorages++, (logStorage ? @"log" : @"db")]];
+		OFIRI *storageIRI = [OFIRI fileIRIWithPath: path];
+
+		if (logStorage)
+			return [MTXLogStorage storageWithIRI: storageIRI];
+
+		return [MTXSQLite3Storage storageWithIRI: storageIRI];
+	}];
+	_clients = [[OFMutableArray alloc] init];
+
+	for (size_t i = 0; i < _numAccounts; i++) {
+		MTXClient *client = [_manager
+		    addClientWithUserID: [OFString stringWithFormat:
+					     @"@bench%zu:localhost", i]
+			       deviceID: [OFString stringWithFormat:
+					     @"DEVICE%zu", i]
+			    accessToken: [OFString stringWithFormat:
+					     @"token%zu", i]
+			     homeserver: homeserver];
+
+		client.syncExceptionHandler = ^ (id exception) {
+			OFLog(@"Sync failed: %@", exception);
+			[OFApplication terminateWithStatus: 1];
+		};
+
+		[_clients addObject: client];
+	}
+
+	_baselineRSS = peakRSS();
+	_startedCPUTime = CPUTime();
+	_started = now();
+
+	[_manager startSyncLoops];
+
+	_timer = [[OFTimer
+	    scheduledTimerWithTimeInterval: 0.01
+				    target: self
+				  selector: @selector(checkFinished)
+				   repeats: true] retain];
+}
+
+- (void)checkFinished
+{
+	for (MTXClient *client in _clients)
+		if ([client.metrics histogramForSyncPhase:
+		    MTXSyncPhaseCommit].count < _numIterations)
+			return;
+
+	OFTimeInterval elapsed = now() - _started;
+	OFTimeInterval CPUTimeUsed = CPUTime() - _startedCPUTime;
+
+	[_timer invalidate];
+	[_manager stopSyncLoops];
+
+	[self reportWithElapsedTime: elapsed CPUTime: CPUTimeUsed];
+
+	[OFApplication terminate];
+}
+
+- (void)reportWithElapsedTime: (OFTimeInterval)elapsed
+		      CPUTime: (OFTimeInterval)CPUTimeUsed
+{
+	unsigned long long RSS = peakRSS();
+	size_t rooms = _numRooms * _numIterations * _numAccounts;
+	/* Three state events besides the members in every room. */
+	size_t events = _numAccounts * _numRooms *
+	    (_numIterations * _numEvents + _stateSize + 3);
+
+	[OFStdOut writeFormat: @"Synced %zu accounts in %.3f s\n",
+			       _numAccounts, elapsed];
+	[OFStdOut writeFormat: @"Rooms/s:  %.0f\n", rooms / elapsed];
+	[OFStdOut writeFormat: @"Events/s: %.0f\n", events / elapsed];
+	[OFStdOut writeFormat: @"Peak RSS: %llu KiB (%llu KiB before sync)\n",
+			       RSS / 1024, _baselineRSS / 1024];
+
+	if (_numAccounts > 1) {
+		[OFStdOut writeFormat: @"Per account: %llu KiB, %.3f ms CPU\n",
+		    (RSS - _baselineRSS) / 1024 / _numAccounts,
+		    CPUTimeUsed * 1000 / _numAccounts];
+	}
+
+	for (size_t i = 0; i <= MTXSyncPhaseCommit; i++) {
+		MTXLatencyHistogram *histogram =
+		    [MTXLatencyHistogram histogram];
+
+		for (MTXClient *client in _clients)
+			[histogram addHistogram:
+			    [client.metrics histogramForSyncPhase:
+			    (MTXSyncPhase)i]];
+
+		[OFStdOut writeFormat:
+		    @"%-8s mean %9.3f ms  p50 %9.3f ms  p99 %9.3f ms\n",
+		    phaseNames[i], histogram.mean * 1000,
+		    [histogram durationAtPercentile: 50] * 1000,
+		    [histogram durationAtPercentile: 99] * 1000];
+	}
+}
+
+-      (void)server: (OFHTTPServer *)server
+  didReceiveRequest: (OFHTTPRequest *)request
+	requestBody: (OFStream *)requestBody
+	   response: (OFHTTPResponse *)response
+{
+	OFString *since = nil;
+
+	if (![request.IRI.path isEqual: syncPath]) {
+		response.statusCode = 404;
+		response.headers = @{ @"Content-Length": @"2" };
+		[response writeString: @"{}"];
+		return;
+	}
+
+	for (OFPair<OFString *, OFString *> *item in request.IRI.queryItems)
+		if ([item.firstObject isEqual: @"since"])
+			since = item.secondObject;
+
+	size_t iteration = 0;
+	if ([since hasPrefix: @"batch"])
+		iteration = (size_t)[since substringFromIndex: 5]
+		    .unsignedLongLongValue;
+
+	if (iteration >= _payloads.count) {
+		/* Everything was served, so keep the long poll waiting. */
+		[_heldResponses addObject: response];
+		return;
+	}
+
+	OFString *payload = [_payloads objectAtIndex: iteration];
+
+	response.statusCode = 200;
+	response.headers = @{
+		@"Content-Type": @"application/json",
+		@"Content-Length": @(payload.UTF8StringLength).stringValue
+	};
+	[response writeString: payload];
+}
+@end
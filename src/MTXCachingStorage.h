@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXStorage.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A storage that keeps frequently read state of another storage in
+ *	  memory.
+ *
+ * The next batches and the joined rooms are cached, so that reading them does
+ * not need to go to the underlying storage. All writes are written through to
+ * the underlying storage immediately. If a transaction is rolled back, the
+ * cached state that was modified in the transaction is discarded and read from
+ * the underlying storage again.
+ *
+ * The underlying storage must not be modified other than through the caching
+ * storage.
+ */
+@interface MTXCachingStorage: OFObject <MTXStorage>
+/**
+ * @brief The underlying storage.
+ */
+@property (readonly, nonatomic) id <MTXStorage> storage;
+
+/**
+ * @brief Creates a new caching storage for the specified storage.
+ *
+ * @param storage The underlying storage
+ * @return An autoreleased MTXCachingStorage
+ */
++ (instancetype)storageWithStorage: (id <MTXStorage>)storage;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated caching storage for the specified
+ *	  storage.
+ *
+ * @param storage The underlying storage
+ * @return An initialized MTXCachingStorage
+ */
+- (instancetype)initWithStorage: (id <MTXStorage>)storage
+    OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
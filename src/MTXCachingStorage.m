@@ -0,0 +1,392 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXCachingStorage.h"
+
+@implementation MTXCachingStorage
+{
+	OFMutableDictionary<OFString *, id> *_nextBatches;
+	OFMutableDictionary<OFString *, OFMutableSet<OFString *> *>
+	    *_joinedRooms;
+	OFMutableDictionary<OFString *, OFArray<OFString *> *>
+	    *_joinedRoomsArrays;
+	size_t _transactionDepth;
+	OFMutableSet<OFString *> *_modifiedDeviceIDs, *_modifiedUserIDs;
+}
+
++ (instancetype)storageWithStorage: (id <MTXStorage>)storage
+{
+	return [[[self alloc] initWithStorage: storage] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithStorage: (id <MTXStorage>)storage
+{
+	self = [super init];
+
+	@try {
+		_storage = [storage retain];
+		_nextBatches = [[OFMutableDictionary alloc] init];
+		_joinedRooms = [[OFMutableDictionary alloc] init];
+		_joinedRoomsArrays = [[OFMutableDictionary alloc] init];
+		_modifiedDeviceIDs = [[OFMutableSet alloc] init];
+		_modifiedUserIDs = [[OFMutableSet alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_storage release];
+	[_nextBatches release];
+	[_joinedRooms release];
+	[_joinedRoomsArrays release];
+	[_modifiedDeviceIDs release];
+	[_modifiedUserIDs release];
+
+	[super dealloc];
+}
+
+- (void)discardModifiedState
+{
+	for (OFString *deviceID in _modifiedDeviceIDs)
+		[_nextBatches removeObjectForKey: deviceID];
+
+	for (OFString *userID in _modifiedUserIDs) {
+		[_joinedRooms removeObjectForKey: userID];
+		[_joinedRoomsArrays removeObjectForKey: userID];
+	}
+
+	[_modifiedDeviceIDs removeAllObjects];
+	[_modifiedUserIDs removeAllObjects];
+}
+
+- (void)transactionWithBlock: (MTXStorageTransactionBlock)block
+{
+	__block bool committed = false;
+
+	_transactionDepth++;
+	@try {
+		[_storage transactionWithBlock: ^ {
+			committed = block();
+			return committed;
+		}];
+	} @catch (id e) {
+		committed = false;
+		@throw e;
+	} @finally {
+		if (--_transactionDepth == 0) {
+			if (!committed)
+				[self discardModifiedState];
+
+			[_modifiedDeviceIDs removeAllObjects];
+			[_modifiedUserIDs removeAllObjects];
+		}
+	}
+}
+
+- (void)writeWithBlock: (void (^)(void))block
+{
+	/*
+	 * Outside of a transaction, the write is done immediately and only
+	 * needs to be undone if it fails.
+	 */
+	if (_transactionDepth == 0) {
+		@try {
+			block();
+		} @catch (id e) {
+			[self discardModifiedState];
+			@throw e;
+		}
+
+		[_modifiedDeviceIDs removeAllObjects];
+		[_modifiedUserIDs removeAllObjects];
+	} else
+		block();
+}
+
+- (void)setNextBatch: (OFString *)nextBatch forDeviceID: (OFString *)deviceID
+{
+	[self writeWithBlock: ^ {
+		[_modifiedDeviceIDs addObject: deviceID];
+
+		[_storage setNextBatch: nextBatch forDeviceID: deviceID];
+		_nextBatches[deviceID] = nextBatch;
+	}];
+}
+
+- (OFString *)nextBatchForDeviceID: (OFString *)deviceID
+{
+	id nextBatch = _nextBatches[deviceID];
+
+	if (nextBatch == nil) {
+		nextBatch = [_storage nextBatchForDeviceID: deviceID];
+		_nextBatches[deviceID] =
+		    (nextBatch != nil ? nextBatch : [OFNull null]);
+	}
+
+	if (nextBatch == [OFNull null])
+		return nil;
+
+	return nextBatch;
+}
+
+- (void)setSlidingSyncPosition: (OFString *)position
+		   forDeviceID: (OFString *)deviceID
+{
+	[_storage setSlidingSyncPosition: position forDeviceID: deviceID];
+}
+
+- (OFString *)slidingSyncPositionForDeviceID: (OFString *)deviceID
+{
+	return [_storage slidingSyncPositionForDeviceID: deviceID];
+}
+
+- (OFMutableSet<OFString *> *)joinedRoomsSetForUser: (OFString *)userID
+{
+	OFMutableSet<OFString *> *joinedRooms = _joinedRooms[userID];
+
+	if (joinedRooms == nil) {
+		joinedRooms = [OFMutableSet setWithArray:
+		    [_storage joinedRoomsForUser: userID]];
+		_joinedRooms[userID] = joinedRooms;
+	}
+
+	return joinedRooms;
+}
+
+- (void)addJoinedRoom: (OFString *)roomID forUser: (OFString *)userID
+{
+	[self addJoinedRooms: @[ roomID ] forUser: userID];
+}
+
+- (void)removeJoinedRoom: (OFString *)roomID forUser: (OFString *)userID
+{
+	[self removeJoinedRooms: @[ roomID ] forUser: userID];
+}
+
+- (void)addJoinedRooms: (OFArray<OFString *> *)roomIDs
+	       forUser: (OFString *)userID
+{
+	if (roomIDs.count == 0)
+		return;
+
+	[self writeWithBlock: ^ {
+		OFMutableSet *joinedRooms =
+		    [self joinedRoomsSetForUser: userID];
+
+		[_modifiedUserIDs addObject: userID];
+
+		[_storage addJoinedRooms: roomIDs forUser: userID];
+		for (OFString *roomID in roomIDs)
+			[joinedRooms addObject: roomID];
+		[_joinedRoomsArrays removeObjectForKey: userID];
+	}];
+}
+
+- (void)removeJoinedRooms: (OFArray<OFString *> *)roomIDs
+		  forUser: (OFString *)userID
+{
+	if (roomIDs.count == 0)
+		return;
+
+	[self writeWithBlock: ^ {
+		OFMutableSet *joinedRooms =
+		    [self joinedRoomsSetForUser: userID];
+
+		[_modifiedUserIDs addObject: userID];
+
+		[_storage removeJoinedRooms: roomIDs forUser: userID];
+		for (OFString *roomID in roomIDs)
+			[joinedRooms removeObject: roomID];
+		[_joinedRoomsArrays removeObjectForKey: userID];
+	}];
+}
+
+- (OFArray<OFString *> *)joinedRoomsForUser: (OFString *)userID
+{
+	OFArray<OFString *> *joinedRooms = _joinedRoomsArrays[userID];
+
+	if (joinedRooms == nil) {
+		joinedRooms = [self joinedRoomsSetForUser: userID].allObjects;
+		_joinedRoomsArrays[userID] = joinedRooms;
+	}
+
+	return joinedRooms;
+}
+
+- (void)appendTimelineEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		      toRoom: (OFString *)roomID
+		   prevBatch: (OFString *)prevBatch
+		     limited: (bool)limited
+{
+	[_storage appendTimelineEvents: events
+				toRoom: roomID
+			     prevBatch: prevBatch
+			       limited: limited];
+}
+
+- (void)fillGapWithToken: (OFString *)gapToken
+		  inRoom: (OFString *)roomID
+		  events: (OFArray<OFDictionary<OFString *, id> *> *)events
+		endToken: (OFString *)endToken
+{
+	[_storage fillGapWithToken: gapToken
+			    inRoom: roomID
+			    events: events
+			  endToken: endToken];
+}
+
+- (OFArray<MTXTimelineEntry *> *)
+    timelineEntriesForRoom: (OFString *)roomID
+	    beforePosition: (int64_t)position
+		     limit: (size_t)limit
+{
+	return [_storage timelineEntriesForRoom: roomID
+				 beforePosition: position
+					  limit: limit];
+}
+
+- (void)applyStateEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		  toRoom: (OFString *)roomID
+{
+	[_storage applyStateEvents: events toRoom: roomID];
+}
+
+- (OFDictionary<OFString *, id> *)stateEventWithType: (OFString *)type
+					    stateKey: (OFString *)stateKey
+					      inRoom: (OFString *)roomID
+{
+	return [_storage stateEventWithType: type
+				   stateKey: stateKey
+				     inRoom: roomID];
+}
+
+- (OFString *)membershipOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	return [_storage membershipOfUser: userID inRoom: roomID];
+}
+
+- (OFString *)displayNameOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	return [_storage displayNameOfUser: userID inRoom: roomID];
+}
+
+- (size_t)numberOfMembersInRoom: (OFString *)roomID
+		 withMembership: (OFString *)membership
+{
+	return [_storage numberOfMembersInRoom: roomID
+				withMembership: membership];
+}
+
+- (void)addOutgoingEvent: (MTXOutgoingEvent *)event
+	     forDeviceID: (OFString *)deviceID
+{
+	[_storage addOutgoingEvent: event forDeviceID: deviceID];
+}
+
+- (void)removeOutgoingEventWithTransactionID: (OFString *)transactionID
+				 forDeviceID: (OFString *)deviceID
+{
+	[_storage removeOutgoingEventWithTransactionID: transactionID
+					   forDeviceID: deviceID];
+}
+
+- (OFArray<MTXOutgoingEvent *> *)outgoingEventsForDeviceID:
+    (OFString *)deviceID
+{
+	return [_storage outgoingEventsForDeviceID: deviceID];
+}
+
+- (void)trackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		    forDeviceID: (OFString *)deviceID
+{
+	[_storage trackDeviceListsOfUsers: userIDs forDeviceID: deviceID];
+}
+
+- (void)markDeviceListsOutdatedOfUsers: (OFArray<OFString *> *)userIDs
+			   forDeviceID: (OFString *)deviceID
+{
+	[_storage markDeviceListsOutdatedOfUsers: userIDs
+				     forDeviceID: deviceID];
+}
+
+- (void)untrackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		      forDeviceID: (OFString *)deviceID
+{
+	[_storage untrackDeviceListsOfUsers: userIDs forDeviceID: deviceID];
+}
+
+- (void)setDevices: (OFDictionary<OFString *, OFDictionary *> *)devices
+	    ofUser: (OFString *)userID
+       forDeviceID: (OFString *)deviceID
+{
+	[_storage setDevices: devices ofUser: userID forDeviceID: deviceID];
+}
+
+- (OFDictionary<OFString *, OFDictionary *> *)
+    devicesOfUser: (OFString *)userID
+      forDeviceID: (OFString *)deviceID
+{
+	return [_storage devicesOfUser: userID forDeviceID: deviceID];
+}
+
+- (OFArray<OFString *> *)usersWithOutdatedDeviceListsForDeviceID:
+    (OFString *)deviceID
+{
+	return [_storage usersWithOutdatedDeviceListsForDeviceID: deviceID];
+}
+
+- (void)addToDeviceEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+	      forDeviceID: (OFString *)deviceID
+{
+	[_storage addToDeviceEvents: events forDeviceID: deviceID];
+}
+
+- (OFArray<OFDictionary<OFString *, id> *> *)toDeviceEventsForDeviceID:
+    (OFString *)deviceID
+{
+	return [_storage toDeviceEventsForDeviceID: deviceID];
+}
+
+- (void)removeFirstToDeviceEvents: (size_t)count
+		      forDeviceID: (OFString *)deviceID
+{
+	[_storage removeFirstToDeviceEvents: count forDeviceID: deviceID];
+}
+
+- (void)setFilterID: (OFString *)filterID
+	  forFilter: (OFString *)filter
+	     userID: (OFString *)userID
+{
+	[_storage setFilterID: filterID forFilter: filter userID: userID];
+}
+
+- (OFString *)filterIDForFilter: (OFString *)filter userID: (OFString *)userID
+{
+	return [_storage filterIDForFilter: filter userID: userID];
+}
+@end
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, 2021, 2024 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2021, 2024, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -18,11 +18,58 @@
 
 #import <ObjFW/ObjFW.h>
 
+#import "MTXEventSubscription.h"
 #import "MTXStorage.h"
 
 OF_ASSUME_NONNULL_BEGIN
 
 @class MTXClient;
+@class MTXConnectionPool;
+@class MTXMediaCache;
+@class MTXMetrics;
+@class MTXRoomSummary;
+@class MTXSlidingSyncList;
+@class MTXSyncFilter;
+
+/**
+ * @brief A block called when events of the timeline of a room were fetched.
+ *
+ * @param events The events, newest first, or `nil` on error
+ * @param position The position to pass to fetch older events, or `nil` if the
+ *		   start of the room has been reached or on error
+ * @param exception An exception if fetching the events failed
+ */
+typedef void (^MTXClientTimelineBlock)(
+    OFArray<OFDictionary<OFString *, id> *> *_Nullable events,
+    OFNumber *_Nullable position, id _Nullable exception);
+
+/**
+ * @brief The protocol used by the sync loop.
+ */
+typedef enum {
+	/** The classic `/sync` endpoint */
+	MTXSyncEngineClassic,
+	/** Simplified sliding sync (MSC4186) */
+	MTXSyncEngineSliding
+} MTXSyncEngine;
+
+/**
+ * @brief A block called when an event was sent.
+ *
+ * @param eventID The ID the server assigned to the event, or `nil` on error
+ * @param exception An exception if sending the event failed
+ */
+typedef void (^MTXClientSendBlock)(OFString *_Nullable eventID,
+    id _Nullable exception);
+
+/**
+ * @brief A block called when media was uploaded.
+ *
+ * @param contentURI The `mxc://` URI of the uploaded media, or `nil` on error
+ * @param exception An exception if uploading the media failed
+ */
+typedef void (^MTXClientUploadBlock)(OFString *_Nullable contentURI,
+    id _Nullable exception);
 
 /**
  * @brief A block called when a new login succeeded or failed.
@@ -66,6 +113,52 @@ typedef void (^MTXClientRoomListBlock)(OFArray<OFString *> *_Nullable rooms,
 typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
     id _Nullable exception);
 
+/**
+ * @brief A delegate to be informed about the health of the sync loop.
+ */
+@protocol MTXSyncHealthDelegate <OFObject>
+@optional
+/**
+ * @brief A sync request failed with a transient error and is going to be
+ *	  retried.
+ *
+ * @param client The client whose sync failed
+ * @param exception The exception that occurred
+ * @param delay The delay after which the sync is retried
+ */
+- (void)client: (MTXClient *)client
+    syncFailedWithException: (id)exception
+	     willRetryAfter: (OFTimeInterval)delay;
+
+/**
+ * @brief A sync succeeded again after one or more transient errors.
+ *
+ * @param client The client whose sync recovered
+ * @param failures The number of failed sync requests before the recovery
+ */
+- (void)client: (MTXClient *)client
+    syncRecoveredAfterFailures: (size_t)failures;
+
+/**
+ * @brief The sync loop was stopped because of an error that cannot be
+ *	  recovered from by retrying, such as the access token being
+ *	  invalidated.
+ *
+ * @param client The client whose sync loop was stopped
+ * @param exception The exception that occurred
+ */
+- (void)client: (MTXClient *)client syncStoppedWithException: (id)exception;
+
+/**
+ * @brief The timeout used for sync requests was adapted.
+ *
+ * @param client The client whose sync timeout was adapted
+ * @param timeout The timeout used for sync requests from now on
+ */
+- (void)client: (MTXClient *)client
+    didAdaptSyncTimeout: (OFTimeInterval)timeout;
+@end
+
 /**
  * @brief A class that represents a client.
  */
@@ -95,18 +188,188 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
  */
 @property (readonly, nonatomic) id <MTXStorage> storage;
 
+/**
+ * @brief The pool of keep-alive connections to the homeserver.
+ *
+ * This is used for all requests except for sync, which uses a dedicated
+ * connection so that the long poll never blocks other requests. The limits for
+ * idle and in-flight connections can be configured on the pool.
+ */
+@property (readonly, nonatomic) MTXConnectionPool *connectionPool;
+
+/**
+ * @brief The metrics collected by the client.
+ *
+ * This includes counters and latencies for every endpoint, the durations of
+ * the phases of each sync and of storage transactions. Use `copy` to get a
+ * snapshot.
+ */
+@property (readonly, nonatomic) MTXMetrics *metrics;
+
+/**
+ * @brief Whether the homeserver may send compressed responses.
+ *
+ * Compressed responses are decompressed transparently. This greatly reduces
+ * the amount of data transferred for sync, which is mostly repetitive JSON.
+ *
+ * Defaults to `true`.
+ */
+@property (nonatomic) bool acceptsCompressedResponses;
+
 /**
  * @brief The timeout for sync requests.
  *
+ * This is the maximum. If sync requests are cut off before the timeout, e.g.
+ * by a proxy, a shorter timeout is used, see @ref effectiveSyncTimeout.
+ *
  * Defaults to 5 minutes.
  */
 @property (nonatomic) OFTimeInterval syncTimeout;
 
 /**
- * @brief A block to handle exceptions that occurred during sync.
+ * @brief The timeout that is actually used for sync requests.
+ *
+ * If a sync request fails after having been open for a while, but before the
+ * timeout expired, it was most likely cut off by a proxy. In this case, the
+ * timeout is lowered below the time after which the request was cut off. After
+ * several sync requests ran for the whole timeout without being cut off, it is
+ * raised again, up to @ref syncTimeout.
+ */
+@property (readonly, nonatomic) OFTimeInterval effectiveSyncTimeout;
+
+/**
+ * @brief The maximum delay between retries of failed sync requests.
+ *
+ * The delay starts at one second and is doubled with every failure, with
+ * random jitter applied so that many clients do not retry at the same time.
+ *
+ * Defaults to 1 minute.
+ */
+@property (nonatomic) OFTimeInterval maxSyncRetryDelay;
+
+/**
+ * @brief A delegate to be informed about the health of the sync loop.
+ */
+@property (nullable, assign, nonatomic)
+    id <MTXSyncHealthDelegate> syncHealthDelegate;
+
+/**
+ * @brief The protocol used by the sync loop.
+ *
+ * Both engines feed the same processing and storage, so the engine can be
+ * switched without other changes. A change takes effect with the next sync
+ * request.
+ *
+ * Defaults to @ref MTXSyncEngineClassic.
+ */
+@property (nonatomic) MTXSyncEngine syncEngine;
+
+/**
+ * @brief The room lists requested when using @ref MTXSyncEngineSliding.
+ *
+ * The windows of the lists can be moved while syncing. The total number of
+ * rooms in each list is updated with every sync.
+ */
+@property (copy, nonatomic) OFArray<MTXSlidingSyncList *> *slidingSyncLists;
+
+/**
+ * @brief The filter to apply to sync, or `nil` to not filter anything.
+ *
+ * This only applies to @ref MTXSyncEngineClassic.
+ *
+ * The filter is uploaded to the server before the next sync and its ID is
+ * cached in the storage, so that it only needs to be uploaded once.
+ */
+@property (copy, nullable, nonatomic) MTXSyncFilter *syncFilter;
+
+/**
+ * @brief Whether sync responses are processed while they arrive.
+ *
+ * This only applies to @ref MTXSyncEngineClassic.
+ *
+ * If enabled, only one room or one other top-level value of the sync response
+ * is parsed and kept in memory at a time, so that the peak memory is bounded
+ * by the largest room rather than the whole response. This is useful for the
+ * initial sync of accounts with many rooms.
+ *
+ * Defaults to `false`.
+ */
+@property (nonatomic) bool streamingSync;
+
+/**
+ * @brief Whether the next sync request is sent while the previous response is
+ *	  still being processed.
+ *
+ * If enabled, the next long poll is started as soon as the next batch of a
+ * response is known, so that new events do not wait on the server while a big
+ * response is processed. The next batch of a response is still only stored
+ * together with the processed response, so that no events are skipped if the
+ * application crashes.
+ *
+ * This has no effect if @ref streamingSync is enabled, as the next batch is
+ * only known once the whole response has been processed then.
+ *
+ * Defaults to `false`.
+ */
+@property (nonatomic) bool pipelinedSync;
+
+/**
+ * @brief A block to handle exceptions that stopped the sync loop.
+ *
+ * Transient errors are retried by the sync loop and only reported to the
+ * @ref syncHealthDelegate.
  */
 @property (copy, nonatomic) MTXSyncExceptionHandlerBlock syncExceptionHandler;
 
+/**
+ * @brief The summaries of all joined rooms.
+ *
+ * The summaries are kept in memory and updated with every sync. They are
+ * built from the storage on first access, unless they were loaded using
+ * @ref loadSnapshot.
+ */
+@property (readonly, nonatomic) OFArray<MTXRoomSummary *> *roomSummaries;
+
+/**
+ * @brief The file to which a snapshot of the room summaries is written, or
+ *	  `nil` to not write snapshots.
+ *
+ * The snapshot is written after a sync once @ref snapshotInterval has passed
+ * since the last snapshot, and when the sync loop is stopped.
+ */
+@property (copy, nullable, nonatomic) OFIRI *snapshotIRI;
+
+/**
+ * @brief The minimum interval between two snapshots.
+ *
+ * Defaults to 1 minute.
+ */
+@property (nonatomic) OFTimeInterval snapshotInterval;
+
+/**
+ * @brief The cache for downloaded media and thumbnails, or `nil` to not cache
+ *	  them.
+ */
+@property (retain, nullable, nonatomic) MTXMediaCache *mediaCache;
+
+/**
+ * @brief The delay after which changed typing notifications, read receipts and
+ *	  read markers are sent.
+ *
+ * All changes made within the delay are sent together, with only the latest
+ * state of each room. Defaults to 1 second.
+ */
+@property (nonatomic) OFTimeInterval ephemeralFlushInterval;
+
+/**
+ * @brief The number of attempts after which sending an event that keeps
+ *	  failing with a network or server error is given up.
+ *
+ * The event is then removed from the send queue and its block is called with
+ * the last error. 0 retries forever. Defaults to 10.
+ */
+@property (nonatomic) size_t maxSendAttempts;
+
 /**
  * @brief Creates a new client with the specified access token on the specified
  *	  homeserver.
@@ -115,7 +378,8 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
  * @param deviceID The device ID for the client
  * @param accessToken The access token for the client
  * @param homeserver The IRI of the homeserver
- * @param storage The storage the client should use
+ * @param storage The storage the client should use, which must not be used by
+ *		  clients of other users
  * @return An autoreleased MTXClient
  */
 + (instancetype)clientWithUserID: (OFString *)userID
@@ -130,7 +394,8 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
  * @param user The user to log into
  * @param password The password to log in with
  * @param homeserver The homeserver to log into
- * @param storage The storage the client should use
+ * @param storage The storage the client should use, which must not be used by
+ *		  clients of other users
  * @param block A block to call once login succeeded or failed
  */
 + (void)logInWithUser: (OFString *)user
@@ -147,7 +412,37 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
  * @param deviceID The device ID for the client
  * @param accessToken The access token for the client
  * @param homeserver The IRI of the homeserver
- * @param storage The storage the client should use
+ * @param storage The storage the client should use, which must not be used by
+ *		  clients of other users
+ * @return An initialized MTXClient
+ */
+- (instancetype)initWithUserID: (OFString *)userID
+		      deviceID: (OFString *)deviceID
+		   accessToken: (OFString *)accessToken
+		    homeserver: (OFIRI *)homeserver
+		       storage: (id <MTXStorage>)storage;
+
+/**
+ * @brief Initializes an already allocated client with the specified access
+ *	  token on the specified homeserver, using the specified connection
+ *	  pools.
+ *
+ * This allows many clients to share the connections to the same homeserver,
+ * see @ref MTXClientManager.
+ *
+ * @param userID The user ID for the client
+ * @param deviceID The device ID for the client
+ * @param accessToken The access token for the client
+ * @param homeserver The IRI of the homeserver
+ * @param storage The storage the client should use, which must not be used by
+ *		  clients of other users
+ * @param connectionPool The connection pool to use for requests, or `nil` to
+ *			 create one for the client
+ * @param syncConnectionPool The connection pool to use for the long-polling
+ *			     sync requests, or `nil` to create one for the
+ *			     client. A shared pool queues the sync requests of
+ *			     all clients in the order they were made once its
+ *			     maximum number of connections is reached.
  * @return An initialized MTXClient
  */
 - (instancetype)initWithUserID: (OFString *)userID
@@ -155,10 +450,17 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
 		   accessToken: (OFString *)accessToken
 		    homeserver: (OFIRI *)homeserver
 		       storage: (id <MTXStorage>)storage
+		connectionPool: (nullable MTXConnectionPool *)connectionPool
+	    syncConnectionPool: (nullable MTXConnectionPool *)syncConnectionPool
     OF_DESIGNATED_INITIALIZER;
 
 /**
  * @brief Starts the sync loop.
+ *
+ * If a sync request fails with a transient error, such as a network error,
+ * a server error or rate limiting, it is retried with exponential backoff. If
+ * another exception occurs during sync, it is passed to the
+ * @ref syncExceptionHandler and the sync loop is stopped.
  */
 - (void)startSyncLoop;
 
@@ -202,9 +504,144 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
  */
 - (void)leaveRoom: (OFString *)roomID block: (MTXClientResponseBlock)block;
 
+/**
+ * @brief Fetches events of the timeline of the specified room, going
+ *	  backwards.
+ *
+ * The timeline is stored while syncing, so events are read from the storage.
+ * Only if a gap in the stored timeline is reached, the missing events are
+ * fetched from the server and stored for the next time.
+ *
+ * @param roomID The room ID of the room for which to fetch the timeline
+ * @param position The position returned by the previous call to continue with
+ *		   older events, or `nil` to start with the newest event
+ * @param limit The maximum number of events to fetch
+ * @param block A block to call with the fetched events
+ */
+- (void)fetchTimelineForRoom: (OFString *)roomID
+	      beforePosition: (nullable OFNumber *)position
+		       limit: (size_t)limit
+		       block: (MTXClientTimelineBlock)block;
+
+/**
+ * @brief Returns the name of the specified room from the stored room state.
+ *
+ * @param roomID The room ID of the room for which to return the name
+ * @return The name of the room, or `nil` if it has none
+ */
+- (nullable OFString *)nameOfRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the power level of the specified user in the specified room
+ *	  from the stored room state.
+ *
+ * @param userID The user ID for which to return the power level
+ * @param roomID The room ID of the room for which to return the power level
+ * @return The power level of the user in the room
+ */
+- (long long)powerLevelOfUser: (OFString *)userID inRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the number of joined members of the specified room from the
+ *	  stored room state.
+ *
+ * @param roomID The room ID of the room for which to return the number of
+ *		 joined members
+ * @return The number of joined members of the room
+ */
+- (size_t)numberOfJoinedMembersInRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the summary of the specified joined room.
+ *
+ * @param roomID The room ID of the room for which to return the summary
+ * @return The summary of the room, or `nil` if the room is not joined
+ */
+- (nullable MTXRoomSummary *)summaryOfRoom: (OFString *)roomID;
+
+/**
+ * @brief Loads the room summaries from the snapshot at @ref snapshotIRI.
+ *
+ * The snapshot is only used if it has a supported version, belongs to the
+ * same user and device and was written at the next batch that is stored in
+ * the storage. Otherwise, the room summaries are built from the storage on
+ * first access.
+ *
+ * @return Whether the snapshot was loaded
+ */
+- (bool)loadSnapshot;
+
+/**
+ * @brief Writes a snapshot of the room summaries to @ref snapshotIRI.
+ */
+- (void)writeSnapshot;
+
+/**
+ * @brief Subscribes to events with the specified type in the specified room.
+ *
+ * The block is called for every matching event received by a sync, once the
+ * sync has been committed to the storage. Events of types that no
+ * subscription matches are not decoded beyond their type.
+ *
+ * @param type The type of events to subscribe to, or `nil` for all types
+ * @param roomID The room to subscribe to events of, or `nil` for all rooms as
+ *		 well as events that do not belong to a room
+ * @param block The block to call for each matching event
+ * @return The subscription, which can be passed to @ref unsubscribe:
+ */
+- (MTXEventSubscription *)
+    subscribeToEventsWithType: (nullable OFString *)type
+		       roomID: (nullable OFString *)roomID
+			block: (MTXEventBlock)block;
+
+/**
+ * @brief Removes the specified subscription.
+ *
+ * @param subscription The subscription to remove
+ */
+- (void)unsubscribe: (MTXEventSubscription *)subscription;
+
+/**
+ * @brief Starts tracking the device lists of the specified users.
+ *
+ * The devices of tracked users are kept in the storage. Once a sync reports
+ * that the devices of a tracked user changed, they are outdated until they are
+ * fetched again by @ref updateDeviceListsWithBlock:. Users that no longer
+ * share a room with the client are no longer tracked.
+ *
+ * @param userIDs The user IDs whose device lists to track
+ */
+- (void)trackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs;
+
+/**
+ * @brief Returns the devices of the specified user, as last fetched by
+ *	  @ref updateDeviceListsWithBlock:.
+ *
+ * @param userID The user ID whose devices to return
+ * @return The device keys of the user, keyed by device ID, or `nil` if the
+ *	   device list of the user is not tracked or has never been fetched
+ */
+- (nullable OFDictionary<OFString *, OFDictionary *> *)devicesOfUser:
+    (OFString *)userID;
+
+/**
+ * @brief Fetches the devices of all tracked users whose device lists are
+ *	  outdated.
+ *
+ * The users are queried in batches. Users that are already being queried are
+ * not queried again, and users whose devices change while they are being
+ * queried stay outdated.
+ *
+ * @param block A block to call when the device lists have been fetched
+ */
+- (void)updateDeviceListsWithBlock: (MTXClientResponseBlock)block;
+
 /**
  * @brief Sends the specified message to the specified room ID.
  *
+ * The message is sent through the send queue, see
+ * @ref sendEventWithType:content:roomID:block:.
+ *
  * @param message The message to send
  * @param roomID The room ID to which to send the message
  * @param block A block to call when the message was sent
@@ -212,6 +649,191 @@ typedef void (^MTXClientRoomJoinBlock)(OFString *_Nullable roomID,
 - (void)sendMessage: (OFString *)message
 	     roomID: (OFString *)roomID
 	      block: (MTXClientResponseBlock)block;
+
+/**
+ * @brief Sends an event with the specified type and content to the specified
+ *	  room ID.
+ *
+ * The event is added to a send queue that is persisted in the storage. Each
+ * event gets a transaction ID, so that retransmissions do not create
+ * duplicates. The events of a room are sent in order, one after another,
+ * while the events of different rooms are sent in parallel.
+ *
+ * If sending fails because of a network error or a server error, the event is
+ * retried with increasing delays, up to @ref maxSendAttempts times. If the
+ * server rate limits the client, sending to the room is paused for the time
+ * requested by the server, while other rooms continue. The block is only
+ * called once the event was sent, the server rejected it or it was given up.
+ *
+ * @param type The type of the event
+ * @param content The content of the event
+ * @param roomID The room ID to which to send the event
+ * @param block A block to call when the event was sent, or `nil`
+ */
+- (void)sendEventWithType: (OFString *)type
+		  content: (OFDictionary<OFString *, id> *)content
+		   roomID: (OFString *)roomID
+		    block: (nullable MTXClientSendBlock)block;
+
+/**
+ * @brief Resumes sending the events that were left in the send queue, e.g.
+ *	  when the process exited before they could be sent.
+ *
+ * Events resumed from the storage have no block to report errors to, so they
+ * are dropped from the queue if the server rejects them or if they are given
+ * up after @ref maxSendAttempts.
+ */
+- (void)resumeSendQueue;
+
+/**
+ * @brief Sets whether the user is typing in the specified room.
+ *
+ * The state is only sent if it differs from what the server was last told,
+ * or to renew a typing notification before it expires. It can therefore be
+ * called on every keystroke.
+ *
+ * @param typing Whether the user is typing
+ * @param roomID The room ID in which the user is typing
+ */
+- (void)setTyping: (bool)typing inRoom: (OFString *)roomID;
+
+/**
+ * @brief Sends a read receipt for the specified event in the specified room.
+ *
+ * Only the latest receipt per room is sent, together with the fully read
+ * marker of the room.
+ *
+ * @param eventID The event ID that was read
+ * @param roomID The room ID of the event
+ */
+- (void)sendReadReceiptForEvent: (OFString *)eventID
+			 inRoom: (OFString *)roomID;
+
+/**
+ * @brief Moves the fully read marker of the specified room to the specified
+ *	  event.
+ *
+ * Only the latest marker per room is sent, together with the read receipt of
+ * the room.
+ *
+ * @param eventID The event ID up to which the room was read
+ * @param roomID The room ID of the event
+ */
+- (void)setFullyReadMarkerToEvent: (OFString *)eventID
+			   inRoom: (OFString *)roomID;
+
+/**
+ * @brief Sends the pending typing notifications, read receipts and read
+ *	  markers without waiting for @ref ephemeralFlushInterval.
+ */
+- (void)flushEphemeralTraffic;
+
+/**
+ * @brief Returns the users that are typing in the specified room.
+ *
+ * @param roomID The room ID for which to return the typing users
+ * @return The user IDs of the users that are typing
+ */
+- (OFArray<OFString *> *)typingUsersInRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the event ID up to which the specified user has read the
+ *	  specified room.
+ *
+ * Receipts are only known if they were received by a sync of this client.
+ *
+ * @param userID The user ID whose read receipt to return
+ * @param roomID The room ID for which to return the read receipt
+ * @return The event ID of the read receipt, or `nil` if none is known
+ */
+- (nullable OFString *)readReceiptOfUser: (OFString *)userID
+				  inRoom: (OFString *)roomID;
+
+/**
+ * @brief Uploads media read from the specified stream.
+ *
+ * The stream is sent as it is read, so the media is never held in memory as a
+ * whole.
+ *
+ * @param stream The stream to read the media from
+ * @param length The length of the media in bytes
+ * @param contentType The MIME type of the media
+ * @param fileName The name of the file, or `nil`
+ * @param block A block to call with the `mxc://` URI of the uploaded media
+ */
+- (void)uploadMediaFromStream: (OFStream *)stream
+		       length: (unsigned long long)length
+		  contentType: (OFString *)contentType
+		     fileName: (nullable OFString *)fileName
+			block: (MTXClientUploadBlock)block;
+
+/**
+ * @brief Uploads the specified file.
+ *
+ * @param IRI The file to upload
+ * @param contentType The MIME type of the file
+ * @param block A block to call with the `mxc://` URI of the uploaded file
+ */
+- (void)uploadFileAtIRI: (OFIRI *)IRI
+	    contentType: (OFString *)contentType
+		  block: (MTXClientUploadBlock)block;
+
+/**
+ * @brief Downloads the specified media and writes it to the specified stream
+ *	  as it arrives.
+ *
+ * If a @ref mediaCache is set, the media is read from it if possible and added
+ * to it otherwise. If it is read from the cache, the block is called before
+ * this method returns.
+ *
+ * @param contentURI The `mxc://` URI of the media to download
+ * @param stream The stream to write the media to
+ * @param block A block to call once the media was downloaded
+ */
+- (void)downloadMediaWithURI: (OFString *)contentURI
+		    toStream: (OFStream *)stream
+		       block: (MTXClientResponseBlock)block;
+
+/**
+ * @brief Downloads the specified part of the specified media and writes it to
+ *	  the specified stream as it arrives.
+ *
+ * The part is requested from the server with a range request. If the media is
+ * in the @ref mediaCache, the part is read from the cache instead. Parts are
+ * only added to the cache if the server ignores the range and sends the whole
+ * media.
+ *
+ * @param contentURI The `mxc://` URI of the media to download
+ * @param offset The offset of the part in bytes
+ * @param length The length of the part in bytes
+ * @param stream The stream to write the part of the media to
+ * @param block A block to call once the part of the media was downloaded
+ */
+- (void)downloadMediaWithURI: (OFString *)contentURI
+		      offset: (unsigned long long)offset
+		      length: (unsigned long long)length
+		    toStream: (OFStream *)stream
+		       block: (MTXClientResponseBlock)block;
+
+/**
+ * @brief Downloads a thumbnail of the specified media and writes it to the
+ *	  specified stream as it arrives.
+ *
+ * Thumbnails are cached in the @ref mediaCache the same way as media.
+ *
+ * @param contentURI The `mxc://` URI of the media to download a thumbnail of
+ * @param width The desired width of the thumbnail
+ * @param height The desired height of the thumbnail
+ * @param method `crop` or `scale`, or `nil` to let the server decide
+ * @param stream The stream to write the thumbnail to
+ * @param block A block to call once the thumbnail was downloaded
+ */
+- (void)downloadThumbnailWithURI: (OFString *)contentURI
+			   width: (size_t)width
+			  height: (size_t)height
+			  method: (nullable OFString *)method
+			toStream: (OFStream *)stream
+			   block: (MTXClientResponseBlock)block;
 @end
 
 OF_ASSUME_NONNULL_END
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, 2021, 2024 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2021, 2024, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -17,15 +17,217 @@
  */
 
 #import "MTXClient.h"
+#import "MTXConnectionPool.h"
+#import "MTXMediaCache.h"
+#import "MTXMetrics.h"
+#import "MTXOutgoingEvent.h"
 #import "MTXRequest.h"
-
+#import "MTXRoomSummary.h"
+#import "MTXSlidingSyncList.h"
+#import "MTXSlidingSyncList+Private.h"
+#import "MTXSyncFilter.h"
+#import "MTXSyncParser.h"
+#import "MTXTimelineEntry.h"
+
+#import "MTXDownloadMediaFailedException.h"
 #import "MTXFetchRoomListFailedException.h"
+#import "MTXFetchTimelineFailedException.h"
 #import "MTXJoinRoomFailedException.h"
 #import "MTXLeaveRoomFailedException.h"
 #import "MTXLoginFailedException.h"
 #import "MTXLogoutFailedException.h"
+#import "MTXQueryKeysFailedException.h"
+#import "MTXSendEventFailedException.h"
 #import "MTXSendMessageFailedException.h"
 #import "MTXSyncFailedException.h"
+#import "MTXUploadMediaFailedException.h"
+
+static OFString *const slidingSyncPath =
+    @"/_matrix/client/unstable/org.matrix.simplified_msc3575/sync";
+static const size_t syncBufferSize = 16384;
+/* The number of streamed rooms that are processed together. */
+static const size_t streamingRoomBatchSize = 64;
+static const size_t maxPendingSyncResponses = 2;
+
+/*
+ * Timers that are due are fired before the run loop waits for I/O again. The
+ * delay makes sure the next sync request is sent before processing starts.
+ */
+static const OFTimeInterval syncProcessingDelay = 0.001;
+
+/* The delay for retrying a failed sync starts at this and doubles. */
+static const OFTimeInterval minSyncRetryDelay = 1;
+
+/*
+ * A sync request that failed after being open for less than this is not
+ * considered to have been cut off by a proxy, and the effective timeout is
+ * never lowered below it.
+ */
+static const OFTimeInterval minEffectiveSyncTimeout = 10;
+
+/* Full-length long polls needed before the effective timeout is raised. */
+static const size_t syncTimeoutRaiseThreshold = 10;
+
+/* The delay for retrying a send doubles up to this. */
+static const OFTimeInterval maxSendRetryDelay = 60;
+
+static const size_t mediaBufferSize = 65536;
+
+/*
+ * How long the server shows a typing notification for, which is renewed once
+ * half of it has passed.
+ */
+static const OFTimeInterval typingTimeout = 30;
+
+/* The number of users whose device lists are queried in a single request. */
+static const size_t deviceListQueryBatchSize = 100;
+
+/*
+ * Snapshots start with the magic and the version, followed by the user ID, the
+ * device ID and the next batch at which the snapshot was written and then the
+ * room summaries. All integers are big endian and strings are prefixed with
+ * their length, with nil strings having a length of snapshotNilString.
+ */
+static const char snapshotMagic[4] = { 'M', 'T', 'X', 'S' };
+static const uint32_t snapshotVersion = 1;
+static const uint32_t snapshotNilString = UINT32_MAX;
+
+typedef struct {
+	const unsigned char *bytes;
+	size_t length, offset;
+} SnapshotReader;
+
+static OFString *
+makeTransactionID(void)
+{
+	return [OFString stringWithFormat: @"%016" PRIx64 "%016" PRIx64,
+					   OFRandom64(), OFRandom64()];
+}
+
+static OFString *
+membershipInEvents(OFArray *events, OFString *userID, OFString *membership)
+{
+	if (![events isKindOfClass: OFArray.class])
+		return membership;
+
+	for (OFDictionary *event in events) {
+		if (![event isKindOfClass: OFDictionary.class])
+			continue;
+
+		if (![event[@"type"] isEqual: @"m.room.member"] ||
+		    ![event[@"state_key"] isEqual: userID])
+			continue;
+
+		OFDictionary *content = event[@"content"];
+		if ([content isKindOfClass: OFDictionary.class] &&
+		    [content[@"membership"] isKindOfClass: OFString.class])
+			membership = content[@"membership"];
+	}
+
+	return membership;
+}
+
+static void
+appendUInt32(OFMutableData *data, uint32_t value)
+{
+	value = OFToBigEndian32(value);
+	[data addItems: &value count: sizeof(value)];
+}
+
+static void
+appendUInt64(OFMutableData *data, uint64_t value)
+{
+	value = OFToBigEndian64(value);
+	[data addItems: &value count: sizeof(value)];
+}
+
+static void
+appendString(OFMutableData *data, OFString *string)
+{
+	if (string == nil) {
+		appendUInt32(data, snapshotNilString);
+		return;
+	}
+
+	size_t length = string.UTF8StringLength;
+	if (length >= snapshotNilString)
+		@throw [OFOutOfRangeException exception];
+
+	appendUInt32(data, (uint32_t)length);
+	[data addItems: string.UTF8String count: length];
+}
+
+static bool
+readUInt32(SnapshotReader *reader, uint32_t *value)
+{
+	if (reader->length - reader->offset < sizeof(*value))
+		return false;
+
+	memcpy(value, reader->bytes + reader->offset, sizeof(*value));
+	*value = OFFromBigEndian32(*value);
+	reader->offset += sizeof(*value);
+
+	return true;
+}
+
+static bool
+readUInt64(SnapshotReader *reader, uint64_t *value)
+{
+	if (reader->length - reader->offset < sizeof(*value))
+		return false;
+
+	memcpy(value, reader->bytes + reader->offset, sizeof(*value));
+	*value = OFFromBigEndian64(*value);
+	reader->offset += sizeof(*value);
+
+	return true;
+}
+
+static bool
+readString(SnapshotReader *reader, OFString **string)
+{
+	uint32_t length;
+
+	if (!readUInt32(reader, &length))
+		return false;
+
+	if (length == snapshotNilString) {
+		*string = nil;
+		return true;
+	}
+
+	if (reader->length - reader->offset < length)
+		return false;
+
+	*string = [OFString
+	    stringWithUTF8String: (const char *)reader->bytes + reader->offset
+			  length: length];
+	reader->offset += length;
+
+	return true;
+}
+
+static bool
+isTransientSyncException(id exception)
+{
+	if ([exception isKindOfClass: MTXSyncFailedException.class]) {
+		int statusCode = [exception statusCode];
+
+		/* Anything else, e.g. 401 on logout, needs the application. */
+		return (statusCode == 408 || statusCode == 429 ||
+		    statusCode >= 500);
+	}
+
+	return ([exception isKindOfClass: OFResolveHostFailedException.class] ||
+	    [exception isKindOfClass: OFConnectSocketFailedException.class] ||
+	    [exception isKindOfClass: OFReadFailedException.class] ||
+	    [exception isKindOfClass: OFWriteFailedException.class] ||
+	    [exception isKindOfClass: OFTruncatedDataException.class] ||
+	    [exception isKindOfClass: OFInvalidServerResponseException.class] ||
+	    /* A garbled or truncated successful response. */
+	    [exception isKindOfClass: OFInvalidFormatException.class] ||
+	    [exception isKindOfClass: OFInvalidJSONException.class]);
+}
 
 static void
 validateHomeserver(OFIRI *homeserver)
@@ -43,9 +245,178 @@ validateHomeserver(OFIRI *homeserver)
 		@throw [OFInvalidArgumentException exception];
 }
 
+/*
+ * Returns the strings in the array, skipping anything else, or an empty array
+ * if it is missing or not an array.
+ */
+static OFArray<OFString *> *
+stringsInArray(OFArray<OFString *> *array)
+{
+	OFMutableArray<OFString *> *strings;
+
+	if (![array isKindOfClass: OFArray.class])
+		return [OFArray array];
+
+	strings = [OFMutableArray arrayWithCapacity: array.count];
+	for (id object in array)
+		if ([object isKindOfClass: OFString.class])
+			[strings addObject: object];
+
+	[strings makeImmutable];
+
+	return strings;
+}
+
+/*
+ * Adds the subscriptions for the room and for all rooms to the matches,
+ * creating the array of matches if needed.
+ */
+static OFMutableArray *
+addMatchingSubscriptions(OFMutableArray *matches,
+    OFDictionary<id, OFArray<MTXEventSubscription *> *> *subscriptionsByRoom,
+    OFString *roomID)
+{
+	OFArray<MTXEventSubscription *> *subscriptions;
+
+	if (subscriptionsByRoom == nil)
+		return matches;
+
+	if (roomID != nil &&
+	    (subscriptions = subscriptionsByRoom[roomID]) != nil) {
+		if (matches == nil)
+			matches = [OFMutableArray array];
+
+		[matches addObjectsFromArray: subscriptions];
+	}
+
+	if ((subscriptions = subscriptionsByRoom[[OFNull null]]) != nil) {
+		if (matches == nil)
+			matches = [OFMutableArray array];
+
+		[matches addObjectsFromArray: subscriptions];
+	}
+
+	return matches;
+}
+
+static void
+parseContentURI(OFString *contentURI, OFString **serverName,
+    OFString **mediaID)
+{
+	size_t prefixLength = 6;
+	OFRange slash;
+
+	if (![contentURI hasPrefix: @"mxc://"])
+		@throw [OFInvalidArgumentException exception];
+
+	slash = [contentURI
+	    rangeOfString: @"/"
+		  options: 0
+		    range: OFMakeRange(prefixLength,
+			       contentURI.length - prefixLength)];
+
+	if (slash.location == OFNotFound || slash.location == prefixLength ||
+	    slash.location + 1 == contentURI.length)
+		@throw [OFInvalidArgumentException exception];
+
+	*serverName = [contentURI substringWithRange:
+	    OFMakeRange(prefixLength, slash.location - prefixLength)];
+	*mediaID = [contentURI substringFromIndex: slash.location + 1];
+
+	if ([*mediaID containsString: @"/"])
+		@throw [OFInvalidArgumentException exception];
+}
+
+/*
+ * Copies the source to the writer, if any, and the part of the source starting
+ * at offset with the specified length to the destination.
+ */
+static void
+copyMedia(OFStream *source, OFStream *destination, MTXMediaCacheWriter *writer,
+    unsigned long long offset, unsigned long long length)
+{
+	unsigned long long position = 0;
+	unsigned long long end = (length > ULLONG_MAX - offset
+	    ? ULLONG_MAX : offset + length);
+	char *buffer = OFAllocMemory(1, mediaBufferSize);
+
+	@try {
+		while (!source.atEndOfStream) {
+			size_t bufferLength = [source
+			    readIntoBuffer: buffer
+				    length: mediaBufferSize];
+
+			[writer writeBuffer: buffer length: bufferLength];
+
+			if (position + bufferLength > offset &&
+			    position < end) {
+				size_t start = (offset > position
+				    ? (size_t)(offset - position) : 0);
+				size_t stop = (end - position < bufferLength
+				    ? (size_t)(end - position) : bufferLength);
+
+				[destination writeBuffer: buffer + start
+						  length: stop - start];
+			}
+
+			position += bufferLength;
+
+			/* Without a writer, the rest is not needed. */
+			if (writer == nil && position >= end)
+				break;
+		}
+	} @finally {
+		OFFreeMemory(buffer);
+	}
+}
+
 @implementation MTXClient
 {
-	bool _syncing;
+	bool _syncing, _syncInFlight, _syncProcessingScheduled;
+	unsigned long long _syncGeneration;
+	MTXConnectionPool *_syncConnectionPool;
+	OFString *_pipelineSince, *_syncFilterID;
+	OFMutableArray<MTXResponse> *_pendingSyncResponses;
+	OFTimeInterval _syncRequestStarted;
+	size_t _syncFailures, _fullLengthSyncs;
+	unsigned long long _syncRetryToken;
+	bool _outgoingEventsLoaded;
+	OFMutableDictionary<OFString *, OFMutableArray<MTXOutgoingEvent *> *>
+	    *_outgoingEvents;
+	OFMutableDictionary<OFString *, MTXRequestBlock> *_outgoingBlocks;
+	OFMutableDictionary<OFString *, OFNumber *> *_sendRetries;
+	OFMutableSet<OFString *> *_sendingRooms;
+	OFMutableDictionary<OFString *, MTXRoomSummary *> *_roomSummaries;
+	OFMutableSet<OFString *> *_joinedSummaryRoomIDs, *_leftSummaryRoomIDs;
+	OFTimeInterval _lastSnapshot;
+	/*
+	 * Subscriptions by type and then by room ID, with OFNull for
+	 * subscriptions to all types or rooms.
+	 */
+	OFMutableDictionary<id, OFMutableDictionary<id,
+	    OFMutableArray<MTXEventSubscription *> *> *> *_subscriptions;
+	OFMutableArray *_pendingDispatches;
+	bool _toDeviceEventsPending, _deliveringToDeviceEvents;
+	OFMutableSet<OFString *> *_queriedDeviceListUsers;
+	/* Users whose device lists changed while they were being queried. */
+	OFMutableSet<OFString *> *_changedDeviceListUsers;
+	bool _ephemeralFlushScheduled;
+	OFMutableDictionary<OFString *, OFNumber *> *_pendingTyping;
+	/* When the server was last told that the user is typing in a room. */
+	OFMutableDictionary<OFString *, OFNumber *> *_typingSent;
+	/* Room ID -> marker type -> event ID. */
+	OFMutableDictionary<OFString *, OFMutableDictionary<OFString *,
+	    OFString *> *> *_pendingReadMarkers;
+	OFMutableSet<OFString *> *_sendingReadMarkerRooms;
+	OFMutableDictionary<OFString *, OFArray<OFString *> *> *_typingUsers;
+	/* Room ID -> user ID -> event ID. */
+	OFMutableDictionary<OFString *, OFMutableDictionary<OFString *,
+	    OFString *> *> *_readReceipts;
+	/* Received in the current transaction, applied once it committed. */
+	OFMutableDictionary<OFString *, OFArray<OFString *> *>
+	    *_stagedTypingUsers;
+	OFMutableDictionary<OFString *, OFMutableDictionary<OFString *,
+	    OFString *> *> *_stagedReadReceipts;
 }
 
 + (instancetype)clientWithUserID: (OFString *)userID
@@ -149,6 +520,23 @@ validateHomeserver(OFIRI *homeserver)
 		   accessToken: (OFString *)accessToken
 		    homeserver: (OFIRI *)homeserver
 		       storage: (id <MTXStorage>)storage
+{
+	return [self initWithUserID: userID
+			   deviceID: deviceID
+			accessToken: accessToken
+			 homeserver: homeserver
+			    storage: storage
+		     connectionPool: nil
+		 syncConnectionPool: nil];
+}
+
+- (instancetype)initWithUserID: (OFString *)userID
+		      deviceID: (OFString *)deviceID
+		   accessToken: (OFString *)accessToken
+		    homeserver: (OFIRI *)homeserver
+		       storage: (id <MTXStorage>)storage
+		connectionPool: (MTXConnectionPool *)connectionPool
+	    syncConnectionPool: (MTXConnectionPool *)syncConnectionPool
 {
 	self = [super init];
 
@@ -160,7 +548,49 @@ validateHomeserver(OFIRI *homeserver)
 		_accessToken = [accessToken copy];
 		_homeserver = [homeserver copy];
 		_storage = [storage retain];
-		_syncTimeout = 300;
+
+		if (connectionPool != nil)
+			_connectionPool = [connectionPool retain];
+		else
+			_connectionPool = [[MTXConnectionPool alloc] init];
+
+		if (syncConnectionPool != nil)
+			_syncConnectionPool = [syncConnectionPool retain];
+		else {
+			_syncConnectionPool = [[MTXConnectionPool alloc] init];
+			_syncConnectionPool.maxConnections = 1;
+			_syncConnectionPool.maxIdleConnections = 1;
+		}
+
+		_pendingSyncResponses = [[OFMutableArray alloc] init];
+		_metrics = [[MTXMetrics alloc] init];
+		_outgoingEvents = [[OFMutableDictionary alloc] init];
+		_outgoingBlocks = [[OFMutableDictionary alloc] init];
+		_sendRetries = [[OFMutableDictionary alloc] init];
+		_sendingRooms = [[OFMutableSet alloc] init];
+		_joinedSummaryRoomIDs = [[OFMutableSet alloc] init];
+		_leftSummaryRoomIDs = [[OFMutableSet alloc] init];
+		_subscriptions = [[OFMutableDictionary alloc] init];
+		_pendingDispatches = [[OFMutableArray alloc] init];
+		_queriedDeviceListUsers = [[OFMutableSet alloc] init];
+		_changedDeviceListUsers = [[OFMutableSet alloc] init];
+		_pendingTyping = [[OFMutableDictionary alloc] init];
+		_typingSent = [[OFMutableDictionary alloc] init];
+		_pendingReadMarkers = [[OFMutableDictionary alloc] init];
+		_sendingReadMarkerRooms = [[OFMutableSet alloc] init];
+		_typingUsers = [[OFMutableDictionary alloc] init];
+		_readReceipts = [[OFMutableDictionary alloc] init];
+		_stagedTypingUsers = [[OFMutableDictionary alloc] init];
+		_stagedReadReceipts = [[OFMutableDictionary alloc] init];
+		_slidingSyncLists = [@[
+			[MTXSlidingSyncList listWithName: @"all"]
+		] retain];
+		_acceptsCompressedResponses = true;
+		_syncTimeout = _effectiveSyncTimeout = 300;
+		_maxSyncRetryDelay = 60;
+		_snapshotInterval = 60;
+		_ephemeralFlushInterval = 1;
+		_maxSendAttempts = 10;
 	} @catch (id e) {
 		[self release];
 		@throw e;
@@ -176,6 +606,35 @@ validateHomeserver(OFIRI *homeserver)
 	[_accessToken release];
 	[_homeserver release];
 	[_storage release];
+	[_connectionPool release];
+	[_syncConnectionPool release];
+	[_pipelineSince release];
+	[_pendingSyncResponses release];
+	[_metrics release];
+	[_slidingSyncLists release];
+	[_syncFilter release];
+	[_syncFilterID release];
+	[_outgoingEvents release];
+	[_outgoingBlocks release];
+	[_sendRetries release];
+	[_sendingRooms release];
+	[_roomSummaries release];
+	[_joinedSummaryRoomIDs release];
+	[_leftSummaryRoomIDs release];
+	[_snapshotIRI release];
+	[_subscriptions release];
+	[_pendingDispatches release];
+	[_queriedDeviceListUsers release];
+	[_changedDeviceListUsers release];
+	[_pendingTyping release];
+	[_typingSent release];
+	[_pendingReadMarkers release];
+	[_sendingReadMarkerRooms release];
+	[_typingUsers release];
+	[_readReceipts release];
+	[_stagedTypingUsers release];
+	[_stagedReadReceipts release];
+	[_mediaCache release];
 
 	[super dealloc];
 }
@@ -194,9 +653,86 @@ validateHomeserver(OFIRI *homeserver)
 
 - (MTXRequest *)requestWithPath: (OFString *)path
 {
-	return [MTXRequest requestWithPath: path
-			       accessToken: _accessToken
-				homeserver: _homeserver];
+	MTXRequest *request = [MTXRequest requestWithPath: path
+					      accessToken: _accessToken
+					       homeserver: _homeserver];
+	request.connectionPool = _connectionPool;
+	request.acceptsCompressedResponses = _acceptsCompressedResponses;
+	request.metrics = _metrics;
+
+	return request;
+}
+
+- (void)storageTransactionWithBlock: (MTXStorageTransactionBlock)block
+			 syncPhases: (bool)syncPhases
+{
+	OFTimeInterval started = OFDate.date.timeIntervalSince1970;
+	__block OFTimeInterval processed = started;
+	__block bool commits = false;
+	bool committed = false;
+
+	@try {
+		[_storage transactionWithBlock: ^ {
+			commits = block();
+			processed = OFDate.date.timeIntervalSince1970;
+			return commits;
+		}];
+
+		/* Only known once the commit itself did not throw. */
+		committed = commits;
+	} @finally {
+		OFTimeInterval finished = OFDate.date.timeIntervalSince1970;
+
+		/*
+		 * Rooms changed in a rolled back transaction are unchanged and
+		 * its events will be received again.
+		 */
+		if (!committed) {
+			[_joinedSummaryRoomIDs removeAllObjects];
+			[_leftSummaryRoomIDs removeAllObjects];
+			[_pendingDispatches removeAllObjects];
+			[_stagedTypingUsers removeAllObjects];
+			[_stagedReadReceipts removeAllObjects];
+		}
+
+		[_metrics addStorageTransactionWithDuration:
+		    finished - started];
+
+		if (syncPhases) {
+			[_metrics addDuration: processed - started
+				 forSyncPhase: MTXSyncPhaseProcess];
+			[_metrics addDuration: finished - processed
+				 forSyncPhase: MTXSyncPhaseCommit];
+		}
+	}
+
+	[self updateRoomSummaries];
+	[self applyStagedEphemeralState];
+	[self performPendingDispatches];
+
+	if (_toDeviceEventsPending)
+		[self deliverToDeviceEvents];
+
+	if (syncPhases && _snapshotIRI != nil &&
+	    OFDate.date.timeIntervalSince1970 - _lastSnapshot >=
+	    _snapshotInterval)
+		[self tryWritingSnapshot];
+}
+
+- (void)addSyncPhasesOfRequest: (MTXRequest *)request
+{
+	[_metrics addDuration: request.waitDuration
+		 forSyncPhase: MTXSyncPhaseRequest];
+	[_metrics addDuration: request.transferDuration
+		 forSyncPhase: MTXSyncPhaseTransfer];
+	[_metrics addDuration: request.parseDuration
+		 forSyncPhase: MTXSyncPhaseParse];
+}
+
+- (void)setSyncTimeout: (OFTimeInterval)syncTimeout
+{
+	_syncTimeout = _effectiveSyncTimeout = syncTimeout;
+	_fullLengthSyncs = 0;
 }
 
 - (void)startSyncLoop
@@ -205,14 +741,42 @@ validateHomeserver(OFIRI *homeserver)
 		return;
 
 	_syncing = true;
+	/* Cancels a pending retry from before the loop was stopped. */
+	_syncRetryToken++;
+
+	/* Events left in the inbox if delivery was interrupted last time. */
+	_toDeviceEventsPending = true;
+	[self deliverToDeviceEvents];
+
+	/* A request from before the loop was stopped continues the loop. */
+	if (!_syncInFlight)
+		[self sync];
+}
+
+- (void)sync
+{
+	if (_syncEngine == MTXSyncEngineSliding) {
+		[self slidingSync];
+		return;
+	}
+
+	if (_syncFilter != nil && _syncFilterID == nil) {
+		[self uploadSyncFilter];
+		return;
+	}
 
 	void *pool = objc_autoreleasePoolPush();
 	MTXRequest *request = [self
 	    requestWithPath: @"/_matrix/client/r0/sync"];
-	unsigned long long timeoutMs = _syncTimeout * 1000;
+	request.connectionPool = _syncConnectionPool;
+	request.lazilyDecodesEvents = true;
+	unsigned long long timeoutMs = _effectiveSyncTimeout * 1000;
 	OFMutableArray<OFPair <OFString *, OFString *> *> *queryItems =
 	    [OFMutableArray array];
-	OFString *since = [_storage nextBatchForDeviceID: _deviceID];
+	OFString *since = _pipelineSince;
+
+	if (since == nil)
+		since = [_storage nextBatchForDeviceID: _deviceID];
 
 	[queryItems addObject:
 	    [OFPair pairWithFirstObject: @"timeout"
@@ -223,235 +787,2243 @@ validateHomeserver(OFIRI *homeserver)
 		    [OFPair pairWithFirstObject: @"since"
 				   secondObject: since]];
 
+	if (_syncFilterID != nil)
+		[queryItems addObject:
+		    [OFPair pairWithFirstObject: @"filter"
+				   secondObject: _syncFilterID]];
+
 	request.queryItems = queryItems;
+	_syncRequestStarted = OFDate.date.timeIntervalSince1970;
+
+	if (_streamingSync) {
+		[self performStreamingSyncRequest: request];
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	unsigned long long generation = _syncGeneration;
+	_syncInFlight = true;
+
 	[request performWithBlock: ^ (MTXResponse response, int statusCode,
 				       id exception) {
+		/* A previous response failed, so this one must be dropped. */
+		if (generation != _syncGeneration)
+			return;
+
+		_syncInFlight = false;
+
 		if (exception != nil) {
-			if (_syncExceptionHandler != NULL)
-				_syncExceptionHandler(exception);
+			[self syncFailedWithException: exception];
 			return;
 		}
 
 		if (statusCode != 200) {
-			if (_syncExceptionHandler != NULL)
-				_syncExceptionHandler([MTXSyncFailedException
-				    exceptionWithStatusCode: statusCode
-						   response: response
-						     client: self]);
+			[self syncFailedWithException: [MTXSyncFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self]];
 			return;
 		}
 
 		OFString *nextBatch = response[@"next_batch"];
 		if (![nextBatch isKindOfClass: OFString.class]) {
-			if (_syncExceptionHandler != NULL)
-				_syncExceptionHandler(
-				    [OFInvalidServerResponseException
-				    exception]);
+			[self syncFailedWithException:
+			    [OFInvalidServerResponseException exception]];
 			return;
 		}
 
-		@try {
-			[_storage transactionWithBlock: ^ {
-				[_storage setNextBatch: nextBatch
-					   forDeviceID: _deviceID];
-
-				[self processRoomsSync: response[@"rooms"]];
-				[self processPresenceSync:
-				    response[@"presence"]];
-				[self processAccountDataSync:
-				    response[@"account_data"]];
-				[self processToDeviceSync:
-				    response[@"to_device"]];
+		[self syncRequestSucceeded];
+		[self addSyncPhasesOfRequest: request];
 
-				return true;
-			}];
+		if (_pipelinedSync) {
+			[self enqueueSyncResponse: response
+					nextBatch: nextBatch];
+			return;
+		}
+
+		@try {
+			[self processSyncResponse: response
+					nextBatch: nextBatch];
 		} @catch (id e) {
-			if (_syncExceptionHandler != NULL)
-				_syncExceptionHandler(e);
+			[self syncFailedWithException: e];
 			return;
 		}
 
 		if (_syncing)
-			[self startSyncLoop];
+			[self sync];
 	}];
 
 	objc_autoreleasePoolPop(pool);
 }
 
-- (void)stopSyncLoop
+- (void)setSyncFilter: (MTXSyncFilter *)syncFilter
 {
-	_syncing = false;
+	MTXSyncFilter *old = _syncFilter;
+	_syncFilter = [syncFilter copy];
+	[old release];
+
+	/* Looked up or uploaded again before the next sync. */
+	[_syncFilterID release];
+	_syncFilterID = nil;
 }
 
-- (void)logOutWithBlock: (MTXClientResponseBlock)block
+- (void)uploadSyncFilter
 {
 	void *pool = objc_autoreleasePoolPush();
-	MTXRequest *request =
-	    [self requestWithPath: @"/_matrix/client/r0/logout"];
+	MTXSyncFilter *syncFilter = [[_syncFilter retain] autorelease];
+	OFDictionary *filter = syncFilter.filterDictionary;
+	OFString *filterJSON = [filter JSONRepresentationWithOptions:
+	    OFJSONRepresentationOptionSorted];
+	OFString *filterID = [_storage filterIDForFilter: filterJSON
+						  userID: _userID];
+
+	if (filterID != nil) {
+		_syncFilterID = [filterID copy];
+		[self sync];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	MTXRequest *request = [self requestWithPath: [OFString
+	    stringWithFormat: @"/_matrix/client/r0/user/%@/filter", _userID]];
+	request.metricsEndpoint = @"/_matrix/client/r0/user/{userId}/filter";
 	request.method = OFHTTPRequestMethodPost;
+	request.body = filter;
+
+	unsigned long long generation = _syncGeneration;
+	_syncInFlight = true;
+
 	[request performWithBlock: ^ (MTXResponse response, int statusCode,
 				       id exception) {
+		if (generation != _syncGeneration)
+			return;
+
+		_syncInFlight = false;
+
 		if (exception != nil) {
-			block(exception);
+			[self syncFailedWithException: exception];
 			return;
 		}
 
 		if (statusCode != 200) {
-			block([MTXLogoutFailedException
+			[self syncFailedWithException: [MTXSyncFailedException
 			    exceptionWithStatusCode: statusCode
 					   response: response
-					     client: self]);
+					     client: self]];
 			return;
 		}
 
-		block(nil);
-	}];
-
-	objc_autoreleasePoolPop(pool);
-}
-
-- (void)fetchRoomListWithBlock: (MTXClientRoomListBlock)block
-{
-	void *pool = objc_autoreleasePoolPush();
-	MTXRequest *request =
-	    [self requestWithPath: @"/_matrix/client/r0/joined_rooms"];
-	[request performWithBlock: ^ (MTXResponse response, int statusCode,
-				       id exception) {
-		if (exception != nil) {
-			block(nil, exception);
+		OFString *filterID = response[@"filter_id"];
+		if (![filterID isKindOfClass: OFString.class]) {
+			[self syncFailedWithException:
+			    [OFInvalidServerResponseException exception]];
 			return;
 		}
 
-		if (statusCode != 200) {
-			block(nil, [MTXFetchRoomListFailedException
-			    exceptionWithStatusCode: statusCode
-					   response: response
-					     client: self]);
+		@try {
+			[_storage setFilterID: filterID
+				    forFilter: filterJSON
+				       userID: _userID];
+		} @catch (id e) {
+			[self syncFailedWithException: e];
 			return;
 		}
 
-		OFArray<OFString *> *joinedRooms = response[@"joined_rooms"];
-		if (![joinedRooms isKindOfClass: OFArray.class]) {
-			block(nil,
-			    [OFInvalidServerResponseException exception]);
-			return;
-		}
-		for (OFString *room in joinedRooms) {
-			if (![room isKindOfClass: OFString.class]) {
-				block(nil,
-				    [OFInvalidServerResponseException
-				    exception]);
-				return;
-			}
+		/* The filter might have been changed in the meantime. */
+		if (_syncFilter == syncFilter) {
+			[_syncFilterID release];
+			_syncFilterID = [filterID copy];
 		}
 
-		block(response[@"joined_rooms"], nil);
+		if (_syncing)
+			[self sync];
 	}];
 
 	objc_autoreleasePoolPop(pool);
 }
 
-- (void)joinRoom: (OFString *)room block: (MTXClientRoomJoinBlock)block
+- (void)syncFailedWithException: (id)exception
 {
-	void *pool = objc_autoreleasePoolPush();
-	MTXRequest *request = [self requestWithPath:
-	    [OFString stringWithFormat: @"/_matrix/client/r0/join/%@", room]];
-	request.method = OFHTTPRequestMethodPost;
-	[request performWithBlock: ^ (MTXResponse response, int statusCode,
-				       id exception) {
-		if (exception != nil) {
-			block(nil, exception);
-			return;
-		}
+	OFTimeInterval elapsed =
+	    OFDate.date.timeIntervalSince1970 - _syncRequestStarted;
+	bool transient = isTransientSyncException(exception);
 
-		if (statusCode != 200) {
-			block(nil, [MTXJoinRoomFailedException
-			    exceptionWithRoom: room
-				   statusCode: statusCode
-				     response: response
-				       client: self]);
-			return;
-		}
+	_syncInFlight = false;
 
-		OFString *roomID = response[@"room_id"];
-		if (![roomID isKindOfClass: OFString.class]) {
+	/*
+	 * Everything after the last stored next batch needs to be synced
+	 * again, so drop all responses that have not been processed yet.
+	 */
+	_syncGeneration++;
+	[_pendingSyncResponses removeAllObjects];
+	[_pipelineSince release];
+	_pipelineSince = nil;
+
+	if (!_syncing || !transient) {
+		_syncing = false;
+
+		if ([_syncHealthDelegate respondsToSelector:
+		    @selector(client:syncStoppedWithException:)])
+			[_syncHealthDelegate client: self
+			   syncStoppedWithException: exception];
+
+		if (_syncExceptionHandler != NULL)
+			_syncExceptionHandler(exception);
+
+		return;
+	}
+
+	/*
+	 * A request that was open for a while but failed before the timeout
+	 * was most likely cut off by a proxy, so stay below that.
+	 */
+	if (elapsed >= minEffectiveSyncTimeout &&
+	    elapsed < _effectiveSyncTimeout * 0.9) {
+		OFTimeInterval timeout = elapsed * 0.75;
+
+		if (timeout < minEffectiveSyncTimeout)
+			timeout = minEffectiveSyncTimeout;
+
+		[self adaptSyncTimeout: timeout];
+	}
+	_fullLengthSyncs = 0;
+
+	OFTimeInterval delay = minSyncRetryDelay;
+	for (size_t i = 0; i < _syncFailures && delay < _maxSyncRetryDelay;
+	    i++)
+		delay *= 2;
+	if (delay > _maxSyncRetryDelay)
+		delay = _maxSyncRetryDelay;
+
+	/* Jitter so that many clients do not all retry at the same time. */
+	delay *= 0.5 + 0.5 * ((OFTimeInterval)OFRandom32() / UINT32_MAX);
+
+	if ([exception isKindOfClass: MTXSyncFailedException.class] &&
+	    [exception statusCode] == 429) {
+		OFNumber *retryAfter = [exception response][@"retry_after_ms"];
+
+		if ([retryAfter isKindOfClass: OFNumber.class] &&
+		    retryAfter.doubleValue / 1000 > delay)
+			delay = retryAfter.doubleValue / 1000;
+	}
+
+	_syncFailures++;
+
+	if ([_syncHealthDelegate respondsToSelector:
+	    @selector(client:syncFailedWithException:willRetryAfter:)])
+		[_syncHealthDelegate client: self
+		    syncFailedWithException: exception
+			     willRetryAfter: delay];
+
+	[self performSelector: @selector(retrySyncWithToken:)
+		   withObject: @(++_syncRetryToken)
+		   afterDelay: delay];
+}
+
+- (void)retrySyncWithToken: (OFNumber *)token
+{
+	if (!_syncing || token.unsignedLongLongValue != _syncRetryToken)
+		return;
+
+	[self sync];
+}
+
+- (void)syncRequestSucceeded
+{
+	OFTimeInterval elapsed =
+	    OFDate.date.timeIntervalSince1970 - _syncRequestStarted;
+
+	if (_syncFailures > 0) {
+		size_t failures = _syncFailures;
+		_syncFailures = 0;
+
+		if ([_syncHealthDelegate respondsToSelector:
+		    @selector(client:syncRecoveredAfterFailures:)])
+			[_syncHealthDelegate client: self
+			 syncRecoveredAfterFailures: failures];
+	}
+
+	/* Only long polls without events tell that the timeout works. */
+	if (_effectiveSyncTimeout >= _syncTimeout ||
+	    elapsed < _effectiveSyncTimeout * 0.9)
+		return;
+
+	if (++_fullLengthSyncs < syncTimeoutRaiseThreshold)
+		return;
+
+	OFTimeInterval timeout = _effectiveSyncTimeout * 1.5;
+	if (timeout > _syncTimeout)
+		timeout = _syncTimeout;
+
+	[self adaptSyncTimeout: timeout];
+}
+
+- (void)adaptSyncTimeout: (OFTimeInterval)timeout
+{
+	if (timeout == _effectiveSyncTimeout)
+		return;
+
+	_effectiveSyncTimeout = timeout;
+	_fullLengthSyncs = 0;
+
+	if ([_syncHealthDelegate respondsToSelector:
+	    @selector(client:didAdaptSyncTimeout:)])
+		[_syncHealthDelegate client: self
+			didAdaptSyncTimeout: timeout];
+}
+
+- (void)processSyncResponse: (MTXResponse)response
+		  nextBatch: (OFString *)nextBatch
+{
+	[self storageTransactionWithBlock: ^ {
+		[_storage setNextBatch: nextBatch forDeviceID: _deviceID];
+
+		[self processRoomsSync: response[@"rooms"]];
+		[self processPresenceSync: response[@"presence"]];
+		[self processAccountDataSync: response[@"account_data"]];
+		[self processDeviceListsSync: response[@"device_lists"]];
+		[self processToDeviceSync: response[@"to_device"]];
+
+		return true;
+	} syncPhases: true];
+}
+
+- (void)enqueueSyncResponse: (MTXResponse)response
+		  nextBatch: (OFString *)nextBatch
+{
+	OFString *old = _pipelineSince;
+	_pipelineSince = [nextBatch copy];
+	[old release];
+
+	[_pendingSyncResponses addObject: response];
+
+	/* Start the next long poll before processing this response. */
+	if (_syncing && _pendingSyncResponses.count < maxPendingSyncResponses)
+		[self sync];
+
+	if (!_syncProcessingScheduled) {
+		_syncProcessingScheduled = true;
+		[self performSelector: @selector(processPendingSyncResponses)
+			   afterDelay: syncProcessingDelay];
+	}
+}
+
+- (void)processPendingSyncResponses
+{
+	_syncProcessingScheduled = false;
+
+	while (_pendingSyncResponses.count > 0) {
+		void *pool = objc_autoreleasePoolPush();
+		MTXResponse response =
+		    [[_pendingSyncResponses.firstObject retain] autorelease];
+
+		[_pendingSyncResponses removeObjectAtIndex: 0];
+
+		@try {
+			[self processSyncResponse: response
+					nextBatch: response[@"next_batch"]];
+		} @catch (id e) {
+			[self syncFailedWithException: e];
+			objc_autoreleasePoolPop(pool);
+			return;
+		}
+
+		objc_autoreleasePoolPop(pool);
+	}
+
+	/* The next long poll was held back while too much was pending. */
+	if (_syncing && !_syncInFlight)
+		[self sync];
+}
+
+- (void)performStreamingSyncRequest: (MTXRequest *)request
+{
+	unsigned long long generation = _syncGeneration;
+	_syncInFlight = true;
+
+	[request performWithStreamBlock: ^ (OFStream *body) {
+		/* Left unread, which closes the connection. */
+		if (generation != _syncGeneration)
+			return;
+
+		[self storageTransactionWithBlock: ^ {
+			[self processSyncStream: body
+			    lazilyDecodesEvents: request.lazilyDecodesEvents];
+			return true;
+		} syncPhases: true];
+	} block: ^ (MTXResponse response, int statusCode, id exception) {
+		if (generation != _syncGeneration)
+			return;
+
+		_syncInFlight = false;
+
+		[_metrics addDuration: request.waitDuration
+			 forSyncPhase: MTXSyncPhaseRequest];
+
+		if (exception != nil) {
+			[self syncFailedWithException: exception];
+			return;
+		}
+
+		if (statusCode != 200) {
+			[self syncFailedWithException: [MTXSyncFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self]];
+			return;
+		}
+
+		[self syncRequestSucceeded];
+
+		if (_syncing)
+			[self sync];
+	}];
+}
+
+- (void)slidingSync
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request = [self requestWithPath: slidingSyncPath];
+	request.connectionPool = _syncConnectionPool;
+	request.method = OFHTTPRequestMethodPost;
+	unsigned long long timeoutMs = _effectiveSyncTimeout * 1000;
+	OFMutableArray<OFPair <OFString *, OFString *> *> *queryItems =
+	    [OFMutableArray array];
+	OFMutableDictionary *lists = [OFMutableDictionary dictionary];
+	OFString *position =
+	    [_storage slidingSyncPositionForDeviceID: _deviceID];
+
+	[queryItems addObject:
+	    [OFPair pairWithFirstObject: @"timeout"
+			   secondObject: @(timeoutMs).stringValue]];
+
+	if (position != nil)
+		[queryItems addObject:
+		    [OFPair pairWithFirstObject: @"pos"
+				   secondObject: position]];
+
+	for (MTXSlidingSyncList *list in _slidingSyncLists)
+		lists[list.name] = list.requestDictionary;
+
+	request.queryItems = queryItems;
+	request.body = @{ @"lists": lists };
+	_syncRequestStarted = OFDate.date.timeIntervalSince1970;
+
+	unsigned long long generation = _syncGeneration;
+	_syncInFlight = true;
+
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (generation != _syncGeneration)
+			return;
+
+		_syncInFlight = false;
+
+		if (exception != nil) {
+			[self syncFailedWithException: exception];
+			return;
+		}
+
+		if (statusCode == 400 &&
+		    [response[@"errcode"] isEqual: @"M_UNKNOWN_POS"]) {
+			/* The server expired the connection, so start over. */
+			@try {
+				[_storage setSlidingSyncPosition: nil
+						     forDeviceID: _deviceID];
+			} @catch (id e) {
+				[self syncFailedWithException: e];
+				return;
+			}
+
+			if (_syncing)
+				[self sync];
+
+			return;
+		}
+
+		if (statusCode != 200) {
+			[self syncFailedWithException: [MTXSyncFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self]];
+			return;
+		}
+
+		OFString *newPosition = response[@"pos"];
+		if (![newPosition isKindOfClass: OFString.class]) {
+			[self syncFailedWithException:
+			    [OFInvalidServerResponseException exception]];
+			return;
+		}
+
+		[self syncRequestSucceeded];
+		[self addSyncPhasesOfRequest: request];
+
+		@try {
+			/*
+			 * The position is stored with the rooms, so that after
+			 * a restart the connection resumes where the stored
+			 * rooms end.
+			 */
+			[self storageTransactionWithBlock: ^ {
+				[self processSlidingSyncResponse: response];
+				[_storage setSlidingSyncPosition: newPosition
+						     forDeviceID: _deviceID];
+				return true;
+			} syncPhases: true];
+		} @catch (id e) {
+			[self syncFailedWithException: e];
+			return;
+		}
+
+		if (_syncing)
+			[self sync];
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)processSlidingSyncResponse: (MTXResponse)response
+{
+	OFDictionary<OFString *, id> *lists = response[@"lists"];
+	if ([lists isKindOfClass: OFDictionary.class]) {
+		for (MTXSlidingSyncList *list in _slidingSyncLists) {
+			OFDictionary *listResponse = lists[list.name];
+			if (![listResponse isKindOfClass: OFDictionary.class])
+				continue;
+
+			OFNumber *count = listResponse[@"count"];
+			if ([count isKindOfClass: OFNumber.class])
+				list.count =
+				    (size_t)count.unsignedLongLongValue;
+		}
+	}
+
+	OFDictionary<OFString *, id> *rooms = response[@"rooms"];
+	if (rooms == nil)
+		return;
+	if (![rooms isKindOfClass: OFDictionary.class])
+		@throw [OFInvalidServerResponseException exception];
+
+	/*
+	 * Translate the rooms to the layout of the classic sync, so that they
+	 * go through the same processing.
+	 */
+	OFMutableDictionary *joinedRooms = [OFMutableDictionary dictionary];
+	OFMutableDictionary *invitedRooms = [OFMutableDictionary dictionary];
+	OFMutableDictionary *leftRooms = [OFMutableDictionary dictionary];
+	OFMutableDictionary *otherRooms = [OFMutableDictionary dictionary];
+
+	for (OFString *roomID in rooms) {
+		OFDictionary<OFString *, id> *room = rooms[roomID];
+		if (![room isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidServerResponseException exception];
+
+		OFArray *inviteState = room[@"invite_state"];
+		if (inviteState != nil) {
+			invitedRooms[roomID] = @{
+				@"invite_state": @{ @"events": inviteState }
+			};
+			continue;
+		}
+
+		OFArray *state = room[@"required_state"];
+		OFArray *timelineEvents = room[@"timeline"];
+		OFMutableDictionary *timeline = [OFMutableDictionary
+		    dictionaryWithObject: (timelineEvents != nil
+					      ? timelineEvents : @[])
+				  forKey: @"events"];
+
+		if (room[@"limited"] != nil)
+			timeline[@"limited"] = room[@"limited"];
+		if (room[@"prev_batch"] != nil)
+			timeline[@"prev_batch"] = room[@"prev_batch"];
+
+		OFDictionary *classicRoom = @{
+			@"state": @{ @"events": (state != nil ? state : @[]) },
+			@"timeline": timeline
+		};
+
+		OFString *membership = membershipInEvents(state, _userID, nil);
+		membership = membershipInEvents(timelineEvents, _userID,
+		    membership);
+
+		/*
+		 * Updates to a room usually do not repeat the membership, in
+		 * which case the stored one still applies.
+		 */
+		if (membership == nil)
+			membership = [_storage membershipOfUser: _userID
+							 inRoom: roomID];
+
+		if ([membership isEqual: @"join"])
+			joinedRooms[roomID] = classicRoom;
+		else if ([membership isEqual: @"leave"] ||
+		    [membership isEqual: @"ban"])
+			leftRooms[roomID] = classicRoom;
+		else
+			/*
+			 * Without a known membership, the room is neither
+			 * joined nor left, but its events are still kept.
+			 */
+			otherRooms[roomID] = classicRoom;
+	}
+
+	[self processRoomsSync: @{
+		@"join": joinedRooms,
+		@"invite": invitedRooms,
+		@"leave": leftRooms
+	}];
+	[self storeStateAndTimelinesOfRooms: otherRooms];
+}
+
+- (void)processSyncStream: (OFStream *)stream
+      lazilyDecodesEvents: (bool)lazilyDecodesEvents
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXSyncParser *parser = [MTXSyncParser parser];
+	__block OFString *nextBatch = nil;
+	char *buffer = OFAllocMemory(1, syncBufferSize);
+	OFMutableDictionary<OFString *, OFMutableDictionary *> *pendingRooms =
+	    [OFMutableDictionary dictionary];
+	__block size_t numPendingRooms = 0;
+	void (^processPendingRooms)(void) = ^ {
+		if (numPendingRooms == 0)
+			return;
+
+		[self processRoomsSync: pendingRooms];
+		[pendingRooms removeAllObjects];
+		numPendingRooms = 0;
+	};
+
+	parser.lazilyDecodesEvents = lazilyDecodesEvents;
+
+	parser.valueBlock = ^ (OFString *key, id value) {
+		if ([key isEqual: @"next_batch"]) {
+			if (![value isKindOfClass: OFString.class])
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+			[nextBatch release];
+			nextBatch = [value copy];
+		} else if ([key isEqual: @"rooms"])
+			[self processRoomsSync: value];
+		else if ([key isEqual: @"presence"])
+			[self processPresenceSync: value];
+		else if ([key isEqual: @"account_data"])
+			[self processAccountDataSync: value];
+		else if ([key isEqual: @"device_lists"])
+			[self processDeviceListsSync: value];
+		else if ([key isEqual: @"to_device"])
+			[self processToDeviceSync: value];
+	};
+	/*
+	 * Rooms are collected into batches, so that they are written with the
+	 * same batched storage calls as a sync that is not streamed.
+	 */
+	parser.roomBlock = ^ (OFString *section, OFString *roomID, id room) {
+		OFMutableDictionary *rooms = pendingRooms[section];
+
+		if (rooms == nil) {
+			/* The rooms of a section must not overtake another. */
+			processPendingRooms();
+
+			rooms = [OFMutableDictionary dictionary];
+			pendingRooms[section] = rooms;
+		}
+
+		rooms[roomID] = room;
+
+		if (++numPendingRooms >= streamingRoomBatchSize)
+			processPendingRooms();
+	};
+
+	@try {
+		while (!stream.atEndOfStream) {
+			void *pool2 = objc_autoreleasePoolPush();
+			size_t length = [stream readIntoBuffer: buffer
+							length: syncBufferSize];
+
+			[parser parseBuffer: buffer length: length];
+
+			objc_autoreleasePoolPop(pool2);
+		}
+
+		[parser finish];
+		processPendingRooms();
+
+		if (nextBatch == nil)
+			@throw [OFInvalidServerResponseException exception];
+
+		[_storage setNextBatch: nextBatch forDeviceID: _deviceID];
+	} @finally {
+		OFFreeMemory(buffer);
+		[nextBatch release];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)stopSyncLoop
+{
+	_syncing = false;
+
+	if (_snapshotIRI != nil)
+		[self tryWritingSnapshot];
+}
+
+- (void)logOutWithBlock: (MTXClientResponseBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request =
+	    [self requestWithPath: @"/_matrix/client/r0/logout"];
+	request.method = OFHTTPRequestMethodPost;
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (exception != nil) {
+			block(exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block([MTXLogoutFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self]);
+			return;
+		}
+
+		block(nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)fetchRoomListWithBlock: (MTXClientRoomListBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request =
+	    [self requestWithPath: @"/_matrix/client/r0/joined_rooms"];
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (exception != nil) {
+			block(nil, exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block(nil, [MTXFetchRoomListFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self]);
+			return;
+		}
+
+		OFArray<OFString *> *joinedRooms = response[@"joined_rooms"];
+		if (![joinedRooms isKindOfClass: OFArray.class]) {
+			block(nil,
+			    [OFInvalidServerResponseException exception]);
+			return;
+		}
+		for (OFString *room in joinedRooms) {
+			if (![room isKindOfClass: OFString.class]) {
+				block(nil,
+				    [OFInvalidServerResponseException
+				    exception]);
+				return;
+			}
+		}
+
+		block(response[@"joined_rooms"], nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)joinRoom: (OFString *)room block: (MTXClientRoomJoinBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request = [self requestWithPath:
+	    [OFString stringWithFormat: @"/_matrix/client/r0/join/%@", room]];
+	request.metricsEndpoint = @"/_matrix/client/r0/join/{roomIdOrAlias}";
+	request.method = OFHTTPRequestMethodPost;
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (exception != nil) {
+			block(nil, exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block(nil, [MTXJoinRoomFailedException
+			    exceptionWithRoom: room
+				   statusCode: statusCode
+				     response: response
+				       client: self]);
+			return;
+		}
+
+		OFString *roomID = response[@"room_id"];
+		if (![roomID isKindOfClass: OFString.class]) {
+			block(nil,
+			    [OFInvalidServerResponseException exception]);
+			return;
+		}
+
+		block(roomID, nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)leaveRoom: (OFString *)roomID block: (MTXClientResponseBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request = [self requestWithPath: [OFString
+	    stringWithFormat: @"/_matrix/client/r0/rooms/%@/leave", roomID]];
+	request.metricsEndpoint = @"/_matrix/client/r0/rooms/{roomId}/leave";
+	request.method = OFHTTPRequestMethodPost;
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (exception != nil) {
+			block(exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block([MTXLeaveRoomFailedException
+			    exceptionWithRoomID: roomID
+				     statusCode: statusCode
+				       response: response
+					 client: self]);
+			return;
+		}
+
+		block(nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)fetchTimelineForRoom: (OFString *)roomID
+	      beforePosition: (OFNumber *)position
+		       limit: (size_t)limit
+		       block: (MTXClientTimelineBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableArray *events = [OFMutableArray array];
+	int64_t before = (position != nil ? position.longLongValue : INT64_MAX);
+	OFString *gapToken = nil;
+	OFArray<MTXTimelineEntry *> *entries;
+
+	@try {
+		entries = [_storage timelineEntriesForRoom: roomID
+					    beforePosition: before
+						     limit: limit];
+	} @catch (id e) {
+		block(nil, nil, e);
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	for (MTXTimelineEntry *entry in entries) {
+		if (entry.gapToken != nil) {
+			gapToken = entry.gapToken;
+			break;
+		}
+
+		[events addObject: entry.event];
+		before = entry.position;
+	}
+
+	if (gapToken == nil) {
+		/* Fewer entries than requested means the start was reached. */
+		block(events, (entries.count < limit ? nil : @(before)), nil);
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	/* Reached a gap, so fill it from the server and continue from there. */
+	size_t remaining = limit - events.count;
+	[self fillGapWithToken: gapToken
+			inRoom: roomID
+			 limit: remaining
+			 block: ^ (id exception) {
+		if (exception != nil) {
+			block(nil, nil, exception);
+			return;
+		}
+
+		[self fetchTimelineForRoom: roomID
+			    beforePosition: @(before)
+				     limit: remaining
+				     block: ^ (OFArray *olderEvents,
+					 OFNumber *olderPosition,
+					 id exception_) {
+			if (exception_ != nil) {
+				block(nil, nil, exception_);
+				return;
+			}
+
+			block([events arrayByAddingObjectsFromArray:
+			    olderEvents], olderPosition, nil);
+		}];
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)fillGapWithToken: (OFString *)gapToken
+		  inRoom: (OFString *)roomID
+		   limit: (size_t)limit
+		   block: (MTXClientResponseBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request = [self requestWithPath: [OFString
+	    stringWithFormat: @"/_matrix/client/r0/rooms/%@/messages", roomID]];
+	request.metricsEndpoint =
+	    @"/_matrix/client/r0/rooms/{roomId}/messages";
+	request.queryItems = @[
+		[OFPair pairWithFirstObject: @"dir" secondObject: @"b"],
+		[OFPair pairWithFirstObject: @"from" secondObject: gapToken],
+		[OFPair pairWithFirstObject: @"limit"
+			       secondObject: @(limit).stringValue]
+	];
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (exception != nil) {
+			block(exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block([MTXFetchTimelineFailedException
+			    exceptionWithRoomID: roomID
+				     statusCode: statusCode
+				       response: response
+					 client: self]);
+			return;
+		}
+
+		OFArray<OFDictionary<OFString *, id> *> *chunk =
+		    response[@"chunk"];
+		if (![chunk isKindOfClass: OFArray.class]) {
+			block([OFInvalidServerResponseException exception]);
+			return;
+		}
+		for (OFDictionary *event in chunk) {
+			if (![event isKindOfClass: OFDictionary.class]) {
+				block([OFInvalidServerResponseException
+				    exception]);
+				return;
+			}
+		}
+
+		/* Without events, there is nothing before the gap. */
+		OFString *endToken = response[@"end"];
+		if (![endToken isKindOfClass: OFString.class] ||
+		    chunk.count == 0)
+			endToken = nil;
+
+		@try {
+			[self storageTransactionWithBlock: ^ {
+				[_storage fillGapWithToken: gapToken
+						    inRoom: roomID
+						    events: chunk
+						  endToken: endToken];
+				return true;
+			} syncPhases: false];
+		} @catch (id e) {
+			block(e);
+			return;
+		}
+
+		block(nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)nameOfRoom: (OFString *)roomID
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFDictionary<OFString *, id> *event =
+	    [_storage stateEventWithType: @"m.room.name"
+				stateKey: @""
+				  inRoom: roomID];
+	OFDictionary<OFString *, id> *content = event[@"content"];
+	OFString *name = nil;
+
+	if ([content isKindOfClass: OFDictionary.class])
+		name = content[@"name"];
+
+	if (![name isKindOfClass: OFString.class] || name.length == 0)
+		name = nil;
+
+	[name retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [name autorelease];
+}
+
+- (long long)powerLevelOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFDictionary<OFString *, id> *event =
+	    [_storage stateEventWithType: @"m.room.power_levels"
+				stateKey: @""
+				  inRoom: roomID];
+	long long powerLevel = 0;
+
+	if (event == nil) {
+		/* Without power levels, the creator has 100, everyone 0. */
+		event = [_storage stateEventWithType: @"m.room.create"
+					    stateKey: @""
+					      inRoom: roomID];
+
+		if ([event[@"sender"] isEqual: userID])
+			powerLevel = 100;
+
+		objc_autoreleasePoolPop(pool);
+
+		return powerLevel;
+	}
+
+	OFDictionary<OFString *, id> *content = event[@"content"];
+	if (![content isKindOfClass: OFDictionary.class]) {
+		objc_autoreleasePoolPop(pool);
+		return 0;
+	}
+
+	OFDictionary<OFString *, id> *users = content[@"users"];
+	OFNumber *level = nil;
+
+	if ([users isKindOfClass: OFDictionary.class])
+		level = users[userID];
+	if (![level isKindOfClass: OFNumber.class])
+		level = content[@"users_default"];
+	if ([level isKindOfClass: OFNumber.class])
+		powerLevel = level.longLongValue;
+
+	objc_autoreleasePoolPop(pool);
+
+	return powerLevel;
+}
+
+- (size_t)numberOfJoinedMembersInRoom: (OFString *)roomID
+{
+	return [_storage numberOfMembersInRoom: roomID withMembership: @"join"];
+}
+
+- (MTXRoomSummary *)summaryOfRoomFromStorage: (OFString *)roomID
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFArray<MTXTimelineEntry *> *newest =
+	    [_storage timelineEntriesForRoom: roomID
+			      beforePosition: INT64_MAX
+				       limit: 1];
+	OFNumber *timestamp = newest.firstObject.event[@"origin_server_ts"];
+
+	if (![timestamp isKindOfClass: OFNumber.class])
+		timestamp = nil;
+
+	MTXRoomSummary *summary = [[MTXRoomSummary alloc]
+	       initWithRoomID: roomID
+			 name: [self nameOfRoom: roomID]
+	numberOfJoinedMembers: [self numberOfJoinedMembersInRoom: roomID]
+	   lastEventTimestamp: timestamp.unsignedLongLongValue];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [summary autorelease];
+}
+
+- (void)loadRoomSummaries
+{
+	if (_roomSummaries != nil)
+		return;
+
+	OFMutableDictionary *roomSummaries = [OFMutableDictionary dictionary];
+	void *pool = objc_autoreleasePoolPush();
+
+	for (OFString *roomID in [_storage joinedRoomsForUser: _userID]) {
+		void *pool2 = objc_autoreleasePoolPush();
+
+		roomSummaries[roomID] = [self summaryOfRoomFromStorage: roomID];
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	_roomSummaries = [roomSummaries retain];
+}
+
+/*
+ * Updates the summaries of the rooms changed by the last transaction. If the
+ * summaries have not been loaded yet, they are built with all changes once
+ * they are needed.
+ */
+- (void)updateRoomSummaries
+{
+	if (_roomSummaries != nil) {
+		for (OFString *roomID in _joinedSummaryRoomIDs) {
+			void *pool = objc_autoreleasePoolPush();
+
+			_roomSummaries[roomID] =
+			    [self summaryOfRoomFromStorage: roomID];
+
+			objc_autoreleasePoolPop(pool);
+		}
+
+		for (OFString *roomID in _leftSummaryRoomIDs)
+			[_roomSummaries removeObjectForKey: roomID];
+	}
+
+	[_joinedSummaryRoomIDs removeAllObjects];
+	[_leftSummaryRoomIDs removeAllObjects];
+}
+
+- (OFArray<MTXRoomSummary *> *)roomSummaries
+{
+	[self loadRoomSummaries];
+
+	return _roomSummaries.allObjects;
+}
+
+- (MTXRoomSummary *)summaryOfRoom: (OFString *)roomID
+{
+	[self loadRoomSummaries];
+
+	return [[_roomSummaries[roomID] retain] autorelease];
+}
+
+- (OFMutableDictionary *)roomSummariesFromSnapshot: (OFData *)snapshot
+{
+	SnapshotReader reader = { snapshot.items, snapshot.count, 0 };
+	OFString *userID, *deviceID, *nextBatch;
+	uint32_t version, count;
+
+	if (snapshot.count < sizeof(snapshotMagic) ||
+	    memcmp(snapshot.items, snapshotMagic, sizeof(snapshotMagic)) != 0)
+		return nil;
+
+	reader.offset = sizeof(snapshotMagic);
+
+	if (!readUInt32(&reader, &version) || version != snapshotVersion)
+		return nil;
+
+	/*
+	 * Without a next batch, it is impossible to tell whether the storage
+	 * has changed since the snapshot was written.
+	 */
+	if (!readString(&reader, &userID) ||
+	    !readString(&reader, &deviceID) ||
+	    !readString(&reader, &nextBatch) || nextBatch == nil ||
+	    ![userID isEqual: _userID] || ![deviceID isEqual: _deviceID] ||
+	    ![nextBatch isEqual: [_storage nextBatchForDeviceID: _deviceID]])
+		return nil;
+
+	if (!readUInt32(&reader, &count))
+		return nil;
+
+	OFMutableDictionary *roomSummaries = [OFMutableDictionary dictionary];
+
+	for (uint32_t i = 0; i < count; i++) {
+		OFString *roomID, *name;
+		uint64_t numberOfJoinedMembers, lastEventTimestamp;
+
+		if (!readString(&reader, &roomID) || roomID == nil ||
+		    !readString(&reader, &name) ||
+		    !readUInt64(&reader, &numberOfJoinedMembers) ||
+		    !readUInt64(&reader, &lastEventTimestamp) ||
+		    numberOfJoinedMembers > SIZE_MAX)
+			return nil;
+
+		roomSummaries[roomID] = [MTXRoomSummary
+		     summaryWithRoomID: roomID
+				  name: name
+		 numberOfJoinedMembers: (size_t)numberOfJoinedMembers
+		    lastEventTimestamp: lastEventTimestamp];
+	}
+
+	if (reader.offset != reader.length)
+		return nil;
+
+	return roomSummaries;
+}
+
+- (bool)loadSnapshot
+{
+	if (_snapshotIRI == nil)
+		return false;
+
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableDictionary *roomSummaries;
+
+	@try {
+		roomSummaries = [self roomSummariesFromSnapshot:
+		    [OFData dataWithContentsOfIRI: _snapshotIRI]];
+	} @catch (id e) {
+		/* A snapshot that cannot be read is the same as none. */
+		roomSummaries = nil;
+	}
+
+	if (roomSummaries != nil) {
+		[_roomSummaries release];
+		_roomSummaries = [roomSummaries retain];
+		_lastSnapshot = OFDate.date.timeIntervalSince1970;
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	return (roomSummaries != nil);
+}
+
+- (void)writeSnapshot
+{
+	if (_snapshotIRI == nil)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableData *snapshot = [OFMutableData data];
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	OFIRI *temporaryIRI = [OFIRI fileIRIWithPath: [_snapshotIRI
+	    .fileSystemRepresentation stringByAppendingString: @".tmp"]];
+
+	[self loadRoomSummaries];
+
+	if (_roomSummaries.count > UINT32_MAX)
+		@throw [OFOutOfRangeException exception];
+
+	[snapshot addItems: snapshotMagic count: sizeof(snapshotMagic)];
+	appendUInt32(snapshot, snapshotVersion);
+	appendString(snapshot, _userID);
+	appendString(snapshot, _deviceID);
+	appendString(snapshot, [_storage nextBatchForDeviceID: _deviceID]);
+	appendUInt32(snapshot, (uint32_t)_roomSummaries.count);
+
+	for (MTXRoomSummary *summary in _roomSummaries.objectEnumerator) {
+		appendString(snapshot, summary.roomID);
+		appendString(snapshot, summary.name);
+		appendUInt64(snapshot, summary.numberOfJoinedMembers);
+		appendUInt64(snapshot, summary.lastEventTimestamp);
+	}
+
+	/*
+	 * The snapshot is moved into place once it is complete. A crash before
+	 * the move leaves no snapshot, which is only slower to start from.
+	 */
+	[snapshot writeToIRI: temporaryIRI];
+
+	if ([fileManager fileExistsAtIRI: _snapshotIRI])
+		[fileManager removeItemAtIRI: _snapshotIRI];
+
+	[fileManager moveItemAtIRI: temporaryIRI toIRI: _snapshotIRI];
+
+	_lastSnapshot = OFDate.date.timeIntervalSince1970;
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)tryWritingSnapshot
+{
+	@try {
+		[self writeSnapshot];
+	} @catch (id e) {
+		/* This only makes the next start slower, so keep syncing. */
+		_lastSnapshot = OFDate.date.timeIntervalSince1970;
+	}
+}
+
+- (void)sendMessage: (OFString *)message
+	     roomID: (OFString *)roomID
+	      block: (MTXClientResponseBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXOutgoingEvent *event = [MTXOutgoingEvent
+	    eventWithTransactionID: makeTransactionID()
+			    roomID: roomID
+			      type: @"m.room.message"
+			   content: @{
+				@"msgtype": @"m.text",
+				@"body": message
+			   }];
+
+	[self enqueueOutgoingEvent: event
+			completion: ^ (MTXResponse response, int statusCode,
+					id exception) {
+		if (exception != nil) {
+			block(exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block([MTXSendMessageFailedException
+			    exceptionWithMessage: message
+					  roomID: roomID
+				      statusCode: statusCode
+					response: response
+					  client: self]);
+			return;
+		}
+
+		block(nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)sendEventWithType: (OFString *)type
+		  content: (OFDictionary<OFString *, id> *)content
+		   roomID: (OFString *)roomID
+		    block: (MTXClientSendBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXOutgoingEvent *event = [MTXOutgoingEvent
+	    eventWithTransactionID: makeTransactionID()
+			    roomID: roomID
+			      type: type
+			   content: content];
+
+	[self enqueueOutgoingEvent: event
+			completion: ^ (MTXResponse response, int statusCode,
+					id exception) {
+		if (block == nil)
+			return;
+
+		if (exception != nil) {
+			block(nil, exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block(nil, [MTXSendEventFailedException
+			    exceptionWithRoomID: roomID
+				     statusCode: statusCode
+				       response: response
+					 client: self]);
+			return;
+		}
+
+		OFString *eventID = response[@"event_id"];
+		if (![eventID isKindOfClass: OFString.class]) {
+			block(nil,
+			    [OFInvalidServerResponseException exception]);
+			return;
+		}
+
+		block(eventID, nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)resumeSendQueue
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self loadOutgoingEvents];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)loadOutgoingEvents
+{
+	if (_outgoingEventsLoaded)
+		return;
+
+	/*
+	 * Loaded before the first event is queued, so that events left over
+	 * from a previous run are sent before newer events to the same room.
+	 */
+	for (MTXOutgoingEvent *event in
+	    [_storage outgoingEventsForDeviceID: _deviceID])
+		[self queueOutgoingEvent: event];
+
+	_outgoingEventsLoaded = true;
+
+	for (OFString *roomID in _outgoingEvents.allKeys)
+		[self sendNextOutgoingEventInRoom: roomID];
+}
+
+- (void)queueOutgoingEvent: (MTXOutgoingEvent *)event
+{
+	OFMutableArray *queue = _outgoingEvents[event.roomID];
+
+	if (queue == nil) {
+		queue = [OFMutableArray array];
+		_outgoingEvents[event.roomID] = queue;
+	}
+
+	[queue addObject: event];
+}
+
+- (void)enqueueOutgoingEvent: (MTXOutgoingEvent *)event
+		  completion: (MTXRequestBlock)completion
+{
+	@try {
+		[self loadOutgoingEvents];
+		[_storage addOutgoingEvent: event forDeviceID: _deviceID];
+	} @catch (id e) {
+		completion(nil, 0, e);
+		return;
+	}
+
+	[self queueOutgoingEvent: event];
+	_outgoingBlocks[event.transactionID] =
+	    [[completion copy] autorelease];
+
+	[self sendNextOutgoingEventInRoom: event.roomID];
+}
+
+- (void)sendNextOutgoingEventInRoom: (OFString *)roomID
+{
+	if ([_sendingRooms containsObject: roomID])
+		return;
+
+	OFMutableArray<MTXOutgoingEvent *> *queue = _outgoingEvents[roomID];
+	if (queue.count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+	MTXOutgoingEvent *event = queue.firstObject;
+	OFString *path = [OFString stringWithFormat:
+	    @"/_matrix/client/r0/rooms/%@/send/%@/%@",
+	    roomID, event.type, event.transactionID];
+	MTXRequest *request = [self requestWithPath: path];
+	request.metricsEndpoint =
+	    @"/_matrix/client/r0/rooms/{roomId}/send/{eventType}/{txnId}";
+	request.method = OFHTTPRequestMethodPut;
+	request.body = event.content;
+
+	/*
+	 * Only one event per room is in flight, as events sent over different
+	 * connections could overtake each other.
+	 */
+	[_sendingRooms addObject: roomID];
+
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		[self outgoingEvent: event
+		   sentWithResponse: response
+			 statusCode: statusCode
+			  exception: exception];
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)outgoingEvent: (MTXOutgoingEvent *)event
+     sentWithResponse: (MTXResponse)response
+	   statusCode: (int)statusCode
+	    exception: (id)exception
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFString *roomID = event.roomID;
+
+	/*
+	 * While waiting for a retry, the room stays marked as sending, so that
+	 * later events cannot overtake the event.
+	 */
+	if (exception == nil && statusCode == 429) {
+		OFNumber *retryAfter = response[@"retry_after_ms"];
+		OFTimeInterval delay = 1;
+
+		if ([retryAfter isKindOfClass: OFNumber.class])
+			delay = retryAfter.doubleValue / 1000;
+
+		/*
+		 * The server does not say whether a limit is for the user or
+		 * the room, so only the room waits. Other rooms wait on their
+		 * own once they hit a limit that applies to the user.
+		 */
+		[self performSelector: @selector(retrySendingInRoom:)
+			   withObject: roomID
+			   afterDelay: delay];
+
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	if (exception != nil || statusCode >= 500) {
+		unsigned long long retries =
+		    [_sendRetries[roomID] unsignedLongLongValue];
+
+		if (_maxSendAttempts == 0 || retries + 1 < _maxSendAttempts) {
+			OFTimeInterval delay = (retries < 6
+			    ? (OFTimeInterval)(1 << retries)
+			    : maxSendRetryDelay);
+
+			_sendRetries[roomID] = @(retries + 1);
+			[self performSelector: @selector(retrySendingInRoom:)
+				   withObject: roomID
+				   afterDelay: delay];
+
+			objc_autoreleasePoolPop(pool);
+			return;
+		}
+
+		/* Given up, so the error is reported like a rejection. */
+	}
+
+	[_sendingRooms removeObject: roomID];
+
+	OFMutableArray *queue = _outgoingEvents[roomID];
+	MTXRequestBlock completion =
+	    [[_outgoingBlocks[event.transactionID] retain] autorelease];
+
+	[[event retain] autorelease];
+	[queue removeObjectAtIndex: 0];
+	if (queue.count == 0)
+		[_outgoingEvents removeObjectForKey: roomID];
+	[_outgoingBlocks removeObjectForKey: event.transactionID];
+	[_sendRetries removeObjectForKey: roomID];
+
+	@try {
+		[_storage
+		    removeOutgoingEventWithTransactionID: event.transactionID
+					     forDeviceID: _deviceID];
+	} @catch (id e) {
+		response = nil;
+		statusCode = 0;
+		exception = e;
+	}
+
+	if (completion != nil)
+		completion(response, statusCode, exception);
+
+	[self sendNextOutgoingEventInRoom: roomID];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)retrySendingInRoom: (OFString *)roomID
+{
+	[_sendingRooms removeObject: roomID];
+	[self sendNextOutgoingEventInRoom: roomID];
+}
+
+- (void)setTyping: (bool)typing inRoom: (OFString *)roomID
+{
+	OFNumber *sent = _typingSent[roomID];
+
+	/* Nothing needs to be sent if the server already has that state. */
+	if (typing ? (sent != nil &&
+	    OFDate.date.timeIntervalSince1970 - sent.doubleValue <
+	    typingTimeout / 2) : sent == nil) {
+		[_pendingTyping removeObjectForKey: roomID];
+		return;
+	}
+
+	_pendingTyping[roomID] = @(typing);
+	[self scheduleEphemeralFlush];
+}
+
+- (void)sendReadReceiptForEvent: (OFString *)eventID
+			 inRoom: (OFString *)roomID
+{
+	[self setReadMarker: @"m.read" toEvent: eventID inRoom: roomID];
+}
+
+- (void)setFullyReadMarkerToEvent: (OFString *)eventID
+			   inRoom: (OFString *)roomID
+{
+	[self setReadMarker: @"m.fully_read" toEvent: eventID inRoom: roomID];
+}
+
+- (void)setReadMarker: (OFString *)marker
+	      toEvent: (OFString *)eventID
+	       inRoom: (OFString *)roomID
+{
+	OFMutableDictionary *markers = _pendingReadMarkers[roomID];
+
+	if (markers == nil) {
+		markers = [OFMutableDictionary dictionary];
+		_pendingReadMarkers[roomID] = markers;
+	}
+
+	markers[marker] = eventID;
+	[self scheduleEphemeralFlush];
+}
+
+- (void)scheduleEphemeralFlush
+{
+	if (_ephemeralFlushScheduled)
+		return;
+
+	_ephemeralFlushScheduled = true;
+	[self performSelector: @selector(flushEphemeralTraffic)
+		   afterDelay: _ephemeralFlushInterval];
+}
+
+- (void)flushEphemeralTraffic
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	_ephemeralFlushScheduled = false;
+
+	for (OFString *roomID in _pendingTyping)
+		[self sendTyping: [_pendingTyping[roomID] boolValue]
+			  inRoom: roomID];
+
+	[_pendingTyping removeAllObjects];
+
+	for (OFString *roomID in _pendingReadMarkers.allKeys) {
+		/*
+		 * Markers sent in parallel could overtake each other, so the
+		 * room's markers wait for the next flush.
+		 */
+		if ([_sendingReadMarkerRooms containsObject: roomID])
+			continue;
+
+		[self sendReadMarkers: _pendingReadMarkers[roomID]
+			       inRoom: roomID];
+		[_pendingReadMarkers removeObjectForKey: roomID];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)sendTyping: (bool)typing inRoom: (OFString *)roomID
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request = [self requestWithPath: [OFString
+	    stringWithFormat: @"/_matrix/client/v3/rooms/%@/typing/%@",
+	    roomID, _userID]];
+	OFNumber *sent = nil;
+
+	request.metricsEndpoint =
+	    @"/_matrix/client/v3/rooms/{roomId}/typing/{userId}";
+	request.method = OFHTTPRequestMethodPut;
+
+	OFNumber *stopped = nil;
+
+	if (typing) {
+		unsigned long long timeoutMs = typingTimeout * 1000;
+
+		sent = @(OFDate.date.timeIntervalSince1970);
+		_typingSent[roomID] = sent;
+		request.body = @{
+			@"typing": @true,
+			@"timeout": @(timeoutMs)
+		};
+	} else {
+		stopped = [[_typingSent[roomID] retain] autorelease];
+		[_typingSent removeObjectForKey: roomID];
+		request.body = @{ @"typing": @false };
+	}
+
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		/* Typing again sends it again if this was not sent. */
+		if ((exception != nil || statusCode != 200) &&
+		    sent != nil && _typingSent[roomID] == sent)
+			[_typingSent removeObjectForKey: roomID];
+
+		/*
+		 * A failed stop is sent again, unless the typing has timed
+		 * out on the server by then or the typing state has changed
+		 * in the meantime. The timeout bounds the retries.
+		 */
+		if ((exception != nil || statusCode >= 500) &&
+		    stopped != nil && _typingSent[roomID] == nil &&
+		    _pendingTyping[roomID] == nil &&
+		    OFDate.date.timeIntervalSince1970 - stopped.doubleValue <
+		    typingTimeout) {
+			_typingSent[roomID] = stopped;
+			_pendingTyping[roomID] = @false;
+			[self scheduleEphemeralFlush];
+		}
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)sendReadMarkers: (OFDictionary<OFString *, OFString *> *)markers
+		 inRoom: (OFString *)roomID
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request = [self requestWithPath: [OFString
+	    stringWithFormat: @"/_matrix/client/v3/rooms/%@/read_markers",
+	    roomID]];
+
+	request.metricsEndpoint =
+	    @"/_matrix/client/v3/rooms/{roomId}/read_markers";
+	request.method = OFHTTPRequestMethodPost;
+	request.body = markers;
+
+	[_sendingReadMarkerRooms addObject: roomID];
+
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		OFMutableDictionary *pending = _pendingReadMarkers[roomID];
+
+		[_sendingReadMarkerRooms removeObject: roomID];
+
+		/*
+		 * Markers that failed to send and have not been replaced are
+		 * sent again with the next flush. No flush is scheduled for
+		 * them, so that they are not retried in a loop while offline.
+		 */
+		if (exception != nil || statusCode >= 500) {
+			if (pending == nil) {
+				pending = [OFMutableDictionary dictionary];
+				_pendingReadMarkers[roomID] = pending;
+			}
+
+			for (OFString *marker in markers)
+				if (pending[marker] == nil)
+					pending[marker] = markers[marker];
+		} else if (pending != nil)
+			[self scheduleEphemeralFlush];
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFArray<OFString *> *)typingUsersInRoom: (OFString *)roomID
+{
+	OFArray<OFString *> *userIDs = _typingUsers[roomID];
+
+	return (userIDs != nil ? userIDs : [OFArray array]);
+}
+
+- (OFString *)readReceiptOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	return _readReceipts[roomID][userID];
+}
+
+- (void)uploadMediaFromStream: (OFStream *)stream
+		       length: (unsigned long long)length
+		  contentType: (OFString *)contentType
+		     fileName: (OFString *)fileName
+			block: (MTXClientUploadBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXRequest *request =
+	    [self requestWithPath: @"/_matrix/media/v3/upload"];
+	request.method = OFHTTPRequestMethodPost;
+	request.bodyStream = stream;
+	request.bodyStreamLength = length;
+	request.headers = @{ @"Content-Type": contentType };
+
+	if (fileName != nil)
+		request.queryItems = @[
+			[OFPair pairWithFirstObject: @"filename"
+				       secondObject: fileName]
+		];
+
+	[request performWithBlock: ^ (MTXResponse response, int statusCode,
+				       id exception) {
+		if (exception != nil) {
+			block(nil, exception);
+			return;
+		}
+
+		if (statusCode != 200) {
+			block(nil, [MTXUploadMediaFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self]);
+			return;
+		}
+
+		OFString *contentURI = response[@"content_uri"];
+		if (![contentURI isKindOfClass: OFString.class]) {
 			block(nil,
 			    [OFInvalidServerResponseException exception]);
 			return;
 		}
 
-		block(roomID, nil);
-	}];
+		block(contentURI, nil);
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)uploadFileAtIRI: (OFIRI *)IRI
+	    contentType: (OFString *)contentType
+		  block: (MTXClientUploadBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFFile *file;
+	unsigned long long length;
+
+	@try {
+		length = [OFFileManager.defaultManager
+		    attributesOfItemAtIRI: IRI].fileSize;
+		file = [OFFile fileWithPath: IRI.fileSystemRepresentation
+				       mode: @"r"];
+	} @catch (id e) {
+		block(nil, e);
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	[self uploadMediaFromStream: file
+			     length: length
+			contentType: contentType
+			   fileName: IRI.lastPathComponent
+			      block: block];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)downloadMediaWithURI: (OFString *)contentURI
+		    toStream: (OFStream *)stream
+		       block: (MTXClientResponseBlock)block
+{
+	[self downloadMediaWithURI: contentURI
+			    offset: 0
+			    length: ULLONG_MAX
+			  toStream: stream
+			     block: block];
+}
+
+- (void)downloadMediaWithURI: (OFString *)contentURI
+		      offset: (unsigned long long)offset
+		      length: (unsigned long long)length
+		    toStream: (OFStream *)stream
+		       block: (MTXClientResponseBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFString *serverName, *mediaID;
+
+	@try {
+		parseContentURI(contentURI, &serverName, &mediaID);
+	} @catch (id e) {
+		block(e);
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	[self downloadFromPath: [OFString stringWithFormat:
+				    @"/_matrix/client/v1/media/download/%@/%@",
+				    serverName, mediaID]
+		    queryItems: nil
+	       metricsEndpoint: @"/_matrix/client/v1/media/download"
+		    contentURI: contentURI
+		      cacheKey: contentURI
+			offset: offset
+			length: length
+		      toStream: stream
+			 block: block];
 
 	objc_autoreleasePoolPop(pool);
 }
 
-- (void)leaveRoom: (OFString *)roomID block: (MTXClientResponseBlock)block
+- (void)downloadThumbnailWithURI: (OFString *)contentURI
+			   width: (size_t)width
+			  height: (size_t)height
+			  method: (OFString *)method
+			toStream: (OFStream *)stream
+			   block: (MTXClientResponseBlock)block
 {
 	void *pool = objc_autoreleasePoolPush();
-	MTXRequest *request = [self requestWithPath: [OFString
-	    stringWithFormat: @"/_matrix/client/r0/rooms/%@/leave", roomID]];
-	request.method = OFHTTPRequestMethodPost;
-	[request performWithBlock: ^ (MTXResponse response, int statusCode,
-				       id exception) {
-		if (exception != nil) {
-			block(exception);
-			return;
+	OFString *serverName, *mediaID;
+
+	@try {
+		parseContentURI(contentURI, &serverName, &mediaID);
+	} @catch (id e) {
+		block(e);
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	OFMutableArray *queryItems = [OFMutableArray arrayWithObjects:
+	    [OFPair pairWithFirstObject: @"width"
+			   secondObject: @(width).stringValue],
+	    [OFPair pairWithFirstObject: @"height"
+			   secondObject: @(height).stringValue], nil];
+	if (method != nil)
+		[queryItems addObject:
+		    [OFPair pairWithFirstObject: @"method"
+				   secondObject: method]];
+
+	/* A fragment, as it can never be part of an mxc:// URI. */
+	OFString *cacheKey = [OFString stringWithFormat:
+	    @"%@#thumbnail=%zux%zu,%@", contentURI, width, height,
+	    (method != nil ? method : @"")];
+
+	[self downloadFromPath: [OFString stringWithFormat:
+				    @"/_matrix/client/v1/media/thumbnail/%@/%@",
+				    serverName, mediaID]
+		    queryItems: queryItems
+	       metricsEndpoint: @"/_matrix/client/v1/media/thumbnail"
+		    contentURI: contentURI
+		      cacheKey: cacheKey
+			offset: 0
+			length: ULLONG_MAX
+		      toStream: stream
+			 block: block];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)downloadFromPath: (OFString *)path
+	      queryItems: (OFArray *)queryItems
+	 metricsEndpoint: (OFString *)metricsEndpoint
+	      contentURI: (OFString *)contentURI
+		cacheKey: (OFString *)cacheKey
+		  offset: (unsigned long long)offset
+		  length: (unsigned long long)length
+		toStream: (OFStream *)stream
+		   block: (MTXClientResponseBlock)block
+{
+	bool ranged = (offset != 0 || length != ULLONG_MAX);
+	OFIRI *cachedIRI;
+
+	if (length == 0) {
+		block(nil);
+		return;
+	}
+
+	@try {
+		if ((cachedIRI = [_mediaCache IRIForKey: cacheKey]) != nil) {
+			OFFile *file = [OFFile
+			    fileWithPath: cachedIRI.fileSystemRepresentation
+				    mode: @"r"];
+
+			if (offset > 0)
+				[file seekToOffset: (OFStreamOffset)offset
+					    whence: OFSeekSet];
+
+			copyMedia(file, stream, nil, 0, length);
+			[file close];
 		}
+	} @catch (id e) {
+		block(e);
+		return;
+	}
 
-		if (statusCode != 200) {
-			block([MTXLeaveRoomFailedException
-			    exceptionWithRoomID: roomID
-				     statusCode: statusCode
-				       response: response
-					 client: self]);
+	if (cachedIRI != nil) {
+		block(nil);
+		return;
+	}
+
+	MTXRequest *request = [self requestWithPath: path];
+	/* Media is usually compressed already and ranges refer to the media. */
+	request.acceptsCompressedResponses = false;
+	request.queryItems = queryItems;
+	request.metricsEndpoint = metricsEndpoint;
+
+	if (ranged)
+		request.headers = @{
+			@"Range": (length > ULLONG_MAX - offset
+			    ? [OFString stringWithFormat: @"bytes=%llu-",
+			    offset]
+			    : [OFString stringWithFormat: @"bytes=%llu-%llu",
+			    offset, offset + length - 1])
+		};
+
+	__block MTXMediaCacheWriter *writer = nil;
+
+	[request performWithStreamBlock: ^ (OFStream *body) {
+		/* Only the whole media is cached, not a part of it. */
+		if ([request.responseHeaders[@"Content-Range"] length] > 0) {
+			copyMedia(body, stream, nil, 0, ULLONG_MAX);
 			return;
 		}
 
-		block(nil);
+		writer = [[_mediaCache writer] retain];
+		copyMedia(body, stream, writer, offset, length);
+	} block: ^ (MTXResponse response, int statusCode, id exception) {
+		if (exception == nil && statusCode != 200 && statusCode != 206)
+			exception = [MTXDownloadMediaFailedException
+			    exceptionWithContentURI: contentURI
+					 statusCode: statusCode
+					   response: response
+					     client: self];
+
+		@try {
+			if (exception == nil)
+				[writer commitForKey: cacheKey];
+			else
+				[writer discard];
+		} @catch (id e) {
+			/* The media was downloaded, only caching failed. */
+		}
+
+		[writer release];
+		writer = nil;
+
+		block(exception);
 	}];
+}
+
+- (MTXEventSubscription *)
+    subscribeToEventsWithType: (OFString *)type
+		       roomID: (OFString *)roomID
+			block: (MTXEventBlock)block
+{
+	MTXEventSubscription *subscription =
+	    [MTXEventSubscription subscriptionWithType: type
+						roomID: roomID
+						 block: block];
+	id typeKey = (type != nil ? subscription.type : [OFNull null]);
+	id roomKey = (roomID != nil ? subscription.roomID : [OFNull null]);
+	OFMutableDictionary *subscriptionsByRoom = _subscriptions[typeKey];
+
+	if (subscriptionsByRoom == nil) {
+		subscriptionsByRoom = [OFMutableDictionary dictionary];
+		_subscriptions[typeKey] = subscriptionsByRoom;
+	}
+
+	OFMutableArray *subscriptions = subscriptionsByRoom[roomKey];
+
+	if (subscriptions == nil) {
+		subscriptions = [OFMutableArray array];
+		subscriptionsByRoom[roomKey] = subscriptions;
+	}
+
+	[subscriptions addObject: subscription];
+
+	/*
+	 * Events might be waiting in the to-device inbox for a subscription.
+	 * They are delivered later, as the caller does not have the
+	 * subscription yet.
+	 */
+	if (roomID == nil) {
+		_toDeviceEventsPending = true;
+		[self performSelector: @selector(deliverToDeviceEvents)
+			   afterDelay: 0];
+	}
+
+	return subscription;
+}
+
+- (void)trackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+{
+	[_storage trackDeviceListsOfUsers: userIDs forDeviceID: _deviceID];
+}
+
+- (OFDictionary<OFString *, OFDictionary *> *)devicesOfUser:
+    (OFString *)userID
+{
+	return [_storage devicesOfUser: userID forDeviceID: _deviceID];
+}
+
+- (void)updateDeviceListsWithBlock: (MTXClientResponseBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableArray<OFString *> *userIDs = [OFMutableArray array];
+
+	for (OFString *userID in
+	    [_storage usersWithOutdatedDeviceListsForDeviceID: _deviceID])
+		if (![_queriedDeviceListUsers containsObject: userID])
+			[userIDs addObject: userID];
+
+	size_t count = userIDs.count;
+
+	if (count == 0) {
+		objc_autoreleasePoolPop(pool);
+		block(nil);
+		return;
+	}
+
+	__block size_t pendingBatches =
+	    (count + deviceListQueryBatchSize - 1) / deviceListQueryBatchSize;
+	__block id firstException = nil;
+
+	for (size_t i = 0; i < count; i += deviceListQueryBatchSize) {
+		size_t length = count - i;
+
+		if (length > deviceListQueryBatchSize)
+			length = deviceListQueryBatchSize;
+
+		[self queryDeviceListsOfUsers: [userIDs
+		    objectsInRange: OFMakeRange(i, length)]
+					block: ^ (id exception) {
+			if (exception != nil && firstException == nil)
+				firstException = [exception retain];
+
+			if (--pendingBatches == 0)
+				block([firstException autorelease]);
+		}];
+	}
 
 	objc_autoreleasePoolPop(pool);
 }
 
-- (void)sendMessage: (OFString *)message
-	     roomID: (OFString *)roomID
-	      block: (MTXClientResponseBlock)block
+- (void)queryDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+			  block: (MTXClientResponseBlock)block
 {
 	void *pool = objc_autoreleasePoolPush();
-	OFString *path = [OFString stringWithFormat:
-	    @"/_matrix/client/r0/rooms/%@/send/m.room.message", roomID];
-	MTXRequest *request = [self requestWithPath: path];
+	MTXRequest *request =
+	    [self requestWithPath: @"/_matrix/client/v3/keys/query"];
+	OFMutableDictionary *deviceKeys =
+	    [OFMutableDictionary dictionaryWithCapacity: userIDs.count];
+
+	for (OFString *userID in userIDs) {
+		deviceKeys[userID] = @[];
+		[_queriedDeviceListUsers addObject: userID];
+	}
+
 	request.method = OFHTTPRequestMethodPost;
-	request.body = @{
-		@"msgtype": @"m.text",
-		@"body": message
-	};
+	request.body = @{ @"device_keys": deviceKeys };
 	[request performWithBlock: ^ (MTXResponse response, int statusCode,
 				       id exception) {
-		if (exception != nil) {
-			block(exception);
-			return;
-		}
+		OFDictionary *devicesByUser = response[@"device_keys"];
 
-		if (statusCode != 200) {
-			block([MTXSendMessageFailedException
-			    exceptionWithMessage: message
-					  roomID: roomID
-				      statusCode: statusCode
-					response: response
-					  client: self]);
-			return;
+		if (exception == nil && statusCode != 200)
+			exception = [MTXQueryKeysFailedException
+			    exceptionWithStatusCode: statusCode
+					   response: response
+					     client: self];
+
+		if (exception == nil &&
+		    ![devicesByUser isKindOfClass: OFDictionary.class])
+			exception =
+			    [OFInvalidServerResponseException exception];
+
+		@try {
+			if (exception == nil)
+				[self storeDevices: devicesByUser
+					  ofUsers: userIDs];
+		} @catch (id e) {
+			exception = e;
+		} @finally {
+			for (OFString *userID in userIDs) {
+				[_queriedDeviceListUsers removeObject: userID];
+				[_changedDeviceListUsers removeObject: userID];
+			}
 		}
 
-		block(nil);
+		block(exception);
 	}];
 
 	objc_autoreleasePoolPop(pool);
 }
 
+- (void)storeDevices: (OFDictionary<OFString *, id> *)devicesByUser
+	     ofUsers: (OFArray<OFString *> *)userIDs
+{
+	[self storageTransactionWithBlock: ^ {
+		for (OFString *userID in userIDs) {
+			OFDictionary *devices = devicesByUser[userID];
+
+			/*
+			 * Users the server failed to query and users whose
+			 * devices changed in the meantime stay outdated.
+			 */
+			if (![devices isKindOfClass: OFDictionary.class] ||
+			    [_changedDeviceListUsers containsObject: userID])
+				continue;
+
+			[_storage setDevices: devices
+				      ofUser: userID
+				 forDeviceID: _deviceID];
+		}
+
+		return true;
+	} syncPhases: false];
+}
+
+- (void)unsubscribe: (MTXEventSubscription *)subscription
+{
+	id typeKey = (subscription.type != nil
+	    ? subscription.type : [OFNull null]);
+	id roomKey = (subscription.roomID != nil
+	    ? subscription.roomID : [OFNull null]);
+	OFMutableDictionary *subscriptionsByRoom = _subscriptions[typeKey];
+	OFMutableArray *subscriptions = subscriptionsByRoom[roomKey];
+
+	[subscriptions removeObjectIdenticalTo: subscription];
+
+	if (subscriptions.count == 0)
+		[subscriptionsByRoom removeObjectForKey: roomKey];
+
+	if (subscriptionsByRoom.count == 0)
+		[_subscriptions removeObjectForKey: typeKey];
+}
+
+- (void)dispatchEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		source: (MTXEventSource)source
+		roomID: (OFString *)roomID
+{
+	if (_subscriptions.count == 0 || ![events isKindOfClass: OFArray.class])
+		return;
+
+	OFDictionary *subscriptionsForAllTypes = _subscriptions[[OFNull null]];
+
+	for (OFDictionary *event in events) {
+		if (![event isKindOfClass: OFDictionary.class])
+			continue;
+
+		/*
+		 * Only the type is needed to find the subscriptions, which for
+		 * an MTXEvent is the only field that gets decoded.
+		 */
+		OFString *type = event[@"type"];
+		if (![type isKindOfClass: OFString.class])
+			continue;
+
+		OFMutableArray *matches = addMatchingSubscriptions(nil,
+		    _subscriptions[type], roomID);
+		matches = addMatchingSubscriptions(matches,
+		    subscriptionsForAllTypes, roomID);
+
+		if (matches != nil)
+			[_pendingDispatches addObject: @[
+				event,
+				@(source),
+				(roomID != nil ? roomID : [OFNull null]),
+				matches
+			]];
+	}
+}
+
+- (void)dispatchEventsInSection: (OFDictionary<OFString *, id> *)section
+			 source: (MTXEventSource)source
+			 roomID: (OFString *)roomID
+{
+	if (_subscriptions.count == 0 ||
+	    ![section isKindOfClass: OFDictionary.class])
+		return;
+
+	[self dispatchEvents: section[@"events"] source: source roomID: roomID];
+}
+
+- (void)performPendingDispatches
+{
+	if (_pendingDispatches.count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+	/* A block might start another transaction that adds dispatches. */
+	OFArray *dispatches = [[_pendingDispatches copy] autorelease];
+
+	[_pendingDispatches removeAllObjects];
+
+	for (OFArray *dispatch in dispatches) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFDictionary *event = [dispatch objectAtIndex: 0];
+		MTXEventSource source = [[dispatch objectAtIndex: 1] intValue];
+		OFString *roomID = [dispatch objectAtIndex: 2];
+
+		if ([roomID isEqual: [OFNull null]])
+			roomID = nil;
+
+		for (MTXEventSubscription *subscription in
+		    [dispatch objectAtIndex: 3])
+			subscription.block(source, roomID, event);
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
 - (void)processRoomsSync: (OFDictionary<OFString *, id> *)rooms
 {
+	if (rooms == nil || rooms == (id)[OFNull null])
+		return;
+	if (![rooms isKindOfClass: OFDictionary.class])
+		@throw [OFInvalidServerResponseException exception];
+
 	[self processJoinedRooms: rooms[@"join"]];
 	[self processInvitedRooms: rooms[@"invite"]];
 	[self processLeftRooms: rooms[@"leave"]];
@@ -459,14 +3031,268 @@ validateHomeserver(OFIRI *homeserver)
 
 - (void)processPresenceSync: (OFDictionary<OFString *, id> *)presence
 {
+	[self dispatchEventsInSection: presence
+			       source: MTXEventSourcePresence
+			       roomID: nil];
 }
 
 - (void)processAccountDataSync: (OFDictionary<OFString *, id> *)accountData
 {
+	[self dispatchEventsInSection: accountData
+			       source: MTXEventSourceAccountData
+			       roomID: nil];
+}
+
+- (void)processEphemeralSync: (OFDictionary<OFString *, id> *)ephemeral
+		      roomID: (OFString *)roomID
+{
+	if (![ephemeral isKindOfClass: OFDictionary.class])
+		return;
+
+	OFArray<OFDictionary<OFString *, id> *> *events = ephemeral[@"events"];
+	if (![events isKindOfClass: OFArray.class])
+		return;
+
+	for (OFDictionary<OFString *, id> *event in events) {
+		if (![event isKindOfClass: OFDictionary.class])
+			continue;
+
+		OFString *type = event[@"type"];
+		OFDictionary<OFString *, id> *content = event[@"content"];
+		if (![type isKindOfClass: OFString.class] ||
+		    ![content isKindOfClass: OFDictionary.class])
+			continue;
+
+		if ([type isEqual: @"m.typing"])
+			[self applyTypingContent: content roomID: roomID];
+		else if ([type isEqual: @"m.receipt"])
+			[self applyReceiptContent: content roomID: roomID];
+	}
+
+	[self dispatchEvents: events
+		      source: MTXEventSourceEphemeral
+		      roomID: roomID];
+}
+
+- (void)applyTypingContent: (OFDictionary<OFString *, id> *)content
+		    roomID: (OFString *)roomID
+{
+	OFArray<OFString *> *userIDs = content[@"user_ids"];
+	if (![userIDs isKindOfClass: OFArray.class])
+		return;
+
+	for (id userID in userIDs)
+		if (![userID isKindOfClass: OFString.class])
+			return;
+
+	/* An empty array removes the room once applied. */
+	_stagedTypingUsers[roomID] = userIDs;
+}
+
+- (void)applyReceiptContent: (OFDictionary<OFString *, id> *)content
+		     roomID: (OFString *)roomID
+{
+	OFMutableDictionary<OFString *, OFString *> *receipts =
+	    _stagedReadReceipts[roomID];
+
+	for (OFString *eventID in content) {
+		OFDictionary *receiptsByType = content[eventID];
+		if (![receiptsByType isKindOfClass: OFDictionary.class])
+			continue;
+
+		for (OFString *receiptType in
+		    @[ @"m.read", @"m.read.private" ]) {
+			OFDictionary *receiptsByUser =
+			    receiptsByType[receiptType];
+			if (![receiptsByUser isKindOfClass: OFDictionary.class])
+				continue;
+
+			for (OFString *userID in receiptsByUser) {
+				OFDictionary *receipt = receiptsByUser[userID];
+				OFString *threadID;
+
+				if (![receipt isKindOfClass:
+				    OFDictionary.class])
+					continue;
+
+				/* Receipts in threads are not for the room. */
+				threadID = receipt[@"thread_id"];
+				if (threadID != nil &&
+				    ![threadID isEqual: @"main"])
+					continue;
+
+				if (receipts == nil) {
+					receipts =
+					    [OFMutableDictionary dictionary];
+					_stagedReadReceipts[roomID] = receipts;
+				}
+
+				receipts[userID] = eventID;
+			}
+		}
+	}
+}
+
+/*
+ * Applies the typing notifications and read receipts of a committed
+ * transaction, so that those of a rolled back one are received again instead.
+ */
+- (void)applyStagedEphemeralState
+{
+	for (OFString *roomID in _stagedTypingUsers) {
+		OFArray<OFString *> *userIDs = _stagedTypingUsers[roomID];
+
+		if (userIDs.count > 0)
+			_typingUsers[roomID] = userIDs;
+		else
+			[_typingUsers removeObjectForKey: roomID];
+	}
+
+	for (OFString *roomID in _stagedReadReceipts) {
+		OFMutableDictionary<OFString *, OFString *> *receipts =
+		    _readReceipts[roomID];
+
+		if (receipts == nil) {
+			receipts = [OFMutableDictionary dictionary];
+			_readReceipts[roomID] = receipts;
+		}
+
+		[receipts addEntriesFromDictionary:
+		    _stagedReadReceipts[roomID]];
+	}
+
+	[_stagedTypingUsers removeAllObjects];
+	[_stagedReadReceipts removeAllObjects];
+}
+
+- (void)processDeviceListsSync: (OFDictionary<OFString *, id> *)deviceLists
+{
+	/* Like presence and account data, malformed entries are skipped. */
+	if (![deviceLists isKindOfClass: OFDictionary.class])
+		return;
+
+	OFArray<OFString *> *changed = stringsInArray(deviceLists[@"changed"]);
+	OFArray<OFString *> *left = stringsInArray(deviceLists[@"left"]);
+
+	[_storage markDeviceListsOutdatedOfUsers: changed
+				     forDeviceID: _deviceID];
+	[_storage untrackDeviceListsOfUsers: left forDeviceID: _deviceID];
+
+	/* A query in flight must not mark these as up to date. */
+	for (OFString *userID in changed)
+		if ([_queriedDeviceListUsers containsObject: userID])
+			[_changedDeviceListUsers addObject: userID];
 }
 
 - (void)processToDeviceSync: (OFDictionary<OFString *, id> *)toDevice
 {
+	if (![toDevice isKindOfClass: OFDictionary.class])
+		return;
+
+	OFArray<OFDictionary<OFString *, id> *> *events = toDevice[@"events"];
+	if (![events isKindOfClass: OFArray.class])
+		return;
+
+	OFMutableArray *validEvents =
+	    [OFMutableArray arrayWithCapacity: events.count];
+
+	for (OFDictionary<OFString *, id> *event in events)
+		if ([event isKindOfClass: OFDictionary.class] &&
+		    [event[@"type"] isKindOfClass: OFString.class])
+			[validEvents addObject: event];
+
+	if (validEvents.count == 0)
+		return;
+
+	/*
+	 * The events are added to the inbox in the same transaction that
+	 * stores the next batch, so that they are neither lost nor received
+	 * twice. They are delivered once the transaction has been committed.
+	 */
+	[_storage addToDeviceEvents: validEvents forDeviceID: _deviceID];
+	_toDeviceEventsPending = true;
+}
+
+/* Whether any subscription is for events that do not belong to a room. */
+- (bool)hasToDeviceSubscriptions
+{
+	for (OFDictionary *subscriptionsByRoom in
+	    _subscriptions.objectEnumerator)
+		if ([subscriptionsByRoom[[OFNull null]] count] > 0)
+			return true;
+
+	return false;
+}
+
+/*
+ * Delivers the events in the to-device inbox in the order they were received
+ * and removes them from the inbox afterwards. An event is only delivered again
+ * if a subscription threw or the process died before its removal was written.
+ *
+ * Delivery stops at the first event that no subscription matches. That event
+ * and all after it stay in the inbox until a matching subscription is added,
+ * so that events received before the application subscribed are not lost and
+ * are still delivered in order.
+ */
+- (void)deliverToDeviceEvents
+{
+	/* A block might commit a transaction that receives more events. */
+	if (_deliveringToDeviceEvents)
+		return;
+
+	_deliveringToDeviceEvents = true;
+	@try {
+		while (_toDeviceEventsPending &&
+		    [self hasToDeviceSubscriptions]) {
+			void *pool = objc_autoreleasePoolPush();
+			OFArray<OFDictionary<OFString *, id> *> *events =
+			    [_storage toDeviceEventsForDeviceID: _deviceID];
+			OFDictionary *subscriptionsForAllTypes =
+			    _subscriptions[[OFNull null]];
+			size_t delivered = 0;
+			bool unmatched = false;
+
+			_toDeviceEventsPending = false;
+
+			@try {
+				for (OFDictionary *event in events) {
+					OFMutableArray *matches =
+					    addMatchingSubscriptions(nil,
+					    _subscriptions[event[@"type"]],
+					    nil);
+					matches = addMatchingSubscriptions(
+					    matches, subscriptionsForAllTypes,
+					    nil);
+
+					if (matches.count == 0) {
+						unmatched = true;
+						break;
+					}
+
+					for (MTXEventSubscription *subscription
+					    in matches)
+						subscription.block(
+						    MTXEventSourceToDevice,
+						    nil, event);
+
+					delivered++;
+				}
+			} @finally {
+				[_storage removeFirstToDeviceEvents: delivered
+							forDeviceID: _deviceID];
+			}
+
+			objc_autoreleasePoolPop(pool);
+
+			/* Subscribing delivers the rest. */
+			if (unmatched) {
+				_toDeviceEventsPending = true;
+				break;
+			}
+		}
+	} @finally {
+		_deliveringToDeviceEvents = false;
+	}
 }
 
 - (void)processJoinedRooms: (OFDictionary<OFString *, id> *)rooms
@@ -474,14 +3300,37 @@ validateHomeserver(OFIRI *homeserver)
 	if (rooms == nil)
 		return;
 
+	[_storage addJoinedRooms: rooms.allKeys forUser: _userID];
+	[self storeStateAndTimelinesOfRooms: rooms];
+
 	for (OFString *roomID in rooms)
-		[_storage addJoinedRoom: roomID forUser: _userID];
+		[_joinedSummaryRoomIDs addObject: roomID];
 }
 
 - (void)processInvitedRooms: (OFDictionary<OFString *, id> *)rooms
 {
 	if (rooms == nil)
 		return;
+
+	for (OFString *roomID in rooms) {
+		void *pool = objc_autoreleasePoolPush();
+		OFDictionary<OFString *, id> *room = rooms[roomID];
+
+		if (![room isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidServerResponseException exception];
+
+		OFDictionary<OFString *, id> *inviteState =
+		    room[@"invite_state"];
+		if ([inviteState isKindOfClass: OFDictionary.class]) {
+			[self applyStateEvents: inviteState[@"events"]
+					toRoom: roomID];
+			[self dispatchEvents: inviteState[@"events"]
+				      source: MTXEventSourceInviteState
+				      roomID: roomID];
+		}
+
+		objc_autoreleasePoolPop(pool);
+	}
 }
 
 - (void)processLeftRooms: (OFDictionary<OFString *, id> *)rooms
@@ -489,7 +3338,91 @@ validateHomeserver(OFIRI *homeserver)
 	if (rooms == nil)
 		return;
 
+	[_storage removeJoinedRooms: rooms.allKeys forUser: _userID];
+	[self storeStateAndTimelinesOfRooms: rooms];
+
 	for (OFString *roomID in rooms)
-		[_storage removeJoinedRoom: roomID forUser: _userID];
+		[_leftSummaryRoomIDs addObject: roomID];
+}
+
+- (void)storeStateAndTimelinesOfRooms: (OFDictionary<OFString *, id> *)rooms
+{
+	for (OFString *roomID in rooms) {
+		void *pool = objc_autoreleasePoolPush();
+		OFDictionary<OFString *, id> *room = rooms[roomID];
+
+		if (![room isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidServerResponseException exception];
+
+		/*
+		 * The state section is the state at the start of the timeline,
+		 * state events in the timeline are applied on top of it.
+		 */
+		OFDictionary<OFString *, id> *state = room[@"state"];
+		if ([state isKindOfClass: OFDictionary.class]) {
+			[self applyStateEvents: state[@"events"]
+					toRoom: roomID];
+			[self dispatchEvents: state[@"events"]
+				      source: MTXEventSourceState
+				      roomID: roomID];
+		}
+
+		[self processEphemeralSync: room[@"ephemeral"] roomID: roomID];
+		[self dispatchEventsInSection: room[@"account_data"]
+				       source: MTXEventSourceRoomAccountData
+				       roomID: roomID];
+
+		OFDictionary<OFString *, id> *timeline = room[@"timeline"];
+		if (timeline == nil) {
+			objc_autoreleasePoolPop(pool);
+			continue;
+		}
+		if (![timeline isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidServerResponseException exception];
+
+		OFArray<OFDictionary<OFString *, id> *> *events =
+		    timeline[@"events"];
+		if (![events isKindOfClass: OFArray.class])
+			@throw [OFInvalidServerResponseException exception];
+		for (OFDictionary *event in events)
+			if (![event isKindOfClass: OFDictionary.class])
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+		OFString *prevBatch = timeline[@"prev_batch"];
+		if (![prevBatch isKindOfClass: OFString.class])
+			prevBatch = nil;
+
+		OFNumber *limited = timeline[@"limited"];
+		if (![limited isKindOfClass: OFNumber.class])
+			limited = nil;
+
+		[_storage appendTimelineEvents: events
+					toRoom: roomID
+				     prevBatch: prevBatch
+				       limited: limited.boolValue];
+		[self applyStateEvents: events toRoom: roomID];
+		[self dispatchEvents: events
+			      source: MTXEventSourceTimeline
+			      roomID: roomID];
+
+		objc_autoreleasePoolPop(pool);
+	}
+}
+
+- (void)applyStateEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		  toRoom: (OFString *)roomID
+{
+	if (events == nil)
+		return;
+
+	if (![events isKindOfClass: OFArray.class])
+		@throw [OFInvalidServerResponseException exception];
+
+	for (OFDictionary *event in events)
+		if (![event isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidServerResponseException exception];
+
+	[_storage applyStateEvents: events toRoom: roomID];
 }
 @end
@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+#import "MTXClient.h"
+#import "MTXStorage.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A block returning a new storage for an account of an
+ *	  @ref MTXClientManager.
+ *
+ * The block is called on the thread that is going to use the storage, once for
+ * every user that a client is added for.
+ *
+ * @param userID The user ID of the account
+ * @return The storage to use for the clients of the account
+ */
+typedef id <MTXStorage> _Nonnull (^MTXClientManagerStorageBlock)(
+    OFString *userID);
+
+/**
+ * @brief A manager to run many clients in one process.
+ *
+ * All clients of a manager share, per homeserver, one connection pool for
+ * requests and one for the long-polling sync requests, so that the overhead per
+ * client is only the client and its storage.
+ *
+ * Every account has its own storage, which is created by the storage block
+ * when the first client of the account is added and shared by all clients of
+ * the account. Accounts cannot share a storage, as the timelines and the state
+ * of rooms are stored per room, while they differ between accounts.
+ *
+ * By default, all clients run on the run loop of the thread that created the
+ * manager. Optionally, the clients can be distributed over several threads,
+ * each with its own run loop and connection pools. In this case, each client
+ * is assigned to a thread by its user ID and must only be used on that thread
+ * once its sync loop has been started.
+ */
+@interface MTXClientManager: OFObject
+/**
+ * @brief The number of threads the clients are distributed over, or 0 if the
+ *	  clients run on the run loop of the thread that created the manager.
+ */
+@property (readonly, nonatomic) size_t numberOfThreads;
+
+/**
+ * @brief The maximum number of connections to a homeserver for requests other
+ *	  than sync, per thread.
+ *
+ * This only applies to homeservers for which no client has been added yet.
+ *
+ * Defaults to 8.
+ */
+@property (nonatomic) size_t maxConnectionsPerHomeserver;
+
+/**
+ * @brief The maximum number of concurrent sync requests to a homeserver, per
+ *	  thread.
+ *
+ * If this many sync requests are waiting for a response, the sync requests of
+ * other clients are queued and sent in the order they were made, so that every
+ * client gets its turn. 0 means unlimited.
+ *
+ * This only applies to homeservers for which no client has been added yet.
+ *
+ * Defaults to 0.
+ */
+@property (nonatomic) size_t maxSyncConnectionsPerHomeserver;
+
+/**
+ * @brief Creates a new manager which runs all clients on the run loop of the
+ *	  current thread.
+ *
+ * @param storageBlock A block that is called to create the storage for each
+ *		       account
+ * @return An autoreleased MTXClientManager
+ */
++ (instancetype)managerWithStorageBlock:
+    (MTXClientManagerStorageBlock)storageBlock;
+
+/**
+ * @brief Creates a new manager which distributes the clients over the
+ *	  specified number of threads.
+ *
+ * @param numberOfThreads The number of threads to distribute the clients over
+ * @param storageBlock A block that is called on the thread of an account to
+ *		       create the storage for the account
+ * @return An autoreleased MTXClientManager
+ */
++ (instancetype)
+    managerWithNumberOfThreads: (size_t)numberOfThreads
+		  storageBlock: (MTXClientManagerStorageBlock)storageBlock;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated manager to run all clients on the
+ *	  run loop of the current thread.
+ *
+ * @param storageBlock A block that is called to create the storage for each
+ *		       account
+ * @return An initialized MTXClientManager
+ */
+- (instancetype)initWithStorageBlock:
+    (MTXClientManagerStorageBlock)storageBlock OF_DESIGNATED_INITIALIZER;
+
+/**
+ * @brief Initializes an already allocated manager to distribute the clients
+ *	  over the specified number of threads.
+ *
+ * @param numberOfThreads The number of threads to distribute the clients over
+ * @param storageBlock A block that is called on the thread of an account to
+ *		       create the storage for the account
+ * @return An initialized MTXClientManager
+ */
+- (instancetype)
+    initWithNumberOfThreads: (size_t)numberOfThreads
+	       storageBlock: (MTXClientManagerStorageBlock)storageBlock
+    OF_DESIGNATED_INITIALIZER;
+
+/**
+ * @brief Creates a new client with the specified access token on the specified
+ *	  homeserver and adds it to the manager.
+ *
+ * @param userID The user ID for the client
+ * @param deviceID The device ID for the client
+ * @param accessToken The access token for the client
+ * @param homeserver The IRI of the homeserver
+ * @return The new client
+ * @throw OFInvalidArgumentException The storage block returned a storage that
+ *				     is already used by another account
+ */
+- (MTXClient *)addClientWithUserID: (OFString *)userID
+			  deviceID: (OFString *)deviceID
+		       accessToken: (OFString *)accessToken
+			homeserver: (OFIRI *)homeserver;
+
+/**
+ * @brief Stops the sync loop of the specified client and removes it from the
+ *	  manager.
+ *
+ * @param client The client to remove
+ */
+- (void)removeClient: (MTXClient *)client;
+
+/**
+ * @brief Starts the sync loops of all clients.
+ */
+- (void)startSyncLoops;
+
+/**
+ * @brief Stops the sync loops of all clients.
+ */
+- (void)stopSyncLoops;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,421 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXClientManager.h"
+#import "MTXConnectionPool.h"
+
+/*
+ * The clients of one thread, together with their storages and connection pools.
+ * All methods are only called on the thread of the shard.
+ */
+@interface MTXClientManagerShard: OFObject
+{
+	OFThread *_thread;
+	MTXClientManagerStorageBlock _storageBlock;
+	OFMutableDictionary<OFString *, id <MTXStorage>> *_storages;
+	OFMutableDictionary<OFString *, MTXConnectionPool *> *_connectionPools;
+	OFMutableDictionary<OFString *, MTXConnectionPool *>
+	    *_syncConnectionPools;
+	OFCountedSet<OFString *> *_homeservers;
+	OFMutableSet<MTXClient *> *_clients;
+}
+
+@property (readonly, nonatomic) OFThread *thread;
+
+- (instancetype)initWithThread: (OFThread *)thread
+		  storageBlock: (MTXClientManagerStorageBlock)storageBlock;
+- (void)addClientWithParameters: (OFMutableDictionary *)parameters;
+- (void)removeClient: (MTXClient *)client;
+- (void)startSyncLoops;
+- (void)stopSyncLoops;
+- (void)stopRunLoop;
+@end
+
+static OFString *
+homeserverKey(OFIRI *homeserver)
+{
+	return [OFString stringWithFormat: @"%@://%@:%@",
+	    homeserver.scheme, homeserver.host, homeserver.port];
+}
+
+@implementation MTXClientManagerShard
+@synthesize thread = _thread;
+
+- (instancetype)initWithThread: (OFThread *)thread
+		  storageBlock: (MTXClientManagerStorageBlock)storageBlock
+{
+	self = [super init];
+
+	@try {
+		_thread = [thread retain];
+		_storageBlock = [storageBlock copy];
+		_storages = [[OFMutableDictionary alloc] init];
+		_connectionPools = [[OFMutableDictionary alloc] init];
+		_syncConnectionPools = [[OFMutableDictionary alloc] init];
+		_homeservers = [[OFCountedSet alloc] init];
+		_clients = [[OFMutableSet alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_thread release];
+	[_storageBlock release];
+	[_storages release];
+	[_connectionPools release];
+	[_syncConnectionPools release];
+	[_homeservers release];
+	[_clients release];
+
+	[super dealloc];
+}
+
+/*
+ * Returns the storage of the account, creating it for the first client of the
+ * account. Timelines and room state are stored per room, so two accounts in
+ * the same storage would overwrite each other's.
+ */
+- (id <MTXStorage>)storageForUserID: (OFString *)userID
+{
+	id <MTXStorage> storage = _storages[userID];
+
+	if (storage != nil)
+		return storage;
+
+	storage = _storageBlock(userID);
+
+	for (id <MTXStorage> otherStorage in _storages.objectEnumerator)
+		if (otherStorage == storage)
+			@throw [OFInvalidArgumentException exception];
+
+	return storage;
+}
+
+/*
+ * Long-polling connections are given back to the pool while the response is
+ * processed and taken again right after, so keep one idle connection per
+ * client that can sync at the same time to avoid reconnecting.
+ */
+- (void)updateIdleConnectionsForHomeserver: (OFString *)key
+{
+	MTXConnectionPool *syncPool = _syncConnectionPools[key];
+	size_t count = [_homeservers countForObject: key];
+	size_t max = syncPool.maxConnections;
+
+	syncPool.maxIdleConnections = (max != 0 && max < count ? max : count);
+}
+
+- (void)addClientWithParameters: (OFMutableDictionary *)parameters
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	@try {
+		OFString *userID = parameters[@"userID"];
+		OFIRI *homeserver = parameters[@"homeserver"];
+		OFString *key = homeserverKey(homeserver);
+		id <MTXStorage> storage = [self storageForUserID: userID];
+		MTXConnectionPool *connectionPool = _connectionPools[key];
+		MTXConnectionPool *syncPool = _syncConnectionPools[key];
+
+		if (connectionPool == nil) {
+			connectionPool = [MTXConnectionPool connectionPool];
+			connectionPool.maxConnections = (size_t)
+			    [parameters[@"maxConnections"]
+			    unsignedLongLongValue];
+
+			syncPool = [MTXConnectionPool connectionPool];
+			syncPool.maxConnections = (size_t)
+			    [parameters[@"maxSyncConnections"]
+			    unsignedLongLongValue];
+
+			_connectionPools[key] = connectionPool;
+			_syncConnectionPools[key] = syncPool;
+		}
+
+		MTXClient *client = [[[MTXClient alloc]
+			initWithUserID: userID
+			      deviceID: parameters[@"deviceID"]
+			   accessToken: parameters[@"accessToken"]
+			    homeserver: homeserver
+			       storage: storage
+			connectionPool: connectionPool
+		    syncConnectionPool: syncPool] autorelease];
+
+		[_clients addObject: client];
+		_storages[userID] = storage;
+		[_homeservers addObject: key];
+		[self updateIdleConnectionsForHomeserver: key];
+
+		parameters[@"client"] = client;
+	} @catch (id e) {
+		/* Rethrown on the thread that added the client. */
+		parameters[@"exception"] = e;
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)removeClient: (MTXClient *)client
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFString *key = homeserverKey(client.homeserver);
+
+	if (![_clients containsObject: client]) {
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	bool accountHasClients = false;
+	for (MTXClient *otherClient in _clients) {
+		if (otherClient != client &&
+		    [otherClient.userID isEqual: client.userID]) {
+			accountHasClients = true;
+			break;
+		}
+	}
+
+	if (!accountHasClients)
+		[_storages removeObjectForKey: client.userID];
+
+	[client stopSyncLoop];
+	[_clients removeObject: client];
+	[_homeservers removeObject: key];
+
+	if ([_homeservers countForObject: key] == 0) {
+		[_connectionPools[key] closeIdleConnections];
+		[_syncConnectionPools[key] closeIdleConnections];
+		[_connectionPools removeObjectForKey: key];
+		[_syncConnectionPools removeObjectForKey: key];
+	} else
+		[self updateIdleConnectionsForHomeserver: key];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)startSyncLoops
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	for (MTXClient *client in _clients)
+		[client startSyncLoop];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)stopSyncLoops
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	for (MTXClient *client in _clients)
+		[client stopSyncLoop];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)stopRunLoop
+{
+	[[OFRunLoop currentRunLoop] stop];
+}
+@end
+
+@implementation MTXClientManager
+{
+	OFArray<MTXClientManagerShard *> *_shards;
+}
+
+@synthesize numberOfThreads = _numberOfThreads;
+
++ (instancetype)managerWithStorageBlock:
+    (MTXClientManagerStorageBlock)storageBlock
+{
+	return [[[self alloc] initWithStorageBlock: storageBlock] autorelease];
+}
+
++ (instancetype)
+    managerWithNumberOfThreads: (size_t)numberOfThreads
+		  storageBlock: (MTXClientManagerStorageBlock)storageBlock
+{
+	return [[[self alloc] initWithNumberOfThreads: numberOfThreads
+					 storageBlock: storageBlock]
+	    autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithStorageBlock:
+    (MTXClientManagerStorageBlock)storageBlock
+{
+	self = [super init];
+
+	@try {
+		MTXClientManagerShard *shard =
+		    [[[MTXClientManagerShard alloc]
+		    initWithThread: nil
+		      storageBlock: storageBlock] autorelease];
+
+		_shards = [[OFArray alloc] initWithObject: shard];
+		_maxConnectionsPerHomeserver = 8;
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (instancetype)
+    initWithNumberOfThreads: (size_t)numberOfThreads
+	       storageBlock: (MTXClientManagerStorageBlock)storageBlock
+{
+	self = [super init];
+
+	@try {
+		void *pool = objc_autoreleasePoolPush();
+		OFMutableArray *shards;
+
+		if (numberOfThreads == 0)
+			@throw [OFInvalidArgumentException exception];
+
+		/* Set right away so that dealloc stops the started threads. */
+		shards = [OFMutableArray arrayWithCapacity: numberOfThreads];
+		_shards = [shards retain];
+		_numberOfThreads = numberOfThreads;
+		_maxConnectionsPerHomeserver = 8;
+
+		for (size_t i = 0; i < numberOfThreads; i++) {
+			OFThread *thread = [OFThread thread];
+			thread.name = [OFString stringWithFormat:
+			    @"MTXClientManager %zu", i];
+			[thread start];
+
+			MTXClientManagerShard *shard =
+			    [[[MTXClientManagerShard alloc]
+			    initWithThread: thread
+			      storageBlock: storageBlock] autorelease];
+			[shards addObject: shard];
+		}
+
+		objc_autoreleasePoolPop(pool);
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	for (MTXClientManagerShard *shard in _shards) {
+		OFThread *thread = shard.thread;
+
+		if (thread == nil)
+			continue;
+
+		[shard performSelector: @selector(stopRunLoop)
+			      onThread: thread
+			 waitUntilDone: false];
+		[thread join];
+	}
+
+	[_shards release];
+
+	[super dealloc];
+}
+
+- (MTXClientManagerShard *)shardForUserID: (OFString *)userID
+{
+	return [_shards objectAtIndex: userID.hash % _shards.count];
+}
+
+- (void)performSelector: (SEL)selector
+		onShard: (MTXClientManagerShard *)shard
+	     withObject: (id)object
+{
+	OFThread *thread = shard.thread;
+
+	if (thread == nil)
+		[shard performSelector: selector withObject: object];
+	else
+		[shard performSelector: selector
+			      onThread: thread
+			    withObject: object
+			 waitUntilDone: true];
+}
+
+- (MTXClient *)addClientWithUserID: (OFString *)userID
+			  deviceID: (OFString *)deviceID
+		       accessToken: (OFString *)accessToken
+			homeserver: (OFIRI *)homeserver
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableDictionary *parameters = [OFMutableDictionary dictionary];
+
+	parameters[@"userID"] = userID;
+	parameters[@"deviceID"] = deviceID;
+	parameters[@"accessToken"] = accessToken;
+	parameters[@"homeserver"] = homeserver;
+	parameters[@"maxConnections"] = @(_maxConnectionsPerHomeserver);
+	parameters[@"maxSyncConnections"] =
+	    @(_maxSyncConnectionsPerHomeserver);
+
+	[self performSelector: @selector(addClientWithParameters:)
+		      onShard: [self shardForUserID: userID]
+		   withObject: parameters];
+
+	if (parameters[@"exception"] != nil)
+		@throw parameters[@"exception"];
+
+	MTXClient *client = [parameters[@"client"] retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [client autorelease];
+}
+
+- (void)removeClient: (MTXClient *)client
+{
+	[self performSelector: @selector(removeClient:)
+		      onShard: [self shardForUserID: client.userID]
+		   withObject: client];
+}
+
+- (void)startSyncLoops
+{
+	for (MTXClientManagerShard *shard in _shards)
+		[self performSelector: @selector(startSyncLoops)
+			      onShard: shard
+			   withObject: nil];
+}
+
+- (void)stopSyncLoops
+{
+	for (MTXClientManagerShard *shard in _shards)
+		[self performSelector: @selector(stopSyncLoops)
+			      onShard: shard
+			   withObject: nil];
+}
+@end
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A block called with an HTTP client acquired from a connection pool.
+ *
+ * @param client The HTTP client to perform a request with. It needs to be
+ *		 given back to the pool once the response has been read.
+ */
+typedef void (^MTXConnectionPoolBlock)(OFHTTPClient *client);
+
+/**
+ * @brief A pool of keep-alive connections to a homeserver.
+ *
+ * Every connection is an OFHTTPClient, which keeps the underlying TCP and TLS
+ * connection open as long as the server allows it and the previous response
+ * has been read completely.
+ */
+@interface MTXConnectionPool: OFObject
+/**
+ * @brief The maximum number of connections that can be in flight at the same
+ *	  time.
+ *
+ * If this many connections are in use, further requests are queued until a
+ * connection becomes available. 0 means unlimited.
+ *
+ * Defaults to 8.
+ */
+@property (nonatomic) size_t maxConnections;
+
+/**
+ * @brief The maximum number of idle connections to keep open.
+ *
+ * Defaults to 4.
+ */
+@property (nonatomic) size_t maxIdleConnections;
+
+/**
+ * @brief The number of connections that are currently in flight.
+ */
+@property (readonly, nonatomic) size_t numberOfActiveConnections;
+
+/**
+ * @brief The number of idle connections that are currently kept open.
+ */
+@property (readonly, nonatomic) size_t numberOfIdleConnections;
+
+/**
+ * @brief Creates a new connection pool.
+ *
+ * @return An autoreleased MTXConnectionPool
+ */
++ (instancetype)connectionPool;
+
+/**
+ * @brief Acquires an HTTP client from the pool.
+ *
+ * If a connection is available, the block is called immediately. Otherwise, it
+ * is called as soon as another connection is released.
+ *
+ * @param block The block to call with the acquired HTTP client
+ */
+- (void)acquireClientWithBlock: (MTXConnectionPoolBlock)block;
+
+/**
+ * @brief Releases an HTTP client that was acquired from the pool.
+ *
+ * @param client The HTTP client to release
+ * @param reusable Whether the connection of the client can be reused. This
+ *		   should be `false` if the request failed or the response has
+ *		   not been read completely.
+ */
+- (void)releaseClient: (OFHTTPClient *)client reusable: (bool)reusable;
+
+/**
+ * @brief Closes all idle connections.
+ */
+- (void)closeIdleConnections;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXConnectionPool.h"
+
+@implementation MTXConnectionPool
+{
+	OFMutableArray<OFHTTPClient *> *_idleClients;
+	OFMutableArray<MTXConnectionPoolBlock> *_waitingBlocks;
+}
+
++ (instancetype)connectionPool
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	@try {
+		_idleClients = [[OFMutableArray alloc] init];
+		_waitingBlocks = [[OFMutableArray alloc] init];
+		_maxConnections = 8;
+		_maxIdleConnections = 4;
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[self closeIdleConnections];
+
+	[_idleClients release];
+	[_waitingBlocks release];
+
+	[super dealloc];
+}
+
+- (size_t)numberOfIdleConnections
+{
+	return _idleClients.count;
+}
+
+- (void)acquireClientWithBlock: (MTXConnectionPoolBlock)block
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	if (_maxConnections > 0 &&
+	    _numberOfActiveConnections >= _maxConnections) {
+		[_waitingBlocks addObject: [[block copy] autorelease]];
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	OFHTTPClient *client = [[_idleClients.lastObject retain] autorelease];
+	if (client != nil)
+		[_idleClients removeLastObject];
+	else
+		client = [OFHTTPClient client];
+
+	_numberOfActiveConnections++;
+	block(client);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)releaseClient: (OFHTTPClient *)client reusable: (bool)reusable
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	client.delegate = nil;
+
+	if (!reusable) {
+		[client close];
+		client = nil;
+	}
+
+	if (_waitingBlocks.count > 0) {
+		MTXConnectionPoolBlock block =
+		    [[_waitingBlocks.firstObject retain] autorelease];
+		[_waitingBlocks removeObjectAtIndex: 0];
+
+		/* The connection stays active and is handed over directly. */
+		block(client != nil ? client : [OFHTTPClient client]);
+	} else {
+		_numberOfActiveConnections--;
+
+		if (client != nil) {
+			if (_idleClients.count < _maxIdleConnections)
+				[_idleClients addObject: client];
+			else
+				[client close];
+		}
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)closeIdleConnections
+{
+	for (OFHTTPClient *client in _idleClients)
+		[client close];
+
+	[_idleClients removeAllObjects];
+}
+@end
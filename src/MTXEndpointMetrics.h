@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+#import "MTXLatencyHistogram.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief Metrics for the requests to one endpoint.
+ */
+@interface MTXEndpointMetrics: OFObject <OFCopying>
+/**
+ * @brief The number of requests.
+ */
+@property (readonly, nonatomic) unsigned long long numberOfRequests;
+
+/**
+ * @brief The number of requests that failed with an exception or a status code
+ *	  other than 2xx.
+ */
+@property (readonly, nonatomic) unsigned long long numberOfFailures;
+
+/**
+ * @brief The number of bytes sent in request bodies.
+ */
+@property (readonly, nonatomic) unsigned long long bytesSent;
+
+/**
+ * @brief The number of bytes received in response bodies.
+ */
+@property (readonly, nonatomic) unsigned long long bytesReceived;
+
+/**
+ * @brief The latency of the requests, from sending the request until the
+ *	  response has been parsed.
+ */
+@property (readonly, nonatomic) MTXLatencyHistogram *latency;
+
+/**
+ * @brief Creates new, empty endpoint metrics.
+ *
+ * @return Autoreleased MTXEndpointMetrics
+ */
++ (instancetype)metrics;
+
+/**
+ * @brief Adds a request to the metrics.
+ *
+ * @param latency The latency of the request
+ * @param bytesSent The number of bytes sent in the request body
+ * @param bytesReceived The number of bytes received in the response body
+ * @param failed Whether the request failed
+ */
+- (void)addRequestWithLatency: (OFTimeInterval)latency
+		    bytesSent: (unsigned long long)bytesSent
+		bytesReceived: (unsigned long long)bytesReceived
+		       failed: (bool)failed;
+@end
+
+OF_ASSUME_NONNULL_END
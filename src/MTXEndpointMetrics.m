@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXEndpointMetrics.h"
+
+@implementation MTXEndpointMetrics
++ (instancetype)metrics
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	@try {
+		_latency = [[MTXLatencyHistogram alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_latency release];
+
+	[super dealloc];
+}
+
+- (id)copy
+{
+	MTXEndpointMetrics *copy = [[MTXEndpointMetrics alloc] init];
+
+	@try {
+		copy->_numberOfRequests = _numberOfRequests;
+		copy->_numberOfFailures = _numberOfFailures;
+		copy->_bytesSent = _bytesSent;
+		copy->_bytesReceived = _bytesReceived;
+		[copy->_latency release];
+		copy->_latency = nil;
+		copy->_latency = [_latency copy];
+	} @catch (id e) {
+		[copy release];
+		@throw e;
+	}
+
+	return copy;
+}
+
+- (void)addRequestWithLatency: (OFTimeInterval)latency
+		    bytesSent: (unsigned long long)bytesSent
+		bytesReceived: (unsigned long long)bytesReceived
+		       failed: (bool)failed
+{
+	_numberOfRequests++;
+	if (failed)
+		_numberOfFailures++;
+	_bytesSent += bytesSent;
+	_bytesReceived += bytesReceived;
+	[_latency addDuration: latency];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat:
+	    @"<%@ requests=%llu failures=%llu sent=%llu received=%llu "
+	    @"latency=%@>",
+	    self.class, _numberOfRequests, _numberOfFailures, _bytesSent,
+	    _bytesReceived, _latency];
+}
+@end
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXEvent.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+/**
+ * @brief Parses the specified JSON straight from its UTF-8 bytes.
+ *
+ * @param JSON The JSON to parse
+ * @param length The length of the JSON
+ * @return The parsed JSON
+ * @throw OFInvalidFormatException The structure of the JSON is invalid
+ * @throw OFInvalidJSONException A string, number or literal in the JSON is
+ *				 invalid
+ */
+extern id MTXParseJSON(const char *JSON, size_t length);
+
+/**
+ * @brief Parses the specified JSON, with the elements of all arrays named
+ *	  `events` as lazily decoded @ref MTXEvent.
+ *
+ * @param JSON The JSON to parse
+ * @param length The length of the JSON
+ * @return The parsed JSON
+ * @throw OFInvalidFormatException The structure of the JSON is invalid
+ * @throw OFInvalidJSONException A string, number or literal in the JSON is
+ *				 invalid
+ */
+extern id MTXParseJSONWithLazyEvents(const char *JSON, size_t length);
+
+/**
+ * @brief Serializes the specified object to JSON in a single buffer.
+ *
+ * Containers are written into the buffer directly instead of into strings of
+ * their own, and @ref MTXEvent is written as the JSON it was received as.
+ *
+ * @param object The object to serialize
+ * @return The JSON as UTF-8
+ * @throw OFInvalidArgumentException The object cannot be serialized
+ */
+extern OFData *MTXJSONData(id object);
+#ifdef __cplusplus
+}
+#endif
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief An event that is only decoded from its JSON as far as needed.
+ *
+ * An MTXEvent is a dictionary and can be used wherever an event dictionary is
+ * expected. Only the positions of the top-level fields are determined when it
+ * is created. A field is decoded the first time it is accessed and the whole
+ * event is only decoded when it is enumerated. The JSON representation is the
+ * JSON the event was created from.
+ *
+ * As decoded fields are cached, an MTXEvent must not be accessed from multiple
+ * threads at the same time.
+ */
+@interface MTXEvent: OFDictionary<OFString *, id>
+/**
+ * @brief The JSON the event was created from.
+ */
+@property (readonly, nonatomic) OFData *JSONData;
+
+/**
+ * @brief The type of the event, or `nil` if it has none.
+ */
+@property (readonly, nullable, nonatomic) OFString *type;
+
+/**
+ * @brief The sender of the event, or `nil` if it has none.
+ */
+@property (readonly, nullable, nonatomic) OFString *sender;
+
+/**
+ * @brief The ID of the event, or `nil` if it has none.
+ */
+@property (readonly, nullable, nonatomic) OFString *eventID;
+
+/**
+ * @brief The state key of the event, or `nil` if it is not a state event.
+ */
+@property (readonly, nullable, nonatomic) OFString *stateKey;
+
+/**
+ * @brief The server timestamp of the event in milliseconds since the epoch,
+ *	  or 0 if it has none.
+ */
+@property (readonly, nonatomic) uint64_t originServerTimestamp;
+
+/**
+ * @brief The content of the event, or `nil` if it has none.
+ */
+@property (readonly, nullable, nonatomic)
+    OFDictionary<OFString *, id> *content;
+
+/**
+ * @brief Creates a new event from the specified JSON.
+ *
+ * @param JSONData The JSON of the event, which needs to be an object
+ * @return An autoreleased MTXEvent
+ * @throw OFInvalidFormatException The JSON is not an object
+ */
++ (instancetype)eventWithJSONData: (OFData *)JSONData;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated event from the specified JSON.
+ *
+ * @param JSONData The JSON of the event, which needs to be an object
+ * @return An initialized MTXEvent
+ * @throw OFInvalidFormatException The JSON is not an object
+ */
+- (instancetype)initWithJSONData: (OFData *)JSONData;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,644 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#import "MTXEvent.h"
+#import "MTXEvent+Private.h"
+#import "MTXIdentifierTable.h"
+
+/* Spans of a field, relative to the start of the JSON. */
+struct Field {
+	size_t keyStart, keyLength, valueStart, valueLength;
+	bool keyHasEscape;
+};
+
+static size_t
+skipWhitespace(const char *JSON, size_t length, size_t i)
+{
+	while (i < length && (JSON[i] == ' ' || JSON[i] == '\t' ||
+	    JSON[i] == '\r' || JSON[i] == '\n'))
+		i++;
+
+	return i;
+}
+
+/* Returns the index after the closing quote of the string starting at i. */
+static size_t
+skipString(const char *JSON, size_t length, size_t i, bool *hasEscape)
+{
+	if (hasEscape != NULL)
+		*hasEscape = false;
+
+	for (i++; i < length; i++) {
+		if (JSON[i] == '\\') {
+			if (hasEscape != NULL)
+				*hasEscape = true;
+
+			i++;
+		} else if (JSON[i] == '"')
+			return i + 1;
+	}
+
+	@throw [OFInvalidFormatException exception];
+}
+
+/*
+ * Returns the index after the value starting at i. The value is not
+ * validated, this is left to the JSON parser once it gets decoded.
+ */
+static size_t
+skipValue(const char *JSON, size_t length, size_t i)
+{
+	size_t start = i, depth = 0;
+
+	if (i >= length)
+		@throw [OFInvalidFormatException exception];
+
+	if (JSON[i] == '"')
+		return skipString(JSON, length, i, NULL);
+
+	if (JSON[i] == '{' || JSON[i] == '[') {
+		for (; i < length; i++) {
+			switch (JSON[i]) {
+			case '"':
+				i = skipString(JSON, length, i, NULL) - 1;
+				break;
+			case '{':
+			case '[':
+				depth++;
+				break;
+			case '}':
+			case ']':
+				if (--depth == 0)
+					return i + 1;
+				break;
+			}
+		}
+
+		@throw [OFInvalidFormatException exception];
+	}
+
+	/* Numbers, true, false and null end at the next delimiter. */
+	while (i < length && JSON[i] != ',' && JSON[i] != '}' &&
+	    JSON[i] != ']' && JSON[i] != ' ' && JSON[i] != '\t' &&
+	    JSON[i] != '\r' && JSON[i] != '\n')
+		i++;
+
+	if (i == start)
+		@throw [OFInvalidFormatException exception];
+
+	return i;
+}
+
+/*
+ * Reads the field of an object at *i, which needs to be right after the
+ * opening brace or the previous field. Returns false and moves *i past the
+ * closing brace at the end of the object.
+ */
+static bool
+nextField(const char *JSON, size_t length, size_t *i, bool first,
+    struct Field *field)
+{
+	*i = skipWhitespace(JSON, length, *i);
+	if (*i >= length)
+		@throw [OFInvalidFormatException exception];
+
+	if (JSON[*i] == '}') {
+		(*i)++;
+		return false;
+	}
+
+	if (!first) {
+		if (JSON[*i] != ',')
+			@throw [OFInvalidFormatException exception];
+
+		*i = skipWhitespace(JSON, length, *i + 1);
+	}
+
+	if (*i >= length || JSON[*i] != '"')
+		@throw [OFInvalidFormatException exception];
+
+	field->keyStart = *i;
+	*i = skipString(JSON, length, *i, &field->keyHasEscape);
+	field->keyLength = *i - field->keyStart;
+
+	*i = skipWhitespace(JSON, length, *i);
+	if (*i >= length || JSON[*i] != ':')
+		@throw [OFInvalidFormatException exception];
+
+	field->valueStart = skipWhitespace(JSON, length, *i + 1);
+	*i = skipValue(JSON, length, field->valueStart);
+	field->valueLength = *i - field->valueStart;
+
+	return true;
+}
+
+/* Same as nextField(), but for the elements of an array. */
+static bool
+nextElement(const char *JSON, size_t length, size_t *i, bool first,
+    size_t *elementStart)
+{
+	*i = skipWhitespace(JSON, length, *i);
+	if (*i >= length)
+		@throw [OFInvalidFormatException exception];
+
+	if (JSON[*i] == ']') {
+		(*i)++;
+		return false;
+	}
+
+	if (!first) {
+		if (JSON[*i] != ',')
+			@throw [OFInvalidFormatException exception];
+
+		*i = skipWhitespace(JSON, length, *i + 1);
+	}
+
+	*elementStart = *i;
+	*i = skipValue(JSON, length, *i);
+
+	return true;
+}
+
+/* Deeper nesting is rejected, like the JSON parser of ObjFW does. */
+static const size_t maxDepth = 32;
+
+/* Parses a value that is neither an object nor an array. */
+static id
+parseJSONValue(const char *JSON, size_t length)
+{
+	/* Most strings have no escape sequences and need no JSON parser. */
+	if (length >= 2 && JSON[0] == '"' && JSON[length - 1] == '"' &&
+	    memchr(JSON, '\\', length) == NULL)
+		return [OFString stringWithUTF8String: JSON + 1
+					       length: length - 2];
+
+	if (length == 4 && memcmp(JSON, "true", 4) == 0)
+		return [OFNumber numberWithBool: true];
+	if (length == 5 && memcmp(JSON, "false", 5) == 0)
+		return [OFNumber numberWithBool: false];
+	if (length == 4 && memcmp(JSON, "null", 4) == 0)
+		return [OFNull null];
+
+	return [OFString stringWithUTF8String: JSON
+				       length: length].objectByParsingJSON;
+}
+
+/*
+ * Where in a sync response an object is. Only the keys of the objects under
+ * rooms are interned, as they are the room IDs of the account, which are few.
+ * All other keys may be user IDs, thread IDs and the like, which would grow
+ * the identifier table without bound.
+ */
+enum Context {
+	ContextNone,
+	ContextDocument,
+	ContextRooms,
+	ContextRoomIDs
+};
+
+static id parseValue(const char *JSON, size_t start, size_t end,
+    bool lazyEvents, enum Context context, size_t depth);
+
+/*
+ * Parses the array from start to end. If events is true, the objects in it
+ * become lazily decoded events.
+ */
+static OFArray *
+parseArray(const char *JSON, size_t start, size_t end, bool lazyEvents,
+    bool events, size_t depth)
+{
+	OFMutableArray *array = [OFMutableArray array];
+	size_t i = start + 1, elementStart;
+	bool first = true;
+
+	while (nextElement(JSON, end, &i, first, &elementStart)) {
+		const char *element = JSON + elementStart;
+		size_t elementLength = i - elementStart;
+
+		/*
+		 * Anything that is not an object is left for the validation of
+		 * the caller.
+		 */
+		if (events && *element == '{')
+			[array addObject: [MTXEvent eventWithJSONData:
+			    [OFData dataWithItems: element
+					    count: elementLength]]];
+		else
+			[array addObject: parseValue(JSON, elementStart, i,
+			    lazyEvents, ContextNone, depth + 1)];
+
+		first = false;
+	}
+
+	[array makeImmutable];
+
+	return array;
+}
+
+static id
+parseValue(const char *JSON, size_t start, size_t end, bool lazyEvents,
+    enum Context context, size_t depth)
+{
+	OFMutableDictionary *dictionary;
+	struct Field field;
+	size_t i = start + 1;
+	bool first = true;
+
+	if (JSON[start] != '{' && JSON[start] != '[')
+		return parseJSONValue(JSON + start, end - start);
+
+	if (depth >= maxDepth)
+		@throw [OFInvalidFormatException exception];
+
+	if (JSON[start] == '[')
+		return parseArray(JSON, start, end, lazyEvents, false, depth);
+
+	dictionary = [OFMutableDictionary dictionary];
+
+	while (nextField(JSON, end, &i, first, &field)) {
+		OFString *key = parseJSONValue(JSON + field.keyStart,
+		    field.keyLength);
+		size_t valueEnd = field.valueStart + field.valueLength;
+		enum Context valueContext = ContextNone;
+		id value;
+
+		if (context == ContextRoomIDs)
+			key = [[MTXIdentifierTable sharedTable]
+			    internIdentifier: key];
+		else if (context == ContextDocument &&
+		    [key isEqual: @"rooms"])
+			valueContext = ContextRooms;
+		else if (context == ContextRooms &&
+		    ([key isEqual: @"join"] || [key isEqual: @"invite"] ||
+		    [key isEqual: @"leave"] || [key isEqual: @"knock"]))
+			valueContext = ContextRoomIDs;
+
+		if (lazyEvents && JSON[field.valueStart] == '[' &&
+		    [key isEqual: @"events"])
+			value = parseArray(JSON, field.valueStart, valueEnd,
+			    lazyEvents, true, depth + 1);
+		else
+			value = parseValue(JSON, field.valueStart, valueEnd,
+			    lazyEvents, valueContext, depth + 1);
+
+		[dictionary setObject: value forKey: key];
+		first = false;
+	}
+
+	[dictionary makeImmutable];
+
+	return dictionary;
+}
+
+static id
+parseDocument(const char *JSON, size_t length, bool lazyEvents)
+{
+	size_t start = skipWhitespace(JSON, length, 0);
+	size_t end = skipValue(JSON, length, start);
+
+	if (skipWhitespace(JSON, length, end) != length)
+		@throw [OFInvalidFormatException exception];
+
+	return parseValue(JSON, start, end, lazyEvents, ContextDocument, 0);
+}
+
+id
+MTXParseJSON(const char *JSON, size_t length)
+{
+	return parseDocument(JSON, length, false);
+}
+
+id
+MTXParseJSONWithLazyEvents(const char *JSON, size_t length)
+{
+	return parseDocument(JSON, length, true);
+}
+
+static void
+appendJSON(OFMutableData *data, id object, size_t depth)
+{
+	if (depth >= maxDepth)
+		@throw [OFInvalidArgumentException exception];
+
+	/* Events that were received are sent as they are. */
+	if ([object isKindOfClass: [MTXEvent class]]) {
+		OFData *JSONData = [object JSONData];
+
+		[data addItems: JSONData.items count: JSONData.count];
+		return;
+	}
+
+	if ([object isKindOfClass: [OFDictionary class]]) {
+		bool first = true;
+
+		[data addItem: "{"];
+
+		for (id key in object) {
+			if (![key isKindOfClass: [OFString class]])
+				@throw [OFInvalidArgumentException exception];
+
+			if (!first)
+				[data addItem: ","];
+
+			appendJSON(data, key, depth + 1);
+			[data addItem: ":"];
+			appendJSON(data, [object objectForKey: key], depth + 1);
+
+			first = false;
+		}
+
+		[data addItem: "}"];
+		return;
+	}
+
+	if ([object isKindOfClass: [OFArray class]]) {
+		bool first = true;
+
+		[data addItem: "["];
+
+		for (id element in object) {
+			if (!first)
+				[data addItem: ","];
+
+			appendJSON(data, element, depth + 1);
+			first = false;
+		}
+
+		[data addItem: "]"];
+		return;
+	}
+
+	/* Strings, numbers and null are small, so ObjFW serializes them. */
+	void *pool = objc_autoreleasePoolPush();
+	OFString *JSON = [object JSONRepresentation];
+
+	[data addItems: JSON.UTF8String count: JSON.UTF8StringLength];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+OFData *
+MTXJSONData(id object)
+{
+	OFMutableData *data = [OFMutableData data];
+
+	appendJSON(data, object, 0);
+
+	return data;
+}
+
+@implementation MTXEvent
+{
+	OFData *_JSONData;
+	struct Field *_fields;
+	size_t _fieldsCount;
+	OFMutableDictionary<OFString *, id> *_decodedFields;
+	OFDictionary<OFString *, id> *_dictionary;
+}
+
+@synthesize JSONData = _JSONData;
+
++ (instancetype)eventWithJSONData: (OFData *)JSONData
+{
+	return [[[self alloc] initWithJSONData: JSONData] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithJSONData: (OFData *)JSONData
+{
+	self = [super init];
+
+	@try {
+		const char *JSON;
+		size_t length, i;
+		struct Field field;
+		bool first = true;
+
+		if (JSONData.itemSize != 1)
+			@throw [OFInvalidArgumentException exception];
+
+		_JSONData = [JSONData copy];
+		JSON = _JSONData.items;
+		length = _JSONData.count;
+
+		i = skipWhitespace(JSON, length, 0);
+		if (i >= length || JSON[i] != '{')
+			@throw [OFInvalidFormatException exception];
+
+		i++;
+		while (nextField(JSON, length, &i, first, &field)) {
+			_fields = OFResizeMemory(_fields, _fieldsCount + 1,
+			    sizeof(*_fields));
+			_fields[_fieldsCount++] = field;
+			first = false;
+		}
+
+		if (skipWhitespace(JSON, length, i) != length)
+			@throw [OFInvalidFormatException exception];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_JSONData release];
+	OFFreeMemory(_fields);
+	[_decodedFields release];
+	[_dictionary release];
+
+	[super dealloc];
+}
+
+- (OFDictionary<OFString *, id> *)materializedDictionary
+{
+	if (_dictionary == nil) {
+		OFString *JSON = [[OFString alloc]
+		    initWithUTF8String: _JSONData.items
+				length: _JSONData.count];
+
+		@try {
+			_dictionary = [JSON.objectByParsingJSON retain];
+		} @finally {
+			[JSON release];
+		}
+
+		[_decodedFields release];
+		_decodedFields = nil;
+	}
+
+	return _dictionary;
+}
+
+- (id)objectForKey: (id)key
+{
+	const char *JSON, *UTF8String;
+	size_t UTF8StringLength;
+	id object;
+
+	if (_dictionary != nil)
+		return [_dictionary objectForKey: key];
+
+	if ((object = [_decodedFields objectForKey: key]) != nil)
+		return object;
+
+	if (![key isKindOfClass: [OFString class]])
+		return nil;
+
+	JSON = _JSONData.items;
+	UTF8String = [key UTF8String];
+	UTF8StringLength = [key UTF8StringLength];
+
+	/* Like the JSON parser, prefer the last one for duplicate keys. */
+	for (size_t i = _fieldsCount; i > 0; i--) {
+		const struct Field *field = &_fields[i - 1];
+
+		if (field->keyHasEscape) {
+			if (![parseJSONValue(JSON + field->keyStart,
+			    field->keyLength) isEqual: key])
+				continue;
+		} else if (field->keyLength - 2 != UTF8StringLength ||
+		    memcmp(JSON + field->keyStart + 1, UTF8String,
+		    UTF8StringLength) != 0)
+			continue;
+
+		object = parseValue(JSON, field->valueStart,
+		    field->valueStart + field->valueLength, false,
+		    ContextNone, 0);
+
+		/*
+		 * Senders are not interned: They are only bounded by the
+		 * members of all rooms and would never leave the table.
+		 */
+		if ([object isKindOfClass: [OFString class]] &&
+		    ([key isEqual: @"type"] || [key isEqual: @"room_id"]))
+			object = [[MTXIdentifierTable sharedTable]
+			    internIdentifier: object];
+
+		if (_decodedFields == nil)
+			_decodedFields = [[OFMutableDictionary alloc] init];
+
+		[_decodedFields setObject: object forKey: key];
+
+		return object;
+	}
+
+	return nil;
+}
+
+- (size_t)count
+{
+	return self.materializedDictionary.count;
+}
+
+- (OFEnumerator *)keyEnumerator
+{
+	return [self.materializedDictionary keyEnumerator];
+}
+
+- (OFEnumerator *)objectEnumerator
+{
+	return [self.materializedDictionary objectEnumerator];
+}
+
+- (int)countByEnumeratingWithState: (OFFastEnumerationState *)state
+			   objects: (id *)objects
+			     count: (int)count
+{
+	OFDictionary *dictionary = self.materializedDictionary;
+
+	return [dictionary countByEnumeratingWithState: state
+					       objects: objects
+						 count: count];
+}
+
+- (OFString *)JSONRepresentation
+{
+	return [OFString stringWithUTF8String: _JSONData.items
+				       length: _JSONData.count];
+}
+
+- (OFString *)JSONRepresentationWithOptions:
+    (OFJSONRepresentationOptions)options
+{
+	if (options == 0)
+		return self.JSONRepresentation;
+
+	return [self.materializedDictionary
+	    JSONRepresentationWithOptions: options];
+}
+
+- (OFString *)stringForKey: (OFString *)key
+{
+	id object = [self objectForKey: key];
+
+	if (![object isKindOfClass: [OFString class]])
+		return nil;
+
+	return object;
+}
+
+- (OFString *)type
+{
+	return [self stringForKey: @"type"];
+}
+
+- (OFString *)sender
+{
+	return [self stringForKey: @"sender"];
+}
+
+- (OFString *)eventID
+{
+	return [self stringForKey: @"event_id"];
+}
+
+- (OFString *)stateKey
+{
+	return [self stringForKey: @"state_key"];
+}
+
+- (uint64_t)originServerTimestamp
+{
+	id timestamp = [self objectForKey: @"origin_server_ts"];
+
+	if (![timestamp isKindOfClass: [OFNumber class]])
+		return 0;
+
+	return [timestamp unsignedLongLongValue];
+}
+
+- (OFDictionary<OFString *, id> *)content
+{
+	id content = [self objectForKey: @"content"];
+
+	if (![content isKindOfClass: [OFDictionary class]])
+		return nil;
+
+	return content;
+}
+@end
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief The part of a sync response an event was received in.
+ */
+typedef enum {
+	/** The timeline of a room */
+	MTXEventSourceTimeline,
+	/** The state of a room preceding the timeline */
+	MTXEventSourceState,
+	/** The stripped state of a room the user is invited to */
+	MTXEventSourceInviteState,
+	/** Ephemeral events of a room, such as typing notifications */
+	MTXEventSourceEphemeral,
+	/** The account data of a room */
+	MTXEventSourceRoomAccountData,
+	/** The global account data */
+	MTXEventSourceAccountData,
+	/** Presence updates */
+	MTXEventSourcePresence,
+	/**
+	 * Events sent directly to the device. They are kept in the storage
+	 * until they have been delivered in order. Delivery waits at the
+	 * first event that no subscription for all rooms matches, so that
+	 * events received before subscribing to their type are not lost.
+	 */
+	MTXEventSourceToDevice
+} MTXEventSource;
+
+/**
+ * @brief A block called for an event matching a subscription.
+ *
+ * @param source The part of the sync response the event was received in
+ * @param roomID The room the event belongs to, or `nil` if it does not belong
+ *		 to a room
+ * @param event The event
+ */
+typedef void (^MTXEventBlock)(MTXEventSource source,
+    OFString *_Nullable roomID, OFDictionary<OFString *, id> *event);
+
+/**
+ * @brief A subscription to events of a type and room.
+ *
+ * Subscriptions are added to a client with
+ * @ref MTXClient::subscribeToEventsWithType:roomID:block:.
+ */
+@interface MTXEventSubscription: OFObject
+/**
+ * @brief The type of events to subscribe to, or `nil` for all types.
+ */
+@property (readonly, nullable, nonatomic) OFString *type;
+
+/**
+ * @brief The room to subscribe to events of, or `nil` for all rooms as well
+ *	  as events that do not belong to a room.
+ */
+@property (readonly, nullable, nonatomic) OFString *roomID;
+
+/**
+ * @brief The block to call for each matching event.
+ */
+@property (readonly, nonatomic) MTXEventBlock block;
+
+/**
+ * @brief Creates a new subscription.
+ *
+ * @param type The type of events to subscribe to, or `nil` for all types
+ * @param roomID The room to subscribe to events of, or `nil` for all rooms
+ * @param block The block to call for each matching event
+ * @return An autoreleased MTXEventSubscription
+ */
++ (instancetype)subscriptionWithType: (nullable OFString *)type
+			      roomID: (nullable OFString *)roomID
+			       block: (MTXEventBlock)block;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated subscription.
+ *
+ * @param type The type of events to subscribe to, or `nil` for all types
+ * @param roomID The room to subscribe to events of, or `nil` for all rooms
+ * @param block The block to call for each matching event
+ * @return An initialized MTXEventSubscription
+ */
+- (instancetype)initWithType: (nullable OFString *)type
+		      roomID: (nullable OFString *)roomID
+		       block: (MTXEventBlock)block OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
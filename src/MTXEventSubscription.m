@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXEventSubscription.h"
+
+@implementation MTXEventSubscription
++ (instancetype)subscriptionWithType: (OFString *)type
+			      roomID: (OFString *)roomID
+			       block: (MTXEventBlock)block
+{
+	return [[[self alloc] initWithType: type
+				    roomID: roomID
+				     block: block] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithType: (OFString *)type
+		      roomID: (OFString *)roomID
+		       block: (MTXEventBlock)block
+{
+	self = [super init];
+
+	@try {
+		_type = [type copy];
+		_roomID = [roomID copy];
+		_block = [block copy];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_type release];
+	[_roomID release];
+	[_block release];
+
+	[super dealloc];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat: @"<%@ type %@ in room %@>",
+	    self.class, _type, _roomID];
+}
+@end
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A table of interned identifiers, such as room IDs, user IDs and event
+ *	  types.
+ *
+ * The same identifiers show up in every sync response. Interning them means
+ * only one instance of each identifier is kept in memory, no matter how many
+ * events reference it, and that equal identifiers can usually be compared by
+ * pointer.
+ *
+ * Identifiers are never removed from the table, so only strings that come
+ * from a bounded set should be interned.
+ *
+ * The table is safe to use from multiple threads.
+ */
+@interface MTXIdentifierTable: OFObject
+/**
+ * @brief The number of identifiers in the table.
+ */
+@property (readonly) size_t count;
+
+/**
+ * @brief Returns the table shared by the whole process.
+ *
+ * @return The table shared by the whole process
+ */
++ (MTXIdentifierTable *)sharedTable;
+
+/**
+ * @brief Returns the shared instance of the specified identifier.
+ *
+ * If the identifier is not in the table yet, an immutable copy of it is added.
+ *
+ * @param identifier The identifier to intern
+ * @return The shared, immutable instance of the identifier
+ */
+- (OFString *)internIdentifier: (OFString *)identifier;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXIdentifierTable.h"
+
+static MTXIdentifierTable *sharedTable = nil;
+
+@implementation MTXIdentifierTable
+{
+	OFMutex *_mutex;
+	OFMutableDictionary<OFString *, OFString *> *_identifiers;
+}
+
++ (void)initialize
+{
+	if (self == [MTXIdentifierTable class])
+		sharedTable = [[self alloc] init];
+}
+
++ (MTXIdentifierTable *)sharedTable
+{
+	return sharedTable;
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	@try {
+		_mutex = [[OFMutex alloc] init];
+		_identifiers = [[OFMutableDictionary alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_mutex release];
+	[_identifiers release];
+
+	[super dealloc];
+}
+
+- (size_t)count
+{
+	size_t count;
+
+	[_mutex lock];
+	count = _identifiers.count;
+	[_mutex unlock];
+
+	return count;
+}
+
+- (OFString *)internIdentifier: (OFString *)identifier
+{
+	OFString *interned;
+
+	[_mutex lock];
+	@try {
+		interned = [_identifiers objectForKey: identifier];
+
+		if (interned == nil) {
+			interned = [[identifier copy] autorelease];
+			[_identifiers setObject: interned forKey: interned];
+		}
+	} @finally {
+		[_mutex unlock];
+	}
+
+	return interned;
+}
+@end
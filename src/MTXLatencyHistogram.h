@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A histogram of durations with exponentially growing buckets.
+ *
+ * Each bucket covers twice the range of the previous one, starting at one
+ * microsecond, so that adding a duration is cheap and the histogram has a
+ * fixed size, while percentiles are still accurate to a factor of two.
+ */
+@interface MTXLatencyHistogram: OFObject <OFCopying>
+/**
+ * @brief The number of durations added.
+ */
+@property (readonly, nonatomic) unsigned long long count;
+
+/**
+ * @brief The sum of all durations added.
+ */
+@property (readonly, nonatomic) OFTimeInterval sum;
+
+/**
+ * @brief The shortest duration added, or 0 if none was added.
+ */
+@property (readonly, nonatomic) OFTimeInterval minimum;
+
+/**
+ * @brief The longest duration added, or 0 if none was added.
+ */
+@property (readonly, nonatomic) OFTimeInterval maximum;
+
+/**
+ * @brief The mean of all durations added, or 0 if none was added.
+ */
+@property (readonly, nonatomic) OFTimeInterval mean;
+
+/**
+ * @brief Creates a new, empty histogram.
+ *
+ * @return An autoreleased MTXLatencyHistogram
+ */
++ (instancetype)histogram;
+
+/**
+ * @brief Adds the specified duration to the histogram.
+ *
+ * @param duration The duration to add
+ */
+- (void)addDuration: (OFTimeInterval)duration;
+
+/**
+ * @brief Adds all durations of the specified histogram to the histogram.
+ *
+ * @param histogram The histogram whose durations to add
+ */
+- (void)addHistogram: (MTXLatencyHistogram *)histogram;
+
+/**
+ * @brief Returns an upper bound for the specified percentile of the durations.
+ *
+ * @param percentile The percentile, between 0 and 100
+ * @return An upper bound for the percentile, which is at most twice the actual
+ *	   value, or 0 if no duration was added
+ */
+- (OFTimeInterval)durationAtPercentile: (double)percentile;
+
+/**
+ * @brief Removes all durations from the histogram.
+ */
+- (void)reset;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#import "MTXLatencyHistogram.h"
+
+/*
+ * Bucket 0 is for durations below one microsecond, bucket i for durations
+ * below 2^(i-1) microseconds. The last bucket also takes all longer durations.
+ */
+#define NUM_BUCKETS 40
+
+@implementation MTXLatencyHistogram
+{
+	unsigned long long _buckets[NUM_BUCKETS];
+}
+
++ (instancetype)histogram
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (id)copy
+{
+	MTXLatencyHistogram *copy = [[MTXLatencyHistogram alloc] init];
+
+	memcpy(copy->_buckets, _buckets, sizeof(_buckets));
+	copy->_count = _count;
+	copy->_sum = _sum;
+	copy->_minimum = _minimum;
+	copy->_maximum = _maximum;
+
+	return copy;
+}
+
+- (OFTimeInterval)mean
+{
+	return (_count > 0 ? _sum / _count : 0);
+}
+
+- (void)addDuration: (OFTimeInterval)duration
+{
+	double microseconds = duration * 1000000;
+	size_t bucket = 0;
+
+	if (duration < 0)
+		duration = microseconds = 0;
+
+	for (double bound = 1; bucket < NUM_BUCKETS - 1 &&
+	    microseconds >= bound; bound *= 2)
+		bucket++;
+
+	_buckets[bucket]++;
+
+	if (_count == 0 || duration < _minimum)
+		_minimum = duration;
+	if (_count == 0 || duration > _maximum)
+		_maximum = duration;
+
+	_count++;
+	_sum += duration;
+}
+
+- (void)addHistogram: (MTXLatencyHistogram *)histogram
+{
+	if (histogram->_count == 0)
+		return;
+
+	for (size_t i = 0; i < NUM_BUCKETS; i++)
+		_buckets[i] += histogram->_buckets[i];
+
+	if (_count == 0 || histogram->_minimum < _minimum)
+		_minimum = histogram->_minimum;
+	if (_count == 0 || histogram->_maximum > _maximum)
+		_maximum = histogram->_maximum;
+
+	_count += histogram->_count;
+	_sum += histogram->_sum;
+}
+
+- (OFTimeInterval)durationAtPercentile: (double)percentile
+{
+	unsigned long long seen = 0, needed;
+
+	if (_count == 0)
+		return 0;
+
+	if (percentile < 0)
+		percentile = 0;
+	if (percentile > 100)
+		percentile = 100;
+
+	needed = (unsigned long long)(_count * percentile / 100);
+	if (needed == 0)
+		needed = 1;
+
+	for (size_t i = 0; i < NUM_BUCKETS; i++) {
+		seen += _buckets[i];
+
+		if (seen >= needed) {
+			OFTimeInterval bound = (OFTimeInterval)
+			    (1ull << i) / 1000000;
+
+			/* The minimum and maximum are more accurate. */
+			if (bound > _maximum || i == NUM_BUCKETS - 1)
+				return _maximum;
+			if (bound < _minimum)
+				return _minimum;
+
+			return bound;
+		}
+	}
+
+	return _maximum;
+}
+
+- (void)reset
+{
+	memset(_buckets, 0, sizeof(_buckets));
+	_count = 0;
+	_sum = _minimum = _maximum = 0;
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat:
+	    @"<%@ count=%llu mean=%f p50=%f p99=%f max=%f>",
+	    self.class, _count, self.mean, [self durationAtPercentile: 50],
+	    [self durationAtPercentile: 99], _maximum];
+}
+@end
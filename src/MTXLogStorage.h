@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXStorage.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief Log-structured storage for @ref MTXClient.
+ *
+ * All changes are appended to a log file. Every transaction is written as a
+ * single checksummed batch, so that it is committed atomically: A batch that
+ * was only partially written when the process died is discarded when the log
+ * is opened again.
+ *
+ * When the log is opened, it is memory-mapped and an index of it is built in
+ * memory. Small values like the next batches, the joined rooms and the room
+ * members are kept in the index, while timeline and state events are only
+ * decoded from the mapped log when they are read.
+ *
+ * Once the log has grown to twice its size after the last compaction, a
+ * snapshot of the live records is written to a new log in the background,
+ * which then replaces the old log.
+ *
+ * If a nested transaction is rolled back, the outermost transaction is rolled
+ * back as well. Rolling back a transaction rebuilds the index from the log.
+ */
+@interface MTXLogStorage: OFObject <MTXStorage>
+/**
+ * @brief Creates a new log-structured storage for @ref MTXClient.
+ *
+ * @param IRI The IRI for the log file
+ * @return An autoreleased MTXLogStorage
+ */
++ (instancetype)storageWithIRI: (OFIRI *)IRI;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated MTXLogStorage.
+ *
+ * @param IRI The IRI for the log file
+ * @return An initialized MTXLogStorage
+ */
+- (instancetype)initWithIRI: (OFIRI *)IRI OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
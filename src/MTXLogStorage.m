@@ -0,0 +1,1859 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#import "MTXLogStorage.h"
+#import "MTXIdentifierTable.h"
+#import "MTXOutgoingEvent.h"
+#import "MTXTimelineEntry.h"
+
+/*
+ * The log is a sequence of batches. Every batch starts with the length of its
+ * operations and their CRC32, both big endian, and every operation in a batch
+ * is a MessagePack array prefixed with its big endian length.
+ */
+static const size_t batchHeaderSize = 8;
+static const size_t operationHeaderSize = 4;
+
+/* The log is not compacted before it has reached this size. */
+static const uint64_t minCompactionSize = 1024 * 1024;
+
+/* See MTXSQLite3Storage.m. */
+static const int64_t chunkMiddle = INT64_C(1) << 31;
+
+static OFString *const memberships[] = {
+	@"invite", @"join", @"knock", @"leave", @"ban"
+};
+#define numMemberships (sizeof(memberships) / sizeof(*memberships))
+
+typedef enum {
+	MTXLogOperationSetNextBatch,
+	MTXLogOperationAddJoinedRooms,
+	MTXLogOperationRemoveJoinedRooms,
+	MTXLogOperationSetFilterID,
+	MTXLogOperationInsertTimelineEntry,
+	MTXLogOperationRemoveTimelineEntry,
+	MTXLogOperationSetStateEvent,
+	MTXLogOperationSetMember,
+	MTXLogOperationAddOutgoingEvent,
+	MTXLogOperationRemoveOutgoingEvent,
+	MTXLogOperationTrackDeviceLists,
+	MTXLogOperationMarkDeviceListsOutdated,
+	MTXLogOperationUntrackDeviceLists,
+	MTXLogOperationSetDevices,
+	MTXLogOperationAddToDeviceEvents,
+	MTXLogOperationRemoveToDeviceEvents,
+	MTXLogOperationSetSlidingSyncPosition
+} MTXLogOperation;
+
+static uint32_t CRC32Table[256];
+
+static uint32_t
+CRC32(const unsigned char *bytes, size_t length)
+{
+	uint32_t CRC = ~UINT32_C(0);
+
+	for (size_t i = 0; i < length; i++)
+		CRC = CRC32Table[(CRC ^ bytes[i]) & 0xFF] ^ (CRC >> 8);
+
+	return ~CRC;
+}
+
+static uint32_t
+readUInt32(const unsigned char *bytes)
+{
+	uint32_t value;
+
+	memcpy(&value, bytes, sizeof(value));
+
+	return OFFromBigEndian32(value);
+}
+
+static size_t
+membershipIndex(OFString *membership)
+{
+	for (size_t i = 0; i < numMemberships; i++)
+		if ([memberships[i] isEqual: membership])
+			return i;
+
+	return numMemberships;
+}
+
+static id
+nilIfNull(id object)
+{
+	return (object != [OFNull null] ? object : nil);
+}
+
+static id
+nullIfNil(id object)
+{
+	return (object != nil ? object : [OFNull null]);
+}
+
+static void
+writeAll(int fd, const void *bytes, size_t length, uint64_t offset, id object)
+{
+	size_t written = 0;
+
+	while (written < length) {
+		ssize_t ret = pwrite(fd, (const char *)bytes + written,
+		    length - written, (off_t)(offset + written));
+
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		if (ret <= 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: object
+				requestedLength: length
+				   bytesWritten: written
+					  errNo: (ret < 0 ? errno : EIO)];
+
+		written += ret;
+	}
+
+	if (fsync(fd) != 0)
+		@throw [OFWriteFailedException exceptionWithObject: object
+						   requestedLength: length
+						      bytesWritten: written
+							     errNo: errno];
+}
+
+/* An operation in the log that is referenced from the index. */
+@interface MTXLogStorageRecord: OFObject
+@property (nonatomic) uint64_t offset, compactedOffset;
+@property (nonatomic) uint32_t length;
+@property (nonatomic) int64_t position;
+@property (copy, nullable, nonatomic) OFString *eventID, *gapToken;
+@end
+
+@interface MTXLogStorageRoom: OFObject
+{
+	size_t _memberCounts[numMemberships];
+}
+
+/* Ordered by position. */
+@property (readonly, nonatomic)
+    OFMutableArray<MTXLogStorageRecord *> *timeline;
+@property (readonly, nonatomic) OFMutableSet<OFString *> *timelineEventIDs;
+/* Type -> state key -> record. */
+@property (readonly, nonatomic) OFMutableDictionary<OFString *,
+    OFMutableDictionary<OFString *, MTXLogStorageRecord *> *> *state;
+@property (readonly, nonatomic)
+    OFMutableDictionary<OFString *, OFNumber *> *memberships;
+@property (readonly, nonatomic)
+    OFMutableDictionary<OFString *, OFString *> *displayNames;
+
+- (size_t)indexOfPosition: (int64_t)position;
+- (void)setMembership: (size_t)membership
+	  displayName: (nullable OFString *)displayName
+	       ofUser: (OFString *)userID;
+- (size_t)numberOfMembersWithMembership: (size_t)membership;
+@end
+
+/*
+ * A compaction that is running in the background. The snapshot contains all
+ * records up to the log size, while the batches committed afterwards are
+ * collected in the tail, to be appended once the snapshot has been written.
+ */
+@interface MTXLogStorageCompaction: OFObject
+{
+	OFMutex *_mutex;
+	bool _done;
+}
+
+@property (readonly, nonatomic) OFData *snapshot;
+@property (readonly, nonatomic) uint64_t logSize;
+@property (readonly, nonatomic) OFMutableData *tail;
+@property (retain, nullable) id exception;
+@property (getter=isDone) bool done;
+
+- (instancetype)initWithSnapshot: (OFData *)snapshot logSize: (uint64_t)logSize;
+@end
+
+@implementation MTXLogStorageRecord
+@synthesize offset = _offset, compactedOffset = _compactedOffset;
+@synthesize length = _length, position = _position;
+@synthesize eventID = _eventID, gapToken = _gapToken;
+
+- (void)dealloc
+{
+	[_eventID release];
+	[_gapToken release];
+
+	[super dealloc];
+}
+@end
+
+@implementation MTXLogStorageRoom
+@synthesize timeline = _timeline, timelineEventIDs = _timelineEventIDs;
+@synthesize state = _state, memberships = _memberships;
+@synthesize displayNames = _displayNames;
+
+- (instancetype)init
+{
+	self = [super init];
+
+	@try {
+		_timeline = [[OFMutableArray alloc] init];
+		_timelineEventIDs = [[OFMutableSet alloc] init];
+		_state = [[OFMutableDictionary alloc] init];
+		_memberships = [[OFMutableDictionary alloc] init];
+		_displayNames = [[OFMutableDictionary alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_timeline release];
+	[_timelineEventIDs release];
+	[_state release];
+	[_memberships release];
+	[_displayNames release];
+
+	[super dealloc];
+}
+
+/* Returns the index of the first entry at or after the position. */
+- (size_t)indexOfPosition: (int64_t)position
+{
+	size_t low = 0, high = _timeline.count;
+
+	while (low < high) {
+		size_t middle = low + (high - low) / 2;
+
+		if ([_timeline objectAtIndex: middle].position < position)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	return low;
+}
+
+- (void)setMembership: (size_t)membership
+	  displayName: (OFString *)displayName
+	       ofUser: (OFString *)userID
+{
+	OFNumber *oldMembership = _memberships[userID];
+
+	if (oldMembership != nil)
+		_memberCounts[oldMembership.unsignedLongLongValue]--;
+
+	_memberships[userID] = @(membership);
+	_memberCounts[membership]++;
+
+	if (displayName != nil)
+		_displayNames[userID] = displayName;
+	else
+		[_displayNames removeObjectForKey: userID];
+}
+
+- (size_t)numberOfMembersWithMembership: (size_t)membership
+{
+	return _memberCounts[membership];
+}
+@end
+
+@implementation MTXLogStorageCompaction
+@synthesize snapshot = _snapshot, logSize = _logSize, tail = _tail;
+@synthesize exception = _exception;
+
+- (instancetype)initWithSnapshot: (OFData *)snapshot logSize: (uint64_t)logSize
+{
+	self = [super init];
+
+	@try {
+		_mutex = [[OFMutex alloc] init];
+		_snapshot = [snapshot copy];
+		_logSize = logSize;
+		_tail = [[OFMutableData alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_mutex release];
+	[_snapshot release];
+	[_tail release];
+	[_exception release];
+
+	[super dealloc];
+}
+
+- (bool)isDone
+{
+	[_mutex lock];
+	bool done = _done;
+	[_mutex unlock];
+
+	return done;
+}
+
+- (void)setDone: (bool)done
+{
+	[_mutex lock];
+	_done = done;
+	[_mutex unlock];
+}
+@end
+
+@implementation MTXLogStorage
+{
+	OFString *_path, *_compactionPath;
+	int _fd;
+	const unsigned char *_map;
+	size_t _mapSize;
+	uint64_t _logSize, _compactedSize;
+	OFMutableData *_pending;
+	size_t _transactionDepth;
+	bool _rollBack, _directoryNeedsSync;
+	OFMutableDictionary<OFString *, OFString *> *_nextBatches;
+	OFMutableDictionary<OFString *, OFString *> *_slidingSyncPositions;
+	OFMutableDictionary<OFString *, OFMutableSet<OFString *> *>
+	    *_joinedRooms;
+	OFMutableDictionary<OFString *,
+	    OFMutableDictionary<OFString *, OFString *> *> *_filterIDs;
+	OFMutableDictionary<OFString *, MTXLogStorageRoom *> *_rooms;
+	OFMutableDictionary<OFString *, OFMutableArray<MTXOutgoingEvent *> *>
+	    *_outgoingEvents;
+	/* Device ID -> user ID -> devices, or OFNull if never fetched. */
+	OFMutableDictionary<OFString *, OFMutableDictionary<OFString *, id> *>
+	    *_deviceLists;
+	OFMutableDictionary<OFString *, OFMutableSet<OFString *> *>
+	    *_outdatedDeviceLists;
+	OFMutableDictionary<OFString *, OFMutableArray<OFDictionary *> *>
+	    *_toDeviceEvents;
+	MTXLogStorageCompaction *_compaction;
+	OFThread *_compactionThread;
+}
+
++ (void)initialize
+{
+	if (self != [MTXLogStorage class])
+		return;
+
+	for (uint32_t i = 0; i < 256; i++) {
+		uint32_t CRC = i;
+
+		for (uint_fast8_t j = 0; j < 8; j++)
+			CRC = (CRC & 1 ? (CRC >> 1) ^ 0xEDB88320 : CRC >> 1);
+
+		CRC32Table[i] = CRC;
+	}
+}
+
++ (instancetype)storageWithIRI: (OFIRI *)IRI
+{
+	return [[[self alloc] initWithIRI: IRI] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithIRI: (OFIRI *)IRI
+{
+	self = [super init];
+
+	_fd = -1;
+
+	@try {
+		void *pool = objc_autoreleasePoolPush();
+
+		_path = [IRI.fileSystemRepresentation copy];
+		_compactionPath =
+		    [[_path stringByAppendingString: @".compact"] retain];
+		_pending = [[OFMutableData alloc] init];
+
+		const char *path =
+		    [_path cStringWithEncoding: [OFLocale encoding]];
+
+		if ((_fd = open(path, O_RDWR | O_CREAT, 0600)) == -1)
+			@throw [OFOpenItemFailedException
+			    exceptionWithIRI: IRI
+					mode: @"r+"
+				       errNo: errno];
+
+		[self readLog];
+		_compactedSize = _logSize;
+
+		objc_autoreleasePoolPop(pool);
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[self discardCompaction];
+
+	if (_map != NULL)
+		munmap((void *)_map, _mapSize);
+	if (_fd != -1)
+		close(_fd);
+
+	[_path release];
+	[_compactionPath release];
+	[_pending release];
+	[_nextBatches release];
+	[_slidingSyncPositions release];
+	[_joinedRooms release];
+	[_filterIDs release];
+	[_rooms release];
+	[_outgoingEvents release];
+	[_deviceLists release];
+	[_outdatedDeviceLists release];
+	[_toDeviceEvents release];
+
+	[super dealloc];
+}
+
+- (void)mapLogOfSize: (uint64_t)size
+{
+	if (size <= _mapSize)
+		return;
+
+	/*
+	 * Map twice the size, so that the log can grow for a while without
+	 * remapping. Only the part that has been written is ever accessed.
+	 */
+	long pageSize = sysconf(_SC_PAGESIZE);
+	uint64_t mapSize = (size < minCompactionSize / 2
+	    ? minCompactionSize : size * 2);
+	mapSize = (mapSize + pageSize - 1) / pageSize * pageSize;
+
+	if (mapSize > SIZE_MAX)
+		@throw [OFOutOfRangeException exception];
+
+	if (_map != NULL) {
+		munmap((void *)_map, _mapSize);
+		_map = NULL;
+		_mapSize = 0;
+	}
+
+	void *map = mmap(NULL, (size_t)mapSize, PROT_READ, MAP_SHARED, _fd, 0);
+	if (map == MAP_FAILED)
+		@throw [OFOutOfMemoryException
+		    exceptionWithRequestedSize: (size_t)mapSize];
+
+	_map = map;
+	_mapSize = (size_t)mapSize;
+}
+
+- (const unsigned char *)bytesAtOffset: (uint64_t)offset
+{
+	/* Written in the current transaction, but not committed yet. */
+	if (offset >= _logSize)
+		return (const unsigned char *)_pending.items +
+		    (offset - _logSize);
+
+	[self mapLogOfSize: _logSize];
+
+	return _map + offset;
+}
+
+- (OFArray *)operationAtOffset: (uint64_t)offset length: (uint32_t)length
+{
+	OFData *data = [OFData
+	    dataWithItemsNoCopy: (void *)[self bytesAtOffset: offset]
+			  count: length
+		   freeWhenDone: false];
+	OFArray *operation = data.objectByParsingMessagePack;
+
+	if (![operation isKindOfClass: OFArray.class] || operation.count < 1)
+		@throw [OFInvalidFormatException exception];
+
+	return operation;
+}
+
+- (OFArray *)operationForRecord: (MTXLogStorageRecord *)record
+{
+	return [self operationAtOffset: record.offset length: record.length];
+}
+
+- (void)resetIndex
+{
+	[_nextBatches release];
+	[_slidingSyncPositions release];
+	[_joinedRooms release];
+	[_filterIDs release];
+	[_rooms release];
+	[_outgoingEvents release];
+	[_deviceLists release];
+	[_outdatedDeviceLists release];
+	[_toDeviceEvents release];
+
+	_nextBatches = [[OFMutableDictionary alloc] init];
+	_slidingSyncPositions = [[OFMutableDictionary alloc] init];
+	_joinedRooms = [[OFMutableDictionary alloc] init];
+	_filterIDs = [[OFMutableDictionary alloc] init];
+	_rooms = [[OFMutableDictionary alloc] init];
+	_outgoingEvents = [[OFMutableDictionary alloc] init];
+	_deviceLists = [[OFMutableDictionary alloc] init];
+	_outdatedDeviceLists = [[OFMutableDictionary alloc] init];
+	_toDeviceEvents = [[OFMutableDictionary alloc] init];
+}
+
+/*
+ * Builds the index by replaying all complete batches of the log and discards
+ * a partially written batch at its end.
+ */
+- (void)readLog
+{
+	struct stat st;
+
+	if (fstat(_fd, &st) != 0)
+		@throw [OFReadFailedException exceptionWithObject: self
+						  requestedLength: 0
+							    errNo: errno];
+
+	uint64_t size = st.st_size, offset = 0;
+
+	[self resetIndex];
+	[self mapLogOfSize: size];
+	_logSize = size;
+
+	while (size - offset >= batchHeaderSize) {
+		const unsigned char *batch = _map + offset;
+		uint32_t length = readUInt32(batch);
+
+		if (length > size - offset - batchHeaderSize ||
+		    CRC32(batch + batchHeaderSize, length) !=
+		    readUInt32(batch + 4))
+			break;
+
+		uint64_t operationOffset = offset + batchHeaderSize;
+		uint64_t end = operationOffset + length;
+
+		while (operationOffset < end) {
+			void *pool = objc_autoreleasePoolPush();
+			uint32_t operationLength;
+
+			if (end - operationOffset < operationHeaderSize)
+				@throw [OFInvalidFormatException exception];
+
+			operationLength = readUInt32(_map + operationOffset);
+			operationOffset += operationHeaderSize;
+
+			if (operationLength > end - operationOffset)
+				@throw [OFInvalidFormatException exception];
+
+			[self applyOperation:
+			    [self operationAtOffset: operationOffset
+					     length: operationLength]
+				      offset: operationOffset
+				      length: operationLength];
+
+			operationOffset += operationLength;
+
+			objc_autoreleasePoolPop(pool);
+		}
+
+		offset = end;
+	}
+
+	if (offset < size) {
+		if (ftruncate(_fd, (off_t)offset) != 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: 0
+				   bytesWritten: 0
+					  errNo: errno];
+
+		_logSize = offset;
+	}
+}
+
+- (MTXLogStorageRoom *)roomWithID: (OFString *)roomID create: (bool)create
+{
+	MTXLogStorageRoom *room = _rooms[roomID];
+
+	if (room == nil && create) {
+		room = [[[MTXLogStorageRoom alloc] init] autorelease];
+		_rooms[[[MTXIdentifierTable sharedTable]
+		    internIdentifier: roomID]] = room;
+	}
+
+	return room;
+}
+
+- (OFMutableDictionary<OFString *, id> *)deviceListsForDeviceID:
+    (OFString *)deviceID
+{
+	OFMutableDictionary *deviceLists = _deviceLists[deviceID];
+
+	if (deviceLists == nil) {
+		deviceLists = [OFMutableDictionary dictionary];
+		_deviceLists[deviceID] = deviceLists;
+	}
+
+	return deviceLists;
+}
+
+- (OFMutableSet<OFString *> *)outdatedDeviceListsForDeviceID:
+    (OFString *)deviceID
+{
+	OFMutableSet *outdated = _outdatedDeviceLists[deviceID];
+
+	if (outdated == nil) {
+		outdated = [OFMutableSet set];
+		_outdatedDeviceLists[deviceID] = outdated;
+	}
+
+	return outdated;
+}
+
+- (void)applyOperation: (OFArray *)operation
+		offset: (uint64_t)offset
+		length: (uint32_t)length
+{
+	switch ([[operation objectAtIndex: 0] unsignedIntValue]) {
+	case MTXLogOperationSetNextBatch:
+		_nextBatches[operation[1]] = operation[2];
+		break;
+	case MTXLogOperationSetSlidingSyncPosition:
+		if (operation[2] != [OFNull null])
+			_slidingSyncPositions[operation[1]] = operation[2];
+		else
+			[_slidingSyncPositions
+			    removeObjectForKey: operation[1]];
+		break;
+	case MTXLogOperationAddJoinedRooms: {
+		OFMutableSet *joinedRooms = _joinedRooms[operation[1]];
+
+		if (joinedRooms == nil) {
+			joinedRooms = [OFMutableSet set];
+			_joinedRooms[operation[1]] = joinedRooms;
+		}
+
+		for (OFString *roomID in operation[2])
+			[joinedRooms addObject: [[MTXIdentifierTable
+			    sharedTable] internIdentifier: roomID]];
+
+		break;
+	}
+	case MTXLogOperationRemoveJoinedRooms:
+		for (OFString *roomID in operation[2])
+			[_joinedRooms[operation[1]] removeObject: roomID];
+
+		break;
+	case MTXLogOperationSetFilterID: {
+		OFMutableDictionary *filterIDs = _filterIDs[operation[1]];
+
+		if (filterIDs == nil) {
+			filterIDs = [OFMutableDictionary dictionary];
+			_filterIDs[operation[1]] = filterIDs;
+		}
+
+		filterIDs[operation[2]] = operation[3];
+		break;
+	}
+	case MTXLogOperationInsertTimelineEntry: {
+		MTXLogStorageRoom *room = [self roomWithID: operation[1]
+						    create: true];
+		OFMutableArray *timeline = room.timeline;
+		OFDictionary *event = nilIfNull(operation[3]);
+		OFString *eventID = event[@"event_id"];
+		MTXLogStorageRecord *record =
+		    [[[MTXLogStorageRecord alloc] init] autorelease];
+
+		record.offset = offset;
+		record.length = length;
+		record.position = [operation[2] longLongValue];
+		record.gapToken = nilIfNull(operation[4]);
+
+		if ([eventID isKindOfClass: OFString.class]) {
+			record.eventID = eventID;
+			[room.timelineEventIDs addObject: eventID];
+		}
+
+		size_t idx = [room indexOfPosition: record.position];
+
+		if (idx < timeline.count &&
+		    [timeline objectAtIndex: idx].position == record.position)
+			[timeline replaceObjectAtIndex: idx withObject: record];
+		else
+			[timeline insertObject: record atIndex: idx];
+
+		break;
+	}
+	case MTXLogOperationRemoveTimelineEntry: {
+		MTXLogStorageRoom *room = [self roomWithID: operation[1]
+						    create: true];
+		OFMutableArray<MTXLogStorageRecord *> *timeline = room.timeline;
+		int64_t position = [operation[2] longLongValue];
+		size_t idx = [room indexOfPosition: position];
+
+		if (idx < timeline.count &&
+		    [timeline objectAtIndex: idx].position == position) {
+			OFString *eventID = [timeline objectAtIndex: idx]
+			    .eventID;
+
+			if (eventID != nil)
+				[room.timelineEventIDs removeObject: eventID];
+
+			[timeline removeObjectAtIndex: idx];
+		}
+
+		break;
+	}
+	case MTXLogOperationSetStateEvent: {
+		OFMutableDictionary *state = [self roomWithID: operation[1]
+						       create: true].state;
+		OFMutableDictionary *stateOfType = state[operation[2]];
+		MTXLogStorageRecord *record =
+		    [[[MTXLogStorageRecord alloc] init] autorelease];
+
+		if (stateOfType == nil) {
+			stateOfType = [OFMutableDictionary dictionary];
+			state[[[MTXIdentifierTable sharedTable]
+			    internIdentifier: operation[2]]] = stateOfType;
+		}
+
+		record.offset = offset;
+		record.length = length;
+		stateOfType[operation[3]] = record;
+
+		break;
+	}
+	case MTXLogOperationSetMember: {
+		size_t membership =
+		    (size_t)[operation[3] unsignedLongLongValue];
+
+		if (membership >= numMemberships)
+			@throw [OFInvalidFormatException exception];
+
+		[[self roomWithID: operation[1] create: true]
+		    setMembership: membership
+		      displayName: nilIfNull(operation[4])
+			   ofUser: operation[2]];
+
+		break;
+	}
+	case MTXLogOperationAddOutgoingEvent: {
+		OFMutableArray *outgoingEvents = _outgoingEvents[operation[1]];
+
+		if (outgoingEvents == nil) {
+			outgoingEvents = [OFMutableArray array];
+			_outgoingEvents[operation[1]] = outgoingEvents;
+		}
+
+		[outgoingEvents addObject: [MTXOutgoingEvent
+		    eventWithTransactionID: operation[2]
+				    roomID: operation[3]
+				      type: operation[4]
+				   content: operation[5]]];
+
+		break;
+	}
+	case MTXLogOperationRemoveOutgoingEvent: {
+		OFMutableArray<MTXOutgoingEvent *> *outgoingEvents =
+		    _outgoingEvents[operation[1]];
+
+		for (size_t i = 0; i < outgoingEvents.count; i++) {
+			if ([[outgoingEvents objectAtIndex: i].transactionID
+			    isEqual: operation[2]]) {
+				[outgoingEvents removeObjectAtIndex: i];
+				break;
+			}
+		}
+
+		break;
+	}
+	case MTXLogOperationTrackDeviceLists: {
+		OFMutableDictionary *deviceLists =
+		    [self deviceListsForDeviceID: operation[1]];
+		OFMutableSet *outdated =
+		    [self outdatedDeviceListsForDeviceID: operation[1]];
+
+		for (OFString *userID in operation[2]) {
+			if (deviceLists[userID] != nil)
+				continue;
+
+			deviceLists[userID] = [OFNull null];
+			[outdated addObject: userID];
+		}
+
+		break;
+	}
+	case MTXLogOperationMarkDeviceListsOutdated: {
+		OFMutableDictionary *deviceLists = _deviceLists[operation[1]];
+		OFMutableSet *outdated =
+		    [self outdatedDeviceListsForDeviceID: operation[1]];
+
+		for (OFString *userID in operation[2])
+			if (deviceLists[userID] != nil)
+				[outdated addObject: userID];
+
+		break;
+	}
+	case MTXLogOperationUntrackDeviceLists:
+		for (OFString *userID in operation[2]) {
+			[_deviceLists[operation[1]] removeObjectForKey: userID];
+			[_outdatedDeviceLists[operation[1]]
+			    removeObject: userID];
+		}
+
+		break;
+	case MTXLogOperationSetDevices: {
+		OFString *userID = operation[2];
+		OFMutableSet *outdated =
+		    [self outdatedDeviceListsForDeviceID: operation[1]];
+
+		[self deviceListsForDeviceID: operation[1]][userID] =
+		    operation[3];
+
+		if ([operation[4] boolValue])
+			[outdated addObject: userID];
+		else
+			[outdated removeObject: userID];
+
+		break;
+	}
+	case MTXLogOperationAddToDeviceEvents: {
+		OFMutableArray *toDeviceEvents = _toDeviceEvents[operation[1]];
+
+		if (toDeviceEvents == nil) {
+			toDeviceEvents = [OFMutableArray array];
+			_toDeviceEvents[operation[1]] = toDeviceEvents;
+		}
+
+		[toDeviceEvents addObjectsFromArray: operation[2]];
+		break;
+	}
+	case MTXLogOperationRemoveToDeviceEvents: {
+		OFMutableArray *toDeviceEvents = _toDeviceEvents[operation[1]];
+		size_t count = (size_t)[operation[2] unsignedLongLongValue];
+
+		if (count > toDeviceEvents.count)
+			count = toDeviceEvents.count;
+
+		[toDeviceEvents removeObjectsInRange: OFMakeRange(0, count)];
+		break;
+	}
+	default:
+		@throw [OFInvalidFormatException exception];
+	}
+}
+
+/* Appends the operation to the current transaction and applies it. */
+- (void)writeOperation: (OFArray *)operation
+{
+	OFData *data = operation.messagePackRepresentation;
+	size_t count = data.count;
+
+	if (count > UINT32_MAX)
+		@throw [OFOutOfRangeException exception];
+
+	if (_pending.count == 0)
+		[_pending increaseCountBy: batchHeaderSize];
+
+	uint32_t length = OFToBigEndian32((uint32_t)count);
+	[_pending addItems: &length count: sizeof(length)];
+
+	uint64_t offset = _logSize + _pending.count;
+	[_pending addItems: data.items count: count];
+
+	[self applyOperation: operation offset: offset length: (uint32_t)count];
+}
+
+- (void)commit
+{
+	size_t count = _pending.count;
+
+	if (count == 0)
+		return;
+
+	if (count - batchHeaderSize > UINT32_MAX)
+		@throw [OFOutOfRangeException exception];
+
+	unsigned char *items = _pending.mutableItems;
+	uint32_t header[2] = {
+		OFToBigEndian32((uint32_t)(count - batchHeaderSize)),
+		OFToBigEndian32(CRC32(items + batchHeaderSize,
+		    count - batchHeaderSize))
+	};
+	memcpy(items, header, sizeof(header));
+
+	@try {
+		[self syncDirectory];
+		writeAll(_fd, items, count, _logSize, self);
+	} @catch (id e) {
+		[self rollBack];
+		@throw e;
+	}
+
+	[_compaction.tail addItems: items count: count];
+	[_pending removeAllItems];
+	_logSize += count;
+
+	[self finishCompaction];
+
+	if (_compaction == nil && _logSize >= minCompactionSize &&
+	    _logSize / 2 >= _compactedSize)
+		[self startCompaction];
+}
+
+- (void)rollBack
+{
+	[self discardCompaction];
+	[_pending removeAllItems];
+
+	/* Discard anything a failed commit might have written. */
+	if (ftruncate(_fd, (off_t)_logSize) != 0)
+		@throw [OFWriteFailedException exceptionWithObject: self
+						   requestedLength: 0
+						      bytesWritten: 0
+							     errNo: errno];
+
+	[self readLog];
+}
+
+- (void)transactionWithBlock: (MTXStorageTransactionBlock)block
+{
+	bool commit = false;
+
+	_transactionDepth++;
+	@try {
+		commit = block();
+	} @finally {
+		if (!commit)
+			_rollBack = true;
+
+		if (--_transactionDepth == 0) {
+			bool rollBack = _rollBack;
+
+			_rollBack = false;
+
+			if (rollBack) {
+				if (_pending.count > 0)
+					[self rollBack];
+			} else
+				[self commit];
+		}
+	}
+}
+
+static size_t
+appendOperation(OFMutableData *data, const void *bytes, size_t length)
+{
+	uint32_t header = OFToBigEndian32((uint32_t)length);
+
+	[data addItems: &header count: sizeof(header)];
+
+	size_t offset = data.count;
+	[data addItems: bytes count: length];
+
+	return offset;
+}
+
+static void
+appendNewOperation(OFMutableData *data, OFArray *operation)
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFData *encoded = operation.messagePackRepresentation;
+
+	appendOperation(data, encoded.items, encoded.count);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)copyRecord: (MTXLogStorageRecord *)record
+	    toData: (OFMutableData *)data
+{
+	record.compactedOffset = appendOperation(data,
+	    [self bytesAtOffset: record.offset], record.length);
+}
+
+/*
+ * Writes a snapshot of the index into a new batch. Events are copied from the
+ * log as they are, everything else is encoded from the index.
+ */
+- (OFData *)snapshot
+{
+	OFMutableData *snapshot = [OFMutableData data];
+
+	[snapshot increaseCountBy: batchHeaderSize];
+
+	for (OFString *deviceID in _nextBatches)
+		appendNewOperation(snapshot, @[
+			@(MTXLogOperationSetNextBatch),
+			deviceID, _nextBatches[deviceID]
+		]);
+
+	for (OFString *deviceID in _slidingSyncPositions)
+		appendNewOperation(snapshot, @[
+			@(MTXLogOperationSetSlidingSyncPosition),
+			deviceID, _slidingSyncPositions[deviceID]
+		]);
+
+	for (OFString *userID in _joinedRooms)
+		appendNewOperation(snapshot, @[
+			@(MTXLogOperationAddJoinedRooms),
+			userID, _joinedRooms[userID].allObjects
+		]);
+
+	for (OFString *userID in _filterIDs) {
+		OFDictionary *filterIDs = _filterIDs[userID];
+
+		for (OFString *filter in filterIDs)
+			appendNewOperation(snapshot, @[
+				@(MTXLogOperationSetFilterID),
+				userID, filter, filterIDs[filter]
+			]);
+	}
+
+	for (OFString *roomID in _rooms) {
+		MTXLogStorageRoom *room = _rooms[roomID];
+
+		for (MTXLogStorageRecord *record in room.timeline)
+			[self copyRecord: record toData: snapshot];
+
+		for (OFString *type in room.state)
+			for (MTXLogStorageRecord *record in
+			    room.state[type].objectEnumerator)
+				[self copyRecord: record toData: snapshot];
+
+		for (OFString *userID in room.memberships)
+			appendNewOperation(snapshot, @[
+				@(MTXLogOperationSetMember),
+				roomID, userID, room.memberships[userID],
+				nullIfNil(room.displayNames[userID])
+			]);
+	}
+
+	for (OFString *deviceID in _outgoingEvents)
+		for (MTXOutgoingEvent *event in _outgoingEvents[deviceID])
+			appendNewOperation(snapshot, @[
+				@(MTXLogOperationAddOutgoingEvent),
+				deviceID, event.transactionID, event.roomID,
+				event.type, event.content
+			]);
+
+	for (OFString *deviceID in _deviceLists) {
+		OFDictionary *deviceLists = _deviceLists[deviceID];
+		OFSet *outdated = _outdatedDeviceLists[deviceID];
+
+		for (OFString *userID in deviceLists)
+			appendNewOperation(snapshot, @[
+				@(MTXLogOperationSetDevices),
+				deviceID, userID, deviceLists[userID],
+				@([outdated containsObject: userID])
+			]);
+	}
+
+	for (OFString *deviceID in _toDeviceEvents)
+		if (_toDeviceEvents[deviceID].count > 0)
+			appendNewOperation(snapshot, @[
+				@(MTXLogOperationAddToDeviceEvents),
+				deviceID, _toDeviceEvents[deviceID]
+			]);
+
+	size_t count = snapshot.count - batchHeaderSize;
+
+	if (count > UINT32_MAX)
+		@throw [OFOutOfRangeException exception];
+
+	unsigned char *items = snapshot.mutableItems;
+	uint32_t header[2] = {
+		OFToBigEndian32((uint32_t)count),
+		OFToBigEndian32(CRC32(items + batchHeaderSize, count))
+	};
+	memcpy(items, header, sizeof(header));
+
+	return snapshot;
+}
+
+- (void)startCompaction
+{
+	void *pool = objc_autoreleasePoolPush();
+	MTXLogStorageCompaction *compaction = [[[MTXLogStorageCompaction alloc]
+	    initWithSnapshot: [self snapshot]
+		     logSize: _logSize] autorelease];
+	OFString *path = _compactionPath;
+
+	_compactionThread = [[OFThread threadWithBlock: ^ id (void) {
+		int fd = -1;
+
+		@try {
+			if ((fd = open(
+			    [path cStringWithEncoding: [OFLocale encoding]],
+			    O_WRONLY | O_CREAT | O_TRUNC, 0600)) == -1)
+				@throw [OFOpenItemFailedException
+				    exceptionWithPath: path
+						 mode: @"w"
+						errNo: errno];
+
+			writeAll(fd, compaction.snapshot.items,
+			    compaction.snapshot.count, 0, compaction);
+		} @catch (id e) {
+			compaction.exception = e;
+		} @finally {
+			if (fd != -1)
+				close(fd);
+		}
+
+		compaction.done = true;
+
+		return nil;
+	}] retain];
+	_compaction = [compaction retain];
+
+	[_compactionThread start];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)discardCompaction
+{
+	if (_compactionThread == nil)
+		return;
+
+	[_compactionThread join];
+	[_compactionThread release];
+	_compactionThread = nil;
+	[_compaction release];
+	_compaction = nil;
+
+	unlink([_compactionPath cStringWithEncoding: [OFLocale encoding]]);
+}
+
+/*
+ * Replaces the log with the compacted log if the snapshot has been written,
+ * after appending the batches that were committed in the meantime. If
+ * anything fails, the old log is still intact and compaction is tried again
+ * once the log has doubled again.
+ */
+- (void)finishCompaction
+{
+	if (_compaction == nil || !_compaction.done)
+		return;
+
+	MTXLogStorageCompaction *compaction =
+	    [[_compaction retain] autorelease];
+	uint64_t snapshotSize = compaction.snapshot.count;
+	OFData *tail = compaction.tail;
+	const char *path = [_path cStringWithEncoding: [OFLocale encoding]];
+	const char *compactionPath =
+	    [_compactionPath cStringWithEncoding: [OFLocale encoding]];
+	int fd = -1;
+
+	[_compactionThread join];
+	[_compactionThread release];
+	_compactionThread = nil;
+	[_compaction release];
+	_compaction = nil;
+
+	@try {
+		if (compaction.exception != nil)
+			@throw compaction.exception;
+
+		if ((fd = open(compactionPath, O_RDWR)) == -1)
+			@throw [OFOpenItemFailedException
+			    exceptionWithPath: _compactionPath
+					 mode: @"r+"
+					errNo: errno];
+
+		writeAll(fd, tail.items, tail.count, snapshotSize, self);
+
+		if (rename(compactionPath, path) != 0)
+			@throw [OFMoveItemFailedException
+			    exceptionWithSourceIRI: [OFIRI fileIRIWithPath:
+						       _compactionPath]
+				    destinationIRI: [OFIRI fileIRIWithPath:
+						       _path]
+					     errNo: errno];
+	} @catch (id e) {
+		if (fd != -1)
+			close(fd);
+
+		unlink(compactionPath);
+		_compactedSize = _logSize;
+
+		return;
+	}
+
+	close(_fd);
+	_fd = fd;
+
+	if (_map != NULL) {
+		munmap((void *)_map, _mapSize);
+		_map = NULL;
+		_mapSize = 0;
+	}
+
+	/*
+	 * Records from before the snapshot were copied into it, records from
+	 * after it are in the tail, which directly follows the snapshot.
+	 */
+	for (MTXLogStorageRoom *room in _rooms.objectEnumerator) {
+		for (MTXLogStorageRecord *record in room.timeline)
+			[self relocateRecord: record
+				  compaction: compaction
+				snapshotSize: snapshotSize];
+
+		for (OFDictionary *stateOfType in room.state.objectEnumerator)
+			for (MTXLogStorageRecord *record in
+			    stateOfType.objectEnumerator)
+				[self relocateRecord: record
+					  compaction: compaction
+					snapshotSize: snapshotSize];
+	}
+
+	_logSize = snapshotSize + tail.count;
+	_compactedSize = _logSize;
+
+	/*
+	 * The rename is only durable once the directory is synced. If that
+	 * fails, the next commit tries again before writing to the new log,
+	 * as its batch would be lost with the rename otherwise.
+	 */
+	_directoryNeedsSync = true;
+	@try {
+		[self syncDirectory];
+	} @catch (id e) {
+	}
+}
+
+- (void)syncDirectory
+{
+	if (!_directoryNeedsSync)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+	OFString *directory = _path.stringByDeletingLastPathComponent;
+	int fd;
+
+	if (directory.length == 0)
+		directory = @".";
+
+	if ((fd = open([directory cStringWithEncoding: [OFLocale encoding]],
+	    O_RDONLY)) == -1)
+		@throw [OFOpenItemFailedException exceptionWithPath: directory
+							       mode: @"r"
+							      errNo: errno];
+
+	@try {
+		if (fsync(fd) != 0)
+			@throw [OFWriteFailedException
+			    exceptionWithObject: self
+				requestedLength: 0
+				   bytesWritten: 0
+					  errNo: errno];
+	} @finally {
+		close(fd);
+	}
+
+	_directoryNeedsSync = false;
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)relocateRecord: (MTXLogStorageRecord *)record
+	    compaction: (MTXLogStorageCompaction *)compaction
+	  snapshotSize: (uint64_t)snapshotSize
+{
+	if (record.offset >= compaction.logSize)
+		record.offset = record.offset - compaction.logSize +
+		    snapshotSize;
+	else
+		record.offset = record.compactedOffset;
+}
+
+- (void)setNextBatch: (OFString *)nextBatch forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationSetNextBatch), deviceID, nextBatch
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)nextBatchForDeviceID: (OFString *)deviceID
+{
+	return [[_nextBatches[deviceID] retain] autorelease];
+}
+
+- (void)setSlidingSyncPosition: (OFString *)position
+		   forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationSetSlidingSyncPosition),
+			deviceID, nullIfNil(position)
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)slidingSyncPositionForDeviceID: (OFString *)deviceID
+{
+	return [[_slidingSyncPositions[deviceID] retain] autorelease];
+}
+
+- (void)addJoinedRoom: (OFString *)roomID forUser: (OFString *)userID
+{
+	[self addJoinedRooms: @[ roomID ] forUser: userID];
+}
+
+- (void)removeJoinedRoom: (OFString *)roomID forUser: (OFString *)userID
+{
+	[self removeJoinedRooms: @[ roomID ] forUser: userID];
+}
+
+- (void)addJoinedRooms: (OFArray<OFString *> *)roomIDs
+	       forUser: (OFString *)userID
+{
+	if (roomIDs.count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationAddJoinedRooms), userID, roomIDs
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)removeJoinedRooms: (OFArray<OFString *> *)roomIDs
+		  forUser: (OFString *)userID
+{
+	if (roomIDs.count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationRemoveJoinedRooms), userID, roomIDs
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFArray<OFString *> *)joinedRoomsForUser: (OFString *)userID
+{
+	OFArray *joinedRooms = _joinedRooms[userID].allObjects;
+
+	return (joinedRooms != nil ? joinedRooms : [OFArray array]);
+}
+
+- (void)setFilterID: (OFString *)filterID
+	  forFilter: (OFString *)filter
+	     userID: (OFString *)userID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationSetFilterID), userID, filter, filterID
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)filterIDForFilter: (OFString *)filter userID: (OFString *)userID
+{
+	return [[_filterIDs[userID][filter] retain] autorelease];
+}
+
+- (void)insertTimelineEntryInRoom: (OFString *)roomID
+			 position: (int64_t)position
+			    event: (OFDictionary<OFString *, id> *)event
+			 gapToken: (OFString *)gapToken
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self writeOperation: @[
+		@(MTXLogOperationInsertTimelineEntry),
+		roomID, @(position), nullIfNil(event), nullIfNil(gapToken)
+	]];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)appendTimelineEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		      toRoom: (OFString *)roomID
+		   prevBatch: (OFString *)prevBatch
+		     limited: (bool)limited
+{
+	[self transactionWithBlock: ^ {
+		MTXLogStorageRoom *room = [self roomWithID: roomID
+						    create: true];
+		MTXLogStorageRecord *last = room.timeline.lastObject;
+		int64_t position = last.position;
+
+		if (last == nil || limited) {
+			int64_t chunk =
+			    (last != nil ? (position >> 32) + 1 : 1);
+
+			position = (chunk << 32) | chunkMiddle;
+
+			if (prevBatch != nil)
+				[self insertTimelineEntryInRoom: roomID
+						       position: position
+							  event: nil
+						       gapToken: prevBatch];
+		}
+
+		for (OFDictionary<OFString *, id> *event in events) {
+			OFString *eventID = event[@"event_id"];
+
+			if ([eventID isKindOfClass: OFString.class] &&
+			    [room.timelineEventIDs containsObject: eventID])
+				continue;
+
+			if ((++position & UINT32_MAX) == 0)
+				@throw [OFOutOfRangeException exception];
+
+			[self insertTimelineEntryInRoom: roomID
+					       position: position
+						  event: event
+					       gapToken: nil];
+		}
+
+		return true;
+	}];
+}
+
+- (void)fillGapWithToken: (OFString *)gapToken
+		  inRoom: (OFString *)roomID
+		  events: (OFArray<OFDictionary<OFString *, id> *> *)events
+		endToken: (OFString *)endToken
+{
+	MTXLogStorageRoom *room = [self roomWithID: roomID create: false];
+	MTXLogStorageRecord *gap = nil;
+
+	for (MTXLogStorageRecord *record in room.timeline) {
+		if ([record.gapToken isEqual: gapToken]) {
+			gap = record;
+			break;
+		}
+	}
+
+	/* Already filled. */
+	if (gap == nil)
+		return;
+
+	[self transactionWithBlock: ^ {
+		void *pool = objc_autoreleasePoolPush();
+		int64_t position = gap.position;
+
+		[self writeOperation: @[
+			@(MTXLogOperationRemoveTimelineEntry),
+			roomID, @(position)
+		]];
+
+		for (OFDictionary<OFString *, id> *event in events) {
+			OFString *eventID = event[@"event_id"];
+
+			/* Reached events that are already stored. */
+			if ([eventID isKindOfClass: OFString.class] &&
+			    [room.timelineEventIDs containsObject: eventID]) {
+				objc_autoreleasePoolPop(pool);
+				return true;
+			}
+
+			[self insertTimelineEntryInRoom: roomID
+					       position: position
+						  event: event
+					       gapToken: nil];
+
+			if ((position-- & UINT32_MAX) == 0)
+				@throw [OFOutOfRangeException exception];
+		}
+
+		if (endToken != nil)
+			[self insertTimelineEntryInRoom: roomID
+					       position: position
+						  event: nil
+					       gapToken: endToken];
+
+		objc_autoreleasePoolPop(pool);
+
+		return true;
+	}];
+}
+
+- (OFArray<MTXTimelineEntry *> *)
+    timelineEntriesForRoom: (OFString *)roomID
+	    beforePosition: (int64_t)position
+		     limit: (size_t)limit
+{
+	OFMutableArray *entries = [OFMutableArray array];
+	MTXLogStorageRoom *room = [self roomWithID: roomID create: false];
+	OFArray<MTXLogStorageRecord *> *timeline = room.timeline;
+
+	for (size_t i = [room indexOfPosition: position];
+	    i > 0 && entries.count < limit; i--) {
+		void *pool = objc_autoreleasePoolPush();
+		MTXLogStorageRecord *record = [timeline objectAtIndex: i - 1];
+		OFDictionary *event = nil;
+
+		if (record.gapToken == nil)
+			event = nilIfNull(
+			    [self operationForRecord: record][3]);
+
+		[entries addObject: [MTXTimelineEntry
+		    entryWithPosition: record.position
+				event: event
+			     gapToken: record.gapToken]];
+
+		objc_autoreleasePoolPop(pool);
+	}
+
+	return entries;
+}
+
+- (void)applyStateEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		  toRoom: (OFString *)roomID
+{
+	[self transactionWithBlock: ^ {
+		for (OFDictionary<OFString *, id> *event in events) {
+			void *pool = objc_autoreleasePoolPush();
+			OFString *type = event[@"type"];
+			OFString *stateKey = event[@"state_key"];
+
+			if (![type isKindOfClass: OFString.class] ||
+			    ![stateKey isKindOfClass: OFString.class]) {
+				objc_autoreleasePoolPop(pool);
+				continue;
+			}
+
+			if ([type isEqual: @"m.room.member"]) {
+				OFDictionary<OFString *, id> *content =
+				    event[@"content"];
+				size_t membership = numMemberships;
+				OFString *displayName = nil;
+
+				if ([content isKindOfClass:
+				    OFDictionary.class]) {
+					membership = membershipIndex(
+					    content[@"membership"]);
+					displayName = content[@"displayname"];
+				}
+
+				if (membership == numMemberships) {
+					objc_autoreleasePoolPop(pool);
+					continue;
+				}
+
+				if (![displayName isKindOfClass:
+				    OFString.class])
+					displayName = nil;
+
+				[self writeOperation: @[
+					@(MTXLogOperationSetMember),
+					roomID, stateKey, @(membership),
+					nullIfNil(displayName)
+				]];
+			} else
+				[self writeOperation: @[
+					@(MTXLogOperationSetStateEvent),
+					roomID, type, stateKey, event
+				]];
+
+			objc_autoreleasePoolPop(pool);
+		}
+
+		return true;
+	}];
+}
+
+- (OFDictionary<OFString *, id> *)stateEventWithType: (OFString *)type
+					    stateKey: (OFString *)stateKey
+					      inRoom: (OFString *)roomID
+{
+	MTXLogStorageRecord *record =
+	    [self roomWithID: roomID create: false].state[type][stateKey];
+
+	if (record == nil)
+		return nil;
+
+	void *pool = objc_autoreleasePoolPush();
+	OFDictionary *event = [[self operationForRecord: record][4] retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [event autorelease];
+}
+
+- (OFString *)membershipOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	OFNumber *membership =
+	    [self roomWithID: roomID create: false].memberships[userID];
+
+	if (membership == nil)
+		return nil;
+
+	return memberships[membership.unsignedLongLongValue];
+}
+
+- (OFString *)displayNameOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	return [[[self roomWithID: roomID create: false].displayNames[userID]
+	    retain] autorelease];
+}
+
+- (size_t)numberOfMembersInRoom: (OFString *)roomID
+		 withMembership: (OFString *)membership
+{
+	size_t idx = membershipIndex(membership);
+
+	if (idx == numMemberships)
+		return 0;
+
+	return [[self roomWithID: roomID create: false]
+	    numberOfMembersWithMembership: idx];
+}
+
+- (void)addOutgoingEvent: (MTXOutgoingEvent *)event
+	     forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationAddOutgoingEvent),
+			deviceID, event.transactionID, event.roomID,
+			event.type, event.content
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)removeOutgoingEventWithTransactionID: (OFString *)transactionID
+				 forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationRemoveOutgoingEvent),
+			deviceID, transactionID
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFArray<MTXOutgoingEvent *> *)outgoingEventsForDeviceID:
+    (OFString *)deviceID
+{
+	OFArray *events = [[_outgoingEvents[deviceID] copy] autorelease];
+
+	return (events != nil ? events : [OFArray array]);
+}
+
+- (void)writeDeviceListOperation: (MTXLogOperation)operation
+			   users: (OFArray<OFString *> *)userIDs
+			deviceID: (OFString *)deviceID
+{
+	if (userIDs.count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[ @(operation), deviceID, userIDs ]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)trackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		    forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFDictionary *deviceLists = _deviceLists[deviceID];
+	OFMutableArray *untracked = [OFMutableArray array];
+
+	for (OFString *userID in userIDs)
+		if (deviceLists[userID] == nil)
+			[untracked addObject: userID];
+
+	[self writeDeviceListOperation: MTXLogOperationTrackDeviceLists
+				 users: untracked
+			      deviceID: deviceID];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)markDeviceListsOutdatedOfUsers: (OFArray<OFString *> *)userIDs
+			   forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFDictionary *deviceLists = _deviceLists[deviceID];
+	OFSet *outdated = _outdatedDeviceLists[deviceID];
+	OFMutableArray *changed = [OFMutableArray array];
+
+	/* Most changed users are not tracked, so only log the others. */
+	for (OFString *userID in userIDs)
+		if (deviceLists[userID] != nil &&
+		    ![outdated containsObject: userID])
+			[changed addObject: userID];
+
+	[self writeDeviceListOperation: MTXLogOperationMarkDeviceListsOutdated
+				 users: changed
+			      deviceID: deviceID];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)untrackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		      forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFDictionary *deviceLists = _deviceLists[deviceID];
+	OFMutableArray *tracked = [OFMutableArray array];
+
+	for (OFString *userID in userIDs)
+		if (deviceLists[userID] != nil)
+			[tracked addObject: userID];
+
+	[self writeDeviceListOperation: MTXLogOperationUntrackDeviceLists
+				 users: tracked
+			      deviceID: deviceID];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)setDevices: (OFDictionary<OFString *, OFDictionary *> *)devices
+	    ofUser: (OFString *)userID
+       forDeviceID: (OFString *)deviceID
+{
+	if (_deviceLists[deviceID][userID] == nil)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationSetDevices),
+			deviceID, userID, devices, @false
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFDictionary<OFString *, OFDictionary *> *)
+    devicesOfUser: (OFString *)userID
+      forDeviceID: (OFString *)deviceID
+{
+	return [[nilIfNull(_deviceLists[deviceID][userID]) retain]
+	    autorelease];
+}
+
+- (OFArray<OFString *> *)usersWithOutdatedDeviceListsForDeviceID:
+    (OFString *)deviceID
+{
+	OFArray *userIDs = _outdatedDeviceLists[deviceID].allObjects;
+
+	return (userIDs != nil ? userIDs : [OFArray array]);
+}
+
+- (void)addToDeviceEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+	      forDeviceID: (OFString *)deviceID
+{
+	if (events.count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationAddToDeviceEvents), deviceID, events
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFArray<OFDictionary<OFString *, id> *> *)toDeviceEventsForDeviceID:
+    (OFString *)deviceID
+{
+	OFArray *events = [[_toDeviceEvents[deviceID] copy] autorelease];
+
+	return (events != nil ? events : [OFArray array]);
+}
+
+- (void)removeFirstToDeviceEvents: (size_t)count
+		      forDeviceID: (OFString *)deviceID
+{
+	if (count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[self transactionWithBlock: ^ {
+		[self writeOperation: @[
+			@(MTXLogOperationRemoveToDeviceEvents),
+			deviceID, @(count)
+		]];
+		return true;
+	}];
+
+	objc_autoreleasePoolPop(pool);
+}
+@end
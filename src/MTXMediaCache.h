@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+@class MTXMediaCacheWriter;
+
+/**
+ * @brief A size-bounded on-disk cache for media content.
+ *
+ * Content is stored under the SHA-256 of its bytes, so that the same content
+ * is only stored once, no matter under how many keys it was added. Once the
+ * cache exceeds its maximum size, the least recently used content is removed.
+ *
+ * The cache must only be used from one thread.
+ */
+@interface MTXMediaCache: OFObject
+/**
+ * @brief The directory the cache is stored in.
+ */
+@property (readonly, nonatomic) OFIRI *IRI;
+
+/**
+ * @brief The maximum size of all content in the cache in bytes.
+ */
+@property (readonly, nonatomic) unsigned long long maxSize;
+
+/**
+ * @brief The size of all content in the cache in bytes.
+ */
+@property (readonly, nonatomic) unsigned long long size;
+
+/**
+ * @brief Creates a new media cache in the specified directory.
+ *
+ * @param IRI The directory to store the cache in. It is created if it does not
+ *	      exist yet.
+ * @param maxSize The maximum size of all content in the cache in bytes
+ * @return An autoreleased MTXMediaCache
+ */
++ (instancetype)cacheWithIRI: (OFIRI *)IRI
+		     maxSize: (unsigned long long)maxSize;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated media cache in the specified
+ *	  directory.
+ *
+ * Content that exceeds the maximum size, e.g. because it was lowered, is
+ * removed immediately.
+ *
+ * @param IRI The directory to store the cache in. It is created if it does not
+ *	      exist yet.
+ * @param maxSize The maximum size of all content in the cache in bytes
+ * @return An initialized MTXMediaCache
+ */
+- (instancetype)initWithIRI: (OFIRI *)IRI
+		    maxSize: (unsigned long long)maxSize
+    OF_DESIGNATED_INITIALIZER;
+
+/**
+ * @brief Returns the file with the content for the specified key and marks it
+ *	  as recently used.
+ *
+ * @param key The key of the content, e.g. an `mxc://` URI
+ * @return The file with the content, or `nil` if it is not in the cache
+ */
+- (nullable OFIRI *)IRIForKey: (OFString *)key;
+
+/**
+ * @brief Returns a new writer to add content to the cache.
+ *
+ * @return A new, autoreleased writer
+ */
+- (MTXMediaCacheWriter *)writer;
+@end
+
+/**
+ * @brief A writer that adds content to an @ref MTXMediaCache as it arrives.
+ *
+ * The content is written to a temporary file and only becomes part of the
+ * cache once it is committed.
+ */
+@interface MTXMediaCacheWriter: OFObject
+/**
+ * @brief The number of bytes written so far.
+ */
+@property (readonly, nonatomic) unsigned long long length;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Writes the specified part of the content.
+ *
+ * @param buffer The buffer to write
+ * @param length The length of the buffer
+ */
+- (void)writeBuffer: (const void *)buffer length: (size_t)length;
+
+/**
+ * @brief Adds the written content to the cache under the specified key.
+ *
+ * @param key The key for the content, e.g. an `mxc://` URI
+ */
+- (void)commitForKey: (OFString *)key;
+
+/**
+ * @brief Discards the written content.
+ */
+- (void)discard;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <inttypes.h>
+
+#import "MTXMediaCache.h"
+
+@interface MTXMediaCacheObject: OFObject
+@property (copy, nonatomic) OFString *digest;
+@property (nonatomic) unsigned long long size;
+@property (retain, nullable, nonatomic) OFDate *lastUsed;
+@property (nonatomic) OFListItem listItem;
+@end
+
+@interface MTXMediaCache ()
+- (OFIRI *)newTemporaryIRI;
+- (void)addContentAtIRI: (OFIRI *)temporaryIRI
+		 digest: (OFString *)digest
+		   size: (unsigned long long)size
+		 forKey: (OFString *)key;
+@end
+
+@interface MTXMediaCacheWriter ()
+- (instancetype)initWithCache: (MTXMediaCache *)cache;
+@end
+
+static OFString *
+hexString(const unsigned char *bytes, size_t length)
+{
+	OFMutableString *string = [OFMutableString string];
+
+	for (size_t i = 0; i < length; i++)
+		[string appendFormat: @"%02x", bytes[i]];
+
+	[string makeImmutable];
+
+	return string;
+}
+
+static OFString *
+hashOfKey(OFString *key)
+{
+	OFSHA256Hash *hash = [OFSHA256Hash hashWithAllowsSwappableMemory: true];
+
+	[hash updateWithBuffer: key.UTF8String length: key.UTF8StringLength];
+	[hash calculate];
+
+	return hexString(hash.digest, [OFSHA256Hash digestSize]);
+}
+
+@implementation MTXMediaCacheObject
+- (void)dealloc
+{
+	[_digest release];
+	[_lastUsed release];
+
+	[super dealloc];
+}
+
+- (OFComparisonResult)compare: (MTXMediaCacheObject *)object
+{
+	return [_lastUsed compare: object.lastUsed];
+}
+@end
+
+@implementation MTXMediaCache
+{
+	OFIRI *_objectsIRI, *_keysIRI, *_temporaryIRI;
+	OFMutableDictionary<OFString *, MTXMediaCacheObject *> *_objects;
+	/* Least recently used first. */
+	OFList<MTXMediaCacheObject *> *_recentlyUsed;
+}
+
++ (instancetype)cacheWithIRI: (OFIRI *)IRI maxSize: (unsigned long long)maxSize
+{
+	return [[[self alloc] initWithIRI: IRI maxSize: maxSize] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithIRI: (OFIRI *)IRI maxSize: (unsigned long long)maxSize
+{
+	self = [super init];
+
+	@try {
+		void *pool = objc_autoreleasePoolPush();
+		OFFileManager *fileManager = OFFileManager.defaultManager;
+		OFMutableArray<MTXMediaCacheObject *> *objects =
+		    [OFMutableArray array];
+
+		_IRI = [IRI copy];
+		_maxSize = maxSize;
+		_objectsIRI = [[IRI IRIByAppendingPathComponent: @"objects"]
+		    copy];
+		_keysIRI = [[IRI IRIByAppendingPathComponent: @"keys"] copy];
+		_temporaryIRI = [[IRI IRIByAppendingPathComponent: @"tmp"]
+		    copy];
+		_objects = [[OFMutableDictionary alloc] init];
+		_recentlyUsed = [[OFList alloc] init];
+
+		/* Left over by writers that were not committed or discarded. */
+		if ([fileManager directoryExistsAtIRI: _temporaryIRI])
+			[fileManager removeItemAtIRI: _temporaryIRI];
+
+		[fileManager createDirectoryAtIRI: _objectsIRI
+				    createParents: true];
+		[fileManager createDirectoryAtIRI: _keysIRI
+				    createParents: true];
+		[fileManager createDirectoryAtIRI: _temporaryIRI
+				    createParents: true];
+
+		/*
+		 * The modification date of an object is updated whenever it is
+		 * used, so that the order of use survives a restart.
+		 */
+		for (OFIRI *objectIRI in
+		    [fileManager contentsOfDirectoryAtIRI: _objectsIRI]) {
+			OFFileAttributes attributes =
+			    [fileManager attributesOfItemAtIRI: objectIRI];
+			MTXMediaCacheObject *object =
+			    [[[MTXMediaCacheObject alloc] init] autorelease];
+
+			object.digest = objectIRI.lastPathComponent;
+			object.size = attributes.fileSize;
+			object.lastUsed = attributes.fileModificationDate;
+			[objects addObject: object];
+		}
+
+		[objects sort];
+
+		for (MTXMediaCacheObject *object in objects) {
+			object.listItem = [_recentlyUsed appendObject: object];
+			object.lastUsed = nil;
+			_objects[object.digest] = object;
+			_size += object.size;
+		}
+
+		[self evict];
+
+		objc_autoreleasePoolPop(pool);
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_IRI release];
+	[_objectsIRI release];
+	[_keysIRI release];
+	[_temporaryIRI release];
+	[_objects release];
+	[_recentlyUsed release];
+
+	[super dealloc];
+}
+
+- (OFIRI *)IRIOfObject: (MTXMediaCacheObject *)object
+{
+	return [_objectsIRI IRIByAppendingPathComponent: object.digest];
+}
+
+- (void)markObjectUsed: (MTXMediaCacheObject *)object
+{
+	[_recentlyUsed removeListItem: object.listItem];
+	object.listItem = [_recentlyUsed appendObject: object];
+
+	@try {
+		[OFFileManager.defaultManager
+		    setAttributes: @{ OFFileModificationDate: [OFDate date] }
+		      ofItemAtIRI: [self IRIOfObject: object]];
+	} @catch (id e) {
+		/* Only affects the order of eviction after a restart. */
+	}
+}
+
+- (void)evict
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	OFListItem listItem;
+
+	/*
+	 * Keys of evicted objects are left behind and removed once they are
+	 * looked up.
+	 */
+	while (_size > _maxSize &&
+	    (listItem = _recentlyUsed.firstListItem) != NULL) {
+		MTXMediaCacheObject *object =
+		    [[OFListItemObject(listItem) retain] autorelease];
+
+		[fileManager removeItemAtIRI: [self IRIOfObject: object]];
+
+		_size -= object.size;
+		[_recentlyUsed removeListItem: listItem];
+		[_objects removeObjectForKey: object.digest];
+	}
+}
+
+- (OFIRI *)IRIForKey: (OFString *)key
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	OFIRI *keyIRI = [_keysIRI IRIByAppendingPathComponent: hashOfKey(key)];
+	MTXMediaCacheObject *object;
+
+	if (![fileManager fileExistsAtIRI: keyIRI])
+		return nil;
+
+	object = _objects[[OFString stringWithContentsOfIRI: keyIRI]];
+
+	if (object == nil) {
+		[fileManager removeItemAtIRI: keyIRI];
+		return nil;
+	}
+
+	[self markObjectUsed: object];
+
+	return [self IRIOfObject: object];
+}
+
+- (MTXMediaCacheWriter *)writer
+{
+	return [[[MTXMediaCacheWriter alloc] initWithCache: self] autorelease];
+}
+
+- (OFIRI *)newTemporaryIRI
+{
+	return [[_temporaryIRI IRIByAppendingPathComponent:
+	    [OFString stringWithFormat: @"%016" PRIx64, OFRandom64()]] copy];
+}
+
+- (void)addContentAtIRI: (OFIRI *)temporaryIRI
+		 digest: (OFString *)digest
+		   size: (unsigned long long)size
+		 forKey: (OFString *)key
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	MTXMediaCacheObject *object = _objects[digest];
+
+	/* Content that can never fit would only evict everything else. */
+	if (size > _maxSize) {
+		[fileManager removeItemAtIRI: temporaryIRI];
+		return;
+	}
+
+	if (object != nil) {
+		/* The same content is already stored under another key. */
+		[fileManager removeItemAtIRI: temporaryIRI];
+		[self markObjectUsed: object];
+	} else {
+		object = [[[MTXMediaCacheObject alloc] init] autorelease];
+		object.digest = digest;
+		object.size = size;
+
+		[fileManager moveItemAtIRI: temporaryIRI
+				     toIRI: [self IRIOfObject: object]];
+
+		object.listItem = [_recentlyUsed appendObject: object];
+		_objects[digest] = object;
+		_size += size;
+	}
+
+	[digest writeToIRI:
+	    [_keysIRI IRIByAppendingPathComponent: hashOfKey(key)]];
+
+	[self evict];
+}
+@end
+
+@implementation MTXMediaCacheWriter
+{
+	MTXMediaCache *_cache;
+	OFIRI *_IRI;
+	OFFile *_file;
+	OFSHA256Hash *_hash;
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithCache: (MTXMediaCache *)cache
+{
+	self = [super init];
+
+	@try {
+		_cache = [cache retain];
+		_IRI = [cache newTemporaryIRI];
+		_file = [[OFFile alloc]
+		    initWithPath: _IRI.fileSystemRepresentation
+			    mode: @"w"];
+		_hash = [[OFSHA256Hash alloc]
+		    initWithAllowsSwappableMemory: true];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	@try {
+		[self discard];
+	} @catch (id e) {
+		/* The cache removes temporary files when it is opened. */
+	}
+
+	[_cache release];
+	[_IRI release];
+	[_hash release];
+
+	[super dealloc];
+}
+
+- (void)writeBuffer: (const void *)buffer length: (size_t)length
+{
+	if (_file == nil)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	[_file writeBuffer: buffer length: length];
+	[_hash updateWithBuffer: buffer length: length];
+	_length += length;
+}
+
+- (void)commitForKey: (OFString *)key
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	if (_file == nil)
+		@throw [OFNotOpenException exceptionWithObject: self];
+
+	[_file close];
+	[_file release];
+	_file = nil;
+
+	[_hash calculate];
+
+	[_cache addContentAtIRI: _IRI
+			 digest: hexString(_hash.digest,
+				     [OFSHA256Hash digestSize])
+			   size: _length
+			 forKey: key];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)discard
+{
+	if (_file == nil)
+		return;
+
+	[_file close];
+	[_file release];
+	_file = nil;
+
+	[OFFileManager.defaultManager removeItemAtIRI: _IRI];
+}
+@end
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+#import "MTXEndpointMetrics.h"
+#import "MTXLatencyHistogram.h"
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A phase of a sync iteration.
+ */
+typedef enum {
+	/** From sending the request until the response headers arrived */
+	MTXSyncPhaseRequest,
+	/** Reading the response body */
+	MTXSyncPhaseTransfer,
+	/** Parsing the response body as JSON */
+	MTXSyncPhaseParse,
+	/** Processing the response inside the storage transaction */
+	MTXSyncPhaseProcess,
+	/** Committing the storage transaction */
+	MTXSyncPhaseCommit
+} MTXSyncPhase;
+
+/**
+ * @brief Metrics collected by an @ref MTXClient.
+ *
+ * The metrics are updated as requests are performed. Use `copy` to get a
+ * snapshot that is not modified anymore.
+ */
+@interface MTXMetrics: OFObject <OFCopying>
+/**
+ * @brief The metrics for each endpoint, by endpoint name.
+ */
+@property (readonly, nonatomic)
+    OFDictionary<OFString *, MTXEndpointMetrics *> *endpoints;
+
+/**
+ * @brief The durations of storage transactions, including the commit.
+ */
+@property (readonly, nonatomic) MTXLatencyHistogram *storageTransactions;
+
+/**
+ * @brief Creates new, empty metrics.
+ *
+ * @return Autoreleased MTXMetrics
+ */
++ (instancetype)metrics;
+
+/**
+ * @brief Returns the histogram of durations of the specified sync phase.
+ *
+ * With @ref MTXClient.streamingSync, the response is read, parsed and
+ * processed at the same time, which is recorded as
+ * @ref MTXSyncPhaseProcess.
+ *
+ * @param phase The sync phase for which to return the histogram
+ * @return The histogram of durations of the sync phase
+ */
+- (MTXLatencyHistogram *)histogramForSyncPhase: (MTXSyncPhase)phase;
+
+/**
+ * @brief Adds a request to the metrics of the specified endpoint.
+ *
+ * @param endpoint The name of the endpoint
+ * @param latency The latency of the request
+ * @param bytesSent The number of bytes sent in the request body
+ * @param bytesReceived The number of bytes received in the response body
+ * @param failed Whether the request failed
+ */
+- (void)addRequestToEndpoint: (OFString *)endpoint
+		     latency: (OFTimeInterval)latency
+		   bytesSent: (unsigned long long)bytesSent
+	       bytesReceived: (unsigned long long)bytesReceived
+		      failed: (bool)failed;
+
+/**
+ * @brief Adds the specified duration to the histogram of the specified sync
+ *	  phase.
+ *
+ * @param duration The duration of the phase
+ * @param phase The sync phase
+ */
+- (void)addDuration: (OFTimeInterval)duration
+       forSyncPhase: (MTXSyncPhase)phase;
+
+/**
+ * @brief Adds the duration of a storage transaction.
+ *
+ * @param duration The duration of the storage transaction
+ */
+- (void)addStorageTransactionWithDuration: (OFTimeInterval)duration;
+
+/**
+ * @brief Resets all metrics.
+ */
+- (void)reset;
+@end
+
+OF_ASSUME_NONNULL_END
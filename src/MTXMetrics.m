@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXMetrics.h"
+
+#define NUM_SYNC_PHASES (MTXSyncPhaseCommit + 1)
+
+@implementation MTXMetrics
+{
+	OFMutableDictionary<OFString *, MTXEndpointMetrics *> *_endpoints;
+	MTXLatencyHistogram *_syncPhases[NUM_SYNC_PHASES];
+}
+
+@synthesize endpoints = _endpoints;
+
++ (instancetype)metrics
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	@try {
+		_endpoints = [[OFMutableDictionary alloc] init];
+		_storageTransactions = [[MTXLatencyHistogram alloc] init];
+
+		for (size_t i = 0; i < NUM_SYNC_PHASES; i++)
+			_syncPhases[i] = [[MTXLatencyHistogram alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_endpoints release];
+	[_storageTransactions release];
+
+	for (size_t i = 0; i < NUM_SYNC_PHASES; i++)
+		[_syncPhases[i] release];
+
+	[super dealloc];
+}
+
+- (id)copy
+{
+	MTXMetrics *copy = [[MTXMetrics alloc] init];
+
+	@try {
+		for (OFString *endpoint in _endpoints) {
+			MTXEndpointMetrics *metrics =
+			    [_endpoints[endpoint] copy];
+
+			@try {
+				copy->_endpoints[endpoint] = metrics;
+			} @finally {
+				[metrics release];
+			}
+		}
+
+		[copy->_storageTransactions release];
+		copy->_storageTransactions = nil;
+		copy->_storageTransactions = [_storageTransactions copy];
+
+		for (size_t i = 0; i < NUM_SYNC_PHASES; i++) {
+			[copy->_syncPhases[i] release];
+			copy->_syncPhases[i] = nil;
+			copy->_syncPhases[i] = [_syncPhases[i] copy];
+		}
+	} @catch (id e) {
+		[copy release];
+		@throw e;
+	}
+
+	return copy;
+}
+
+- (MTXLatencyHistogram *)histogramForSyncPhase: (MTXSyncPhase)phase
+{
+	if ((size_t)phase >= NUM_SYNC_PHASES)
+		@throw [OFInvalidArgumentException exception];
+
+	return _syncPhases[phase];
+}
+
+- (void)addRequestToEndpoint: (OFString *)endpoint
+		     latency: (OFTimeInterval)latency
+		   bytesSent: (unsigned long long)bytesSent
+	       bytesReceived: (unsigned long long)bytesReceived
+		      failed: (bool)failed
+{
+	MTXEndpointMetrics *metrics = _endpoints[endpoint];
+
+	if (metrics == nil) {
+		metrics = [MTXEndpointMetrics metrics];
+		_endpoints[endpoint] = metrics;
+	}
+
+	[metrics addRequestWithLatency: latency
+			     bytesSent: bytesSent
+			 bytesReceived: bytesReceived
+				failed: failed];
+}
+
+- (void)addDuration: (OFTimeInterval)duration
+       forSyncPhase: (MTXSyncPhase)phase
+{
+	[[self histogramForSyncPhase: phase] addDuration: duration];
+}
+
+- (void)addStorageTransactionWithDuration: (OFTimeInterval)duration
+{
+	[_storageTransactions addDuration: duration];
+}
+
+- (void)reset
+{
+	[_endpoints removeAllObjects];
+	[_storageTransactions reset];
+
+	for (size_t i = 0; i < NUM_SYNC_PHASES; i++)
+		[_syncPhases[i] reset];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat:
+	    @"<%@\n"
+	    @"\tEndpoints = %@\n"
+	    @"\tRequest = %@\n"
+	    @"\tTransfer = %@\n"
+	    @"\tParse = %@\n"
+	    @"\tProcess = %@\n"
+	    @"\tCommit = %@\n"
+	    @"\tStorage transactions = %@\n"
+	    @">",
+	    self.class, _endpoints,
+	    _syncPhases[MTXSyncPhaseRequest],
+	    _syncPhases[MTXSyncPhaseTransfer],
+	    _syncPhases[MTXSyncPhaseParse],
+	    _syncPhases[MTXSyncPhaseProcess],
+	    _syncPhases[MTXSyncPhaseCommit],
+	    _storageTransactions];
+}
+@end
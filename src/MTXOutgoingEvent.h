@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief An event that is queued to be sent to a room.
+ */
+@interface MTXOutgoingEvent: OFObject
+/**
+ * @brief The transaction ID of the event.
+ *
+ * The server uses it to detect retransmissions of the same event.
+ */
+@property (readonly, nonatomic) OFString *transactionID;
+
+/**
+ * @brief The room ID of the room to which the event is sent.
+ */
+@property (readonly, nonatomic) OFString *roomID;
+
+/**
+ * @brief The type of the event.
+ */
+@property (readonly, nonatomic) OFString *type;
+
+/**
+ * @brief The content of the event.
+ */
+@property (readonly, nonatomic) OFDictionary<OFString *, id> *content;
+
+/**
+ * @brief Creates a new outgoing event.
+ *
+ * @param transactionID The transaction ID of the event
+ * @param roomID The room ID of the room to which the event is sent
+ * @param type The type of the event
+ * @param content The content of the event
+ * @return An autoreleased MTXOutgoingEvent
+ */
++ (instancetype)eventWithTransactionID: (OFString *)transactionID
+				roomID: (OFString *)roomID
+				  type: (OFString *)type
+			       content: (OFDictionary<OFString *, id> *)content;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated outgoing event.
+ *
+ * @param transactionID The transaction ID of the event
+ * @param roomID The room ID of the room to which the event is sent
+ * @param type The type of the event
+ * @param content The content of the event
+ * @return An initialized MTXOutgoingEvent
+ */
+- (instancetype)initWithTransactionID: (OFString *)transactionID
+			       roomID: (OFString *)roomID
+				 type: (OFString *)type
+			      content: (OFDictionary<OFString *, id> *)content
+    OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXOutgoingEvent.h"
+
+@implementation MTXOutgoingEvent
++ (instancetype)eventWithTransactionID: (OFString *)transactionID
+				roomID: (OFString *)roomID
+				  type: (OFString *)type
+			       content: (OFDictionary<OFString *, id> *)content
+{
+	return [[[self alloc] initWithTransactionID: transactionID
+					     roomID: roomID
+					       type: type
+					    content: content] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithTransactionID: (OFString *)transactionID
+			       roomID: (OFString *)roomID
+				 type: (OFString *)type
+			      content: (OFDictionary<OFString *, id> *)content
+{
+	self = [super init];
+
+	@try {
+		_transactionID = [transactionID copy];
+		_roomID = [roomID copy];
+		_type = [type copy];
+		_content = [content copy];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_transactionID release];
+	[_roomID release];
+	[_type release];
+	[_content release];
+
+	[super dealloc];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat: @"<%@ %@ in %@: %@ %@>",
+					   self.class, _transactionID, _roomID,
+					   _type, _content];
+}
+@end
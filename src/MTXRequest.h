@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, 2021, 2024 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2021, 2024, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -20,6 +20,9 @@
 
 OF_ASSUME_NONNULL_BEGIN
 
+@class MTXConnectionPool;
+@class MTXMetrics;
+
 /**
  * @brief A response to a request.
  *
@@ -30,7 +33,10 @@ typedef OFDictionary<OFString *, id> *MTXResponse;
 /**
  * @brief A block called with the response for an MTXRequest.
  *
- * @param response The response to the request, as a dictionary parsed from JSON
+ * @param response The response to the request, as a dictionary parsed from
+ *		   JSON. This is an empty dictionary if the request failed
+ *		   with a response that is not JSON, e.g. an error page of a
+ *		   proxy.
  * @param statusCode The HTTP status code returned for the request
  * @param exception The first exception that occurred during the request,
  *		    or `nil` on success
@@ -38,6 +44,15 @@ typedef OFDictionary<OFString *, id> *MTXResponse;
 typedef void (^MTXRequestBlock)(MTXResponse _Nullable response, int statusCode,
     id _Nullable exception);
 
+/**
+ * @brief A block called with the body of a successful response for an
+ *	  MTXRequest.
+ *
+ * @param body The stream to read the response body from. It needs to be read
+ *	       until the end.
+ */
+typedef void (^MTXRequestStreamBlock)(OFStream *body);
+
 /**
  * @brief An internal class for performing a request on the Matrix server.
  */
@@ -79,6 +94,99 @@ typedef void (^MTXRequestBlock)(MTXResponse _Nullable response, int statusCode,
  */
 @property (copy, nullable, nonatomic) OFDictionary<OFString *, id> *body;
 
+/**
+ * @brief An optional stream to send as the body of the request instead of
+ *	  @ref body.
+ *
+ * The stream is sent as it is read, without reading it into memory first.
+ * @ref bodyStreamLength needs to be set to the number of bytes to send.
+ */
+@property (retain, nullable, nonatomic) OFStream *bodyStream;
+
+/**
+ * @brief The number of bytes to send from @ref bodyStream.
+ */
+@property (nonatomic) unsigned long long bodyStreamLength;
+
+/**
+ * @brief Additional headers to send along with the request, e.g.
+ *	  `Content-Type` or `Range`.
+ */
+@property (copy, nullable, nonatomic)
+    OFDictionary<OFString *, OFString *> *headers;
+
+/**
+ * @brief Whether the server may send a compressed response.
+ *
+ * If enabled, `Accept-Encoding: gzip` is sent and gzip-compressed responses
+ * are decompressed transparently.
+ *
+ * Defaults to `false`.
+ */
+@property (nonatomic) bool acceptsCompressedResponses;
+
+/**
+ * @brief Whether the events in `events` arrays of the response are decoded
+ *	  lazily as @ref MTXEvent.
+ *
+ * Defaults to `false`.
+ */
+@property (nonatomic) bool lazilyDecodesEvents;
+
+/**
+ * @brief The connection pool to perform the request with.
+ *
+ * If this is `nil`, a new connection is created for the request.
+ */
+@property (retain, nullable, nonatomic) MTXConnectionPool *connectionPool;
+
+/**
+ * @brief The metrics to add the request to once it finished.
+ */
+@property (retain, nullable, nonatomic) MTXMetrics *metrics;
+
+/**
+ * @brief The name of the endpoint under which the request is added to the
+ *	  metrics.
+ *
+ * If this is `nil`, the path is used.
+ */
+@property (copy, nullable, nonatomic) OFString *metricsEndpoint;
+
+/**
+ * @brief The time from performing the request until the response headers
+ *	  arrived.
+ *
+ * This includes waiting for a connection from the @ref connectionPool. It is
+ * only valid once the request finished.
+ */
+@property (readonly, nonatomic) OFTimeInterval waitDuration;
+
+/**
+ * @brief The time it took to read the response body.
+ *
+ * This is only valid once the request finished. If the request was performed
+ * with @ref performWithStreamBlock:block:, this includes the time spent in
+ * the stream block.
+ */
+@property (readonly, nonatomic) OFTimeInterval transferDuration;
+
+/**
+ * @brief The time it took to parse the response body.
+ *
+ * This is only valid once the request finished.
+ */
+@property (readonly, nonatomic) OFTimeInterval parseDuration;
+
+/**
+ * @brief The headers of the response.
+ *
+ * This is already valid when the stream block passed to
+ * @ref performWithStreamBlock:block: is called.
+ */
+@property (readonly, nullable, nonatomic)
+    OFDictionary<OFString *, OFString *> *responseHeaders;
+
 /**
  * @brief Creates a new request with the specified access token and homeserver.
  *
@@ -109,6 +217,21 @@ typedef void (^MTXRequestBlock)(MTXResponse _Nullable response, int statusCode,
  * @param block The block to call once the request succeeded or failed
  */
 - (void)performWithBlock: (MTXRequestBlock)block;
+
+/**
+ * @brief Performs the request and passes the body of a successful response to
+ *	  the specified stream block as it arrives instead of parsing it as a
+ *	  whole.
+ *
+ * Once the stream block returned, the block is called with a `nil` response.
+ * If the request did not succeed, the response is parsed and passed to the
+ * block instead, just like with @ref performWithBlock:.
+ *
+ * @param streamBlock The block to call with the body of a successful response
+ * @param block The block to call once the request succeeded or failed
+ */
+- (void)performWithStreamBlock: (MTXRequestStreamBlock)streamBlock
+			 block: (MTXRequestBlock)block;
 @end
 
 OF_ASSUME_NONNULL_END
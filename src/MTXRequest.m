@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, 2021, 2024 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2021, 2024, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -17,11 +17,67 @@
  */
 
 #import "MTXRequest.h"
+#import "MTXConnectionPool.h"
+#import "MTXEvent+Private.h"
+#import "MTXMetrics.h"
+
+/* The Content-Length sent by the server is only trusted up to this size. */
+static const size_t maxPreallocatedLength = 16 * 1024 * 1024;
+static const size_t defaultBufferLength = 65536;
+static const size_t bodyStreamBufferLength = 65536;
+
+static OFData *
+readResponseBody(OFStream *stream, OFString *contentLength)
+{
+	size_t capacity = defaultBufferLength, length = 0;
+	char *buffer;
+
+	if (contentLength != nil) {
+		unsigned long long tmp = contentLength.unsignedLongLongValue;
+
+		if (tmp > 0)
+			capacity = (tmp < maxPreallocatedLength
+			    ? (size_t)tmp : maxPreallocatedLength);
+	}
+
+	buffer = OFAllocMemory(1, capacity);
+
+	@try {
+		while (!stream.atEndOfStream) {
+			if (length == capacity) {
+				if (capacity > SIZE_MAX / 2)
+					@throw [OFOutOfRangeException
+					    exception];
+
+				capacity *= 2;
+				buffer = OFResizeMemory(buffer, 1, capacity);
+			}
+
+			length += [stream readIntoBuffer: buffer + length
+						  length: capacity - length];
+		}
+	} @catch (id e) {
+		OFFreeMemory(buffer);
+		@throw e;
+	}
+
+	/* The parser works on the bytes, so they are never made a string. */
+	@try {
+		return [OFData dataWithItemsNoCopy: buffer
+					     count: length
+				      freeWhenDone: true];
+	} @catch (id e) {
+		OFFreeMemory(buffer);
+		@throw e;
+	}
+}
 
 @implementation MTXRequest
 {
 	OFData *_body;
 	MTXRequestBlock _block;
+	MTXRequestStreamBlock _streamBlock;
+	OFTimeInterval _started;
 }
 
 + (instancetype)requestWithPath: (OFString *)path
@@ -58,6 +114,13 @@
 	[_homeserver release];
 	[_path release];
 	[_body release];
+	[_connectionPool release];
+	[_metrics release];
+	[_metricsEndpoint release];
+	[_streamBlock release];
+	[_bodyStream release];
+	[_headers release];
+	[_responseHeaders release];
 
 	[super dealloc];
 }
@@ -67,18 +130,17 @@
 	void *pool = objc_autoreleasePoolPush();
 
 	[_body release];
-
-	OFString *JSONString = [body JSONRepresentation];
-	_body = [[OFData alloc] initWithItems: JSONString.UTF8String
-					count: JSONString.UTF8StringLength];
+	_body = (body != nil ? [MTXJSONData(body) retain] : nil);
 
 	objc_autoreleasePoolPop(pool);
 }
 
 - (OFDictionary<OFString *, id> *)body
 {
-	return [OFString stringWithUTF8String: _body.items
-				       length: _body.count].objectByParsingJSON;
+	if (_body == nil)
+		return nil;
+
+	return MTXParseJSON(_body.items, _body.count);
 }
 
 - (void)performWithBlock: (MTXRequestBlock)block
@@ -93,65 +155,192 @@
 	requestIRI.path = _path;
 	requestIRI.queryItems = _queryItems;
 
-	OFMutableDictionary *headers = [OFMutableDictionary dictionary];
+	OFMutableDictionary *headers = (_headers != nil
+	    ? [[_headers mutableCopy] autorelease]
+	    : [OFMutableDictionary dictionary]);
 	headers[@"User-Agent"] = @"ObjMatrix";
 	if (_accessToken != nil)
 		headers[@"Authorization"] =
 		    [OFString stringWithFormat: @"Bearer %@", _accessToken];
-	if (_body != nil)
+	if (_acceptsCompressedResponses)
+		headers[@"Accept-Encoding"] = @"gzip";
+	if (_bodyStream != nil)
+		headers[@"Content-Length"] = @(_bodyStreamLength).stringValue;
+	else if (_body != nil)
 		headers[@"Content-Length"] = @(_body.count).stringValue;
 
 	OFHTTPRequest *request = [OFHTTPRequest requestWithIRI: requestIRI];
 	request.method = _method;
 	request.headers = headers;
 
-	OFHTTPClient *client = [OFHTTPClient client];
-	client.delegate = self;
-
 	_block = [block copy];
 	[self retain];
-	[client asyncPerformRequest: request];
+
+	_started = OFDate.date.timeIntervalSince1970;
+
+	if (_connectionPool != nil)
+		[_connectionPool acquireClientWithBlock:
+		    ^ (OFHTTPClient *client) {
+			[self performHTTPRequest: request withClient: client];
+		}];
+	else
+		[self performHTTPRequest: request
+			      withClient: [OFHTTPClient client]];
 
 	objc_autoreleasePoolPop(pool);
 }
 
+- (void)performWithStreamBlock: (MTXRequestStreamBlock)streamBlock
+			 block: (MTXRequestBlock)block
+{
+	if (_block != nil)
+		@throw [OFAlreadyOpenException exceptionWithObject: self];
+
+	[_streamBlock release];
+	_streamBlock = [streamBlock copy];
+
+	[self performWithBlock: block];
+}
+
+- (void)performHTTPRequest: (OFHTTPRequest *)request
+		withClient: (OFHTTPClient *)client
+{
+	client.delegate = self;
+
+	@try {
+		[client asyncPerformRequest: request];
+	} @catch (id e) {
+		[self client: client
+		    didPerformRequest: request
+			     response: nil
+			    exception: e];
+	}
+}
+
 -      (void)client: (OFHTTPClient *)client
   didPerformRequest: (OFHTTPRequest *)request
 	   response: (OFHTTPResponse *)response
 	  exception: (id)exception
 {
+	OFTimeInterval headersReceived = OFDate.date.timeIntervalSince1970;
+	unsigned long long bytesReceived = 0;
+
 	if (response != nil &&
 	    [exception isKindOfClass: [OFHTTPRequestFailedException class]])
 		exception = nil;
 
+	_waitDuration = headersReceived - _started;
+	_transferDuration = _parseDuration = 0;
+
+	[_responseHeaders release];
+	_responseHeaders = [response.headers copy];
+
 	/* Reset to nil first, so that another one can be performed. */
 	MTXRequestBlock block = _block;
+	MTXRequestStreamBlock streamBlock = _streamBlock;
 	_block = nil;
+	_streamBlock = nil;
+
+	MTXResponse responseJSON = nil;
+	int statusCode = 0;
+	bool reusable = false;
 
 	if (exception == nil) {
+		statusCode = response.statusCode;
+
 		@try {
-			OFMutableData *responseData = [OFMutableData data];
-			while (!response.atEndOfStream) {
-				char buffer[512];
-				size_t length = [response readIntoBuffer: buffer
-								  length: 512];
+			OFStream *body = response;
+			OFString *contentLength =
+			    response.headers[@"Content-Length"];
+
+			if (contentLength != nil)
+				bytesReceived =
+				    contentLength.unsignedLongLongValue;
 
-				[responseData addItems: buffer count: length];
+			if (_acceptsCompressedResponses &&
+			    [response.headers[@"Content-Encoding"]
+			    isEqual: @"gzip"]) {
+				body = [OFGZIPStream streamWithStream: response
+								 mode: @"r"];
+				/* Only the compressed length is known. */
+				contentLength = nil;
 			}
 
-			MTXResponse responseJSON = [OFString
-			    stringWithUTF8String: responseData.items
-					  length: responseData.count]
-			    .objectByParsingJSON;
+			if (streamBlock != nil &&
+			    statusCode >= 200 && statusCode < 300) {
+				streamBlock(body);
+
+				_transferDuration =
+				    OFDate.date.timeIntervalSince1970 -
+				    headersReceived;
+			} else {
+				OFData *data =
+				    readResponseBody(body, contentLength);
+				OFTimeInterval read =
+				    OFDate.date.timeIntervalSince1970;
+
+				if (contentLength == nil)
+					bytesReceived = data.count;
 
-			block(responseJSON, response.statusCode, nil);
+				@try {
+					if (_lazilyDecodesEvents)
+						responseJSON =
+						    MTXParseJSONWithLazyEvents(
+						    data.items, data.count);
+					else
+						responseJSON = MTXParseJSON(
+						    data.items, data.count);
+				} @catch (id e) {
+					/*
+					 * Error pages of proxies are often
+					 * HTML. The status code tells the
+					 * caller what happened.
+					 */
+					if (statusCode >= 200 &&
+					    statusCode < 300)
+						@throw e;
+
+					responseJSON =
+					    [OFDictionary dictionary];
+				}
+
+				_transferDuration = read - headersReceived;
+				_parseDuration =
+				    OFDate.date.timeIntervalSince1970 - read;
+			}
+
+			/*
+			 * Only reuse the connection if the response has been
+			 * read completely.
+			 */
+			reusable = response.atEndOfStream;
 		} @catch (id e) {
-			block(nil, response.statusCode, e);
+			exception = e;
 		}
-	} else
-		block(nil, 0, exception);
+	}
+
+	/*
+	 * Give the connection back before calling the block, so that a request
+	 * performed from the block can already reuse it.
+	 */
+	[_connectionPool releaseClient: client reusable: reusable];
+
+	[_metrics addRequestToEndpoint: (_metricsEndpoint != nil
+					    ? _metricsEndpoint : _path)
+			       latency: (OFDate.date.timeIntervalSince1970 -
+					    _started)
+			     bytesSent: (_bodyStream != nil
+					    ? _bodyStreamLength
+					    : _body.count)
+			 bytesReceived: bytesReceived
+				failed: (exception != nil ||
+					    statusCode < 200 ||
+					    statusCode >= 300)];
+
+	block(responseJSON, statusCode, exception);
 
 	[block release];
+	[streamBlock release];
 	[self release];
 }
 
@@ -159,6 +348,30 @@
   wantsRequestBody: (OFStream *)body
 	   request: (OFHTTPRequest *)request
 {
-	[body writeData: _body];
+	if (_bodyStream == nil) {
+		[body writeBuffer: _body.items length: _body.count];
+		return;
+	}
+
+	unsigned long long remaining = _bodyStreamLength;
+	char *buffer = OFAllocMemory(1, bodyStreamBufferLength);
+
+	@try {
+		while (remaining > 0) {
+			size_t length = [_bodyStream
+			    readIntoBuffer: buffer
+				    length: (remaining < bodyStreamBufferLength
+						? (size_t)remaining
+						: bodyStreamBufferLength)];
+
+			if (length == 0 && _bodyStream.atEndOfStream)
+				@throw [OFTruncatedDataException exception];
+
+			[body writeBuffer: buffer length: length];
+			remaining -= length;
+		}
+	} @finally {
+		OFFreeMemory(buffer);
+	}
 }
 @end
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A summary of a joined room, as needed to display a room list.
+ */
+@interface MTXRoomSummary: OFObject
+/**
+ * @brief The room ID of the room.
+ */
+@property (readonly, nonatomic) OFString *roomID;
+
+/**
+ * @brief The name of the room, or `nil` if it has none.
+ */
+@property (readonly, nullable, nonatomic) OFString *name;
+
+/**
+ * @brief The number of joined members of the room.
+ */
+@property (readonly, nonatomic) size_t numberOfJoinedMembers;
+
+/**
+ * @brief The server timestamp of the newest stored event of the room in
+ *	  milliseconds since the epoch, or 0 if no event is stored.
+ */
+@property (readonly, nonatomic) uint64_t lastEventTimestamp;
+
+/**
+ * @brief Creates a new room summary.
+ *
+ * @param roomID The room ID of the room
+ * @param name The name of the room, or `nil` if it has none
+ * @param numberOfJoinedMembers The number of joined members of the room
+ * @param lastEventTimestamp The server timestamp of the newest stored event
+ * @return An autoreleased MTXRoomSummary
+ */
++ (instancetype)summaryWithRoomID: (OFString *)roomID
+			     name: (nullable OFString *)name
+	    numberOfJoinedMembers: (size_t)numberOfJoinedMembers
+	       lastEventTimestamp: (uint64_t)lastEventTimestamp;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated room summary.
+ *
+ * @param roomID The room ID of the room
+ * @param name The name of the room, or `nil` if it has none
+ * @param numberOfJoinedMembers The number of joined members of the room
+ * @param lastEventTimestamp The server timestamp of the newest stored event
+ * @return An initialized MTXRoomSummary
+ */
+- (instancetype)initWithRoomID: (OFString *)roomID
+			  name: (nullable OFString *)name
+	 numberOfJoinedMembers: (size_t)numberOfJoinedMembers
+	    lastEventTimestamp: (uint64_t)lastEventTimestamp
+    OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
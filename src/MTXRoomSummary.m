@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXRoomSummary.h"
+
+@implementation MTXRoomSummary
++ (instancetype)summaryWithRoomID: (OFString *)roomID
+			     name: (OFString *)name
+	    numberOfJoinedMembers: (size_t)numberOfJoinedMembers
+	       lastEventTimestamp: (uint64_t)lastEventTimestamp
+{
+	return [[[self alloc]
+	       initWithRoomID: roomID
+			 name: name
+	numberOfJoinedMembers: numberOfJoinedMembers
+	   lastEventTimestamp: lastEventTimestamp] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithRoomID: (OFString *)roomID
+			  name: (OFString *)name
+	 numberOfJoinedMembers: (size_t)numberOfJoinedMembers
+	    lastEventTimestamp: (uint64_t)lastEventTimestamp
+{
+	self = [super init];
+
+	@try {
+		_roomID = [roomID copy];
+		_name = [name copy];
+		_numberOfJoinedMembers = numberOfJoinedMembers;
+		_lastEventTimestamp = lastEventTimestamp;
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_roomID release];
+	[_name release];
+
+	[super dealloc];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat:
+	    @"<%@ %@: %@, %zu joined members, last event at %" PRIu64 ">",
+	    self.class, _roomID, _name, _numberOfJoinedMembers,
+	    _lastEventTimestamp];
+}
+@end
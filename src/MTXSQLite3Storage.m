@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, 2021 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2021, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -19,14 +19,84 @@
 #import <ObjSQLite3/ObjSQLite3.h>
 
 #import "MTXSQLite3Storage.h"
+#import "MTXOutgoingEvent.h"
+#import "MTXTimelineEntry.h"
+
+/* The number of rows written by a single step of a batch statement. */
+static const size_t batchSize = 64;
+
+/*
+ * Timeline positions consist of a chunk in the upper 32 bits and an index in
+ * the lower 32 bits. A new chunk is started for every gap, with the gap in the
+ * middle of the chunk: New events are appended after it, while filling the gap
+ * inserts events before it, so that neither can run into another chunk.
+ */
+static const int64_t chunkMiddle = INT64_C(1) << 31;
+
+/*
+ * Version 1 stores room IDs, user IDs and event types as integer keys into the
+ * identifiers table. Version 2 adds the device lists and the to-device inbox.
+ */
+static const long long schemaVersion = 2;
+
+/*
+ * Memberships are stored as the index into this array to keep the members
+ * table small, as there can be tens of thousands of members in a room.
+ */
+static OFString *const memberships[] = {
+	@"invite", @"join", @"knock", @"leave", @"ban"
+};
+static const size_t numMemberships =
+    sizeof(memberships) / sizeof(*memberships);
+
+static OFNumber *
+membershipToNumber(OFString *membership)
+{
+	for (size_t i = 0; i < numMemberships; i++)
+		if ([memberships[i] isEqual: membership])
+			return @(i);
+
+	return nil;
+}
 
 @implementation MTXSQLite3Storage
 {
 	SL3Connection *_conn;
+	OFMutableDictionary<OFString *, OFNumber *> *_identifierKeys;
+	OFMutableDictionary<OFNumber *, OFString *> *_keyIdentifiers;
+	SL3PreparedStatement *_identifierKeyGetStatement;
+	SL3PreparedStatement *_identifierAddStatement;
+	SL3PreparedStatement *_identifierGetStatement;
 	SL3PreparedStatement *_nextBatchSetStatement, *_nextBatchGetStatement;
+	SL3PreparedStatement *_positionSetStatement, *_positionRemoveStatement;
+	SL3PreparedStatement *_positionGetStatement;
 	SL3PreparedStatement *_joinedRoomsAddStatement;
 	SL3PreparedStatement *_joinedRoomsRemoveStatement;
 	SL3PreparedStatement *_joinedRoomsGetStatement;
+	SL3PreparedStatement *_joinedRoomsAddBatchStatement;
+	SL3PreparedStatement *_joinedRoomsRemoveBatchStatement;
+	SL3PreparedStatement *_filterIDSetStatement, *_filterIDGetStatement;
+	SL3PreparedStatement *_timelineLastPositionStatement;
+	SL3PreparedStatement *_timelineInsertStatement;
+	SL3PreparedStatement *_timelineEventExistsStatement;
+	SL3PreparedStatement *_timelineGapGetStatement;
+	SL3PreparedStatement *_timelineRemoveStatement;
+	SL3PreparedStatement *_timelineGetStatement;
+	SL3PreparedStatement *_stateSetStatement, *_stateGetStatement;
+	SL3PreparedStatement *_memberSetStatement, *_memberGetStatement;
+	SL3PreparedStatement *_memberCountStatement;
+	SL3PreparedStatement *_outgoingAddStatement;
+	SL3PreparedStatement *_outgoingRemoveStatement;
+	SL3PreparedStatement *_outgoingGetStatement;
+	SL3PreparedStatement *_deviceListTrackStatement;
+	SL3PreparedStatement *_deviceListMarkOutdatedStatement;
+	SL3PreparedStatement *_deviceListRemoveStatement;
+	SL3PreparedStatement *_deviceListSetStatement;
+	SL3PreparedStatement *_deviceListGetStatement;
+	SL3PreparedStatement *_deviceListOutdatedStatement;
+	SL3PreparedStatement *_toDeviceAddStatement;
+	SL3PreparedStatement *_toDeviceGetStatement;
+	SL3PreparedStatement *_toDeviceRemoveStatement;
 }
 
 + (instancetype)storageWithIRI: (OFIRI *)IRI
@@ -42,9 +112,23 @@
 		void *pool = objc_autoreleasePoolPush();
 
 		_conn = [[SL3Connection alloc] initWithIRI: IRI];
+		_identifierKeys = [[OFMutableDictionary alloc] init];
+		_keyIdentifiers = [[OFMutableDictionary alloc] init];
 
 		[self createTables];
 
+		_identifierKeyGetStatement = [[_conn prepareStatement:
+		    @"SELECT id FROM identifiers\n"
+		    @"WHERE identifier=?1"] retain];
+		_identifierAddStatement = [[_conn prepareStatement:
+		    @"INSERT INTO identifiers (\n"
+		    @"    identifier\n"
+		    @") VALUES (\n"
+		    @"    ?1\n"
+		    @")"] retain];
+		_identifierGetStatement = [[_conn prepareStatement:
+		    @"SELECT identifier FROM identifiers\n"
+		    @"WHERE id=?1"] retain];
 		_nextBatchSetStatement = [[_conn prepareStatement:
 		    @"INSERT OR REPLACE INTO next_batch (\n"
 		    @"    device_id, next_batch\n"
@@ -54,6 +138,18 @@
 		_nextBatchGetStatement = [[_conn prepareStatement:
 		    @"SELECT next_batch FROM next_batch\n"
 		    @"WHERE device_id=$device_id"] retain];
+		_positionSetStatement = [[_conn prepareStatement:
+		    @"INSERT OR REPLACE INTO sliding_sync_positions (\n"
+		    @"    device_id, position\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2\n"
+		    @")"] retain];
+		_positionRemoveStatement = [[_conn prepareStatement:
+		    @"DELETE FROM sliding_sync_positions\n"
+		    @"WHERE device_id=?1"] retain];
+		_positionGetStatement = [[_conn prepareStatement:
+		    @"SELECT position FROM sliding_sync_positions\n"
+		    @"WHERE device_id=?1"] retain];
 		_joinedRoomsAddStatement = [[_conn prepareStatement:
 		    @"INSERT OR REPLACE INTO joined_rooms (\n"
 		    @"    user_id, room_id\n"
@@ -66,6 +162,126 @@
 		_joinedRoomsGetStatement = [[_conn prepareStatement:
 		    @"SELECT room_id FROM joined_rooms\n"
 		    @"WHERE user_id=$user_id"] retain];
+		_joinedRoomsAddBatchStatement = [[self
+		    batchStatementWithPrefix:
+		    @"INSERT OR REPLACE INTO joined_rooms (\n"
+		    @"    user_id, room_id\n"
+		    @") VALUES\n"
+				    rowPrefix: @"    (?1, "
+				    rowSuffix: @")"
+				       suffix: @""] retain];
+		_joinedRoomsRemoveBatchStatement = [[self
+		    batchStatementWithPrefix:
+		    @"DELETE FROM joined_rooms\n"
+		    @"WHERE user_id=?1 AND room_id IN (\n"
+				    rowPrefix: @"    "
+				    rowSuffix: @""
+				       suffix: @"\n)"] retain];
+		_filterIDSetStatement = [[_conn prepareStatement:
+		    @"INSERT OR REPLACE INTO filters (\n"
+		    @"    user_id, filter, filter_id\n"
+		    @") VALUES (\n"
+		    @"    $user_id, $filter, $filter_id\n"
+		    @")"] retain];
+		_filterIDGetStatement = [[_conn prepareStatement:
+		    @"SELECT filter_id FROM filters\n"
+		    @"WHERE user_id=$user_id AND filter=$filter"] retain];
+		_timelineLastPositionStatement = [[_conn prepareStatement:
+		    @"SELECT position FROM timeline_events\n"
+		    @"WHERE room_id=?1\n"
+		    @"ORDER BY position DESC LIMIT 1"] retain];
+		_timelineInsertStatement = [[_conn prepareStatement:
+		    @"INSERT INTO timeline_events (\n"
+		    @"    room_id, position, event_id, event, gap_token\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2, ?3, ?4, ?5\n"
+		    @")"] retain];
+		_timelineEventExistsStatement = [[_conn prepareStatement:
+		    @"SELECT 1 FROM timeline_events\n"
+		    @"WHERE room_id=?1 AND event_id=?2"] retain];
+		_timelineGapGetStatement = [[_conn prepareStatement:
+		    @"SELECT position FROM timeline_events\n"
+		    @"WHERE room_id=?1 AND gap_token=?2"] retain];
+		_timelineRemoveStatement = [[_conn prepareStatement:
+		    @"DELETE FROM timeline_events\n"
+		    @"WHERE room_id=?1 AND position=?2"] retain];
+		_timelineGetStatement = [[_conn prepareStatement:
+		    @"SELECT position, event, gap_token FROM timeline_events\n"
+		    @"WHERE room_id=?1 AND position<?2\n"
+		    @"ORDER BY position DESC LIMIT ?3"] retain];
+		_stateSetStatement = [[_conn prepareStatement:
+		    @"INSERT OR REPLACE INTO room_state (\n"
+		    @"    room_id, type, state_key, event\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2, ?3, ?4\n"
+		    @")"] retain];
+		_stateGetStatement = [[_conn prepareStatement:
+		    @"SELECT event FROM room_state\n"
+		    @"WHERE room_id=?1 AND type=?2 AND state_key=?3"] retain];
+		_memberSetStatement = [[_conn prepareStatement:
+		    @"INSERT OR REPLACE INTO room_members (\n"
+		    @"    room_id, user_id, membership, display_name\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2, ?3, ?4\n"
+		    @")"] retain];
+		_memberGetStatement = [[_conn prepareStatement:
+		    @"SELECT membership, display_name FROM room_members\n"
+		    @"WHERE room_id=?1 AND user_id=?2"] retain];
+		_memberCountStatement = [[_conn prepareStatement:
+		    @"SELECT COUNT(*) FROM room_members\n"
+		    @"WHERE room_id=?1 AND membership=?2"] retain];
+		_outgoingAddStatement = [[_conn prepareStatement:
+		    @"INSERT INTO outgoing_events (\n"
+		    @"    device_id, transaction_id, room_id, type, content\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2, ?3, ?4, ?5\n"
+		    @")"] retain];
+		_outgoingRemoveStatement = [[_conn prepareStatement:
+		    @"DELETE FROM outgoing_events\n"
+		    @"WHERE device_id=?1 AND transaction_id=?2"] retain];
+		_outgoingGetStatement = [[_conn prepareStatement:
+		    @"SELECT transaction_id, room_id, type, content\n"
+		    @"FROM outgoing_events\n"
+		    @"WHERE device_id=?1\n"
+		    @"ORDER BY rowid"] retain];
+		_deviceListTrackStatement = [[_conn prepareStatement:
+		    @"INSERT OR IGNORE INTO device_lists (\n"
+		    @"    device_id, user_id, outdated, devices\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2, 1, NULL\n"
+		    @")"] retain];
+		_deviceListMarkOutdatedStatement = [[_conn prepareStatement:
+		    @"UPDATE device_lists SET outdated=1\n"
+		    @"WHERE device_id=?1 AND user_id=?2"] retain];
+		_deviceListRemoveStatement = [[_conn prepareStatement:
+		    @"DELETE FROM device_lists\n"
+		    @"WHERE device_id=?1 AND user_id=?2"] retain];
+		_deviceListSetStatement = [[_conn prepareStatement:
+		    @"UPDATE device_lists SET outdated=0, devices=?3\n"
+		    @"WHERE device_id=?1 AND user_id=?2"] retain];
+		_deviceListGetStatement = [[_conn prepareStatement:
+		    @"SELECT devices FROM device_lists\n"
+		    @"WHERE device_id=?1 AND user_id=?2"] retain];
+		_deviceListOutdatedStatement = [[_conn prepareStatement:
+		    @"SELECT user_id FROM device_lists\n"
+		    @"WHERE device_id=?1 AND outdated=1"] retain];
+		_toDeviceAddStatement = [[_conn prepareStatement:
+		    @"INSERT INTO to_device_events (\n"
+		    @"    device_id, event\n"
+		    @") VALUES (\n"
+		    @"    ?1, ?2\n"
+		    @")"] retain];
+		_toDeviceGetStatement = [[_conn prepareStatement:
+		    @"SELECT event FROM to_device_events\n"
+		    @"WHERE device_id=?1\n"
+		    @"ORDER BY id"] retain];
+		_toDeviceRemoveStatement = [[_conn prepareStatement:
+		    @"DELETE FROM to_device_events\n"
+		    @"WHERE id IN (\n"
+		    @"    SELECT id FROM to_device_events\n"
+		    @"    WHERE device_id=?1\n"
+		    @"    ORDER BY id LIMIT ?2\n"
+		    @")"] retain];
 
 		objc_autoreleasePoolPop(pool);
 	} @catch (id e) {
@@ -78,33 +294,374 @@
 
 - (void)dealloc
 {
+	[_identifierKeys release];
+	[_keyIdentifiers release];
+	[_identifierKeyGetStatement release];
+	[_identifierAddStatement release];
+	[_identifierGetStatement release];
 	[_nextBatchSetStatement release];
 	[_nextBatchGetStatement release];
+	[_positionSetStatement release];
+	[_positionRemoveStatement release];
+	[_positionGetStatement release];
 	[_joinedRoomsAddStatement release];
 	[_joinedRoomsRemoveStatement release];
 	[_joinedRoomsGetStatement release];
+	[_joinedRoomsAddBatchStatement release];
+	[_joinedRoomsRemoveBatchStatement release];
+	[_filterIDSetStatement release];
+	[_filterIDGetStatement release];
+	[_timelineLastPositionStatement release];
+	[_timelineInsertStatement release];
+	[_timelineEventExistsStatement release];
+	[_timelineGapGetStatement release];
+	[_timelineRemoveStatement release];
+	[_timelineGetStatement release];
+	[_stateSetStatement release];
+	[_stateGetStatement release];
+	[_memberSetStatement release];
+	[_memberGetStatement release];
+	[_memberCountStatement release];
+	[_outgoingAddStatement release];
+	[_outgoingRemoveStatement release];
+	[_outgoingGetStatement release];
+	[_deviceListTrackStatement release];
+	[_deviceListMarkOutdatedStatement release];
+	[_deviceListRemoveStatement release];
+	[_deviceListSetStatement release];
+	[_deviceListGetStatement release];
+	[_deviceListOutdatedStatement release];
+	[_toDeviceAddStatement release];
+	[_toDeviceGetStatement release];
+	[_toDeviceRemoveStatement release];
 	[_conn release];
 
 	[super dealloc];
 }
 
+- (SL3PreparedStatement *)batchStatementWithPrefix: (OFString *)prefix
+					  rowPrefix: (OFString *)rowPrefix
+					  rowSuffix: (OFString *)rowSuffix
+					     suffix: (OFString *)suffix
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableString *SQL = [OFMutableString stringWithString: prefix];
+
+	/* Parameter 1 is the user key, the rooms start at parameter 2. */
+	for (size_t i = 0; i < batchSize; i++) {
+		if (i > 0)
+			[SQL appendString: @",\n"];
+
+		[SQL appendFormat: @"%@?%zu%@", rowPrefix, i + 2, rowSuffix];
+	}
+
+	[SQL appendString: suffix];
+
+	SL3PreparedStatement *statement =
+	    [[_conn prepareStatement: SQL] retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [statement autorelease];
+}
+
+- (long long)schemaVersion
+{
+	void *pool = objc_autoreleasePoolPush();
+	SL3PreparedStatement *statement =
+	    [_conn prepareStatement: @"PRAGMA user_version"];
+	long long version = 0;
+
+	if ([statement step])
+		version = [[statement objectForColumn: 0] longLongValue];
+
+	objc_autoreleasePoolPop(pool);
+
+	return version;
+}
+
+- (bool)hasTable: (OFString *)table
+{
+	void *pool = objc_autoreleasePoolPush();
+	SL3PreparedStatement *statement = [_conn prepareStatement:
+	    @"SELECT 1 FROM sqlite_master\n"
+	    @"WHERE type='table' AND name=?1"];
+
+	[statement bindWithArray: @[ table ]];
+	bool exists = [statement step];
+
+	objc_autoreleasePoolPop(pool);
+
+	return exists;
+}
+
 - (void)createTables
+{
+	if (self.schemaVersion == 0 && [self hasTable: @"joined_rooms"]) {
+		[_conn transactionWithBlock: ^ {
+			[self migrateToIdentifierKeys];
+			return true;
+		}];
+		return;
+	}
+
+	[self createCurrentTables];
+}
+
+- (void)createCurrentTables
 {
 	[_conn executeStatement:
+	    @"CREATE TABLE IF NOT EXISTS identifiers (\n"
+	    @"    id INTEGER PRIMARY KEY,\n"
+	    @"    identifier TEXT NOT NULL UNIQUE\n"
+	    @");\n"
 	    @"CREATE TABLE IF NOT EXISTS next_batch (\n"
 	    @"    device_id TEXT PRIMARY KEY,\n"
 	    @"    next_batch TEXT\n"
 	    @");\n"
+	    @"CREATE TABLE IF NOT EXISTS sliding_sync_positions (\n"
+	    @"    device_id TEXT PRIMARY KEY,\n"
+	    @"    position TEXT\n"
+	    @");\n"
 	    @"CREATE TABLE IF NOT EXISTS joined_rooms (\n"
+	    @"    user_id INTEGER,\n"
+	    @"    room_id INTEGER,\n"
+	    @"    PRIMARY KEY (user_id, room_id)\n"
+	    @") WITHOUT ROWID;\n"
+	    @"CREATE TABLE IF NOT EXISTS filters (\n"
 	    @"    user_id TEXT,\n"
+	    @"    filter TEXT,\n"
+	    @"    filter_id TEXT,\n"
+	    @"    PRIMARY KEY (user_id, filter)\n"
+	    @");\n"
+	    @"CREATE TABLE IF NOT EXISTS timeline_events (\n"
+	    @"    room_id INTEGER,\n"
+	    @"    position INTEGER,\n"
+	    @"    event_id TEXT,\n"
+	    @"    event TEXT,\n"
+	    @"    gap_token TEXT,\n"
+	    @"    PRIMARY KEY (room_id, position)\n"
+	    @");\n"
+	    @"CREATE INDEX IF NOT EXISTS timeline_events_event_id\n"
+	    @"ON timeline_events (room_id, event_id);\n"
+	    @"CREATE TABLE IF NOT EXISTS room_state (\n"
+	    @"    room_id INTEGER,\n"
+	    @"    type INTEGER,\n"
+	    @"    state_key TEXT,\n"
+	    @"    event TEXT,\n"
+	    @"    PRIMARY KEY (room_id, type, state_key)\n"
+	    @") WITHOUT ROWID;\n"
+	    @"CREATE TABLE IF NOT EXISTS room_members (\n"
+	    @"    room_id INTEGER,\n"
+	    @"    user_id INTEGER,\n"
+	    @"    membership INTEGER,\n"
+	    @"    display_name TEXT,\n"
+	    @"    PRIMARY KEY (room_id, user_id)\n"
+	    @") WITHOUT ROWID;\n"
+	    @"CREATE INDEX IF NOT EXISTS room_members_membership\n"
+	    @"ON room_members (room_id, membership);\n"
+	    @"CREATE TABLE IF NOT EXISTS outgoing_events (\n"
+	    @"    device_id TEXT,\n"
+	    @"    transaction_id TEXT,\n"
 	    @"    room_id TEXT,\n"
-	    @"    PRIMARY KEY (user_id, room_id)\n"
-	    @");"];
+	    @"    type TEXT,\n"
+	    @"    content TEXT,\n"
+	    @"    UNIQUE (device_id, transaction_id)\n"
+	    @");\n"
+	    @"CREATE TABLE IF NOT EXISTS device_lists (\n"
+	    @"    device_id TEXT,\n"
+	    @"    user_id INTEGER,\n"
+	    @"    outdated INTEGER,\n"
+	    @"    devices TEXT,\n"
+	    @"    PRIMARY KEY (device_id, user_id)\n"
+	    @") WITHOUT ROWID;\n"
+	    @"CREATE INDEX IF NOT EXISTS device_lists_outdated\n"
+	    @"ON device_lists (device_id, outdated);\n"
+	    @"CREATE TABLE IF NOT EXISTS to_device_events (\n"
+	    @"    id INTEGER PRIMARY KEY AUTOINCREMENT,\n"
+	    @"    device_id TEXT,\n"
+	    @"    event TEXT\n"
+	    @");\n"
+	    @"CREATE INDEX IF NOT EXISTS to_device_events_device_id\n"
+	    @"ON to_device_events (device_id, id);"];
+	[_conn executeStatement: [OFString stringWithFormat:
+	    @"PRAGMA user_version = %lld", schemaVersion]];
+}
+
+/*
+ * Converts a database created before identifiers were stored as integer keys.
+ * Older databases may lack some of the tables, as they were added over time,
+ * so only the tables that exist are copied.
+ */
+- (void)migrateToIdentifierKeys
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableSet<OFString *> *oldTables = [OFMutableSet set];
+
+	for (OFString *table in @[ @"joined_rooms", @"timeline_events",
+	    @"room_state", @"room_members" ]) {
+		if (![self hasTable: table])
+			continue;
+
+		[_conn executeStatement: [OFString stringWithFormat:
+		    @"ALTER TABLE %@ RENAME TO old_%@", table, table]];
+		[oldTables addObject: table];
+	}
+
+	/* Renamed tables keep their indexes, which would clash by name. */
+	[_conn executeStatement:
+	    @"DROP INDEX IF EXISTS timeline_events_event_id;\n"
+	    @"DROP INDEX IF EXISTS room_members_membership;"];
+
+	[self createCurrentTables];
+
+	if ([oldTables containsObject: @"joined_rooms"])
+		[_conn executeStatement:
+		    @"INSERT OR IGNORE INTO identifiers (identifier)\n"
+		    @"    SELECT user_id FROM old_joined_rooms UNION\n"
+		    @"    SELECT room_id FROM old_joined_rooms;\n"
+		    @"INSERT INTO joined_rooms (user_id, room_id)\n"
+		    @"    SELECT u.id, r.id FROM old_joined_rooms AS o\n"
+		    @"    JOIN identifiers AS u ON u.identifier=o.user_id\n"
+		    @"    JOIN identifiers AS r ON r.identifier=o.room_id;\n"
+		    @"DROP TABLE old_joined_rooms;"];
+
+	if ([oldTables containsObject: @"timeline_events"])
+		[_conn executeStatement:
+		    @"INSERT OR IGNORE INTO identifiers (identifier)\n"
+		    @"    SELECT room_id FROM old_timeline_events;\n"
+		    @"INSERT INTO timeline_events (\n"
+		    @"    room_id, position, event_id, event, gap_token\n"
+		    @")\n"
+		    @"    SELECT r.id, o.position, o.event_id, o.event,\n"
+		    @"        o.gap_token\n"
+		    @"    FROM old_timeline_events AS o\n"
+		    @"    JOIN identifiers AS r ON r.identifier=o.room_id;\n"
+		    @"DROP TABLE old_timeline_events;"];
+
+	if ([oldTables containsObject: @"room_state"])
+		[_conn executeStatement:
+		    @"INSERT OR IGNORE INTO identifiers (identifier)\n"
+		    @"    SELECT room_id FROM old_room_state UNION\n"
+		    @"    SELECT type FROM old_room_state;\n"
+		    @"INSERT INTO room_state (\n"
+		    @"    room_id, type, state_key, event\n"
+		    @")\n"
+		    @"    SELECT r.id, t.id, o.state_key, o.event\n"
+		    @"    FROM old_room_state AS o\n"
+		    @"    JOIN identifiers AS r ON r.identifier=o.room_id\n"
+		    @"    JOIN identifiers AS t ON t.identifier=o.type;\n"
+		    @"DROP TABLE old_room_state;"];
+
+	if ([oldTables containsObject: @"room_members"])
+		[_conn executeStatement:
+		    @"INSERT OR IGNORE INTO identifiers (identifier)\n"
+		    @"    SELECT room_id FROM old_room_members UNION\n"
+		    @"    SELECT user_id FROM old_room_members;\n"
+		    @"INSERT INTO room_members (\n"
+		    @"    room_id, user_id, membership, display_name\n"
+		    @")\n"
+		    @"    SELECT r.id, u.id, o.membership, o.display_name\n"
+		    @"    FROM old_room_members AS o\n"
+		    @"    JOIN identifiers AS r ON r.identifier=o.room_id\n"
+		    @"    JOIN identifiers AS u ON u.identifier=o.user_id;\n"
+		    @"DROP TABLE old_room_members;"];
+
+	objc_autoreleasePoolPop(pool);
 }
 
 - (void)transactionWithBlock: (MTXStorageTransactionBlock)block
 {
-	[_conn transactionWithBlock: block];
+	__block bool committed = false;
+
+	@try {
+		[_conn transactionWithBlock: ^ {
+			committed = block();
+			return committed;
+		}];
+	} @finally {
+		/* Keys added by a rolled back transaction do not exist. */
+		if (!committed) {
+			[_identifierKeys removeAllObjects];
+			[_keyIdentifiers removeAllObjects];
+		}
+	}
+}
+
+- (void)cacheKey: (OFNumber *)key forIdentifier: (OFString *)identifier
+{
+	/*
+	 * Not interned, as most identifiers are user IDs, which the shared
+	 * table would keep after the storage is gone.
+	 */
+	identifier = [[identifier copy] autorelease];
+
+	[_identifierKeys setObject: key forKey: identifier];
+	[_keyIdentifiers setObject: identifier forKey: key];
+}
+
+/*
+ * Returns the integer key of the identifier. If the identifier has no key yet,
+ * it is added if create is true and nil is returned otherwise.
+ */
+- (OFNumber *)keyForIdentifier: (OFString *)identifier create: (bool)create
+{
+	OFNumber *key = [_identifierKeys objectForKey: identifier];
+
+	if (key != nil)
+		return key;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_identifierKeyGetStatement reset];
+	[_identifierKeyGetStatement bindWithArray: @[ identifier ]];
+
+	if (![_identifierKeyGetStatement step]) {
+		if (!create) {
+			objc_autoreleasePoolPop(pool);
+			return nil;
+		}
+
+		[_identifierAddStatement reset];
+		[_identifierAddStatement bindWithArray: @[ identifier ]];
+		[_identifierAddStatement step];
+
+		[_identifierKeyGetStatement reset];
+		[_identifierKeyGetStatement bindWithArray: @[ identifier ]];
+
+		if (![_identifierKeyGetStatement step])
+			@throw [OFInvalidFormatException exception];
+	}
+
+	key = [_identifierKeyGetStatement objectForColumn: 0];
+	[self cacheKey: key forIdentifier: identifier];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [_identifierKeys objectForKey: identifier];
+}
+
+- (OFString *)identifierForKey: (OFNumber *)key
+{
+	OFString *identifier = [_keyIdentifiers objectForKey: key];
+
+	if (identifier != nil)
+		return identifier;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_identifierGetStatement reset];
+	[_identifierGetStatement bindWithArray: @[ key ]];
+
+	if (![_identifierGetStatement step])
+		@throw [OFInvalidFormatException exception];
+
+	[self cacheKey: key
+	 forIdentifier: [_identifierGetStatement objectForColumn: 0]];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [_keyIdentifiers objectForKey: key];
 }
 
 - (void)setNextBatch: (OFString *)nextBatch forDeviceID: (OFString *)deviceID
@@ -130,8 +687,10 @@
 		@"$device_id": deviceID
 	}];
 
-	if (![_nextBatchGetStatement step])
+	if (![_nextBatchGetStatement step]) {
+		objc_autoreleasePoolPop(pool);
 		return nil;
+	}
 
 	OFString *nextBatch =
 	    [_nextBatchGetStatement.currentRowDictionary[@"next_batch"] retain];
@@ -141,14 +700,52 @@
 	return [nextBatch autorelease];
 }
 
+- (void)setSlidingSyncPosition: (OFString *)position
+		   forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	if (position != nil) {
+		[_positionSetStatement reset];
+		[_positionSetStatement bindWithArray: @[ deviceID, position ]];
+		[_positionSetStatement step];
+	} else {
+		[_positionRemoveStatement reset];
+		[_positionRemoveStatement bindWithArray: @[ deviceID ]];
+		[_positionRemoveStatement step];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)slidingSyncPositionForDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[_positionGetStatement reset];
+	[_positionGetStatement bindWithArray: @[ deviceID ]];
+
+	if (![_positionGetStatement step]) {
+		objc_autoreleasePoolPop(pool);
+		return nil;
+	}
+
+	OFString *position = [[_positionGetStatement objectForColumn: 0]
+	    retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [position autorelease];
+}
+
 - (void)addJoinedRoom: (OFString *)roomID forUser: (OFString *)userID
 {
 	void *pool = objc_autoreleasePoolPush();
 
 	[_joinedRoomsAddStatement reset];
 	[_joinedRoomsAddStatement bindWithDictionary: @{
-		@"$room_id": roomID,
-		@"$user_id": userID
+		@"$room_id": [self keyForIdentifier: roomID create: true],
+		@"$user_id": [self keyForIdentifier: userID create: true]
 	}];
 	[_joinedRoomsAddStatement step];
 
@@ -157,32 +754,754 @@
 
 - (void)removeJoinedRoom: (OFString *)roomID forUser: (OFString *)userID
 {
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+	OFNumber *userKey = [self keyForIdentifier: userID create: false];
+
+	if (roomKey == nil || userKey == nil)
+		return;
+
 	void *pool = objc_autoreleasePoolPush();
 
 	[_joinedRoomsRemoveStatement reset];
 	[_joinedRoomsRemoveStatement bindWithDictionary: @{
-		@"$room_id": roomID,
-		@"$user_id": userID
+		@"$room_id": roomKey,
+		@"$user_id": userKey
 	}];
 	[_joinedRoomsRemoveStatement step];
 
 	objc_autoreleasePoolPop(pool);
 }
 
+- (void)stepBatchStatement: (SL3PreparedStatement *)statement
+		   roomIDs: (OFArray<OFString *> *)roomIDs
+		    userID: (OFString *)userID
+		    create: (bool)create
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFNumber *userKey = [self keyForIdentifier: userID create: create];
+	OFMutableArray<OFNumber *> *roomKeys =
+	    [OFMutableArray arrayWithCapacity: roomIDs.count];
+
+	for (OFString *roomID in roomIDs) {
+		OFNumber *roomKey = [self keyForIdentifier: roomID
+						    create: create];
+
+		if (roomKey != nil)
+			[roomKeys addObject: roomKey];
+	}
+
+	size_t count = roomKeys.count;
+
+	if (userKey == nil || count == 0) {
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	OFMutableArray *arguments =
+	    [OFMutableArray arrayWithCapacity: batchSize + 1];
+
+	for (size_t i = 0; i < count; i += batchSize) {
+		[arguments removeAllObjects];
+		[arguments addObject: userKey];
+
+		/*
+		 * The last batch is padded by repeating the last room, which
+		 * is harmless for both inserting and deleting.
+		 */
+		for (size_t j = 0; j < batchSize; j++)
+			[arguments addObject: [roomKeys objectAtIndex:
+			    (i + j < count ? i + j : count - 1)]];
+
+		[statement reset];
+		[statement bindWithArray: arguments];
+		[statement step];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)addJoinedRooms: (OFArray<OFString *> *)roomIDs
+	       forUser: (OFString *)userID
+{
+	[self stepBatchStatement: _joinedRoomsAddBatchStatement
+			 roomIDs: roomIDs
+			  userID: userID
+			  create: true];
+}
+
+- (void)removeJoinedRooms: (OFArray<OFString *> *)roomIDs
+		  forUser: (OFString *)userID
+{
+	[self stepBatchStatement: _joinedRoomsRemoveBatchStatement
+			 roomIDs: roomIDs
+			  userID: userID
+			  create: false];
+}
+
 - (OFArray<OFString *> *)joinedRoomsForUser: (OFString *)userID
 {
 	OFMutableArray *joinedRooms = [OFMutableArray array];
 	void *pool = objc_autoreleasePoolPush();
+	OFNumber *userKey = [self keyForIdentifier: userID create: false];
+
+	if (userKey == nil) {
+		objc_autoreleasePoolPop(pool);
+		return joinedRooms;
+	}
 
 	[_joinedRoomsGetStatement reset];
-	[_joinedRoomsGetStatement bindWithDictionary: @{ @"$user_id": userID }];
+	[_joinedRoomsGetStatement bindWithDictionary: @{
+		@"$user_id": userKey
+	}];
 
 	while ([_joinedRoomsGetStatement step])
-		[joinedRooms addObject:
-		    _joinedRoomsGetStatement.currentRowDictionary[@"room_id"]];
+		[joinedRooms addObject: [self identifierForKey:
+		    [_joinedRoomsGetStatement objectForColumn: 0]]];
+
+	objc_autoreleasePoolPop(pool);
+
+	return joinedRooms;
+}
+
+- (void)setFilterID: (OFString *)filterID
+	  forFilter: (OFString *)filter
+	     userID: (OFString *)userID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[_filterIDSetStatement reset];
+	[_filterIDSetStatement bindWithDictionary: @{
+		@"$user_id": userID,
+		@"$filter": filter,
+		@"$filter_id": filterID
+	}];
+	[_filterIDSetStatement step];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)filterIDForFilter: (OFString *)filter userID: (OFString *)userID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[_filterIDGetStatement reset];
+	[_filterIDGetStatement bindWithDictionary: @{
+		@"$user_id": userID,
+		@"$filter": filter
+	}];
+
+	if (![_filterIDGetStatement step]) {
+		objc_autoreleasePoolPop(pool);
+		return nil;
+	}
+
+	OFString *filterID =
+	    [_filterIDGetStatement.currentRowDictionary[@"filter_id"] retain];
 
 	objc_autoreleasePoolPop(pool);
 
-	return [joinedRooms autorelease];
+	return [filterID autorelease];
+}
+
+- (bool)lastTimelinePosition: (int64_t *)position inRoom: (OFString *)roomID
+{
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+	bool found;
+
+	if (roomKey == nil)
+		return false;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_timelineLastPositionStatement reset];
+	[_timelineLastPositionStatement bindWithArray: @[ roomKey ]];
+
+	if ((found = [_timelineLastPositionStatement step]))
+		*position = [[_timelineLastPositionStatement
+		    objectForColumn: 0] longLongValue];
+
+	objc_autoreleasePoolPop(pool);
+
+	return found;
+}
+
+- (bool)hasTimelineEventWithID: (OFString *)eventID inRoom: (OFString *)roomID
+{
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+
+	if (roomKey == nil)
+		return false;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_timelineEventExistsStatement reset];
+	[_timelineEventExistsStatement bindWithArray: @[ roomKey, eventID ]];
+	bool exists = [_timelineEventExistsStatement step];
+
+	objc_autoreleasePoolPop(pool);
+
+	return exists;
+}
+
+- (void)insertTimelineEntryInRoom: (OFString *)roomID
+			 position: (int64_t)position
+			    event: (OFDictionary<OFString *, id> *)event
+			 gapToken: (OFString *)gapToken
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFString *eventID = event[@"event_id"];
+
+	if (![eventID isKindOfClass: OFString.class])
+		eventID = nil;
+
+	[_timelineInsertStatement reset];
+	[_timelineInsertStatement bindWithArray: @[
+		[self keyForIdentifier: roomID create: true],
+		@(position),
+		(eventID != nil ? eventID : [OFNull null]),
+		(event != nil ? event.JSONRepresentation : [OFNull null]),
+		(gapToken != nil ? gapToken : [OFNull null])
+	]];
+	[_timelineInsertStatement step];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)appendTimelineEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		      toRoom: (OFString *)roomID
+		   prevBatch: (OFString *)prevBatch
+		     limited: (bool)limited
+{
+	int64_t position;
+	bool hasTimeline = [self lastTimelinePosition: &position
+					       inRoom: roomID];
+
+	if (!hasTimeline || limited) {
+		int64_t chunk = (hasTimeline ? (position >> 32) + 1 : 1);
+
+		position = (chunk << 32) | chunkMiddle;
+
+		if (prevBatch != nil)
+			[self insertTimelineEntryInRoom: roomID
+					       position: position
+						  event: nil
+					       gapToken: prevBatch];
+	}
+
+	for (OFDictionary<OFString *, id> *event in events) {
+		OFString *eventID = event[@"event_id"];
+
+		if ([eventID isKindOfClass: OFString.class] &&
+		    [self hasTimelineEventWithID: eventID inRoom: roomID])
+			continue;
+
+		if ((++position & UINT32_MAX) == 0)
+			@throw [OFOutOfRangeException exception];
+
+		[self insertTimelineEntryInRoom: roomID
+				       position: position
+					  event: event
+				       gapToken: nil];
+	}
+}
+
+- (void)fillGapWithToken: (OFString *)gapToken
+		  inRoom: (OFString *)roomID
+		  events: (OFArray<OFDictionary<OFString *, id> *> *)events
+		endToken: (OFString *)endToken
+{
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+	int64_t position;
+
+	/* A room without a timeline has no gaps. */
+	if (roomKey == nil)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_timelineGapGetStatement reset];
+	[_timelineGapGetStatement bindWithArray: @[ roomKey, gapToken ]];
+
+	/* Already filled. */
+	if (![_timelineGapGetStatement step]) {
+		objc_autoreleasePoolPop(pool);
+		return;
+	}
+
+	position = [[_timelineGapGetStatement objectForColumn: 0]
+	    longLongValue];
+
+	[_timelineRemoveStatement reset];
+	[_timelineRemoveStatement bindWithArray: @[ roomKey, @(position) ]];
+	[_timelineRemoveStatement step];
+
+	for (OFDictionary<OFString *, id> *event in events) {
+		OFString *eventID = event[@"event_id"];
+
+		/* Reached events that are already stored, gap is closed. */
+		if ([eventID isKindOfClass: OFString.class] &&
+		    [self hasTimelineEventWithID: eventID inRoom: roomID]) {
+			objc_autoreleasePoolPop(pool);
+			return;
+		}
+
+		[self insertTimelineEntryInRoom: roomID
+				       position: position
+					  event: event
+				       gapToken: nil];
+
+		if ((position-- & UINT32_MAX) == 0)
+			@throw [OFOutOfRangeException exception];
+	}
+
+	if (endToken != nil)
+		[self insertTimelineEntryInRoom: roomID
+				       position: position
+					  event: nil
+				       gapToken: endToken];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFArray<MTXTimelineEntry *> *)
+    timelineEntriesForRoom: (OFString *)roomID
+	    beforePosition: (int64_t)position
+		     limit: (size_t)limit
+{
+	OFMutableArray *entries = [OFMutableArray array];
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+
+	if (roomKey == nil)
+		return entries;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_timelineGetStatement reset];
+	[_timelineGetStatement bindWithArray: @[
+		roomKey, @(position), @((unsigned long long)limit)
+	]];
+
+	while ([_timelineGetStatement step]) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFNumber *entryPosition =
+		    [_timelineGetStatement objectForColumn: 0];
+		OFString *event = [_timelineGetStatement objectForColumn: 1];
+		OFString *gapToken = [_timelineGetStatement objectForColumn: 2];
+
+		[entries addObject: [MTXTimelineEntry
+		    entryWithPosition: entryPosition.longLongValue
+				event: ([event isKindOfClass: OFString.class]
+					   ? event.objectByParsingJSON : nil)
+			     gapToken: ([gapToken isKindOfClass: OFString.class]
+					   ? gapToken : nil)]];
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	return entries;
+}
+
+- (void)applyStateEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		  toRoom: (OFString *)roomID
+{
+	for (OFDictionary<OFString *, id> *event in events) {
+		void *pool = objc_autoreleasePoolPush();
+		OFString *type = event[@"type"];
+		OFString *stateKey = event[@"state_key"];
+
+		if (![type isKindOfClass: OFString.class] ||
+		    ![stateKey isKindOfClass: OFString.class]) {
+			objc_autoreleasePoolPop(pool);
+			continue;
+		}
+
+		if ([type isEqual: @"m.room.member"]) {
+			OFDictionary<OFString *, id> *content =
+			    event[@"content"];
+			OFNumber *membership = nil;
+			OFString *displayName = nil;
+
+			if ([content isKindOfClass: OFDictionary.class]) {
+				membership = membershipToNumber(
+				    content[@"membership"]);
+				displayName = content[@"displayname"];
+			}
+
+			if (membership == nil) {
+				objc_autoreleasePoolPop(pool);
+				continue;
+			}
+
+			if (![displayName isKindOfClass: OFString.class])
+				displayName = nil;
+
+			[_memberSetStatement reset];
+			[_memberSetStatement bindWithArray: @[
+				[self keyForIdentifier: roomID create: true],
+				[self keyForIdentifier: stateKey create: true],
+				membership,
+				(displayName != nil
+				    ? displayName : [OFNull null])
+			]];
+			[_memberSetStatement step];
+		} else {
+			[_stateSetStatement reset];
+			[_stateSetStatement bindWithArray: @[
+				[self keyForIdentifier: roomID create: true],
+				[self keyForIdentifier: type create: true],
+				stateKey,
+				event.JSONRepresentation
+			]];
+			[_stateSetStatement step];
+		}
+
+		objc_autoreleasePoolPop(pool);
+	}
+}
+
+- (OFDictionary<OFString *, id> *)stateEventWithType: (OFString *)type
+					    stateKey: (OFString *)stateKey
+					      inRoom: (OFString *)roomID
+{
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+	OFNumber *typeKey = [self keyForIdentifier: type create: false];
+
+	if (roomKey == nil || typeKey == nil)
+		return nil;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_stateGetStatement reset];
+	[_stateGetStatement bindWithArray: @[ roomKey, typeKey, stateKey ]];
+
+	if (![_stateGetStatement step]) {
+		objc_autoreleasePoolPop(pool);
+		return nil;
+	}
+
+	OFDictionary *event = [[[_stateGetStatement objectForColumn: 0]
+	    objectByParsingJSON] retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [event autorelease];
+}
+
+- (bool)stepMemberGetStatementForUser: (OFString *)userID
+			       inRoom: (OFString *)roomID
+{
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+	OFNumber *userKey = [self keyForIdentifier: userID create: false];
+
+	if (roomKey == nil || userKey == nil)
+		return false;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_memberGetStatement reset];
+	[_memberGetStatement bindWithArray: @[ roomKey, userKey ]];
+	bool found = [_memberGetStatement step];
+
+	objc_autoreleasePoolPop(pool);
+
+	return found;
+}
+
+- (OFString *)membershipOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	if (![self stepMemberGetStatementForUser: userID inRoom: roomID])
+		return nil;
+
+	unsigned long long membership =
+	    [[_memberGetStatement objectForColumn: 0]
+	    unsignedLongLongValue];
+
+	if (membership >= numMemberships)
+		return nil;
+
+	return memberships[membership];
+}
+
+- (OFString *)displayNameOfUser: (OFString *)userID inRoom: (OFString *)roomID
+{
+	if (![self stepMemberGetStatementForUser: userID inRoom: roomID])
+		return nil;
+
+	OFString *displayName = [_memberGetStatement objectForColumn: 1];
+
+	if (![displayName isKindOfClass: OFString.class])
+		return nil;
+
+	return displayName;
+}
+
+- (size_t)numberOfMembersInRoom: (OFString *)roomID
+		 withMembership: (OFString *)membership
+{
+	OFNumber *number = membershipToNumber(membership);
+	OFNumber *roomKey = [self keyForIdentifier: roomID create: false];
+
+	if (number == nil || roomKey == nil)
+		return 0;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_memberCountStatement reset];
+	[_memberCountStatement bindWithArray: @[ roomKey, number ]];
+	[_memberCountStatement step];
+
+	size_t count = (size_t)[[_memberCountStatement objectForColumn: 0]
+	    unsignedLongLongValue];
+
+	objc_autoreleasePoolPop(pool);
+
+	return count;
+}
+
+- (void)addOutgoingEvent: (MTXOutgoingEvent *)event
+	     forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[_outgoingAddStatement reset];
+	[_outgoingAddStatement bindWithArray: @[
+		deviceID,
+		event.transactionID,
+		event.roomID,
+		event.type,
+		event.content.JSONRepresentation
+	]];
+	[_outgoingAddStatement step];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)removeOutgoingEventWithTransactionID: (OFString *)transactionID
+				 forDeviceID: (OFString *)deviceID
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[_outgoingRemoveStatement reset];
+	[_outgoingRemoveStatement bindWithArray: @[ deviceID, transactionID ]];
+	[_outgoingRemoveStatement step];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFArray<MTXOutgoingEvent *> *)outgoingEventsForDeviceID:
+    (OFString *)deviceID
+{
+	OFMutableArray *events = [OFMutableArray array];
+	void *pool = objc_autoreleasePoolPush();
+
+	[_outgoingGetStatement reset];
+	[_outgoingGetStatement bindWithArray: @[ deviceID ]];
+
+	while ([_outgoingGetStatement step]) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFDictionary *content = [[_outgoingGetStatement
+		    objectForColumn: 3] objectByParsingJSON];
+
+		if (![content isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidFormatException exception];
+
+		[events addObject: [MTXOutgoingEvent
+		    eventWithTransactionID: [_outgoingGetStatement
+					       objectForColumn: 0]
+				    roomID: [_outgoingGetStatement
+					       objectForColumn: 1]
+				      type: [_outgoingGetStatement
+					       objectForColumn: 2]
+				   content: content]];
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	return events;
+}
+
+- (void)stepDeviceListStatement: (SL3PreparedStatement *)statement
+			  users: (OFArray<OFString *> *)userIDs
+		       deviceID: (OFString *)deviceID
+			 create: (bool)create
+{
+	for (OFString *userID in userIDs) {
+		void *pool = objc_autoreleasePoolPush();
+		OFNumber *userKey = [self keyForIdentifier: userID
+						    create: create];
+
+		if (userKey != nil) {
+			[statement reset];
+			[statement bindWithArray: @[ deviceID, userKey ]];
+			[statement step];
+		}
+
+		objc_autoreleasePoolPop(pool);
+	}
+}
+
+- (void)trackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		    forDeviceID: (OFString *)deviceID
+{
+	[self stepDeviceListStatement: _deviceListTrackStatement
+				users: userIDs
+			     deviceID: deviceID
+			       create: true];
+}
+
+- (void)markDeviceListsOutdatedOfUsers: (OFArray<OFString *> *)userIDs
+			   forDeviceID: (OFString *)deviceID
+{
+	[self stepDeviceListStatement: _deviceListMarkOutdatedStatement
+				users: userIDs
+			     deviceID: deviceID
+			       create: false];
+}
+
+- (void)untrackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		      forDeviceID: (OFString *)deviceID
+{
+	[self stepDeviceListStatement: _deviceListRemoveStatement
+				users: userIDs
+			     deviceID: deviceID
+			       create: false];
+}
+
+- (void)setDevices: (OFDictionary<OFString *, OFDictionary *> *)devices
+	    ofUser: (OFString *)userID
+       forDeviceID: (OFString *)deviceID
+{
+	OFNumber *userKey = [self keyForIdentifier: userID create: false];
+
+	if (userKey == nil)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_deviceListSetStatement reset];
+	[_deviceListSetStatement bindWithArray: @[
+		deviceID, userKey, devices.JSONRepresentation
+	]];
+	[_deviceListSetStatement step];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFDictionary<OFString *, OFDictionary *> *)
+    devicesOfUser: (OFString *)userID
+      forDeviceID: (OFString *)deviceID
+{
+	OFNumber *userKey = [self keyForIdentifier: userID create: false];
+
+	if (userKey == nil)
+		return nil;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_deviceListGetStatement reset];
+	[_deviceListGetStatement bindWithArray: @[ deviceID, userKey ]];
+
+	if (![_deviceListGetStatement step]) {
+		objc_autoreleasePoolPop(pool);
+		return nil;
+	}
+
+	OFString *JSON = [_deviceListGetStatement objectForColumn: 0];
+
+	if (![JSON isKindOfClass: OFString.class]) {
+		objc_autoreleasePoolPop(pool);
+		return nil;
+	}
+
+	OFDictionary *devices = JSON.objectByParsingJSON;
+
+	if (![devices isKindOfClass: OFDictionary.class])
+		@throw [OFInvalidFormatException exception];
+
+	[devices retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [devices autorelease];
+}
+
+- (OFArray<OFString *> *)usersWithOutdatedDeviceListsForDeviceID:
+    (OFString *)deviceID
+{
+	OFMutableArray *userIDs = [OFMutableArray array];
+	void *pool = objc_autoreleasePoolPush();
+
+	[_deviceListOutdatedStatement reset];
+	[_deviceListOutdatedStatement bindWithArray: @[ deviceID ]];
+
+	while ([_deviceListOutdatedStatement step])
+		[userIDs addObject: [self identifierForKey:
+		    [_deviceListOutdatedStatement objectForColumn: 0]]];
+
+	objc_autoreleasePoolPop(pool);
+
+	return userIDs;
+}
+
+- (void)addToDeviceEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+	      forDeviceID: (OFString *)deviceID
+{
+	for (OFDictionary *event in events) {
+		void *pool = objc_autoreleasePoolPush();
+
+		[_toDeviceAddStatement reset];
+		[_toDeviceAddStatement bindWithArray: @[
+			deviceID, event.JSONRepresentation
+		]];
+		[_toDeviceAddStatement step];
+
+		objc_autoreleasePoolPop(pool);
+	}
+}
+
+- (OFArray<OFDictionary<OFString *, id> *> *)toDeviceEventsForDeviceID:
+    (OFString *)deviceID
+{
+	OFMutableArray *events = [OFMutableArray array];
+	void *pool = objc_autoreleasePoolPush();
+
+	[_toDeviceGetStatement reset];
+	[_toDeviceGetStatement bindWithArray: @[ deviceID ]];
+
+	while ([_toDeviceGetStatement step]) {
+		void *pool2 = objc_autoreleasePoolPush();
+		OFDictionary *event = [[_toDeviceGetStatement
+		    objectForColumn: 0] objectByParsingJSON];
+
+		if (![event isKindOfClass: OFDictionary.class])
+			@throw [OFInvalidFormatException exception];
+
+		[events addObject: event];
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	objc_autoreleasePoolPop(pool);
+
+	return events;
+}
+
+- (void)removeFirstToDeviceEvents: (size_t)count
+		      forDeviceID: (OFString *)deviceID
+{
+	if (count == 0)
+		return;
+
+	void *pool = objc_autoreleasePoolPush();
+
+	[_toDeviceRemoveStatement reset];
+	[_toDeviceRemoveStatement bindWithArray: @[ deviceID, @(count) ]];
+	[_toDeviceRemoveStatement step];
+
+	objc_autoreleasePoolPop(pool);
 }
 @end
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A window onto a list of rooms for sliding sync.
+ *
+ * Only the rooms in the window are sent by the server, sorted by recent
+ * activity. Changes to the list take effect with the next sync request.
+ */
+@interface MTXSlidingSyncList: OFObject
+/**
+ * @brief The name of the list.
+ */
+@property (readonly, nonatomic) OFString *name;
+
+/**
+ * @brief The window of the list.
+ *
+ * Defaults to the first 20 rooms.
+ */
+@property (nonatomic) OFRange range;
+
+/**
+ * @brief The state to send for each room in the window, as pairs of event
+ *	  type and state key.
+ *
+ * A state key of `$ME` refers to the user ID of the client, `*` to all state
+ * keys.
+ *
+ * Defaults to the name of the room and the membership of the client.
+ */
+@property (copy, nonatomic)
+    OFArray<OFPair<OFString *, OFString *> *> *requiredState;
+
+/**
+ * @brief The maximum number of timeline events to send per room.
+ *
+ * Defaults to 10.
+ */
+@property (nonatomic) size_t timelineLimit;
+
+/**
+ * @brief The total number of rooms in the list, as reported by the server
+ *	  with the last sync.
+ */
+@property (readonly, nonatomic) size_t count;
+
+/**
+ * @brief Creates a new sliding sync list with the specified name.
+ *
+ * @param name The name of the list
+ * @return An autoreleased MTXSlidingSyncList
+ */
++ (instancetype)listWithName: (OFString *)name;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated sliding sync list with the
+ *	  specified name.
+ *
+ * @param name The name of the list
+ * @return An initialized MTXSlidingSyncList
+ */
+- (instancetype)initWithName: (OFString *)name OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,95 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXSlidingSyncList.h"
+#import "MTXSlidingSyncList+Private.h"
+
+@implementation MTXSlidingSyncList
++ (instancetype)listWithName: (OFString *)name
+{
+	return [[[self alloc] initWithName: name] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithName: (OFString *)name
+{
+	self = [super init];
+
+	@try {
+		_name = [name copy];
+		_range = OFMakeRange(0, 20);
+		_requiredState = [@[
+			[OFPair pairWithFirstObject: @"m.room.name"
+				       secondObject: @""],
+			[OFPair pairWithFirstObject: @"m.room.member"
+				       secondObject: @"$ME"]
+		] retain];
+		_timelineLimit = 10;
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_name release];
+	[_requiredState release];
+
+	[super dealloc];
+}
+
+- (OFDictionary<OFString *, id> *)requestDictionary
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableArray *requiredState = [OFMutableArray array];
+
+	for (OFPair<OFString *, OFString *> *pair in _requiredState)
+		[requiredState addObject: @[ pair.firstObject,
+					     pair.secondObject ]];
+
+	/* Ranges are inclusive in sliding sync. */
+	OFArray *range = @[
+		@(_range.location),
+		@(_range.length > 0 ? _range.location + _range.length - 1 : 0)
+	];
+
+	OFDictionary *dictionary = [@{
+		@"ranges": @[ range ],
+		@"required_state": requiredState,
+		@"timeline_limit": @(_timelineLimit)
+	} retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [dictionary autorelease];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat:
+	    @"<%@ %@: %zu of %zu rooms from %zu>",
+	    self.class, _name, _range.length, _count, _range.location];
+}
+@end
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020, 2021 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2021, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -20,6 +20,9 @@
 
 OF_ASSUME_NONNULL_BEGIN
 
+@class MTXOutgoingEvent;
+@class MTXTimelineEntry;
+
 /**
  * @brief A block which will be treated as a single transaction for the storage.
  *
@@ -30,6 +33,18 @@ typedef bool (^MTXStorageTransactionBlock)(void);
 
 /**
  * @brief A protocol for a storage to be used by @ref MTXClient.
+ *
+ * All methods are required, as @ref MTXClient depends on every one of them.
+ * This is an incompatible change from earlier revisions of the protocol, which
+ * gained methods for sync filters, the sliding sync position, batched joined
+ * room writes, room timelines, room state and members, the outgoing event
+ * queue, device lists and to-device events. Storages implemented outside of
+ * ObjMatrix need to implement all of them; @ref MTXSQLite3Storage can serve
+ * as a reference.
+ *
+ * A storage must only be used by the clients of one account. The timelines
+ * and the state of rooms are stored per room, while they differ between
+ * accounts in the same room.
  */
 @protocol MTXStorage <OFObject>
 /**
@@ -54,6 +69,27 @@ typedef bool (^MTXStorageTransactionBlock)(void);
  */
 - (nullable OFString *)nextBatchForDeviceID: (OFString *)deviceID;
 
+/**
+ * @brief Stores the position of the sliding sync connection of the specified
+ *	  device.
+ *
+ * @param position The position returned by the server, or `nil` to forget the
+ *		   position, e.g. because the server expired the connection
+ * @param deviceID The device for which to store the position
+ */
+- (void)setSlidingSyncPosition: (nullable OFString *)position
+		   forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Returns the position of the sliding sync connection of the specified
+ *	  device.
+ *
+ * @param deviceID The device ID for which to return the position
+ * @return The position of the sliding sync connection, or `nil` if none is
+ *	   available
+ */
+- (nullable OFString *)slidingSyncPositionForDeviceID: (OFString *)deviceID;
+
 /**
  * @brief Adds the specified room ID to the list of joined rooms for the
  *	  specified user ID.
@@ -72,6 +108,32 @@ typedef bool (^MTXStorageTransactionBlock)(void);
  */
 - (void)removeJoinedRoom: (OFString *)roomID forUser: (OFString *)userID;
 
+/**
+ * @brief Adds the specified room IDs to the list of joined rooms for the
+ *	  specified user ID.
+ *
+ * This is equivalent to calling @ref addJoinedRoom:forUser: for each room ID,
+ * but can be implemented more efficiently.
+ *
+ * @param roomIDs The room IDs to add to the list of joined rooms
+ * @param userID The user ID for which to add the rooms
+ */
+- (void)addJoinedRooms: (OFArray<OFString *> *)roomIDs
+	       forUser: (OFString *)userID;
+
+/**
+ * @brief Removes the specified room IDs from the list of joined rooms for the
+ *	  specified user ID.
+ *
+ * This is equivalent to calling @ref removeJoinedRoom:forUser: for each room
+ * ID, but can be implemented more efficiently.
+ *
+ * @param roomIDs The room IDs to remove from the list of joined rooms
+ * @param userID The user ID for which to remove the rooms
+ */
+- (void)removeJoinedRooms: (OFArray<OFString *> *)roomIDs
+		  forUser: (OFString *)userID;
+
 /**
  * @brief Returns the joined room IDs for the specified user ID.
  *
@@ -79,6 +141,271 @@ typedef bool (^MTXStorageTransactionBlock)(void);
  * @return The joined room IDs for the specified user ID
  */
 - (OFArray<OFString *> *)joinedRoomsForUser: (OFString *)userID;
+
+/**
+ * @brief Appends the specified events to the stored timeline of the specified
+ *	  room.
+ *
+ * Events that are already stored are skipped.
+ *
+ * @param events The events to append, oldest first
+ * @param roomID The room ID to whose timeline to append the events
+ * @param prevBatch The token to paginate backwards from the first event, or
+ *		    `nil` if there are no older events
+ * @param limited Whether there are events missing between the stored timeline
+ *		  and the events. In this case, and if no timeline has been
+ *		  stored for the room yet, a gap with the prev batch is stored
+ *		  before the events.
+ */
+- (void)appendTimelineEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		      toRoom: (OFString *)roomID
+		   prevBatch: (nullable OFString *)prevBatch
+		     limited: (bool)limited;
+
+/**
+ * @brief Fills the gap with the specified token with the specified events.
+ *
+ * @param gapToken The token of the gap to fill
+ * @param roomID The room ID of the room which has the gap
+ * @param events The events to fill the gap with, newest first, as returned when
+ *		 paginating backwards from the gap token
+ * @param endToken The token to paginate further backwards from, or `nil` if
+ *		   the start of the room has been reached. If the events reach
+ *		   events that are already stored, no new gap is stored.
+ */
+- (void)fillGapWithToken: (OFString *)gapToken
+		  inRoom: (OFString *)roomID
+		  events: (OFArray<OFDictionary<OFString *, id> *> *)events
+		endToken: (nullable OFString *)endToken;
+
+/**
+ * @brief Returns the stored timeline entries of the specified room before the
+ *	  specified position, newest first.
+ *
+ * @param roomID The room ID for which to return the timeline entries
+ * @param position The position before which to return entries. Use
+ *		   `INT64_MAX` to start with the newest entry.
+ * @param limit The maximum number of entries to return
+ * @return The timeline entries before the position, newest first
+ */
+- (OFArray<MTXTimelineEntry *> *)
+    timelineEntriesForRoom: (OFString *)roomID
+	    beforePosition: (int64_t)position
+		     limit: (size_t)limit;
+
+/**
+ * @brief Applies the specified state events to the stored state of the
+ *	  specified room.
+ *
+ * The events are applied in order, so that a later event replaces an earlier
+ * one with the same type and state key. Events without a state key are
+ * ignored.
+ *
+ * As rooms can have a huge number of members, `m.room.member` events are not
+ * stored as a whole, but only the membership and display name are kept, which
+ * can be queried using @ref membershipOfUser:inRoom: and
+ * @ref displayNameOfUser:inRoom:.
+ *
+ * @param events The state events to apply, oldest first
+ * @param roomID The room ID of the room to which to apply the state events
+ */
+- (void)applyStateEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+		  toRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the current state event of the specified type and state key
+ *	  in the specified room.
+ *
+ * @param type The type of the state event
+ * @param stateKey The state key of the state event
+ * @param roomID The room ID of the room for which to return the state event
+ * @return The state event, or `nil` if no such state event is stored. This is
+ *	   always `nil` for `m.room.member`.
+ */
+- (nullable OFDictionary<OFString *, id> *)
+    stateEventWithType: (OFString *)type
+	      stateKey: (OFString *)stateKey
+		inRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the membership of the specified user in the specified room.
+ *
+ * @param userID The user ID for which to return the membership
+ * @param roomID The room ID of the room for which to return the membership
+ * @return The membership (e.g. `join` or `leave`), or `nil` if unknown
+ */
+- (nullable OFString *)membershipOfUser: (OFString *)userID
+				 inRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the display name of the specified user in the specified room.
+ *
+ * @param userID The user ID for which to return the display name
+ * @param roomID The room ID of the room for which to return the display name
+ * @return The display name, or `nil` if the user has none in the room
+ */
+- (nullable OFString *)displayNameOfUser: (OFString *)userID
+				  inRoom: (OFString *)roomID;
+
+/**
+ * @brief Returns the number of members with the specified membership in the
+ *	  specified room.
+ *
+ * @param roomID The room ID of the room for which to count the members
+ * @param membership The membership to count (e.g. `join`)
+ * @return The number of members with the membership
+ */
+- (size_t)numberOfMembersInRoom: (OFString *)roomID
+		 withMembership: (OFString *)membership;
+
+/**
+ * @brief Adds the specified event to the queue of outgoing events of the
+ *	  specified device.
+ *
+ * @param event The event to add to the queue
+ * @param deviceID The device ID for which to add the event
+ */
+- (void)addOutgoingEvent: (MTXOutgoingEvent *)event
+	     forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Removes the event with the specified transaction ID from the queue of
+ *	  outgoing events of the specified device.
+ *
+ * @param transactionID The transaction ID of the event to remove
+ * @param deviceID The device ID for which to remove the event
+ */
+- (void)removeOutgoingEventWithTransactionID: (OFString *)transactionID
+				 forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Returns the queued outgoing events of the specified device.
+ *
+ * @param deviceID The device ID for which to return the queued events
+ * @return The queued outgoing events, in the order they were added
+ */
+- (OFArray<MTXOutgoingEvent *> *)outgoingEventsForDeviceID:
+    (OFString *)deviceID;
+
+/**
+ * @brief Starts tracking the device lists of the specified users for the
+ *	  specified device.
+ *
+ * The device lists of users that were not tracked before are outdated until
+ * they are set. Users that are already tracked are left unchanged.
+ *
+ * @param userIDs The user IDs whose device lists to track
+ * @param deviceID The device ID for which to track the device lists
+ */
+- (void)trackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		    forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Marks the device lists of the specified users as outdated for the
+ *	  specified device.
+ *
+ * Users whose device lists are not tracked are ignored.
+ *
+ * @param userIDs The user IDs whose device lists changed
+ * @param deviceID The device ID for which the device lists are tracked
+ */
+- (void)markDeviceListsOutdatedOfUsers: (OFArray<OFString *> *)userIDs
+			   forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Stops tracking the device lists of the specified users for the
+ *	  specified device and removes their devices.
+ *
+ * @param userIDs The user IDs whose device lists to no longer track
+ * @param deviceID The device ID for which the device lists are tracked
+ */
+- (void)untrackDeviceListsOfUsers: (OFArray<OFString *> *)userIDs
+		      forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Sets the devices of the specified user and marks the device list of
+ *	  the user as up to date.
+ *
+ * This does nothing if the device list of the user is not tracked.
+ *
+ * @param devices The device keys of the user, keyed by device ID
+ * @param userID The user ID whose devices to set
+ * @param deviceID The device ID for which the device list is tracked
+ */
+- (void)setDevices: (OFDictionary<OFString *, OFDictionary *> *)devices
+	    ofUser: (OFString *)userID
+       forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Returns the devices of the specified user.
+ *
+ * @param userID The user ID whose devices to return
+ * @param deviceID The device ID for which the device list is tracked
+ * @return The device keys of the user, keyed by device ID, or `nil` if the
+ *	   device list of the user is not tracked or has never been fetched
+ */
+- (nullable OFDictionary<OFString *, OFDictionary *> *)
+    devicesOfUser: (OFString *)userID
+      forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Returns the users whose device lists are outdated.
+ *
+ * @param deviceID The device ID for which the device lists are tracked
+ * @return The user IDs whose device lists need to be fetched again
+ */
+- (OFArray<OFString *> *)usersWithOutdatedDeviceListsForDeviceID:
+    (OFString *)deviceID;
+
+/**
+ * @brief Appends the specified to-device events to the inbox of the specified
+ *	  device.
+ *
+ * @param events The to-device events to append
+ * @param deviceID The device ID that received the events
+ */
+- (void)addToDeviceEvents: (OFArray<OFDictionary<OFString *, id> *> *)events
+	      forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Returns the to-device events in the inbox of the specified device.
+ *
+ * @param deviceID The device ID whose inbox to return
+ * @return The to-device events, in the order they were received
+ */
+- (OFArray<OFDictionary<OFString *, id> *> *)toDeviceEventsForDeviceID:
+    (OFString *)deviceID;
+
+/**
+ * @brief Removes the specified number of the oldest to-device events from the
+ *	  inbox of the specified device.
+ *
+ * @param count The number of to-device events to remove
+ * @param deviceID The device ID whose inbox to remove the events from
+ */
+- (void)removeFirstToDeviceEvents: (size_t)count
+		      forDeviceID: (OFString *)deviceID;
+
+/**
+ * @brief Stores the ID the server assigned to the specified filter.
+ *
+ * @param filterID The ID the server assigned to the filter
+ * @param filter The filter as uploaded to the server, as JSON with sorted keys
+ * @param userID The user ID for which the filter was uploaded
+ */
+- (void)setFilterID: (OFString *)filterID
+	  forFilter: (OFString *)filter
+	     userID: (OFString *)userID;
+
+/**
+ * @brief Returns the ID the server assigned to the specified filter.
+ *
+ * @param filter The filter as uploaded to the server, as JSON with sorted keys
+ * @param userID The user ID for which the filter was uploaded
+ * @return The ID of the filter, or `nil` if it has not been uploaded yet
+ */
+- (nullable OFString *)filterIDForFilter: (OFString *)filter
+				  userID: (OFString *)userID;
 @end
 
 OF_ASSUME_NONNULL_END
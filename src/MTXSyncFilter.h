@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A filter for the events the server sends with sync.
+ *
+ * The filter is uploaded to the server once and then referenced by its ID, so
+ * that events the application is not interested in are never sent.
+ */
+@interface MTXSyncFilter: OFObject <OFCopying>
+/**
+ * @brief The event types to send, or `nil` to send all event types.
+ *
+ * This applies to the timeline, state, ephemeral events, account data and
+ * presence. A `*` can be used as a wildcard.
+ */
+@property (copy, nullable, nonatomic) OFArray<OFString *> *eventTypes;
+
+/**
+ * @brief The room IDs to send, or `nil` to send all rooms.
+ */
+@property (copy, nullable, nonatomic) OFArray<OFString *> *rooms;
+
+/**
+ * @brief The maximum number of timeline events to send per room, or 0 to use
+ *	  the default of the server.
+ */
+@property (nonatomic) size_t timelineLimit;
+
+/**
+ * @brief Whether to only send the membership events of senders of events in
+ *	  the timeline instead of all members.
+ */
+@property (nonatomic) bool lazyLoadMembers;
+
+/**
+ * @brief The filter as it is uploaded to the server.
+ */
+@property (readonly, nonatomic) OFDictionary<OFString *, id> *filterDictionary;
+
+/**
+ * @brief Creates a new sync filter that does not filter anything.
+ *
+ * @return An autoreleased MTXSyncFilter
+ */
++ (instancetype)filter;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXSyncFilter.h"
+
+@implementation MTXSyncFilter
++ (instancetype)filter
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (void)dealloc
+{
+	[_eventTypes release];
+	[_rooms release];
+
+	[super dealloc];
+}
+
+- (id)copy
+{
+	MTXSyncFilter *copy = [[MTXSyncFilter alloc] init];
+
+	@try {
+		copy->_eventTypes = [_eventTypes copy];
+		copy->_rooms = [_rooms copy];
+		copy->_timelineLimit = _timelineLimit;
+		copy->_lazyLoadMembers = _lazyLoadMembers;
+	} @catch (id e) {
+		[copy release];
+		@throw e;
+	}
+
+	return copy;
+}
+
+- (bool)isEqual: (id)object
+{
+	MTXSyncFilter *other;
+
+	if (object == self)
+		return true;
+
+	if (![object isKindOfClass: MTXSyncFilter.class])
+		return false;
+
+	other = object;
+
+	return [other.filterDictionary isEqual: self.filterDictionary];
+}
+
+- (unsigned long)hash
+{
+	return self.filterDictionary.hash;
+}
+
+- (OFDictionary<OFString *, id> *)filterDictionary
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFMutableDictionary *eventFilter = [OFMutableDictionary dictionary];
+	OFMutableDictionary *timelineFilter, *stateFilter;
+	OFMutableDictionary *roomFilter = [OFMutableDictionary dictionary];
+	OFMutableDictionary *filter = [OFMutableDictionary dictionary];
+
+	if (_eventTypes != nil)
+		eventFilter[@"types"] = _eventTypes;
+
+	timelineFilter = [[eventFilter mutableCopy] autorelease];
+	stateFilter = [[eventFilter mutableCopy] autorelease];
+
+	if (_timelineLimit > 0)
+		timelineFilter[@"limit"] = @(_timelineLimit);
+
+	if (_lazyLoadMembers) {
+		timelineFilter[@"lazy_load_members"] = @true;
+		stateFilter[@"lazy_load_members"] = @true;
+	}
+
+	if (_rooms != nil)
+		roomFilter[@"rooms"] = _rooms;
+
+	roomFilter[@"timeline"] = timelineFilter;
+	roomFilter[@"state"] = stateFilter;
+	roomFilter[@"ephemeral"] = eventFilter;
+	roomFilter[@"account_data"] = eventFilter;
+
+	filter[@"room"] = roomFilter;
+	filter[@"presence"] = eventFilter;
+	filter[@"account_data"] = eventFilter;
+
+	[filter makeImmutable];
+	[filter retain];
+
+	objc_autoreleasePoolPop(pool);
+
+	return [filter autorelease];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat: @"<%@: %@>",
+					   self.class, self.filterDictionary];
+}
+@end
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief A block called for a top-level value of a sync response.
+ *
+ * @param key The key of the top-level value, e.g. `next_batch`
+ * @param value The value, parsed from JSON
+ */
+typedef void (^MTXSyncParserValueBlock)(OFString *key, id value);
+
+/**
+ * @brief A block called for a room of a sync response.
+ *
+ * @param section The section of `rooms` the room is in, e.g. `join`
+ * @param roomID The room ID of the room
+ * @param room The room, parsed from JSON
+ */
+typedef void (^MTXSyncParserRoomBlock)(OFString *section, OFString *roomID,
+    id room);
+
+/**
+ * @brief An internal class for parsing a sync response as it arrives.
+ *
+ * Instead of parsing the whole response at once, only one top-level value or
+ * one room at a time is kept in memory and handed to the blocks as soon as it
+ * has been received completely.
+ */
+@interface MTXSyncParser: OFObject
+/**
+ * @brief The block to call for each top-level value except for `rooms`.
+ */
+@property (copy, nullable, nonatomic) MTXSyncParserValueBlock valueBlock;
+
+/**
+ * @brief The block to call for each room in `rooms`.
+ */
+@property (copy, nullable, nonatomic) MTXSyncParserRoomBlock roomBlock;
+
+/**
+ * @brief Whether the events in `events` arrays are decoded lazily as
+ *	  @ref MTXEvent.
+ *
+ * Defaults to `false`.
+ */
+@property (nonatomic) bool lazilyDecodesEvents;
+
+/**
+ * @brief Creates a new sync parser.
+ *
+ * @return An autoreleased MTXSyncParser
+ */
++ (instancetype)parser;
+
+/**
+ * @brief Parses the specified part of the response.
+ *
+ * @param buffer The buffer with the next part of the response
+ * @param length The length of the buffer
+ * @throw OFInvalidServerResponseException The response is not a valid sync
+ *					   response
+ */
+- (void)parseBuffer: (const char *)buffer length: (size_t)length;
+
+/**
+ * @brief Finishes parsing the response.
+ *
+ * @throw OFInvalidServerResponseException The response was incomplete
+ */
+- (void)finish;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,318 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXSyncParser.h"
+#import "MTXEvent+Private.h"
+
+#define MAX_DEPTH 64
+
+/* Depth of the keys that need to be remembered: root, rooms and section. */
+#define MAX_KEY_DEPTH 3
+
+enum {
+	CAPTURE_CONTAINER,
+	CAPTURE_STRING,
+	CAPTURE_SCALAR
+};
+
+static OFString *
+decodeKey(OFData *data, bool hasEscape)
+{
+	if (!hasEscape)
+		return [OFString stringWithUTF8String: data.items
+					       length: data.count];
+
+	/* Let the JSON parser take care of the escape sequences. */
+	OFMutableString *JSON = [OFMutableString stringWithString: @"[\""];
+	[JSON appendString: [OFString stringWithUTF8String: data.items
+						    length: data.count]];
+	[JSON appendString: @"\"]"];
+
+	return [JSON.objectByParsingJSON firstObject];
+}
+
+@implementation MTXSyncParser
+{
+	char _containers[MAX_DEPTH];
+	bool _expectsKey[MAX_DEPTH];
+	size_t _depth;
+	bool _inString, _escaped, _readingKey, _keyHasEscape, _finished;
+	OFString *_keys[MAX_KEY_DEPTH + 1];
+	OFMutableData *_keyData;
+	bool _capturing;
+	int _captureKind;
+	size_t _captureDepth;
+	OFMutableData *_captureData;
+}
+
++ (instancetype)parser
+{
+	return [[[self alloc] init] autorelease];
+}
+
+- (instancetype)init
+{
+	self = [super init];
+
+	@try {
+		_keyData = [[OFMutableData alloc] init];
+		_captureData = [[OFMutableData alloc] init];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	for (size_t i = 0; i <= MAX_KEY_DEPTH; i++)
+		[_keys[i] release];
+
+	[_keyData release];
+	[_captureData release];
+	[_valueBlock release];
+	[_roomBlock release];
+
+	[super dealloc];
+}
+
+- (void)finishKey
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFString *key = decodeKey(_keyData, _keyHasEscape);
+
+	[_keys[_depth] release];
+	_keys[_depth] = [key copy];
+
+	_readingKey = false;
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)valueStartsWithKind: (int)kind character: (char)character
+{
+	if (_capturing)
+		return;
+
+	if (_depth == 1) {
+		/* Descend into rooms instead of capturing it as a whole. */
+		if ([_keys[1] isEqual: @"rooms"] && character == '{')
+			return;
+	} else if (_depth == 3) {
+		if (![_keys[1] isEqual: @"rooms"] || _containers[1] != '{' ||
+		    _containers[2] != '{')
+			return;
+	} else
+		return;
+
+	_capturing = true;
+	_captureKind = kind;
+	_captureDepth = _depth;
+	[_captureData removeAllItems];
+}
+
+- (void)finishCapture
+{
+	void *pool = objc_autoreleasePoolPush();
+	id value;
+
+	if (_lazilyDecodesEvents)
+		value = MTXParseJSONWithLazyEvents(_captureData.items,
+		    _captureData.count);
+	else
+		value = [OFString stringWithUTF8String: _captureData.items
+						length: _captureData.count]
+		    .objectByParsingJSON;
+
+	_capturing = false;
+	[_captureData removeAllItems];
+
+	if (_captureDepth == 1) {
+		if (_valueBlock != NULL)
+			_valueBlock(_keys[1], value);
+	} else {
+		if (_roomBlock != NULL)
+			_roomBlock(_keys[2], _keys[3], value);
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)parseBuffer: (const char *)buffer length: (size_t)length
+{
+	size_t captureStart = 0;
+
+	for (size_t i = 0; i < length; i++) {
+		char c = buffer[i];
+
+		if (_inString) {
+			if (_readingKey)
+				[_keyData addItem: &c];
+
+			if (_escaped) {
+				_escaped = false;
+				continue;
+			}
+
+			if (c == '\\') {
+				_escaped = true;
+				_keyHasEscape = true;
+			} else if (c == '"') {
+				_inString = false;
+
+				if (_readingKey) {
+					[_keyData removeLastItem];
+					[self finishKey];
+				} else if (_capturing &&
+				    _captureKind == CAPTURE_STRING &&
+				    _depth == _captureDepth) {
+					[_captureData addItems: buffer +
+								captureStart
+							 count: i + 1 -
+								captureStart];
+					[self finishCapture];
+				}
+			}
+
+			continue;
+		}
+
+		if (_finished) {
+			if (c != ' ' && c != '\t' && c != '\r' && c != '\n')
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+			continue;
+		}
+
+		if (_capturing && _captureKind == CAPTURE_SCALAR &&
+		    (c == ',' || c == '}' || c == ']' || c == ' ' ||
+		    c == '\t' || c == '\r' || c == '\n')) {
+			[_captureData addItems: buffer + captureStart
+					 count: i - captureStart];
+			[self finishCapture];
+		}
+
+		switch (c) {
+		case ' ':
+		case '\t':
+		case '\r':
+		case '\n':
+			break;
+		case '"':
+			_inString = true;
+
+			if (_depth > 0 && _containers[_depth - 1] == '{' &&
+			    _expectsKey[_depth - 1]) {
+				if (_depth <= MAX_KEY_DEPTH && !_capturing) {
+					_readingKey = true;
+					_keyHasEscape = false;
+					[_keyData removeAllItems];
+				}
+			} else {
+				[self valueStartsWithKind: CAPTURE_STRING
+					       character: c];
+
+				if (_capturing && _depth == _captureDepth)
+					captureStart = i;
+			}
+
+			break;
+		case '{':
+		case '[':
+			if (_depth == 0 && c != '{')
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+			if (_depth >= MAX_DEPTH)
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+			if (_depth > 0) {
+				[self valueStartsWithKind: CAPTURE_CONTAINER
+					       character: c];
+
+				if (_capturing && _depth == _captureDepth)
+					captureStart = i;
+			}
+
+			_containers[_depth] = c;
+			_expectsKey[_depth] = (c == '{');
+			_depth++;
+
+			break;
+		case '}':
+		case ']':
+			if (_depth == 0 || _containers[_depth - 1] !=
+			    (c == '}' ? '{' : '['))
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+			_depth--;
+
+			if (_capturing && _captureKind == CAPTURE_CONTAINER &&
+			    _depth == _captureDepth) {
+				[_captureData addItems: buffer + captureStart
+						 count: i + 1 - captureStart];
+				[self finishCapture];
+			}
+
+			if (_depth == 0)
+				_finished = true;
+
+			break;
+		case ':':
+			if (_depth > 0)
+				_expectsKey[_depth - 1] = false;
+
+			break;
+		case ',':
+			if (_depth > 0 && _containers[_depth - 1] == '{')
+				_expectsKey[_depth - 1] = true;
+
+			break;
+		default:
+			if (_depth == 0)
+				@throw [OFInvalidServerResponseException
+				    exception];
+
+			if (!_capturing) {
+				[self valueStartsWithKind: CAPTURE_SCALAR
+					       character: c];
+
+				if (_capturing)
+					captureStart = i;
+			}
+
+			break;
+		}
+	}
+
+	if (_capturing)
+		[_captureData addItems: buffer + captureStart
+				 count: length - captureStart];
+}
+
+- (void)finish
+{
+	if (!_finished || _inString)
+		@throw [OFInvalidServerResponseException exception];
+}
+@end
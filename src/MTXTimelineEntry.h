@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import <ObjFW/ObjFW.h>
+
+OF_ASSUME_NONNULL_BEGIN
+
+/**
+ * @brief An entry of a stored room timeline.
+ *
+ * An entry is either an event or a gap, which marks events that have not been
+ * fetched from the server yet.
+ */
+@interface MTXTimelineEntry: OFObject
+/**
+ * @brief The position of the entry in the timeline of the room.
+ *
+ * Positions are increasing with newer entries, but not contiguous.
+ */
+@property (readonly, nonatomic) int64_t position;
+
+/**
+ * @brief The event, or `nil` if the entry is a gap.
+ */
+@property (readonly, nullable, nonatomic) OFDictionary<OFString *, id> *event;
+
+/**
+ * @brief The token to paginate backwards from to fill the gap, or `nil` if
+ *	  the entry is an event.
+ */
+@property (readonly, nullable, nonatomic) OFString *gapToken;
+
+/**
+ * @brief Creates a new timeline entry.
+ *
+ * @param position The position of the entry
+ * @param event The event, or `nil` for a gap
+ * @param gapToken The token for the gap, or `nil` for an event
+ * @return An autoreleased MTXTimelineEntry
+ */
++ (instancetype)
+    entryWithPosition: (int64_t)position
+		event: (nullable OFDictionary<OFString *, id> *)event
+	     gapToken: (nullable OFString *)gapToken;
+
+- (instancetype)init OF_UNAVAILABLE;
+
+/**
+ * @brief Initializes an already allocated timeline entry.
+ *
+ * @param position The position of the entry
+ * @param event The event, or `nil` for a gap
+ * @param gapToken The token for the gap, or `nil` for an event
+ * @return An initialized MTXTimelineEntry
+ */
+- (instancetype)initWithPosition: (int64_t)position
+			   event: (nullable OFDictionary<OFString *, id> *)event
+			gapToken: (nullable OFString *)gapToken
+    OF_DESIGNATED_INITIALIZER;
+@end
+
+OF_ASSUME_NONNULL_END
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXTimelineEntry.h"
+
+@implementation MTXTimelineEntry
++ (instancetype)entryWithPosition: (int64_t)position
+			    event: (OFDictionary<OFString *, id> *)event
+			 gapToken: (OFString *)gapToken
+{
+	return [[[self alloc] initWithPosition: position
+					 event: event
+				      gapToken: gapToken] autorelease];
+}
+
+- (instancetype)init
+{
+	OF_INVALID_INIT_METHOD
+}
+
+- (instancetype)initWithPosition: (int64_t)position
+			   event: (OFDictionary<OFString *, id> *)event
+			gapToken: (OFString *)gapToken
+{
+	self = [super init];
+
+	@try {
+		_position = position;
+		_event = [event copy];
+		_gapToken = [gapToken copy];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_event release];
+	[_gapToken release];
+
+	[super dealloc];
+}
+
+- (OFString *)description
+{
+	if (_gapToken != nil)
+		return [OFString stringWithFormat:
+		    @"<%@ %" PRId64 ": gap %@>",
+		    self.class, _position, _gapToken];
+
+	return [OFString stringWithFormat: @"<%@ %" PRId64 ": %@>",
+					   self.class, _position, _event];
+}
+@end
@@ -1,5 +1,5 @@
 /*
- * Copyright (c) 2020 Jonathan Schleifer <js@nil.im>
+ * Copyright (c) 2020, 2026 Jonathan Schleifer <js@nil.im>
  *
  * https://fl.nil.im/objmatrix
  *
@@ -16,16 +16,37 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
+#import "MTXCachingStorage.h"
 #import "MTXClient.h"
+#import "MTXClientManager.h"
+#import "MTXConnectionPool.h"
+#import "MTXEndpointMetrics.h"
+#import "MTXEvent.h"
+#import "MTXEventSubscription.h"
+#import "MTXIdentifierTable.h"
+#import "MTXLatencyHistogram.h"
+#import "MTXLogStorage.h"
+#import "MTXMediaCache.h"
+#import "MTXMetrics.h"
+#import "MTXOutgoingEvent.h"
 #import "MTXRequest.h"
+#import "MTXRoomSummary.h"
 #import "MTXSQLite3Storage.h"
+#import "MTXSlidingSyncList.h"
 #import "MTXStorage.h"
+#import "MTXSyncFilter.h"
+#import "MTXTimelineEntry.h"
 
 #import "MTXClientException.h"
+#import "MTXDownloadMediaFailedException.h"
 #import "MTXFetchRoomListFailedException.h"
+#import "MTXFetchTimelineFailedException.h"
 #import "MTXJoinRoomFailedException.h"
 #import "MTXLeaveRoomFailedException.h"
 #import "MTXLoginFailedException.h"
 #import "MTXLogoutFailedException.h"
+#import "MTXQueryKeysFailedException.h"
+#import "MTXSendEventFailedException.h"
 #import "MTXSendMessageFailedException.h"
 #import "MTXSyncFailedException.h"
+#import "MTXUploadMediaFailedException.h"
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#import "MTXDownloadMediaFailedException.h"
+
+#import "MTXClient.h"
+
+@implementation MTXDownloadMediaFailedException
++ (instancetype)exceptionWithContentURI: (OFString *)contentURI
+			     statusCode: (int)statusCode
+			       response: (MTXResponse)response
+				 client: (MTXClient *)client
+{
+	return [[[self alloc] initWithContentURI: contentURI
+				      statusCode: statusCode
+					response: response
+					  client: client] autorelease];
+}
+
+- (instancetype)initWithContentURI: (OFString *)contentURI
+			statusCode: (int)statusCode
+			  response: (MTXResponse)response
+			    client: (MTXClient *)client
+{
+	self = [super initWithStatusCode: statusCode
+				response: response
+				  client: client];
+
+	@try {
+		_contentURI = [contentURI copy];
+	} @catch (id e) {
+		[self release];
+		@throw e;
+	}
+
+	return self;
+}
+
+- (void)dealloc
+{
+	[_contentURI release];
+
+	[super dealloc];
+}
+
+- (OFString *)description
+{
+	return [OFString stringWithFormat:
+	    @"Failed to download %@ for %@ with status code %d: %@",
+	    _contentURI, self.client.userID, self.statusCode, self.response];
+}
+@end
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <inttypes.h>
+
+#import <ObjFW/ObjFW.h>
+
+#import "ObjMatrix.h"
+
+/*
+ * Runs the sliding sync engine against a stub server on localhost, which
+ * answers every request with the next scripted response once the previous
+ * one has been checked. Covers moving the window of a list, changes of the
+ * room count, leaving a room, rooms without a membership event, an expired
+ * position and retrying after responses that are not JSON.
+ */
+@interface SlidingSyncTests: OFObject <OFApplicationDelegate,
+    OFHTTPServerDelegate>
+@end
+
+OF_APPLICATION_DELEGATE(SlidingSyncTests)
+
+#define CHECK(condition)						\
+	[self check: (condition) description: @#condition line: __LINE__]
+
+static OFString *const slidingSyncPath =
+    @"/_matrix/client/unstable/org.matrix.simplified_msc3575/sync";
+static OFString *const userID = @"@tests:localhost";
+static OFString *const deviceID = @"DEVICE";
+
+static OFDictionary<OFString *, id> *
+messageEvent(OFString *eventID)
+{
+	return @{
+		@"type": @"m.room.message",
+		@"event_id": eventID,
+		@"sender": @"@other:localhost",
+		@"origin_server_ts": @1700000000000,
+		@"content": @{ @"msgtype": @"m.text", @"body": eventID }
+	};
+}
+
+static OFDictionary<OFString *, id> *
+memberEvent(OFString *eventID, OFString *membership)
+{
+	return @{
+		@"type": @"m.room.member",
+		@"state_key": userID,
+		@"event_id": eventID,
+		@"sender": userID,
+		@"origin_server_ts": @1700000000000,
+		@"content": @{ @"membership": membership }
+	};
+}
+
+@implementation SlidingSyncTests
+{
+	OFString *_path;
+	OFThread *_serverThread;
+	OFHTTPServer *_server;
+	OFHTTPResponse *_heldResponse;
+	id <MTXStorage> _storage;
+	MTXClient *_client;
+	size_t _numRequests, _numFailures;
+}
+
+- (void)applicationDidFinishLaunching: (OFNotification *)notification
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	bool logStorage =
+	    [OFApplication.environment[@"OBJMATRIX_STORAGE"] isEqual: @"log"];
+
+	_path = (logStorage ? @"slidingsynctests.log" : @"slidingsynctests.db");
+	for (OFString *suffix in @[ @"", @"-wal", @"-shm", @"-journal" ]) {
+		OFString *path = [_path stringByAppendingString: suffix];
+
+		if ([fileManager fileExistsAtPath: path])
+			[fileManager removeItemAtPath: path];
+	}
+
+	[self startServerThread];
+
+	OFIRI *homeserver = [OFIRI IRIWithString: [OFString stringWithFormat:
+	    @"http://127.0.0.1:%" PRIu16 "/", _server.port]];
+	OFIRI *storageIRI = [OFIRI fileIRIWithPath: _path];
+
+	_storage = [(logStorage
+	    ? (id <MTXStorage>)[MTXLogStorage storageWithIRI: storageIRI]
+	    : [MTXSQLite3Storage storageWithIRI: storageIRI]) retain];
+	_client = [[MTXClient clientWithUserID: userID
+				      deviceID: deviceID
+				   accessToken: @"token"
+				    homeserver: homeserver
+				       storage: _storage] retain];
+	_client.syncEngine = MTXSyncEngineSliding;
+	_client.syncExceptionHandler = ^ (id exception) {
+		OFLog(@"Sync failed: %@", exception);
+		[OFApplication terminateWithStatus: 1];
+	};
+
+	[self performSelector: @selector(timedOut) afterDelay: 30];
+	[_client startSyncLoop];
+}
+
+- (void)check: (bool)condition
+  description: (OFString *)description
+	 line: (int)line
+{
+	if (condition)
+		return;
+
+	OFLog(@"Check failed in line %d: %@", line, description);
+	_numFailures++;
+}
+
+- (void)timedOut
+{
+	OFLog(@"Timed out after %zu requests", _numRequests);
+	[OFApplication terminateWithStatus: 1];
+}
+
+- (void)finish
+{
+	[_client stopSyncLoop];
+
+	if (_numFailures > 0) {
+		OFLog(@"%zu checks failed", _numFailures);
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	OFLog(@"All checks passed");
+	[OFApplication terminate];
+}
+
+/*
+ * The server runs on its own thread, as OFHTTPServer writes responses
+ * synchronously, which would otherwise block the client from reading them.
+ */
+- (void)startServerThread
+{
+	_serverThread = [[OFThread alloc] init];
+	_serverThread.name = @"Stub homeserver";
+	[_serverThread start];
+
+	[self performSelector: @selector(startServer)
+		     onThread: _serverThread
+		waitUntilDone: true];
+}
+
+- (void)startServer
+{
+	_server = [[OFHTTPServer alloc] init];
+	_server.host = @"127.0.0.1";
+	_server.port = 0;
+	_server.delegate = self;
+	[_server start];
+}
+
+-      (void)server: (OFHTTPServer *)server
+  didReceiveRequest: (OFHTTPRequest *)request
+	requestBody: (OFStream *)requestBody
+	   response: (OFHTTPResponse *)response
+{
+	id position = [OFNull null], body = [OFNull null];
+
+	if (![request.IRI.path isEqual: slidingSyncPath]) {
+		response.statusCode = 404;
+		response.headers = @{ @"Content-Length": @"2" };
+		[response writeString: @"{}"];
+		return;
+	}
+
+	for (OFPair<OFString *, OFString *> *item in request.IRI.queryItems)
+		if ([item.firstObject isEqual: @"pos"])
+			position = item.secondObject;
+
+	if (requestBody != nil) {
+		OFData *data = [requestBody readDataUntilEndOfStream];
+
+		body = [OFString stringWithUTF8String: data.items
+					       length: data.count]
+		    .objectByParsingJSON;
+	}
+
+	/* Answered once the main thread has checked the client. */
+	[_heldResponse release];
+	_heldResponse = [response retain];
+
+	[self performSelector: @selector(didReceiveSlidingSync:)
+		     onThread: OFThread.mainThread
+		   withObject: @[ position, body ]
+		waitUntilDone: false];
+}
+
+- (void)sendResponse: (OFArray *)response
+{
+	OFString *body = response[2];
+
+	_heldResponse.statusCode = [response[0] intValue];
+	_heldResponse.headers = @{
+		@"Content-Type": response[1],
+		@"Content-Length": @(body.UTF8StringLength).stringValue
+	};
+	[_heldResponse writeString: body];
+
+	[_heldResponse release];
+	_heldResponse = nil;
+}
+
+- (void)respondWithStatusCode: (int)statusCode
+		  contentType: (OFString *)contentType
+			 body: (OFString *)body
+{
+	[self performSelector: @selector(sendResponse:)
+		     onThread: _serverThread
+		   withObject: @[ @(statusCode), contentType, body ]
+		waitUntilDone: false];
+}
+
+- (void)respondWithStatusCode: (int)statusCode
+			 body: (OFDictionary *)body
+{
+	[self respondWithStatusCode: statusCode
+			contentType: @"application/json"
+			       body: body.JSONRepresentation];
+}
+
+- (OFSet<OFString *> *)joinedRooms
+{
+	return [OFSet setWithArray: [_storage joinedRoomsForUser: userID]];
+}
+
+- (void)didReceiveSlidingSync: (OFArray *)positionAndBody
+{
+	id position = positionAndBody[0];
+	OFDictionary *body = positionAndBody[1];
+	OFArray *ranges = nil;
+	MTXSlidingSyncList *list = _client.slidingSyncLists.firstObject;
+
+	if ([body isKindOfClass: OFDictionary.class])
+		ranges = body[@"lists"][@"all"][@"ranges"];
+
+	switch (_numRequests++) {
+	case 0:
+		CHECK(position == [OFNull null]);
+		CHECK([ranges isEqual: @[ @[ @0, @19 ] ]]);
+
+		[self respondWithStatusCode: 200 body: @{
+			@"pos": @"1",
+			@"lists": @{ @"all": @{ @"count": @3 } },
+			@"rooms": @{
+				@"!a:localhost": @{
+					@"required_state": @[
+					    memberEvent(@"$a0", @"join") ],
+					@"timeline": @[ messageEvent(@"$a1") ]
+				},
+				@"!b:localhost": @{
+					@"required_state": @[
+					    memberEvent(@"$b0", @"join") ],
+					@"timeline": @[ messageEvent(@"$b1") ]
+				},
+				/* No membership event, e.g. a peeked room. */
+				@"!c:localhost": @{
+					@"timeline": @[ messageEvent(@"$c1") ]
+				}
+			}
+		}];
+		break;
+	case 1:
+		CHECK([position isEqual: @"1"]);
+		CHECK([[_storage slidingSyncPositionForDeviceID: deviceID]
+		    isEqual: @"1"]);
+		CHECK(list.count == 3);
+		CHECK([[self joinedRooms] isEqual: [OFSet setWithObjects:
+		    @"!a:localhost", @"!b:localhost", nil]]);
+		CHECK([_storage timelineEntriesForRoom: @"!c:localhost"
+					beforePosition: INT64_MAX
+						 limit: 10].count > 0);
+
+		/* Takes effect with the next request. */
+		list.range = OFMakeRange(0, 2);
+
+		[self respondWithStatusCode: 200 body: @{
+			@"pos": @"2",
+			@"lists": @{ @"all": @{ @"count": @4 } },
+			@"rooms": @{
+				/* Updates do not repeat the membership. */
+				@"!a:localhost": @{
+					@"timeline": @[ messageEvent(@"$a2") ]
+				},
+				@"!b:localhost": @{
+					@"timeline": @[
+					    memberEvent(@"$b2", @"leave") ]
+				}
+			}
+		}];
+		break;
+	case 2:
+		CHECK([position isEqual: @"2"]);
+		CHECK([ranges isEqual: @[ @[ @0, @1 ] ]]);
+		CHECK(list.count == 4);
+		CHECK([[self joinedRooms] isEqual:
+		    [OFSet setWithObject: @"!a:localhost"]]);
+
+		[self respondWithStatusCode: 400 body: @{
+			@"errcode": @"M_UNKNOWN_POS",
+			@"error": @"Unknown position"
+		}];
+		break;
+	case 3:
+		/* The expired position must be forgotten and not resent. */
+		CHECK(position == [OFNull null]);
+		CHECK([_storage slidingSyncPositionForDeviceID: deviceID] ==
+		    nil);
+		CHECK([[self joinedRooms] isEqual:
+		    [OFSet setWithObject: @"!a:localhost"]]);
+
+		/* An error page of a proxy needs to be retried. */
+		[self respondWithStatusCode: 502
+				contentType: @"text/html"
+				       body: @"<html><body><h1>502 Bad Gateway"
+					     @"</h1></body></html>\n"];
+		break;
+	case 4:
+		CHECK(position == [OFNull null]);
+
+		/* So does a garbled response. */
+		[self respondWithStatusCode: 200
+				contentType: @"application/json"
+				       body: @"{\"pos\":\"3\",\"rooms\":{"];
+		break;
+	case 5:
+		CHECK(position == [OFNull null]);
+		CHECK([_storage slidingSyncPositionForDeviceID: deviceID] ==
+		    nil);
+
+		[self finish];
+		break;
+	}
+}
+@end
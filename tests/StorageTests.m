@@ -0,0 +1,528 @@
+/*
+ * Copyright (c) 2026 Jonathan Schleifer <js@nil.im>
+ *
+ * https://fl.nil.im/objmatrix
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND ISC DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS.  IN NO EVENT SHALL ISC BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE
+ * OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#import <ObjFW/ObjFW.h>
+
+#import "ObjMatrix.h"
+
+/*
+ * Checks that a storage implements MTXStorage as MTXClient expects it, without
+ * needing a homeserver. The storage to test is selected with the
+ * OBJMATRIX_STORAGE environment variable, which can be sqlite (the default),
+ * caching or log.
+ */
+@interface StorageTests: OFObject <OFApplicationDelegate>
+@end
+
+OF_APPLICATION_DELEGATE(StorageTests)
+
+#define CHECK(condition)						\
+	[self check: (condition) description: @#condition line: __LINE__]
+
+static OFString *const userID = @"@tests:localhost";
+static OFString *const deviceID = @"DEVICE";
+static OFString *const roomID = @"!room:localhost";
+
+static OFDictionary<OFString *, id> *
+messageEvent(OFString *eventID, OFString *body)
+{
+	return @{
+		@"type": @"m.room.message",
+		@"event_id": eventID,
+		@"sender": userID,
+		@"origin_server_ts": @1700000000000,
+		@"content": @{ @"msgtype": @"m.text", @"body": body }
+	};
+}
+
+static OFDictionary<OFString *, id> *
+stateEvent(OFString *type, OFString *stateKey,
+    OFDictionary<OFString *, id> *content)
+{
+	return @{
+		@"type": type,
+		@"state_key": stateKey,
+		@"event_id": [OFString stringWithFormat: @"$%@%@", type,
+							 stateKey],
+		@"sender": userID,
+		@"origin_server_ts": @1700000000000,
+		@"content": content
+	};
+}
+
+@implementation StorageTests
+{
+	OFString *_storageName, *_path;
+	id <MTXStorage> _storage;
+	size_t _numFailures;
+}
+
+- (void)applicationDidFinishLaunching: (OFNotification *)notification
+{
+	_storageName = [OFApplication.environment[@"OBJMATRIX_STORAGE"] copy];
+	if (_storageName == nil)
+		_storageName = @"sqlite";
+
+	if (![_storageName isEqual: @"sqlite"] &&
+	    ![_storageName isEqual: @"caching"] &&
+	    ![_storageName isEqual: @"log"]) {
+		[OFStdErr writeFormat: @"Unknown storage: %@\n", _storageName];
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	_path = ([_storageName isEqual: @"log"]
+	    ? @"storagetests.log" : @"storagetests.db");
+
+	[self removeStorage];
+	[self reopenStorage];
+
+	[self testNextBatch];
+	[self testJoinedRooms];
+	[self testTimeline];
+	[self testState];
+	[self testOutgoingQueue];
+	[self testRollback];
+
+	if ([_storageName isEqual: @"log"]) {
+		[self testTornTail];
+		[self testReopeningAfterCompaction];
+	}
+
+	[_storage release];
+	_storage = nil;
+	[self removeStorage];
+
+	if (_numFailures > 0) {
+		OFLog(@"%zu checks failed with %@ storage", _numFailures,
+		    _storageName);
+		[OFApplication terminateWithStatus: 1];
+	}
+
+	OFLog(@"All checks passed with %@ storage", _storageName);
+	[OFApplication terminate];
+}
+
+- (void)check: (bool)condition
+  description: (OFString *)description
+	 line: (int)line
+{
+	if (condition)
+		return;
+
+	OFLog(@"Check failed in line %d: %@", line, description);
+	_numFailures++;
+}
+
+- (void)removeStorage
+{
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+
+	for (OFString *suffix in @[ @"", @"-wal", @"-shm", @"-journal",
+	    @".compact" ]) {
+		OFString *path = [_path stringByAppendingString: suffix];
+
+		if ([fileManager fileExistsAtPath: path])
+			[fileManager removeItemAtPath: path];
+	}
+}
+
+/* Closes the storage, if open, and opens it again from disk. */
+- (void)reopenStorage
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFIRI *IRI = [OFIRI fileIRIWithPath: _path];
+	id <MTXStorage> storage;
+
+	[_storage release];
+	_storage = nil;
+
+	if ([_storageName isEqual: @"log"])
+		storage = [MTXLogStorage storageWithIRI: IRI];
+	else if ([_storageName isEqual: @"caching"])
+		storage = [MTXCachingStorage storageWithStorage:
+		    [MTXSQLite3Storage storageWithIRI: IRI]];
+	else
+		storage = [MTXSQLite3Storage storageWithIRI: IRI];
+
+	_storage = [storage retain];
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (OFString *)roomName
+{
+	return [_storage stateEventWithType: @"m.room.name"
+				   stateKey: @""
+				     inRoom: roomID][@"content"][@"name"];
+}
+
+- (void)testNextBatch
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	CHECK([_storage nextBatchForDeviceID: deviceID] == nil);
+
+	[_storage setNextBatch: @"batch1" forDeviceID: deviceID];
+	[_storage setNextBatch: @"other" forDeviceID: @"OTHER"];
+	[_storage setNextBatch: @"batch2" forDeviceID: deviceID];
+	CHECK([[_storage nextBatchForDeviceID: deviceID]
+	    isEqual: @"batch2"]);
+
+	[self reopenStorage];
+	CHECK([[_storage nextBatchForDeviceID: deviceID]
+	    isEqual: @"batch2"]);
+	CHECK([[_storage nextBatchForDeviceID: @"OTHER"] isEqual: @"other"]);
+
+	[_storage setSlidingSyncPosition: @"pos1" forDeviceID: deviceID];
+	[_storage setSlidingSyncPosition: @"pos2" forDeviceID: @"OTHER"];
+	[_storage setSlidingSyncPosition: nil forDeviceID: @"OTHER"];
+	[self reopenStorage];
+	CHECK([[_storage slidingSyncPositionForDeviceID: deviceID]
+	    isEqual: @"pos1"]);
+	CHECK([_storage slidingSyncPositionForDeviceID: @"OTHER"] == nil);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)testJoinedRooms
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFSet *expected;
+
+	[_storage addJoinedRoom: @"!a:localhost" forUser: userID];
+	[_storage addJoinedRooms: @[ @"!b:localhost", @"!c:localhost",
+				     @"!d:localhost" ]
+			 forUser: userID];
+	[_storage addJoinedRoom: @"!a:localhost" forUser: @"@other:localhost"];
+	[_storage removeJoinedRoom: @"!b:localhost" forUser: userID];
+	[_storage removeJoinedRooms: @[ @"!c:localhost", @"!x:localhost" ]
+			    forUser: userID];
+
+	expected = [OFSet setWithObjects: @"!a:localhost", @"!d:localhost",
+					  nil];
+	CHECK([[OFSet setWithArray: [_storage joinedRoomsForUser: userID]]
+	    isEqual: expected]);
+
+	[self reopenStorage];
+	CHECK([[OFSet setWithArray: [_storage joinedRoomsForUser: userID]]
+	    isEqual: expected]);
+	CHECK([[_storage joinedRoomsForUser: @"@other:localhost"]
+	    isEqual: @[ @"!a:localhost" ]]);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)testTimeline
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFArray<MTXTimelineEntry *> *entries;
+
+	[_storage appendTimelineEvents: @[ messageEvent(@"$1", @"one"),
+					   messageEvent(@"$2", @"two") ]
+				toRoom: roomID
+			     prevBatch: @"gap1"
+			       limited: true];
+	/* $2 is already stored and must be skipped. */
+	[_storage appendTimelineEvents: @[ messageEvent(@"$2", @"two"),
+					   messageEvent(@"$3", @"three") ]
+				toRoom: roomID
+			     prevBatch: @"batch"
+			       limited: false];
+
+	for (int i = 0; i < 2; i++) {
+		entries = [_storage timelineEntriesForRoom: roomID
+					    beforePosition: INT64_MAX
+						     limit: 10];
+
+		CHECK(entries.count == 4);
+		if (entries.count == 4) {
+			CHECK([entries[0].event[@"event_id"] isEqual: @"$3"]);
+			CHECK([entries[1].event[@"event_id"] isEqual: @"$2"]);
+			CHECK([entries[2].event[@"content"][@"body"]
+			    isEqual: @"one"]);
+			CHECK(entries[3].event == nil);
+			CHECK([entries[3].gapToken isEqual: @"gap1"]);
+			CHECK(entries[0].position > entries[1].position &&
+			    entries[1].position > entries[2].position &&
+			    entries[2].position > entries[3].position);
+
+			entries = [_storage
+			    timelineEntriesForRoom: roomID
+				    beforePosition: entries[1].position
+					     limit: 1];
+			CHECK(entries.count == 1 &&
+			    [entries[0].event[@"event_id"] isEqual: @"$1"]);
+		}
+
+		[self reopenStorage];
+	}
+
+	/* Filling the gap up to the start of the room removes it. */
+	[_storage fillGapWithToken: @"gap1"
+			    inRoom: roomID
+			    events: @[ messageEvent(@"$0", @"zero") ]
+			  endToken: nil];
+	entries = [_storage timelineEntriesForRoom: roomID
+				    beforePosition: INT64_MAX
+					     limit: 10];
+	CHECK(entries.count == 4 &&
+	    [entries[3].event[@"event_id"] isEqual: @"$0"]);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)testState
+{
+	void *pool = objc_autoreleasePoolPush();
+
+	[_storage applyStateEvents: @[
+	    stateEvent(@"m.room.name", @"", @{ @"name": @"Old" }),
+	    stateEvent(@"m.room.name", @"", @{ @"name": @"New" }),
+	    stateEvent(@"m.room.member", @"@alice:localhost",
+		@{ @"membership": @"join", @"displayname": @"Alice" }),
+	    stateEvent(@"m.room.member", @"@bob:localhost",
+		@{ @"membership": @"invite" }),
+	    stateEvent(@"m.room.member", @"@carol:localhost",
+		@{ @"membership": @"join" })
+	] toRoom: roomID];
+	[_storage applyStateEvents: @[
+	    stateEvent(@"m.room.member", @"@carol:localhost",
+		@{ @"membership": @"leave" })
+	] toRoom: roomID];
+
+	for (int i = 0; i < 2; i++) {
+		CHECK([[self roomName] isEqual: @"New"]);
+		CHECK([_storage stateEventWithType: @"m.room.topic"
+					  stateKey: @""
+					    inRoom: roomID] == nil);
+		CHECK([[_storage membershipOfUser: @"@alice:localhost"
+					   inRoom: roomID] isEqual: @"join"]);
+		CHECK([[_storage displayNameOfUser: @"@alice:localhost"
+					    inRoom: roomID] isEqual: @"Alice"]);
+		CHECK([[_storage membershipOfUser: @"@carol:localhost"
+					   inRoom: roomID] isEqual: @"leave"]);
+		CHECK([_storage membershipOfUser: @"@dave:localhost"
+					  inRoom: roomID] == nil);
+		CHECK([_storage numberOfMembersInRoom: roomID
+				       withMembership: @"join"] == 1);
+		CHECK([_storage numberOfMembersInRoom: roomID
+				       withMembership: @"invite"] == 1);
+
+		[self reopenStorage];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)testOutgoingQueue
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFArray<MTXOutgoingEvent *> *events;
+
+	for (int i = 0; i < 3; i++)
+		[_storage addOutgoingEvent: [MTXOutgoingEvent
+		    eventWithTransactionID: [OFString stringWithFormat:
+					       @"txn%d", i]
+				    roomID: roomID
+				      type: @"m.room.message"
+				   content: @{ @"body": @(i).stringValue }]
+			       forDeviceID: deviceID];
+	[_storage removeOutgoingEventWithTransactionID: @"txn1"
+					   forDeviceID: deviceID];
+
+	for (int i = 0; i < 2; i++) {
+		events = [_storage outgoingEventsForDeviceID: deviceID];
+
+		CHECK(events.count == 2);
+		if (events.count == 2) {
+			CHECK([events[0].transactionID isEqual: @"txn0"]);
+			CHECK([events[1].transactionID isEqual: @"txn2"]);
+			CHECK([events[1].roomID isEqual: roomID]);
+			CHECK([events[1].content[@"body"] isEqual: @"2"]);
+		}
+
+		CHECK([_storage outgoingEventsForDeviceID: @"OTHER"].count ==
+		    0);
+
+		[self reopenStorage];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+
+- (void)testRollback
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFArray *joinedRooms = [_storage joinedRoomsForUser: userID];
+	size_t numEntries = [_storage timelineEntriesForRoom: roomID
+					      beforePosition: INT64_MAX
+						       limit: 100].count;
+
+	[_storage transactionWithBlock: ^ {
+		[_storage setNextBatch: @"rolledBack" forDeviceID: deviceID];
+		[_storage addJoinedRoom: @"!rolledBack:localhost"
+				forUser: userID];
+		[_storage appendTimelineEvents: @[
+		    messageEvent(@"$rolledBack", @"rolled back") ]
+					toRoom: roomID
+				     prevBatch: nil
+				       limited: false];
+		[_storage applyStateEvents: @[
+		    stateEvent(@"m.room.name", @"", @{ @"name": @"Rolled" }),
+		    stateEvent(@"m.room.member", @"@alice:localhost",
+			@{ @"membership": @"leave" })
+		] toRoom: roomID];
+		[_storage removeOutgoingEventWithTransactionID: @"txn0"
+						   forDeviceID: deviceID];
+
+		return false;
+	}];
+
+	/* Once from memory and once from disk. */
+	for (int i = 0; i < 2; i++) {
+		CHECK([[_storage nextBatchForDeviceID: deviceID]
+		    isEqual: @"batch2"]);
+		CHECK([[OFSet setWithArray: [_storage
+		    joinedRoomsForUser: userID]]
+		    isEqual: [OFSet setWithArray: joinedRooms]]);
+		CHECK([_storage timelineEntriesForRoom: roomID
+					beforePosition: INT64_MAX
+						 limit: 100].count ==
+		    numEntries);
+		CHECK([[self roomName] isEqual: @"New"]);
+		CHECK([[_storage membershipOfUser: @"@alice:localhost"
+					   inRoom: roomID] isEqual: @"join"]);
+		CHECK([_storage outgoingEventsForDeviceID: deviceID].count ==
+		    2);
+
+		[self reopenStorage];
+	}
+
+	/* A committed transaction after a rolled back one still commits. */
+	[_storage transactionWithBlock: ^ {
+		[_storage setNextBatch: @"batch3" forDeviceID: deviceID];
+		return true;
+	}];
+	[self reopenStorage];
+	CHECK([[_storage nextBatchForDeviceID: deviceID]
+	    isEqual: @"batch3"]);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+/* A batch that was only partially written must be discarded on opening. */
+- (void)testTornTail
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	unsigned long long size;
+
+	[_storage release];
+	_storage = nil;
+
+	size = [fileManager attributesOfItemAtPath: _path].fileSize;
+
+	/* A header announcing 1000 bytes, followed by only a few of them. */
+	OFFile *file = [OFFile fileWithPath: _path mode: @"a"];
+	[file writeBigEndianInt32: 1000];
+	[file writeBigEndianInt32: 0];
+	[file writeString: @"torn"];
+	[file close];
+
+	[self reopenStorage];
+	CHECK([fileManager attributesOfItemAtPath: _path].fileSize == size);
+	CHECK([[_storage nextBatchForDeviceID: deviceID]
+	    isEqual: @"batch3"]);
+	CHECK([_storage outgoingEventsForDeviceID: deviceID].count == 2);
+
+	/* New batches must follow the last complete one. */
+	[_storage setNextBatch: @"batch4" forDeviceID: deviceID];
+	[self reopenStorage];
+	CHECK([[_storage nextBatchForDeviceID: deviceID]
+	    isEqual: @"batch4"]);
+
+	objc_autoreleasePoolPop(pool);
+}
+
+/*
+ * Replacing the same state event over and over makes the log grow until it
+ * is compacted, after which everything must still be readable, from memory
+ * and after reopening.
+ */
+- (void)testReopeningAfterCompaction
+{
+	void *pool = objc_autoreleasePoolPush();
+	OFFileManager *fileManager = OFFileManager.defaultManager;
+	char paddingBytes[4096];
+	OFString *padding;
+	unsigned long long written = 0;
+
+	memset(paddingBytes, 'x', sizeof(paddingBytes));
+	padding = [OFString stringWithUTF8String: paddingBytes
+					  length: sizeof(paddingBytes)];
+
+	for (size_t i = 0; i < 2048; i++) {
+		void *pool2 = objc_autoreleasePoolPush();
+
+		[_storage transactionWithBlock: ^ {
+			[_storage applyStateEvents: @[
+			    stateEvent(@"org.example.padding", @"",
+				@{ @"i": @(i), @"padding": padding })
+			] toRoom: roomID];
+			return true;
+		}];
+		written += padding.length;
+
+		/* Give the compaction thread a chance to finish. */
+		if (i % 256 == 255)
+			[OFThread sleepForTimeInterval: 0.1];
+
+		objc_autoreleasePoolPop(pool2);
+	}
+
+	CHECK([fileManager attributesOfItemAtPath: _path].fileSize <
+	    written);
+
+	for (int i = 0; i < 2; i++) {
+		OFArray<MTXTimelineEntry *> *entries =
+		    [_storage timelineEntriesForRoom: roomID
+				      beforePosition: INT64_MAX
+					       limit: 10];
+
+		CHECK([[_storage stateEventWithType: @"org.example.padding"
+					   stateKey: @""
+					     inRoom: roomID][@"content"][@"i"]
+		    isEqual: @2047]);
+		CHECK([[self roomName] isEqual: @"New"]);
+		CHECK([[_storage displayNameOfUser: @"@alice:localhost"
+					    inRoom: roomID] isEqual: @"Alice"]);
+		CHECK(entries.count == 4 &&
+		    [entries[0].event[@"event_id"] isEqual: @"$3"]);
+		CHECK([[_storage nextBatchForDeviceID: deviceID]
+		    isEqual: @"batch4"]);
+		CHECK([_storage outgoingEventsForDeviceID: deviceID].count ==
+		    2);
+
+		[self reopenStorage];
+	}
+
+	objc_autoreleasePoolPop(pool);
+}
+@end
@@ -19,12 +19,85 @@
 #import <ObjFW/ObjFW.h>
 
 #import "ObjMatrix.h"
+#import "MTXEvent+Private.h"
 
 @interface Tests: OFObject <OFApplicationDelegate>
 @end
 
 OF_APPLICATION_DELEGATE(Tests)
 
+/*
+ * Parsed by both MTXParseJSON() and ObjFW, which need to agree. Values are
+ * only delimited by MTXParseJSON() and then decoded by ObjFW, so both also
+ * need to agree on the invalid values in here.
+ */
+static OFString *const JSONInputs[] = {
+	@"{}",
+	@"[]",
+	@"\"plain\"",
+	@"\"\u00E4\u20ac \u00e4\"",
+	@"\"\\\" \\/ \\\\ \\b \\f \\n \\r \\t\"",
+	@"\"\\ud83d\\ude00\"",
+	@"\"\\ud83d\"",
+	@"\"\\ude00\\ud83d\"",
+	@"\"\\u12\"",
+	@"0",
+	@"-1",
+	@"1.5",
+	@"-0.25e3",
+	@"1E+2",
+	@"01",
+	@"1.",
+	@"true",
+	@"false",
+	@"null",
+	@"tru",
+	@"True",
+	@" \t\r\n{ \"a\" : [ 1 , 2 ] , \"b\" : { } }\n",
+	@"{\"a\":1,\"a\":2}",
+	@"{\"k\\u00e4y\":\"v\",\"k\u00e4y\":\"w\"}",
+	@"{\"a\\\"b\":\"c\\\\\"}",
+	@"[\"]\",\"}\",\"[\",\"{\",\",\"]",
+	@"{\"next_batch\":\"s1\",\"rooms\":{\"join\":{\"!a:x\":"
+	    @"{\"timeline\":{\"events\":[{\"type\":\"m.room.message\","
+	    @"\"content\":{\"body\":\"\\ud83d\\ude00\"}},[1],2]}}}}}",
+	@"{\"events\":[{\"events\":[{}]}]}",
+	@"[[[], {}], [{\"a\": [null]}]]"
+};
+
+/*
+ * Rejected by MTXParseJSON(). ObjFW also accepts JSON5 and thus some of them,
+ * but Matrix only uses strict JSON.
+ */
+static OFString *const invalidJSONInputs[] = {
+	@"",
+	@" ",
+	@"{",
+	@"}",
+	@"[",
+	@"]",
+	@"[1,]",
+	@"[,1]",
+	@"[1 2]",
+	@"{\"a\"}",
+	@"{\"a\":}",
+	@"{\"a\":1,}",
+	@"{,\"a\":1}",
+	@"{\"a\" 1}",
+	@"{a:1}",
+	@"{\"a\":1]",
+	@"[1}",
+	@"[}",
+	@"{]",
+	@"\"unterminated",
+	@"\"unterminated\\\"",
+	@"{} {}",
+	@"[1]x",
+	@"tru",
+	@"\"\\u12\"",
+	@"{\"a\":[1,{\"b\":tru}]}"
+};
+
 @implementation Tests
 {
 	MTXClient *_client;
@@ -33,6 +106,8 @@ OF_APPLICATION_DELEGATE(Tests)
 
 - (void)applicationDidFinishLaunching: (OFNotification *)notification
 {
+	[self testJSONParser];
+
 	OFDictionary<OFString *, OFString *> *environment =
 	    OFApplication.environment;
 	if (environment[@"OBJMATRIX_USER"] == nil ||
@@ -45,9 +120,13 @@ OF_APPLICATION_DELEGATE(Tests)
 	}
 
 	OFIRI *homeserver = [OFIRI IRIWithString: environment[@"OBJMATRIX_HS"]];
-	OFIRI *storageIRI = [OFIRI fileIRIWithPath: @"tests.db"];
-	id <MTXStorage> storage =
-	    [MTXSQLite3Storage storageWithIRI: storageIRI];
+	id <MTXStorage> storage;
+	if ([environment[@"OBJMATRIX_STORAGE"] isEqual: @"log"])
+		storage = [MTXLogStorage storageWithIRI:
+		    [OFIRI fileIRIWithPath: @"tests.log"]];
+	else
+		storage = [MTXSQLite3Storage storageWithIRI:
+		    [OFIRI fileIRIWithPath: @"tests.db"]];
 	[MTXClient logInWithUser: environment[@"OBJMATRIX_USER"]
 			password: environment[@"OBJMATRIX_PASS"]
 		      homeserver: homeserver
@@ -66,6 +145,125 @@ OF_APPLICATION_DELEGATE(Tests)
 	}];
 }
 
+- (void)testJSONParser
+{
+	size_t numInputs = sizeof(JSONInputs) / sizeof(*JSONInputs);
+	size_t numInvalidInputs =
+	    sizeof(invalidJSONInputs) / sizeof(*invalidJSONInputs);
+	bool failed = false;
+
+	for (size_t i = 0; i < numInputs; i++)
+		if (![self parsesJSONLikeObjFW: JSONInputs[i]])
+			failed = true;
+
+	for (size_t i = 0; i < numInvalidInputs; i++) {
+		OFString *JSON = invalidJSONInputs[i];
+
+		@try {
+			MTXParseJSON(JSON.UTF8String, JSON.UTF8StringLength);
+
+			OFLog(@"Parsed invalid JSON: %@", JSON);
+			failed = true;
+		} @catch (id e) {
+		}
+	}
+
+	/* Both need to reject the same depth. */
+	for (size_t depth = 30; depth <= 34; depth++) {
+		void *pool = objc_autoreleasePoolPush();
+		OFMutableString *JSON = [OFMutableString string];
+
+		for (size_t i = 0; i < depth; i++)
+			[JSON appendString: (i % 2 == 0 ? @"[" : @"{\"a\":")];
+		[JSON appendString: @"null"];
+		for (size_t i = depth; i > 0; i--)
+			[JSON appendString: (i % 2 == 1 ? @"]" : @"}")];
+
+		if (![self parsesJSONLikeObjFW: JSON])
+			failed = true;
+
+		objc_autoreleasePoolPop(pool);
+	}
+
+	for (size_t i = 0; i < numInputs; i++) {
+		void *pool = objc_autoreleasePoolPush();
+		OFString *JSON = JSONInputs[i];
+		id object, serialized;
+		OFData *data;
+
+		@try {
+			object = JSON.objectByParsingJSON;
+		} @catch (id e) {
+			objc_autoreleasePoolPop(pool);
+			continue;
+		}
+
+		data = MTXJSONData(object);
+		serialized = [OFString stringWithUTF8String: data.items
+						     length: data.count]
+		    .objectByParsingJSON;
+
+		if (![serialized isEqual: object]) {
+			OFLog(@"Serializing %@ resulted in %@",
+			    object, serialized);
+			failed = true;
+		}
+
+		objc_autoreleasePoolPop(pool);
+	}
+
+	if (failed)
+		[OFApplication terminateWithStatus: 1];
+
+	OFLog(@"JSON parser tests successful");
+}
+
+/*
+ * Returns whether MTXParseJSON() rejects the JSON if ObjFW does and otherwise
+ * returns the same as ObjFW, also with lazily decoded events.
+ */
+- (bool)parsesJSONLikeObjFW: (OFString *)JSON
+{
+	void *pool = objc_autoreleasePoolPush();
+	const char *UTF8String = JSON.UTF8String;
+	size_t length = JSON.UTF8StringLength;
+	id expected = nil, parsed = nil, lazy = nil;
+	bool matches;
+
+	@try {
+		expected = JSON.objectByParsingJSON;
+	} @catch (id e) {
+	}
+
+	@try {
+		parsed = MTXParseJSON(UTF8String, length);
+
+		/*
+		 * Events are only validated once decoded, so invalid JSON in
+		 * them is only rejected by the eager parser.
+		 */
+		if (expected != nil)
+			lazy = MTXParseJSONWithLazyEvents(UTF8String, length);
+	} @catch (id e) {
+		if (expected != nil)
+			OFLog(@"Failed to parse %@: %@", JSON, e);
+	}
+
+	if (expected == nil)
+		matches = (parsed == nil);
+	else
+		matches = ([parsed isEqual: expected] &&
+		    [lazy isEqual: expected]);
+
+	if (!matches)
+		OFLog(@"Parsing %@ resulted in %@ and %@ instead of %@",
+		    JSON, parsed, lazy, expected);
+
+	objc_autoreleasePoolPop(pool);
+
+	return matches;
+}
+
 - (void)fetchRoomList
 {
 	[_client fetchRoomListWithBlock: ^ (OFArray<OFString *> *rooms,